@@ -0,0 +1,250 @@
+/* protobuf-c side of the benchmark, see bench.h. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench/bench.h"
+#include "t/test-full.pb-c.h"
+
+#define MAX_BATCH_SIZE    1024
+#define BATCH_BYTES       (64 * 1024)
+#define MIN_BATCHES       16
+
+/* types the corpus is built from */
+static const ProtobufCMessageDescriptor *const descriptors[] = {
+  &foo__test_mess__descriptor,
+  &foo__test_mess_optional__descriptor,
+  &foo__test_mess_packed__descriptor,
+  &foo__test_mess_required_bytes__descriptor,
+  &foo__test_mess_sub_mess__descriptor,
+  &foo__test_nested__descriptor,
+};
+
+static const char *const op_names[BENCH_N_OPS] = {
+  "pack",
+  "get_packed_size",
+  "unpack",
+  "free_unpacked",
+};
+
+const char *
+bench_op_name (BenchOp op)
+{
+  return op_names[op];
+}
+
+static uint64_t
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static int
+compare_doubles (const void *a, const void *b)
+{
+  double da = *(const double *) a;
+  double db = *(const double *) b;
+  return (da > db) - (da < db);
+}
+
+size_t
+bench_batch_size (size_t message_len)
+{
+  size_t n = BATCH_BYTES / (message_len ? message_len : 1);
+  if (n < 1)
+    return 1;
+  if (n > MAX_BATCH_SIZE)
+    return MAX_BATCH_SIZE;
+  return n;
+}
+
+int
+bench_measure (const BenchCase *bc,
+               size_t message_len,
+               double min_seconds,
+               BenchResult *result)
+{
+  size_t batch_size = bench_batch_size (message_len);
+  uint64_t min_ns = (uint64_t) (min_seconds * 1e9);
+  uint64_t total_ns = 0;
+  size_t n_samples = 0;
+  size_t n_alloced = 64;
+  double *samples = malloc (n_alloced * sizeof (double));
+  int warm_up = 1;
+  size_t i;
+
+  if (samples == NULL)
+    return -1;
+  while (warm_up || total_ns < min_ns || n_samples < MIN_BATCHES)
+    {
+      uint64_t start, elapsed;
+
+      if (bc->prepare)
+        bc->prepare (bc->ctx, batch_size);
+      start = now_ns ();
+      for (i = 0; i < batch_size; i++)
+        bc->run (bc->ctx, i);
+      elapsed = now_ns () - start;
+      if (bc->finish)
+        bc->finish (bc->ctx, batch_size);
+
+      if (warm_up)
+        {
+          warm_up = 0;
+          continue;
+        }
+      if (n_samples == n_alloced)
+        {
+          double *s = realloc (samples, n_alloced * 2 * sizeof (double));
+          if (s == NULL)
+            {
+              free (samples);
+              return -1;
+            }
+          samples = s;
+          n_alloced *= 2;
+        }
+      samples[n_samples++] = (double) elapsed / batch_size;
+      total_ns += elapsed;
+    }
+
+  qsort (samples, n_samples, sizeof (double), compare_doubles);
+  result->ops = (uint64_t) n_samples * batch_size;
+  result->bytes = result->ops * message_len;
+  result->seconds = total_ns / 1e9;
+  result->p50_ns = samples[n_samples / 2];
+  result->p99_ns = samples[(n_samples * 99) / 100];
+  free (samples);
+  return 0;
+}
+
+/* ==== protobuf-c operations ==== */
+
+typedef struct
+{
+  const ProtobufCMessageDescriptor *descriptor;
+  size_t len;
+  const uint8_t *data;
+  ProtobufCMessage *message;
+  uint8_t *out;
+  ProtobufCMessage *batch[MAX_BATCH_SIZE];
+  int failed;
+} CBench;
+
+/* keeps get_packed_size() from being optimised away */
+static volatile size_t size_sink;
+
+static void
+run_pack (void *ctx, size_t i)
+{
+  CBench *b = ctx;
+  (void) i;
+  if (protobuf_c_message_pack (b->message, b->out) != b->len)
+    b->failed = 1;
+}
+
+static void
+run_get_packed_size (void *ctx, size_t i)
+{
+  CBench *b = ctx;
+  (void) i;
+  size_sink = protobuf_c_message_get_packed_size (b->message);
+}
+
+static void
+run_unpack (void *ctx, size_t i)
+{
+  CBench *b = ctx;
+  b->batch[i] = protobuf_c_message_unpack (b->descriptor, NULL,
+                                           b->len, b->data);
+  if (b->batch[i] == NULL)
+    b->failed = 1;
+}
+
+static void
+run_free_unpacked (void *ctx, size_t i)
+{
+  CBench *b = ctx;
+  protobuf_c_message_free_unpacked (b->batch[i], NULL);
+  b->batch[i] = NULL;
+}
+
+static void
+unpack_batch (void *ctx, size_t batch_size)
+{
+  size_t i;
+  for (i = 0; i < batch_size; i++)
+    run_unpack (ctx, i);
+}
+
+static void
+free_batch (void *ctx, size_t batch_size)
+{
+  CBench *b = ctx;
+  size_t i;
+  for (i = 0; i < batch_size; i++)
+    if (b->batch[i] != NULL)
+      run_free_unpacked (b, i);
+}
+
+int
+bench_c_run (const char *type_name,
+             size_t len,
+             const uint8_t *data,
+             BenchOp op,
+             double min_seconds,
+             BenchResult *result)
+{
+  CBench b;
+  BenchCase bc;
+  unsigned i;
+  int rv;
+
+  memset (&b, 0, sizeof (b));
+  memset (&bc, 0, sizeof (bc));
+  for (i = 0; i < sizeof (descriptors) / sizeof (descriptors[0]); i++)
+    if (strcmp (descriptors[i]->name, type_name) == 0)
+      b.descriptor = descriptors[i];
+  if (b.descriptor == NULL)
+    return -1;
+  b.len = len;
+  b.data = data;
+  b.message = protobuf_c_message_unpack (b.descriptor, NULL, len, data);
+  b.out = malloc (len ? len : 1);
+  if (b.message == NULL || b.out == NULL)
+    {
+      protobuf_c_message_free_unpacked (b.message, NULL);
+      free (b.out);
+      return -1;
+    }
+
+  bc.ctx = &b;
+  switch (op)
+    {
+    case BENCH_PACK:
+      bc.run = run_pack;
+      break;
+    case BENCH_GET_PACKED_SIZE:
+      bc.run = run_get_packed_size;
+      break;
+    case BENCH_UNPACK:
+      bc.run = run_unpack;
+      bc.finish = free_batch;
+      break;
+    case BENCH_FREE_UNPACKED:
+      bc.prepare = unpack_batch;
+      bc.run = run_free_unpacked;
+      bc.finish = free_batch;
+      break;
+    default:
+      break;
+    }
+  rv = bc.run != NULL ? bench_measure (&bc, len, min_seconds, result) : -1;
+
+  protobuf_c_message_free_unpacked (b.message, NULL);
+  free (b.out);
+  return rv == 0 && !b.failed ? 0 : -1;
+}
@@ -0,0 +1,371 @@
+/* Throughput and latency of protobuf-c against C++ protobuf on a corpus
+ * built from t/test-full.proto.  Results are written as JSON:
+ *
+ *   protobuf-c-bench [--min-time SECONDS] [--filter WORKLOAD] [--output FILE]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/stubs/common.h>
+
+#include "t/test-full.pb.h"
+#include "bench/bench.h"
+#include "protobuf-c/protobuf-c.h"
+
+using namespace foo;
+
+struct Workload
+{
+  const char *name;
+  std::unique_ptr<google::protobuf::Message> message;
+};
+
+/* ==== corpus ==== */
+
+static std::unique_ptr<google::protobuf::Message>
+make_small_scalars (void)
+{
+  std::unique_ptr<TestMessOptional> mess (new TestMessOptional);
+  mess->set_test_int32 (150);
+  mess->set_test_sint64 (-12345);
+  mess->set_test_boolean (true);
+  mess->set_test_enum_small (OTHER_VALUE);
+  mess->set_test_double (3.25);
+  return std::move (mess);
+}
+
+static std::unique_ptr<google::protobuf::Message>
+make_wide (void)
+{
+  std::unique_ptr<TestMessSubMess> mess (new TestMessSubMess);
+  TestMess *rep = mess->mutable_rep_mess ();
+  TestMessOptional *opt = mess->mutable_opt_mess ();
+  for (int i = 0; i < 4; i++)
+    {
+      rep->add_test_int32 (i * 1000);
+      rep->add_test_sint32 (-i);
+      rep->add_test_sfixed32 (i);
+      rep->add_test_int64 (INT64_C (1) << (i * 10));
+      rep->add_test_sint64 (-(INT64_C (1) << (i * 10)));
+      rep->add_test_sfixed64 (i);
+      rep->add_test_uint32 (i * 7);
+      rep->add_test_fixed32 (i * 11);
+      rep->add_test_uint64 (i * 13);
+      rep->add_test_fixed64 (i * 17);
+      rep->add_test_float (i * 0.5f);
+      rep->add_test_double (i * 0.25);
+      rep->add_test_boolean (i & 1);
+      rep->add_test_enum_small (VALUE);
+      rep->add_test_enum (VALUE128);
+      rep->add_test_string ("repeated string");
+      rep->add_test_bytes ("repeated bytes");
+      rep->add_test_message ()->set_test (i);
+    }
+  opt->set_test_int32 (1);
+  opt->set_test_sint32 (-2);
+  opt->set_test_sfixed32 (3);
+  opt->set_test_int64 (4);
+  opt->set_test_sint64 (-5);
+  opt->set_test_sfixed64 (6);
+  opt->set_test_uint32 (7);
+  opt->set_test_fixed32 (8);
+  opt->set_test_uint64 (9);
+  opt->set_test_fixed64 (10);
+  opt->set_test_float (11.5f);
+  opt->set_test_double (12.5);
+  opt->set_test_boolean (true);
+  opt->set_test_enum_small (OTHER_VALUE);
+  opt->set_test_enum (VALUE16383);
+  opt->set_test_string ("optional string");
+  opt->set_test_bytes ("optional bytes");
+  opt->mutable_test_message ()->set_test (18);
+  mess->mutable_oneof_mess ()->set_test_string ("oneof");
+  mess->mutable_req_mess ()->set_test (42);
+  mess->mutable_req_mess ()->mutable_sub1 ()->set_str1 ("nested");
+  mess->mutable_def_mess ();
+  return std::move (mess);
+}
+
+static std::unique_ptr<google::protobuf::Message>
+make_deep_nesting (void)
+{
+  std::unique_ptr<TestNested> mess (new TestNested);
+  TestNested *node = mess.get ();
+  for (int depth = 0; depth < 64; depth++)
+    {
+      node->set_depth (depth);
+      node->set_label ("level");
+      node = node->mutable_child ();
+    }
+  return std::move (mess);
+}
+
+static std::unique_ptr<google::protobuf::Message>
+make_packed_arrays (void)
+{
+  std::unique_ptr<TestMessPacked> mess (new TestMessPacked);
+  for (int i = 0; i < 4096; i++)
+    {
+      mess->add_test_int32 (i * 37);
+      mess->add_test_sint64 ((i & 1) ? -i * INT64_C (1000003) : i);
+      mess->add_test_uint64 (UINT64_C (1) << (i % 64));
+      mess->add_test_fixed32 (i);
+      mess->add_test_double (i / 3.0);
+      mess->add_test_boolean (i & 1);
+      mess->add_test_enum_small (i & 1 ? VALUE : OTHER_VALUE);
+    }
+  return std::move (mess);
+}
+
+static std::unique_ptr<google::protobuf::Message>
+make_big_bytes (void)
+{
+  std::unique_ptr<TestMessRequiredBytes> mess (new TestMessRequiredBytes);
+  std::string payload (256 * 1024, '\0');
+  for (size_t i = 0; i < payload.size (); i++)
+    payload[i] = (char) (i * 131);
+  mess->set_test (payload);
+  return std::move (mess);
+}
+
+static std::unique_ptr<google::protobuf::Message>
+make_repeated_messages (void)
+{
+  std::unique_ptr<TestMess> mess (new TestMess);
+  for (int i = 0; i < 256; i++)
+    {
+      SubMess *sub = mess->add_test_message ();
+      sub->set_test (i);
+      sub->set_val1 (i * 2);
+      sub->add_rep (i);
+      sub->add_rep (-i);
+    }
+  return std::move (mess);
+}
+
+/* ==== C++ protobuf operations ==== */
+
+struct CxxBench
+{
+  const google::protobuf::Message *message;
+  std::string data;
+  std::vector<uint8_t> out;
+  std::vector<google::protobuf::Message *> batch;
+  bool failed;
+};
+
+static volatile size_t size_sink;
+
+static void
+cxx_run_pack (void *ctx, size_t)
+{
+  CxxBench *b = (CxxBench *) ctx;
+  if (!b->message->SerializeToArray (b->out.data (), (int) b->out.size ()))
+    b->failed = true;
+}
+
+static void
+cxx_run_get_packed_size (void *ctx, size_t)
+{
+  CxxBench *b = (CxxBench *) ctx;
+  size_sink = b->message->ByteSizeLong ();
+}
+
+static void
+cxx_run_unpack (void *ctx, size_t i)
+{
+  CxxBench *b = (CxxBench *) ctx;
+  b->batch[i] = b->message->New ();
+  if (!b->batch[i]->ParseFromArray (b->data.data (), (int) b->data.size ()))
+    b->failed = true;
+}
+
+static void
+cxx_run_free_unpacked (void *ctx, size_t i)
+{
+  CxxBench *b = (CxxBench *) ctx;
+  delete b->batch[i];
+  b->batch[i] = NULL;
+}
+
+static void
+cxx_unpack_batch (void *ctx, size_t batch_size)
+{
+  for (size_t i = 0; i < batch_size; i++)
+    cxx_run_unpack (ctx, i);
+}
+
+static void
+cxx_free_batch (void *ctx, size_t batch_size)
+{
+  CxxBench *b = (CxxBench *) ctx;
+  for (size_t i = 0; i < batch_size; i++)
+    if (b->batch[i] != NULL)
+      cxx_run_free_unpacked (b, i);
+}
+
+static int
+cxx_run (const google::protobuf::Message &message,
+         const std::string &data,
+         BenchOp op,
+         double min_seconds,
+         BenchResult *result)
+{
+  CxxBench b;
+  BenchCase bc = { NULL, NULL, NULL, &b };
+
+  b.message = &message;
+  b.data = data;
+  b.out.resize (data.size () ? data.size () : 1);
+  b.batch.assign (bench_batch_size (data.size ()), NULL);
+  b.failed = false;
+  switch (op)
+    {
+    case BENCH_PACK:
+      bc.run = cxx_run_pack;
+      break;
+    case BENCH_GET_PACKED_SIZE:
+      bc.run = cxx_run_get_packed_size;
+      break;
+    case BENCH_UNPACK:
+      bc.run = cxx_run_unpack;
+      bc.finish = cxx_free_batch;
+      break;
+    case BENCH_FREE_UNPACKED:
+      bc.prepare = cxx_unpack_batch;
+      bc.run = cxx_run_free_unpacked;
+      bc.finish = cxx_free_batch;
+      break;
+    default:
+      return -1;
+    }
+  if (bench_measure (&bc, data.size (), min_seconds, result) != 0)
+    return -1;
+  return b.failed ? -1 : 0;
+}
+
+/* ==== output ==== */
+
+static void
+print_result (FILE *out,
+              bool *first,
+              const char *workload,
+              const char *implementation,
+              BenchOp op,
+              size_t message_len,
+              const BenchResult *r)
+{
+  fprintf (out, "%s\n    {\"workload\": \"%s\", \"implementation\": \"%s\", "
+           "\"operation\": \"%s\", \"message_bytes\": %lu, \"ops\": %llu, "
+           "\"seconds\": %.6f, \"mb_per_s\": %.3f, \"msgs_per_s\": %.1f, "
+           "\"p50_ns\": %.1f, \"p99_ns\": %.1f}",
+           *first ? "" : ",", workload, implementation, bench_op_name (op),
+           (unsigned long) message_len, (unsigned long long) r->ops,
+           r->seconds, r->bytes / r->seconds / 1e6, r->ops / r->seconds,
+           r->p50_ns, r->p99_ns);
+  *first = false;
+}
+
+static void
+usage (const char *argv0)
+{
+  fprintf (stderr, "usage: %s [--min-time SECONDS] [--filter WORKLOAD] "
+           "[--output FILE]\n", argv0);
+  exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+  double min_seconds = 0.2;
+  const char *filter = NULL;
+  const char *output = NULL;
+  FILE *out = stdout;
+  bool first = true;
+  int status = 0;
+  Workload workloads[] = {
+    { "small_scalars", make_small_scalars () },
+    { "wide", make_wide () },
+    { "deep_nesting", make_deep_nesting () },
+    { "packed_arrays", make_packed_arrays () },
+    { "big_bytes", make_big_bytes () },
+    { "repeated_messages", make_repeated_messages () },
+  };
+
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  for (int i = 1; i < argc; i++)
+    {
+      if (strcmp (argv[i], "--min-time") == 0 && i + 1 < argc)
+        min_seconds = atof (argv[++i]);
+      else if (strcmp (argv[i], "--filter") == 0 && i + 1 < argc)
+        filter = argv[++i];
+      else if (strcmp (argv[i], "--output") == 0 && i + 1 < argc)
+        output = argv[++i];
+      else
+        usage (argv[0]);
+    }
+  if (output != NULL && (out = fopen (output, "w")) == NULL)
+    {
+      perror (output);
+      return 1;
+    }
+
+  fprintf (out, "{\n  \"protobuf_c_version\": \"%s\",\n"
+           "  \"protobuf_version\": \"%s\",\n  \"min_seconds\": %.3f,\n"
+           "  \"results\": [",
+           protobuf_c_version (),
+           google::protobuf::internal::VersionString (GOOGLE_PROTOBUF_VERSION).c_str (),
+           min_seconds);
+
+  for (const Workload &w : workloads)
+    {
+      std::string data;
+
+      if (filter != NULL && strcmp (filter, w.name) != 0)
+        continue;
+      if (!w.message->SerializeToString (&data))
+        {
+          fprintf (stderr, "%s: serialisation failed\n", w.name);
+          status = 1;
+          continue;
+        }
+      for (int op = 0; op < BENCH_N_OPS; op++)
+        {
+          BenchResult r;
+
+          if (bench_c_run (w.message->GetDescriptor ()->full_name ().c_str (),
+                           data.size (), (const uint8_t *) data.data (),
+                           (BenchOp) op, min_seconds, &r) == 0)
+            print_result (out, &first, w.name, "protobuf-c", (BenchOp) op,
+                          data.size (), &r);
+          else
+            {
+              fprintf (stderr, "%s: protobuf-c %s failed\n", w.name,
+                       bench_op_name ((BenchOp) op));
+              status = 1;
+            }
+          if (cxx_run (*w.message, data, (BenchOp) op, min_seconds, &r) == 0)
+            print_result (out, &first, w.name, "protobuf", (BenchOp) op,
+                          data.size (), &r);
+          else
+            {
+              fprintf (stderr, "%s: protobuf %s failed\n", w.name,
+                       bench_op_name ((BenchOp) op));
+              status = 1;
+            }
+        }
+    }
+
+  fprintf (out, "\n  ]\n}\n");
+  if (out != stdout)
+    fclose (out);
+  google::protobuf::ShutdownProtobufLibrary ();
+  return status;
+}
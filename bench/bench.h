@@ -0,0 +1,70 @@
+/* Shared pieces of the protobuf-c benchmark: the measurement loop and the
+ * protobuf-c side of each workload.  The C++ protobuf side and the corpus
+ * live in bench-main.cc. */
+
+#ifndef PROTOBUF_C_BENCH_H
+#define PROTOBUF_C_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+  BENCH_PACK,
+  BENCH_GET_PACKED_SIZE,
+  BENCH_UNPACK,
+  BENCH_FREE_UNPACKED,
+  BENCH_N_OPS
+} BenchOp;
+
+typedef struct
+{
+  uint64_t ops;
+  uint64_t bytes;
+  double seconds;
+  /* per-message latency, from the average of each timed batch */
+  double p50_ns;
+  double p99_ns;
+} BenchResult;
+
+/* One operation under test.  Only `run` is timed; `prepare` and `finish`
+ * bracket each batch, e.g. to unpack the messages a free benchmark frees. */
+typedef struct
+{
+  void (*prepare) (void *ctx, size_t batch_size);
+  void (*run) (void *ctx, size_t i);
+  void (*finish) (void *ctx, size_t batch_size);
+  void *ctx;
+} BenchCase;
+
+const char *bench_op_name (BenchOp op);
+
+/* Number of messages per timed batch, so that batches of small messages
+ * are not dominated by clock overhead. */
+size_t bench_batch_size (size_t message_len);
+
+/* Run batches of `bc` for at least `min_seconds` after one warm-up batch.
+ * `message_len` bytes are accounted per operation. Returns 0 on success. */
+int bench_measure (const BenchCase *bc,
+                   size_t message_len,
+                   double min_seconds,
+                   BenchResult *result);
+
+/* Measure `op` with protobuf-c on the serialised message `data` of the
+ * protobuf type `type_name`. Returns 0 on success. */
+int bench_c_run (const char *type_name,
+                 size_t len,
+                 const uint8_t *data,
+                 BenchOp op,
+                 double min_seconds,
+                 BenchResult *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROTOBUF_C_BENCH_H */
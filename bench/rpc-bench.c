@@ -0,0 +1,230 @@
+/* Loopback throughput and latency of the protobuf-c RPC transport: a server
+ * and a client in one process call t/test.proto's DirLookup service with
+ * a varying number of calls in flight.  Results are written as JSON:
+ *
+ *   protobuf-c-rpc-bench [--min-time SECONDS] [--output FILE]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "protobuf-c/protobuf-c-rpc.h"
+#include "t/test.pb-c.h"
+
+#define SOCKET_PATH "protobuf-c-rpc-bench.sock"
+#define TCP_ADDRESS "127.0.0.1:41200"
+
+static const unsigned depths[] = { 1, 16, 256 };
+
+typedef struct
+{
+  ProtobufCService *client;
+  Foo__Name input;
+  uint64_t *started;      /* send time of the call in each slot */
+  double *latencies;
+  size_t n_latencies;
+  size_t n_alloced;
+  int failed;
+} Bench;
+
+static uint64_t
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static int
+compare_doubles (const void *a, const void *b)
+{
+  double da = *(const double *) a;
+  double db = *(const double *) b;
+  return (da > db) - (da < db);
+}
+
+static void
+by_name (Foo__DirLookup_Service *service,
+         const Foo__Name *input,
+         Foo__LookupResult_Closure closure,
+         void *closure_data)
+{
+  Foo__LookupResult result = FOO__LOOKUP_RESULT__INIT;
+  Foo__Person person = FOO__PERSON__INIT;
+
+  (void) service;
+  person.name = input->name;
+  person.id = 42;
+  person.email = "someone@example.com";
+  result.person = &person;
+  closure (&result, closure_data);
+}
+
+static Foo__DirLookup_Service the_service = FOO__DIR_LOOKUP__INIT ();
+
+typedef struct
+{
+  Bench *bench;
+  unsigned slot;
+} Slot;
+
+static void send_call (Slot *slot);
+
+static void
+handle_result (const Foo__LookupResult *result, void *closure_data)
+{
+  Slot *slot = closure_data;
+  Bench *b = slot->bench;
+
+  if (result == NULL)
+    {
+      b->failed = 1;
+      return;
+    }
+  if (b->n_latencies == b->n_alloced)
+    {
+      double *l = realloc (b->latencies, b->n_alloced * 2 * sizeof (double));
+      if (l == NULL)
+        {
+          b->failed = 1;
+          return;
+        }
+      b->latencies = l;
+      b->n_alloced *= 2;
+    }
+  b->latencies[b->n_latencies++] =
+    (double) (now_ns () - b->started[slot->slot]);
+  send_call (slot);
+}
+
+static void
+send_call (Slot *slot)
+{
+  Bench *b = slot->bench;
+
+  b->started[slot->slot] = now_ns ();
+  foo__dir_lookup__by_name (b->client, &b->input, handle_result, slot);
+}
+
+/* Keep `depth` calls in flight for at least `min_seconds`. */
+static int
+run (ProtobufCRpcAddressType type, const char *address, unsigned depth,
+     double min_seconds, FILE *out, int *first)
+{
+  ProtobufCRpcDispatch *dispatch = protobuf_c_rpc_dispatch_new ();
+  ProtobufCRpcServer *server = NULL;
+  Bench b;
+  Slot *slots = calloc (depth, sizeof (Slot));
+  uint64_t start, elapsed;
+  unsigned i;
+  int rv = -1;
+
+  memset (&b, 0, sizeof (b));
+  b.started = calloc (depth, sizeof (uint64_t));
+  b.n_alloced = 1024;
+  b.latencies = malloc (b.n_alloced * sizeof (double));
+  foo__name__init (&b.input);
+  b.input.name = "benchmark";
+  if (dispatch == NULL || slots == NULL || b.started == NULL ||
+      b.latencies == NULL)
+    goto out;
+  server = protobuf_c_rpc_server_new (type, address, &the_service.base,
+                                      dispatch);
+  if (server == NULL)
+    goto out;
+  b.client = protobuf_c_rpc_client_new (type, address,
+                                        &foo__dir_lookup__descriptor, dispatch);
+  if (b.client == NULL)
+    goto out;
+
+  start = now_ns ();
+  for (i = 0; i < depth; i++)
+    {
+      slots[i].bench = &b;
+      slots[i].slot = i;
+      send_call (&slots[i]);
+    }
+  while (!b.failed && now_ns () - start < (uint64_t) (min_seconds * 1e9))
+    if (protobuf_c_rpc_dispatch_run (dispatch, 1000) < 0)
+      b.failed = 1;
+  elapsed = now_ns () - start;
+  protobuf_c_service_destroy (b.client);
+  if (b.failed && b.n_latencies == 0)
+    goto out;
+
+  qsort (b.latencies, b.n_latencies, sizeof (double), compare_doubles);
+  fprintf (out, "%s\n    {\"transport\": \"%s\", \"depth\": %u, "
+           "\"calls\": %lu, \"seconds\": %.6f, \"calls_per_s\": %.1f, "
+           "\"p50_ns\": %.1f, \"p99_ns\": %.1f}",
+           *first ? "" : ",",
+           type == PROTOBUF_C_RPC_ADDRESS_LOCAL ? "local" : "tcp", depth,
+           (unsigned long) b.n_latencies, elapsed / 1e9,
+           b.n_latencies / (elapsed / 1e9),
+           b.latencies[b.n_latencies / 2],
+           b.latencies[(b.n_latencies * 99) / 100]);
+  *first = 0;
+  rv = 0;
+
+out:
+  protobuf_c_rpc_server_destroy (server);
+  protobuf_c_rpc_dispatch_free (dispatch);
+  free (b.latencies);
+  free (b.started);
+  free (slots);
+  return rv;
+}
+
+int
+main (int argc, char **argv)
+{
+  double min_seconds = 0.5;
+  const char *output = NULL;
+  FILE *out = stdout;
+  int first = 1;
+  int status = 0;
+  unsigned i;
+  int t;
+
+  for (t = 1; t < argc; t++)
+    {
+      if (strcmp (argv[t], "--min-time") == 0 && t + 1 < argc)
+        min_seconds = atof (argv[++t]);
+      else if (strcmp (argv[t], "--output") == 0 && t + 1 < argc)
+        output = argv[++t];
+      else
+        {
+          fprintf (stderr, "usage: %s [--min-time SECONDS] [--output FILE]\n",
+                   argv[0]);
+          return 1;
+        }
+    }
+  if (output != NULL && (out = fopen (output, "w")) == NULL)
+    {
+      perror (output);
+      return 1;
+    }
+
+  fprintf (out, "{\n  \"protobuf_c_version\": \"%s\",\n"
+           "  \"min_seconds\": %.3f,\n  \"results\": [",
+           protobuf_c_version (), min_seconds);
+  for (t = 0; t < 2; t++)
+    for (i = 0; i < sizeof (depths) / sizeof (depths[0]); i++)
+      {
+        ProtobufCRpcAddressType type = t == 0 ?
+          PROTOBUF_C_RPC_ADDRESS_LOCAL : PROTOBUF_C_RPC_ADDRESS_TCP;
+
+        if (run (type, t == 0 ? SOCKET_PATH : TCP_ADDRESS, depths[i],
+                 min_seconds, out, &first) != 0)
+          {
+            fprintf (stderr, "%s, depth %u failed\n",
+                     t == 0 ? "local" : "tcp", depths[i]);
+            status = 1;
+          }
+      }
+  fprintf (out, "\n  ]\n}\n");
+  if (out != stdout)
+    fclose (out);
+  return status;
+}
@@ -0,0 +1,1563 @@
+/*
+ * Copyright (c) 2026, the protobuf-c authors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file
+ * Runtime construction of descriptors from a serialised
+ * `google.protobuf.FileDescriptorSet`.
+ *
+ * The set is read with a small wire reader of its own rather than through
+ * generated code for descriptor.proto, so that indexing a set only touches
+ * the type names and building a descriptor only touches its own definition.
+ */
+
+#include <stdlib.h>	/* for malloc, free, strtod, strtol, qsort, bsearch */
+#include <string.h>	/* for strcmp, memcmp, memcpy, memset */
+
+#include "protobuf-c-dynamic.h"
+
+#define TRUE				1
+#define FALSE				0
+
+/* Workaround for Microsoft compilers. */
+#ifdef _MSC_VER
+# define inline __inline
+#endif
+
+/*
+ * Field numbers and enum values from google/protobuf/descriptor.proto. Only
+ * the ones used here are listed.
+ */
+#define FILE_SET_FILE			1
+
+#define FILE_PACKAGE			2
+#define FILE_MESSAGE_TYPE		4
+#define FILE_ENUM_TYPE			5
+#define FILE_OPTIONS			8
+#define FILE_SYNTAX			12
+
+#define MESSAGE_NAME			1
+#define MESSAGE_FIELD			2
+#define MESSAGE_NESTED_TYPE		3
+#define MESSAGE_ENUM_TYPE		4
+#define MESSAGE_OPTIONS			7
+#define MESSAGE_ONEOF_DECL		8
+
+#define FIELD_NAME			1
+#define FIELD_NUMBER			3
+#define FIELD_LABEL			4
+#define FIELD_TYPE			5
+#define FIELD_TYPE_NAME			6
+#define FIELD_DEFAULT_VALUE		7
+#define FIELD_OPTIONS			8
+#define FIELD_ONEOF_INDEX		9
+
+#define MESSAGE_OPTIONS_MAP_ENTRY	7
+
+#define FIELD_OPTIONS_PACKED		2
+#define FIELD_OPTIONS_DEPRECATED	3
+
+/* The (pb_c_file) and (pb_c_field) options from protobuf-c.proto. */
+#define OPTIONS_PB_C			1019
+#define PB_C_FILE_ENUM_CHECK		7
+#define PB_C_FIELD_STRING_AS_BYTES	1
+#define PB_C_FIELD_ENUM_CHECK		2
+#define PB_C_FIELD_MAP_INDEX		3
+#define PB_C_FIELD_LAYOUT		4
+
+#define ENUM_CHECK_REJECT		1
+#define ENUM_CHECK_UNKNOWN		2
+
+#define REPEATED_LAYOUT_CONTIGUOUS	1
+
+#define ENUM_NAME			1
+#define ENUM_VALUE			2
+
+#define ENUM_VALUE_NAME			1
+#define ENUM_VALUE_NUMBER		2
+
+#define LABEL_OPTIONAL			1
+#define LABEL_REQUIRED			2
+#define LABEL_REPEATED			3
+
+#define TYPE_GROUP			10
+
+/* Alignment of every block handed out by the pool arena. */
+#define ARENA_ALIGN			16
+#define ARENA_CHUNK_SIZE		4096
+
+typedef struct {
+	const uint8_t *data;
+	size_t len;
+} Slice;
+
+typedef struct {
+	const uint8_t *at;
+	const uint8_t *end;
+} Reader;
+
+typedef struct {
+	uint32_t tag;
+	uint8_t wire_type;
+	uint64_t value;		/* for PROTOBUF_C_WIRE_TYPE_VARINT */
+	Slice bytes;		/* for PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED */
+} WireField;
+
+typedef enum {
+	ENTRY_MESSAGE,
+	ENTRY_ENUM,
+} EntryKind;
+
+typedef enum {
+	ENTRY_UNBUILT,
+	ENTRY_BUILDING,
+	ENTRY_BUILT,
+	ENTRY_FAILED,
+} EntryState;
+
+/* What the types of one FileDescriptorProto have in common. */
+typedef struct {
+	const char *package;
+	protobuf_c_boolean proto3;
+	unsigned enum_check;
+} FileInfo;
+
+typedef struct {
+	const char *name;		/* fully qualified, no leading dot */
+	const char *short_name;
+	const FileInfo *file;
+	EntryKind kind;
+	EntryState state;
+	Slice proto;			/* DescriptorProto or EnumDescriptorProto */
+	protobuf_c_boolean map_entry;	/* synthesised map<K,V> entry type */
+	const int *first_value;		/* enum: first value declared */
+	void *descriptor;
+} PoolEntry;
+
+typedef struct ArenaChunk ArenaChunk;
+struct ArenaChunk {
+	ArenaChunk *next;
+	size_t size;
+	size_t used;
+};
+
+struct ProtobufCDescriptorPool {
+	ProtobufCAllocator *allocator;
+	uint8_t *data;
+	size_t n_entries;
+	size_t entries_alloced;
+	PoolEntry *entries;
+	ArenaChunk *chunks;
+
+	/* entries whose build started during the current lookup */
+	size_t n_pending;
+	size_t pending_alloced;
+	PoolEntry **pending;
+	/* the first of them whose build failed */
+	PoolEntry *failed;
+};
+
+/* Parsed FieldDescriptorProto. */
+typedef struct {
+	const char *name;
+	uint32_t number;
+	unsigned label;
+	unsigned type;
+	Slice type_name;
+	Slice default_value;
+	protobuf_c_boolean has_default_value;
+	protobuf_c_boolean has_packed;
+	protobuf_c_boolean packed;
+	protobuf_c_boolean deprecated;
+	protobuf_c_boolean string_as_bytes;
+	protobuf_c_boolean has_enum_check;
+	unsigned enum_check;
+	protobuf_c_boolean map_index;
+	unsigned layout;
+	int oneof_index;
+} FieldInfo;
+
+/* A field name with the index of its field, for sorting by name. */
+typedef struct {
+	const char *name;
+	unsigned index;
+} FieldName;
+
+/* Parsed EnumValueDescriptorProto. */
+typedef struct {
+	const char *name;
+	int number;
+	unsigned decl_index;
+} ValueInfo;
+
+static void *
+system_alloc(void *allocator_data, size_t size)
+{
+	(void)allocator_data;
+	return malloc(size);
+}
+
+static void
+system_free(void *allocator_data, void *data)
+{
+	(void)allocator_data;
+	free(data);
+}
+
+static ProtobufCAllocator dynamic__allocator = {
+	.alloc = &system_alloc,
+	.free = &system_free,
+	.allocator_data = NULL,
+};
+
+static inline void *
+do_alloc(ProtobufCAllocator *allocator, size_t size)
+{
+	return allocator->alloc(allocator->allocator_data, size);
+}
+
+static inline void
+do_free(ProtobufCAllocator *allocator, void *data)
+{
+	if (data != NULL)
+		allocator->free(allocator->allocator_data, data);
+}
+
+/**
+ * \defgroup dynamic descriptor pool implementation
+ *
+ * Everything a pool builds lives in an arena of chunks that is released as a
+ * whole by protobuf_c_descriptor_pool_free().
+ *
+ * \ingroup internal
+ * @{
+ */
+
+static void *
+pool_alloc(ProtobufCDescriptorPool *pool, size_t size)
+{
+	ArenaChunk *chunk = pool->chunks;
+	size_t header = (sizeof(ArenaChunk) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+	uint8_t *rv;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+
+		chunk = do_alloc(pool->allocator, header + chunk_size);
+		if (chunk == NULL)
+			return NULL;
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		chunk->next = pool->chunks;
+		pool->chunks = chunk;
+	}
+	rv = (uint8_t *) chunk + header + chunk->used;
+	chunk->used += size;
+	memset(rv, 0, size);
+	return rv;
+}
+
+static char *
+pool_strndup(ProtobufCDescriptorPool *pool, const uint8_t *str, size_t len)
+{
+	char *rv = pool_alloc(pool, len + 1);
+	if (rv == NULL)
+		return NULL;
+	memcpy(rv, str, len);
+	rv[len] = 0;
+	return rv;
+}
+
+static inline void
+reader_init(Reader *reader, Slice slice)
+{
+	reader->at = slice.data;
+	reader->end = slice.data + slice.len;
+}
+
+static protobuf_c_boolean
+read_varint(Reader *reader, uint64_t *out)
+{
+	uint64_t v = 0;
+	unsigned shift = 0;
+
+	do {
+		if (reader->at == reader->end || shift >= 64)
+			return FALSE;
+		v |= (uint64_t) (*reader->at & 0x7f) << shift;
+		shift += 7;
+	} while (*reader->at++ & 0x80);
+	*out = v;
+	return TRUE;
+}
+
+/*
+ * Read the next field of a serialised message. Returns 1 on success, 0 at
+ * the end of the data and -1 on malformed input. Fixed-width fields are
+ * skipped over; nothing read here is encoded that way.
+ */
+static int
+next_field(Reader *reader, WireField *field)
+{
+	for (;;) {
+		uint64_t key;
+		uint64_t v;
+
+		if (reader->at == reader->end)
+			return 0;
+		if (!read_varint(reader, &key))
+			return -1;
+		field->tag = (uint32_t) (key >> 3);
+		field->wire_type = key & 7;
+		switch (field->wire_type) {
+		case PROTOBUF_C_WIRE_TYPE_VARINT:
+			if (!read_varint(reader, &field->value))
+				return -1;
+			return 1;
+		case PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED:
+			if (!read_varint(reader, &v) ||
+			    v > (uint64_t) (reader->end - reader->at))
+				return -1;
+			field->bytes.data = reader->at;
+			field->bytes.len = (size_t) v;
+			reader->at += v;
+			return 1;
+		case PROTOBUF_C_WIRE_TYPE_64BIT:
+			if (reader->end - reader->at < 8)
+				return -1;
+			reader->at += 8;
+			break;
+		case PROTOBUF_C_WIRE_TYPE_32BIT:
+			if (reader->end - reader->at < 4)
+				return -1;
+			reader->at += 4;
+			break;
+		default:
+			return -1;
+		}
+	}
+}
+
+static protobuf_c_boolean
+slice_equals(Slice slice, const char *str)
+{
+	size_t len = strlen(str);
+	return slice.len == len && memcmp(slice.data, str, len) == 0;
+}
+
+static PoolEntry *
+add_entry(ProtobufCDescriptorPool *pool)
+{
+	if (pool->n_entries == pool->entries_alloced) {
+		size_t new_alloced = pool->entries_alloced ? pool->entries_alloced * 2 : 32;
+		PoolEntry *entries = do_alloc(pool->allocator,
+					      new_alloced * sizeof(PoolEntry));
+		if (entries == NULL)
+			return NULL;
+		if (pool->n_entries != 0)
+			memcpy(entries, pool->entries,
+			       pool->n_entries * sizeof(PoolEntry));
+		do_free(pool->allocator, pool->entries);
+		pool->entries = entries;
+		pool->entries_alloced = new_alloced;
+	}
+	memset(&pool->entries[pool->n_entries], 0, sizeof(PoolEntry));
+	return &pool->entries[pool->n_entries++];
+}
+
+/* Read MessageOptions.map_entry. */
+static protobuf_c_boolean
+parse_map_entry_option(Slice options, protobuf_c_boolean *map_entry)
+{
+	Reader reader;
+	WireField field;
+	int rc;
+
+	reader_init(&reader, options);
+	while ((rc = next_field(&reader, &field)) > 0)
+		if (field.tag == MESSAGE_OPTIONS_MAP_ENTRY &&
+		    field.wire_type == PROTOBUF_C_WIRE_TYPE_VARINT)
+			*map_entry = field.value != 0;
+	return rc == 0;
+}
+
+/*
+ * Record a message or enum under `scope` (the enclosing package or message
+ * name), then its nested types.
+ */
+static protobuf_c_boolean
+index_type(ProtobufCDescriptorPool *pool,
+	   EntryKind kind,
+	   Slice proto,
+	   const char *scope,
+	   const FileInfo *file)
+{
+	Reader reader;
+	WireField field;
+	Slice name = { NULL, 0 };
+	size_t scope_len = strlen(scope);
+	PoolEntry *entry;
+	char *full_name;
+	protobuf_c_boolean map_entry = FALSE;
+	int rc;
+
+	/* MESSAGE_NAME and ENUM_NAME are both field 1 */
+	reader_init(&reader, proto);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		if (field.wire_type != PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+			continue;
+		if (field.tag == MESSAGE_NAME)
+			name = field.bytes;
+		else if (kind == ENTRY_MESSAGE && field.tag == MESSAGE_OPTIONS &&
+			 !parse_map_entry_option(field.bytes, &map_entry))
+			return FALSE;
+	}
+	if (rc < 0 || name.data == NULL)
+		return FALSE;
+
+	full_name = pool_alloc(pool, scope_len + 1 + name.len + 1);
+	if (full_name == NULL)
+		return FALSE;
+	if (scope_len != 0) {
+		memcpy(full_name, scope, scope_len);
+		full_name[scope_len++] = '.';
+	}
+	memcpy(full_name + scope_len, name.data, name.len);
+	full_name[scope_len + name.len] = 0;
+
+	entry = add_entry(pool);
+	if (entry == NULL)
+		return FALSE;
+	entry->name = full_name;
+	entry->short_name = full_name + scope_len;
+	entry->file = file;
+	entry->kind = kind;
+	entry->state = ENTRY_UNBUILT;
+	entry->proto = proto;
+	entry->map_entry = map_entry;
+	entry->first_value = NULL;
+
+	if (kind != ENTRY_MESSAGE)
+		return TRUE;
+	reader_init(&reader, proto);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		if (field.wire_type != PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+			continue;
+		if (field.tag == MESSAGE_NESTED_TYPE &&
+		    !index_type(pool, ENTRY_MESSAGE, field.bytes, full_name, file))
+			return FALSE;
+		if (field.tag == MESSAGE_ENUM_TYPE &&
+		    !index_type(pool, ENTRY_ENUM, field.bytes, full_name, file))
+			return FALSE;
+	}
+	return rc == 0;
+}
+
+/* Find the (pb_c_file) or (pb_c_field) extension in an options message. */
+static protobuf_c_boolean
+find_pb_c_options(Slice options, Slice *out)
+{
+	Reader reader;
+	WireField field;
+	int rc;
+
+	out->data = NULL;
+	out->len = 0;
+	reader_init(&reader, options);
+	while ((rc = next_field(&reader, &field)) > 0)
+		if (field.tag == OPTIONS_PB_C &&
+		    field.wire_type == PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+			*out = field.bytes;
+	return rc == 0;
+}
+
+static protobuf_c_boolean
+index_file(ProtobufCDescriptorPool *pool, Slice proto)
+{
+	Reader reader;
+	Reader oreader;
+	WireField field;
+	WireField ofield;
+	FileInfo *file;
+	Slice pb_c;
+	int rc;
+	int orc;
+
+	file = pool_alloc(pool, sizeof(FileInfo));
+	if (file == NULL)
+		return FALSE;
+	file->package = "";
+	reader_init(&reader, proto);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		if (field.wire_type != PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+			continue;
+		if (field.tag == FILE_PACKAGE) {
+			file->package = pool_strndup(pool, field.bytes.data,
+						     field.bytes.len);
+			if (file->package == NULL)
+				return FALSE;
+		} else if (field.tag == FILE_SYNTAX) {
+			file->proto3 = slice_equals(field.bytes, "proto3");
+		} else if (field.tag == FILE_OPTIONS) {
+			if (!find_pb_c_options(field.bytes, &pb_c))
+				return FALSE;
+			reader_init(&oreader, pb_c);
+			while ((orc = next_field(&oreader, &ofield)) > 0)
+				if (ofield.tag == PB_C_FILE_ENUM_CHECK &&
+				    ofield.wire_type == PROTOBUF_C_WIRE_TYPE_VARINT)
+					file->enum_check = (unsigned) ofield.value;
+			if (orc < 0)
+				return FALSE;
+		}
+	}
+	if (rc < 0)
+		return FALSE;
+
+	reader_init(&reader, proto);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		if (field.wire_type != PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+			continue;
+		if (field.tag == FILE_MESSAGE_TYPE &&
+		    !index_type(pool, ENTRY_MESSAGE, field.bytes,
+				file->package, file))
+			return FALSE;
+		if (field.tag == FILE_ENUM_TYPE &&
+		    !index_type(pool, ENTRY_ENUM, field.bytes,
+				file->package, file))
+			return FALSE;
+	}
+	return rc == 0;
+}
+
+static int
+compare_entries_by_name(const void *a, const void *b)
+{
+	const PoolEntry *ea = a;
+	const PoolEntry *eb = b;
+	return strcmp(ea->name, eb->name);
+}
+
+static PoolEntry *
+find_entry(ProtobufCDescriptorPool *pool, const char *name, size_t len)
+{
+	size_t start = 0;
+	size_t count = pool->n_entries;
+
+	while (count > 0) {
+		size_t mid = start + count / 2;
+		const char *entry_name = pool->entries[mid].name;
+		int rv = strncmp(entry_name, name, len);
+
+		if (rv == 0 && entry_name[len] != 0)
+			rv = 1;
+		if (rv == 0)
+			return &pool->entries[mid];
+		if (rv < 0) {
+			count = start + count - (mid + 1);
+			start = mid + 1;
+		} else {
+			count = mid - start;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Build the ranges used by int_range_lookup() from sorted, distinct values:
+ * one entry per run of consecutive values plus a terminating entry whose
+ * orig_index is the number of values.
+ */
+static ProtobufCIntRange *
+build_ranges(ProtobufCDescriptorPool *pool,
+	     unsigned n_values,
+	     const int *values,
+	     unsigned *n_ranges_out)
+{
+	ProtobufCIntRange *ranges;
+	unsigned n_ranges = 0;
+	unsigned i;
+
+	for (i = 0; i < n_values; i++)
+		if (i == 0 || values[i - 1] + 1 != values[i])
+			n_ranges++;
+	ranges = pool_alloc(pool, (n_ranges + 1) * sizeof(ProtobufCIntRange));
+	if (ranges == NULL)
+		return NULL;
+	n_ranges = 0;
+	for (i = 0; i < n_values; i++) {
+		if (i == 0 || values[i - 1] + 1 != values[i]) {
+			ranges[n_ranges].start_value = values[i];
+			ranges[n_ranges].orig_index = i;
+			n_ranges++;
+		}
+	}
+	ranges[n_ranges].start_value = 0;
+	ranges[n_ranges].orig_index = n_values;
+	*n_ranges_out = n_ranges;
+	return ranges;
+}
+
+static int
+compare_values_by_number(const void *a, const void *b)
+{
+	const ValueInfo *va = a;
+	const ValueInfo *vb = b;
+	if (va->number < vb->number) return -1;
+	if (va->number > vb->number) return 1;
+	if (va->decl_index < vb->decl_index) return -1;
+	if (va->decl_index > vb->decl_index) return 1;
+	return 0;
+}
+
+static int
+compare_value_indices_by_name(const void *a, const void *b)
+{
+	const ProtobufCEnumValueIndex *va = a;
+	const ProtobufCEnumValueIndex *vb = b;
+	return strcmp(va->name, vb->name);
+}
+
+static const ProtobufCEnumDescriptor *
+build_enum(ProtobufCDescriptorPool *pool, PoolEntry *entry)
+{
+	ProtobufCEnumDescriptor *desc;
+	ProtobufCEnumValue *values;
+	ProtobufCEnumValueIndex *values_by_name;
+	ProtobufCIntRange *ranges;
+	ValueInfo *infos;
+	Reader reader;
+	WireField field;
+	Reader vreader;
+	WireField vfield;
+	unsigned n_decl = 0;
+	unsigned n_unique = 0;
+	unsigned n_ranges;
+	unsigned first = 0;
+	unsigned i;
+	int *numbers;
+	int rc;
+
+	if (entry->state == ENTRY_BUILT)
+		return entry->descriptor;
+	if (entry->state == ENTRY_FAILED)
+		return NULL;
+
+	reader_init(&reader, entry->proto);
+	while ((rc = next_field(&reader, &field)) > 0)
+		if (field.tag == ENUM_VALUE)
+			n_decl++;
+	if (rc < 0 || n_decl == 0)
+		goto fail;
+
+	infos = pool_alloc(pool, n_decl * sizeof(ValueInfo));
+	if (infos == NULL)
+		goto fail;
+	n_decl = 0;
+	reader_init(&reader, entry->proto);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		ValueInfo *info;
+		int vrc;
+
+		if (field.tag != ENUM_VALUE ||
+		    field.wire_type != PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+			continue;
+		info = &infos[n_decl];
+		info->decl_index = n_decl++;
+		reader_init(&vreader, field.bytes);
+		while ((vrc = next_field(&vreader, &vfield)) > 0) {
+			if (vfield.tag == ENUM_VALUE_NAME &&
+			    vfield.wire_type == PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED) {
+				info->name = pool_strndup(pool, vfield.bytes.data,
+							  vfield.bytes.len);
+				if (info->name == NULL)
+					goto fail;
+			} else if (vfield.tag == ENUM_VALUE_NUMBER &&
+				   vfield.wire_type == PROTOBUF_C_WIRE_TYPE_VARINT) {
+				info->number = (int) (int32_t) vfield.value;
+			}
+		}
+		if (vrc < 0 || info->name == NULL)
+			goto fail;
+	}
+	qsort(infos, n_decl, sizeof(ValueInfo), compare_values_by_number);
+
+	/* only the first of several aliases gets an entry in values[] */
+	values = pool_alloc(pool, n_decl * sizeof(ProtobufCEnumValue));
+	values_by_name = pool_alloc(pool, n_decl * sizeof(ProtobufCEnumValueIndex));
+	numbers = pool_alloc(pool, n_decl * sizeof(int));
+	if (values == NULL || values_by_name == NULL || numbers == NULL)
+		goto fail;
+	for (i = 0; i < n_decl; i++) {
+		if (i == 0 || infos[i - 1].number != infos[i].number) {
+			values[n_unique].name = infos[i].name;
+			values[n_unique].c_name = NULL;
+			values[n_unique].value = infos[i].number;
+			numbers[n_unique] = infos[i].number;
+			n_unique++;
+		}
+		if (infos[i].decl_index == 0)
+			first = n_unique - 1;
+		values_by_name[i].name = infos[i].name;
+		values_by_name[i].index = n_unique - 1;
+	}
+	qsort(values_by_name, n_decl, sizeof(ProtobufCEnumValueIndex),
+	      compare_value_indices_by_name);
+
+	ranges = build_ranges(pool, n_unique, numbers, &n_ranges);
+	desc = pool_alloc(pool, sizeof(ProtobufCEnumDescriptor));
+	if (ranges == NULL || desc == NULL)
+		goto fail;
+	desc->magic = PROTOBUF_C__ENUM_DESCRIPTOR_MAGIC;
+	desc->name = entry->name;
+	desc->short_name = entry->short_name;
+	desc->c_name = NULL;
+	desc->package_name = entry->file->package;
+	desc->n_values = n_unique;
+	desc->values = values;
+	desc->n_value_names = n_decl;
+	desc->values_by_name = values_by_name;
+	desc->n_value_ranges = n_ranges;
+	desc->value_ranges = ranges;
+	entry->first_value = &values[first].value;
+	entry->descriptor = desc;
+	entry->state = ENTRY_BUILT;
+	return desc;
+
+fail:
+	entry->state = ENTRY_FAILED;
+	return NULL;
+}
+
+static protobuf_c_boolean
+parse_field_options(Slice options, FieldInfo *info)
+{
+	Reader reader;
+	WireField field;
+	Slice pb_c;
+	int rc;
+
+	reader_init(&reader, options);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		if (field.wire_type != PROTOBUF_C_WIRE_TYPE_VARINT)
+			continue;
+		if (field.tag == FIELD_OPTIONS_PACKED) {
+			info->has_packed = TRUE;
+			info->packed = field.value != 0;
+		} else if (field.tag == FIELD_OPTIONS_DEPRECATED) {
+			info->deprecated = field.value != 0;
+		}
+	}
+	if (rc < 0 || !find_pb_c_options(options, &pb_c))
+		return FALSE;
+
+	reader_init(&reader, pb_c);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		if (field.wire_type != PROTOBUF_C_WIRE_TYPE_VARINT)
+			continue;
+		if (field.tag == PB_C_FIELD_STRING_AS_BYTES) {
+			info->string_as_bytes = field.value != 0;
+		} else if (field.tag == PB_C_FIELD_ENUM_CHECK) {
+			info->has_enum_check = TRUE;
+			info->enum_check = (unsigned) field.value;
+		} else if (field.tag == PB_C_FIELD_MAP_INDEX) {
+			info->map_index = field.value != 0;
+		} else if (field.tag == PB_C_FIELD_LAYOUT) {
+			info->layout = (unsigned) field.value;
+		}
+	}
+	return rc == 0;
+}
+
+static protobuf_c_boolean
+parse_field_info(ProtobufCDescriptorPool *pool, Slice proto, FieldInfo *info)
+{
+	Reader reader;
+	WireField field;
+	int rc;
+
+	info->oneof_index = -1;
+	reader_init(&reader, proto);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		if (field.wire_type == PROTOBUF_C_WIRE_TYPE_VARINT) {
+			switch (field.tag) {
+			case FIELD_NUMBER:
+				info->number = (uint32_t) field.value;
+				break;
+			case FIELD_LABEL:
+				info->label = (unsigned) field.value;
+				break;
+			case FIELD_TYPE:
+				info->type = (unsigned) field.value;
+				break;
+			case FIELD_ONEOF_INDEX:
+				info->oneof_index = (int) field.value;
+				break;
+			}
+		} else if (field.wire_type == PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED) {
+			switch (field.tag) {
+			case FIELD_NAME:
+				info->name = pool_strndup(pool, field.bytes.data,
+							  field.bytes.len);
+				if (info->name == NULL)
+					return FALSE;
+				break;
+			case FIELD_TYPE_NAME:
+				info->type_name = field.bytes;
+				break;
+			case FIELD_DEFAULT_VALUE:
+				info->default_value = field.bytes;
+				info->has_default_value = TRUE;
+				break;
+			case FIELD_OPTIONS:
+				if (!parse_field_options(field.bytes, info))
+					return FALSE;
+				break;
+			}
+		}
+	}
+	return rc == 0 && info->name != NULL && info->number != 0;
+}
+
+/* Map descriptor.proto's FieldDescriptorProto.Type to ProtobufCType. */
+static protobuf_c_boolean
+map_field_type(unsigned type, ProtobufCType *out)
+{
+	static const int types[] = {
+		-1,
+		PROTOBUF_C_TYPE_DOUBLE,		/* TYPE_DOUBLE = 1 */
+		PROTOBUF_C_TYPE_FLOAT,		/* TYPE_FLOAT = 2 */
+		PROTOBUF_C_TYPE_INT64,		/* TYPE_INT64 = 3 */
+		PROTOBUF_C_TYPE_UINT64,		/* TYPE_UINT64 = 4 */
+		PROTOBUF_C_TYPE_INT32,		/* TYPE_INT32 = 5 */
+		PROTOBUF_C_TYPE_FIXED64,	/* TYPE_FIXED64 = 6 */
+		PROTOBUF_C_TYPE_FIXED32,	/* TYPE_FIXED32 = 7 */
+		PROTOBUF_C_TYPE_BOOL,		/* TYPE_BOOL = 8 */
+		PROTOBUF_C_TYPE_STRING,		/* TYPE_STRING = 9 */
+		-1,				/* TYPE_GROUP = 10 */
+		PROTOBUF_C_TYPE_MESSAGE,	/* TYPE_MESSAGE = 11 */
+		PROTOBUF_C_TYPE_BYTES,		/* TYPE_BYTES = 12 */
+		PROTOBUF_C_TYPE_UINT32,		/* TYPE_UINT32 = 13 */
+		PROTOBUF_C_TYPE_ENUM,		/* TYPE_ENUM = 14 */
+		PROTOBUF_C_TYPE_SFIXED32,	/* TYPE_SFIXED32 = 15 */
+		PROTOBUF_C_TYPE_SFIXED64,	/* TYPE_SFIXED64 = 16 */
+		PROTOBUF_C_TYPE_SINT32,		/* TYPE_SINT32 = 17 */
+		PROTOBUF_C_TYPE_SINT64,		/* TYPE_SINT64 = 18 */
+	};
+
+	if (type >= sizeof(types) / sizeof(types[0]) || types[type] < 0)
+		return FALSE;
+	*out = (ProtobufCType) types[type];
+	return TRUE;
+}
+
+static size_t
+sizeof_field_type(ProtobufCType type)
+{
+	switch (type) {
+	case PROTOBUF_C_TYPE_INT32:
+	case PROTOBUF_C_TYPE_SINT32:
+	case PROTOBUF_C_TYPE_SFIXED32:
+	case PROTOBUF_C_TYPE_UINT32:
+	case PROTOBUF_C_TYPE_FIXED32:
+	case PROTOBUF_C_TYPE_FLOAT:
+	case PROTOBUF_C_TYPE_ENUM:
+		return 4;
+	case PROTOBUF_C_TYPE_INT64:
+	case PROTOBUF_C_TYPE_SINT64:
+	case PROTOBUF_C_TYPE_SFIXED64:
+	case PROTOBUF_C_TYPE_UINT64:
+	case PROTOBUF_C_TYPE_FIXED64:
+	case PROTOBUF_C_TYPE_DOUBLE:
+		return 8;
+	case PROTOBUF_C_TYPE_BOOL:
+		return sizeof(protobuf_c_boolean);
+	case PROTOBUF_C_TYPE_STRING:
+	case PROTOBUF_C_TYPE_MESSAGE:
+		return sizeof(void *);
+	case PROTOBUF_C_TYPE_BYTES:
+		return sizeof(ProtobufCBinaryData);
+	}
+	return 0;
+}
+
+static size_t
+alignof_field_type(ProtobufCType type)
+{
+	switch (type) {
+	case PROTOBUF_C_TYPE_INT64:
+	case PROTOBUF_C_TYPE_SINT64:
+	case PROTOBUF_C_TYPE_SFIXED64:
+	case PROTOBUF_C_TYPE_UINT64:
+	case PROTOBUF_C_TYPE_FIXED64:
+	case PROTOBUF_C_TYPE_DOUBLE: {
+		struct { char c; uint64_t v; } s;
+		return (size_t) ((char *) &s.v - (char *) &s);
+	}
+	case PROTOBUF_C_TYPE_BYTES:
+	case PROTOBUF_C_TYPE_STRING:
+	case PROTOBUF_C_TYPE_MESSAGE: {
+		struct { char c; void *p; } s;
+		return (size_t) ((char *) &s.p - (char *) &s);
+	}
+	default:
+		return sizeof_field_type(type);
+	}
+}
+
+/* The field's key as protoc-gen-c pre-encodes it, or 0 beyond 3 bytes. */
+static unsigned
+encoded_field_tag(const ProtobufCFieldDescriptor *f)
+{
+	uint32_t key;
+	unsigned rv = 0;
+	unsigned shift = 0;
+
+	if (f->id >= (1U << 18))
+		return 0;
+	if (f->flags & PROTOBUF_C_FIELD_FLAG_PACKED) {
+		key = PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED;
+	} else {
+		switch (f->type) {
+		case PROTOBUF_C_TYPE_SFIXED32:
+		case PROTOBUF_C_TYPE_FIXED32:
+		case PROTOBUF_C_TYPE_FLOAT:
+			key = PROTOBUF_C_WIRE_TYPE_32BIT;
+			break;
+		case PROTOBUF_C_TYPE_SFIXED64:
+		case PROTOBUF_C_TYPE_FIXED64:
+		case PROTOBUF_C_TYPE_DOUBLE:
+			key = PROTOBUF_C_WIRE_TYPE_64BIT;
+			break;
+		case PROTOBUF_C_TYPE_STRING:
+		case PROTOBUF_C_TYPE_BYTES:
+		case PROTOBUF_C_TYPE_MESSAGE:
+			key = PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED;
+			break;
+		default:
+			key = PROTOBUF_C_WIRE_TYPE_VARINT;
+			break;
+		}
+	}
+	key |= f->id << 3;
+	for (; key >= 0x80; key >>= 7, shift += 8)
+		rv |= ((key & 0x7f) | 0x80) << shift;
+	return rv | (key << shift);
+}
+
+static unsigned
+place_member(size_t *offset, size_t size, size_t align, size_t *max_align)
+{
+	unsigned rv;
+
+	*offset = (*offset + align - 1) & ~(align - 1);
+	rv = (unsigned) *offset;
+	*offset += size;
+	if (align > *max_align)
+		*max_align = align;
+	return rv;
+}
+
+/* Undo the C escaping protoc applies to `bytes` default values. */
+static protobuf_c_boolean
+unescape_bytes(ProtobufCDescriptorPool *pool, Slice in, ProtobufCBinaryData *out)
+{
+	uint8_t *data = pool_alloc(pool, in.len + 1);
+	size_t i = 0;
+	size_t n = 0;
+
+	if (data == NULL)
+		return FALSE;
+	while (i < in.len) {
+		uint8_t c = in.data[i++];
+
+		if (c != '\\') {
+			data[n++] = c;
+			continue;
+		}
+		if (i == in.len)
+			return FALSE;
+		c = in.data[i++];
+		switch (c) {
+		case 'n': data[n++] = '\n'; break;
+		case 'r': data[n++] = '\r'; break;
+		case 't': data[n++] = '\t'; break;
+		case 'a': data[n++] = '\a'; break;
+		case 'b': data[n++] = '\b'; break;
+		case 'f': data[n++] = '\f'; break;
+		case 'v': data[n++] = '\v'; break;
+		case 'x': {
+			unsigned v = 0;
+			unsigned digits = 0;
+
+			while (i < in.len && digits < 2) {
+				uint8_t h = in.data[i];
+				if (h >= '0' && h <= '9')
+					v = v * 16 + (h - '0');
+				else if (h >= 'a' && h <= 'f')
+					v = v * 16 + (h - 'a' + 10);
+				else if (h >= 'A' && h <= 'F')
+					v = v * 16 + (h - 'A' + 10);
+				else
+					break;
+				i++;
+				digits++;
+			}
+			if (digits == 0)
+				return FALSE;
+			data[n++] = (uint8_t) v;
+			break;
+		}
+		default:
+			if (c >= '0' && c <= '7') {
+				unsigned v = c - '0';
+				unsigned digits = 1;
+
+				while (i < in.len && digits < 3 &&
+				       in.data[i] >= '0' && in.data[i] <= '7')
+				{
+					v = v * 8 + (in.data[i++] - '0');
+					digits++;
+				}
+				data[n++] = (uint8_t) v;
+			} else {
+				/* \\, \', \" and \? stand for themselves */
+				data[n++] = c;
+			}
+			break;
+		}
+	}
+	out->len = n;
+	out->data = n != 0 ? data : NULL;
+	return TRUE;
+}
+
+static const void *
+build_default_value(ProtobufCDescriptorPool *pool,
+		    const FieldInfo *info,
+		    const ProtobufCFieldDescriptor *field)
+{
+	char *str = pool_strndup(pool, info->default_value.data,
+				 info->default_value.len);
+	void *rv;
+
+	if (str == NULL)
+		return NULL;
+	switch (field->type) {
+	case PROTOBUF_C_TYPE_STRING:
+		return str;
+	case PROTOBUF_C_TYPE_BYTES: {
+		ProtobufCBinaryData *bd = pool_alloc(pool, sizeof(ProtobufCBinaryData));
+		if (bd == NULL || !unescape_bytes(pool, info->default_value, bd))
+			return NULL;
+		return bd;
+	}
+	case PROTOBUF_C_TYPE_ENUM: {
+		const ProtobufCEnumValue *ev =
+			protobuf_c_enum_descriptor_get_value_by_name(field->descriptor, str);
+		if (ev == NULL)
+			return NULL;
+		rv = pool_alloc(pool, sizeof(int32_t));
+		if (rv != NULL)
+			*(int32_t *) rv = ev->value;
+		return rv;
+	}
+	case PROTOBUF_C_TYPE_MESSAGE:
+		return NULL;
+	default:
+		break;
+	}
+
+	rv = pool_alloc(pool, sizeof_field_type(field->type));
+	if (rv == NULL)
+		return NULL;
+	switch (field->type) {
+	case PROTOBUF_C_TYPE_INT32:
+	case PROTOBUF_C_TYPE_SINT32:
+	case PROTOBUF_C_TYPE_SFIXED32:
+		*(int32_t *) rv = (int32_t) strtol(str, NULL, 10);
+		break;
+	case PROTOBUF_C_TYPE_UINT32:
+	case PROTOBUF_C_TYPE_FIXED32:
+		*(uint32_t *) rv = (uint32_t) strtoul(str, NULL, 10);
+		break;
+	case PROTOBUF_C_TYPE_INT64:
+	case PROTOBUF_C_TYPE_SINT64:
+	case PROTOBUF_C_TYPE_SFIXED64:
+		*(int64_t *) rv = (int64_t) strtoll(str, NULL, 10);
+		break;
+	case PROTOBUF_C_TYPE_UINT64:
+	case PROTOBUF_C_TYPE_FIXED64:
+		*(uint64_t *) rv = (uint64_t) strtoull(str, NULL, 10);
+		break;
+	case PROTOBUF_C_TYPE_FLOAT:
+		*(float *) rv = (float) strtod(str, NULL);
+		break;
+	case PROTOBUF_C_TYPE_DOUBLE:
+		*(double *) rv = strtod(str, NULL);
+		break;
+	case PROTOBUF_C_TYPE_BOOL:
+		*(protobuf_c_boolean *) rv = strcmp(str, "true") == 0;
+		break;
+	default:
+		return NULL;
+	}
+	return rv;
+}
+
+static const ProtobufCMessageDescriptor *build_message(ProtobufCDescriptorPool *pool,
+						       PoolEntry *entry);
+
+static protobuf_c_boolean
+resolve_field_type(ProtobufCDescriptorPool *pool,
+		   const FieldInfo *info,
+		   ProtobufCFieldDescriptor *field)
+{
+	PoolEntry *target;
+
+	if (field->type != PROTOBUF_C_TYPE_MESSAGE &&
+	    field->type != PROTOBUF_C_TYPE_ENUM)
+		return TRUE;
+
+	/* protoc always writes fully qualified names into descriptor sets */
+	if (info->type_name.len < 2 || info->type_name.data[0] != '.')
+		return FALSE;
+	target = find_entry(pool, (const char *) info->type_name.data + 1,
+			    info->type_name.len - 1);
+	if (target == NULL)
+		return FALSE;
+	if (field->type == PROTOBUF_C_TYPE_MESSAGE) {
+		if (target->kind != ENTRY_MESSAGE)
+			return FALSE;
+		field->descriptor = build_message(pool, target);
+	} else {
+		if (target->kind != ENTRY_ENUM)
+			return FALSE;
+		field->descriptor = build_enum(pool, target);
+	}
+	return field->descriptor != NULL;
+}
+
+/*
+ * The first value declared by the enum of a resolved field, which protoc-gen-c
+ * initialises proto2 fields to when they have no explicit default.
+ */
+static const int *
+enum_first_value(ProtobufCDescriptorPool *pool, const FieldInfo *info)
+{
+	PoolEntry *target = find_entry(pool,
+				       (const char *) info->type_name.data + 1,
+				       info->type_name.len - 1);
+
+	return target->first_value;
+}
+
+static int
+compare_field_infos_by_number(const void *a, const void *b)
+{
+	const FieldInfo *fa = a;
+	const FieldInfo *fb = b;
+	if (fa->number < fb->number) return -1;
+	if (fa->number > fb->number) return 1;
+	return 0;
+}
+
+static int
+compare_field_names(const void *a, const void *b)
+{
+	const FieldName *na = a;
+	const FieldName *nb = b;
+	return strcmp(na->name, nb->name);
+}
+
+static protobuf_c_boolean
+push_pending(ProtobufCDescriptorPool *pool, PoolEntry *entry)
+{
+	if (pool->n_pending == pool->pending_alloced) {
+		size_t new_alloced = pool->pending_alloced ? pool->pending_alloced * 2 : 16;
+		PoolEntry **pending = do_alloc(pool->allocator,
+					       new_alloced * sizeof(PoolEntry *));
+		if (pending == NULL)
+			return FALSE;
+		if (pool->n_pending != 0)
+			memcpy(pending, pool->pending,
+			       pool->n_pending * sizeof(PoolEntry *));
+		do_free(pool->allocator, pool->pending);
+		pool->pending = pending;
+		pool->pending_alloced = new_alloced;
+	}
+	pool->pending[pool->n_pending++] = entry;
+	return TRUE;
+}
+
+/*
+ * Build the descriptor of an UNBUILT message. The descriptor is registered
+ * before its fields are resolved so recursive types can refer to it.
+ */
+static const ProtobufCMessageDescriptor *
+build_message_definition(ProtobufCDescriptorPool *pool, PoolEntry *entry)
+{
+	ProtobufCMessageDescriptor *desc;
+	ProtobufCFieldDescriptor *fields;
+	FieldInfo *infos;
+	unsigned *sorted_by_name;
+	FieldName *names;
+	unsigned *oneof_offsets;
+	int *numbers;
+	Reader reader;
+	WireField field;
+	unsigned n_fields = 0;
+	unsigned n_oneofs = 0;
+	unsigned n_ranges;
+	size_t offset = sizeof(ProtobufCMessage);
+	size_t max_align = sizeof(void *);
+	unsigned i;
+	int rc;
+
+	desc = pool_alloc(pool, sizeof(ProtobufCMessageDescriptor));
+	if (desc == NULL || !push_pending(pool, entry))
+		return NULL;
+	entry->descriptor = desc;
+	entry->state = ENTRY_BUILDING;
+
+	reader_init(&reader, entry->proto);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		if (field.tag == MESSAGE_FIELD)
+			n_fields++;
+		else if (field.tag == MESSAGE_ONEOF_DECL)
+			n_oneofs++;
+	}
+	if (rc < 0)
+		return NULL;
+
+	infos = pool_alloc(pool, (n_fields + 1) * sizeof(FieldInfo));
+	fields = pool_alloc(pool, (n_fields + 1) * sizeof(ProtobufCFieldDescriptor));
+	sorted_by_name = pool_alloc(pool, (n_fields + 1) * sizeof(unsigned));
+	names = pool_alloc(pool, (n_fields + 1) * sizeof(FieldName));
+	numbers = pool_alloc(pool, (n_fields + 1) * sizeof(int));
+	oneof_offsets = pool_alloc(pool, (n_oneofs + 1) * sizeof(unsigned));
+	if (infos == NULL || fields == NULL || sorted_by_name == NULL ||
+	    names == NULL || numbers == NULL || oneof_offsets == NULL)
+		return NULL;
+
+	n_fields = 0;
+	reader_init(&reader, entry->proto);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		if (field.tag != MESSAGE_FIELD ||
+		    field.wire_type != PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+			continue;
+		if (!parse_field_info(pool, field.bytes, &infos[n_fields]))
+			return NULL;
+		if (infos[n_fields].oneof_index >= (int) n_oneofs)
+			return NULL;
+		n_fields++;
+	}
+	qsort(infos, n_fields, sizeof(FieldInfo), compare_field_infos_by_number);
+
+	for (i = 0; i < n_fields; i++) {
+		const FieldInfo *info = &infos[i];
+		ProtobufCFieldDescriptor *f = &fields[i];
+		size_t size;
+		size_t align;
+		protobuf_c_boolean is_map;
+
+		if (info->type == TYPE_GROUP || !map_field_type(info->type, &f->type))
+			return NULL;
+		if (f->type == PROTOBUF_C_TYPE_STRING && info->string_as_bytes)
+			f->type = PROTOBUF_C_TYPE_BYTES;
+		if (i > 0 && info->number == infos[i - 1].number)
+			return NULL;
+		f->name = info->name;
+		f->id = info->number;
+		numbers[i] = (int) info->number;
+		size = sizeof_field_type(f->type);
+		align = alignof_field_type(f->type);
+
+		switch (info->label) {
+		case LABEL_REQUIRED:
+			f->label = PROTOBUF_C_LABEL_REQUIRED;
+			break;
+		case LABEL_REPEATED:
+			f->label = PROTOBUF_C_LABEL_REPEATED;
+			break;
+		case LABEL_OPTIONAL:
+			f->label = entry->file->proto3 ?
+				PROTOBUF_C_LABEL_NONE : PROTOBUF_C_LABEL_OPTIONAL;
+			break;
+		default:
+			return NULL;
+		}
+
+		is_map = FALSE;
+		if (f->label == PROTOBUF_C_LABEL_REPEATED &&
+		    f->type == PROTOBUF_C_TYPE_MESSAGE &&
+		    info->type_name.len >= 2)
+		{
+			PoolEntry *target =
+				find_entry(pool,
+					   (const char *) info->type_name.data + 1,
+					   info->type_name.len - 1);
+			if (target != NULL && target->map_entry) {
+				f->flags |= PROTOBUF_C_FIELD_FLAG_MAP_ENTRIES;
+				is_map = info->map_index;
+			}
+		}
+
+		/* same member order and presence rules as protoc-gen-c */
+		if (info->oneof_index >= 0) {
+			f->flags |= PROTOBUF_C_FIELD_FLAG_ONEOF;
+			if (oneof_offsets[info->oneof_index] == 0)
+				oneof_offsets[info->oneof_index] =
+					place_member(&offset, sizeof(uint32_t),
+						     sizeof(uint32_t), &max_align);
+			f->quantifier_offset = oneof_offsets[info->oneof_index];
+		} else if (f->label == PROTOBUF_C_LABEL_REPEATED) {
+			f->quantifier_offset = place_member(&offset, sizeof(size_t),
+							    sizeof(size_t), &max_align);
+			size = sizeof(void *);
+			align = alignof_field_type(PROTOBUF_C_TYPE_MESSAGE);
+		} else if (f->label == PROTOBUF_C_LABEL_OPTIONAL &&
+			   f->type != PROTOBUF_C_TYPE_STRING &&
+			   f->type != PROTOBUF_C_TYPE_MESSAGE) {
+			f->quantifier_offset =
+				place_member(&offset, sizeof(protobuf_c_boolean),
+					     sizeof(protobuf_c_boolean), &max_align);
+		}
+		f->offset = place_member(&offset, size, align, &max_align);
+		if (is_map) {
+			/* the ProtobufCMapIndex pointer follows the entries */
+			f->flags |= PROTOBUF_C_FIELD_FLAG_MAP;
+			place_member(&offset, sizeof(void *), sizeof(void *),
+				     &max_align);
+		} else if (info->layout != 0) {
+			/* structure-of-arrays layouts are not supported here */
+			if (info->layout != REPEATED_LAYOUT_CONTIGUOUS ||
+			    f->label != PROTOBUF_C_LABEL_REPEATED ||
+			    f->type != PROTOBUF_C_TYPE_MESSAGE)
+				return NULL;
+			f->flags |= PROTOBUF_C_FIELD_FLAG_CONTIGUOUS;
+		}
+
+		if (f->label == PROTOBUF_C_LABEL_REPEATED &&
+		    f->type != PROTOBUF_C_TYPE_STRING &&
+		    f->type != PROTOBUF_C_TYPE_BYTES &&
+		    f->type != PROTOBUF_C_TYPE_MESSAGE &&
+		    (info->has_packed ? info->packed : entry->file->proto3))
+			f->flags |= PROTOBUF_C_FIELD_FLAG_PACKED;
+		if (info->deprecated)
+			f->flags |= PROTOBUF_C_FIELD_FLAG_DEPRECATED;
+		if (f->type == PROTOBUF_C_TYPE_ENUM) {
+			unsigned enum_check = info->has_enum_check ?
+				info->enum_check : entry->file->enum_check;
+			if (enum_check == ENUM_CHECK_REJECT)
+				f->flags |= PROTOBUF_C_FIELD_FLAG_ENUM_REJECT;
+			else if (enum_check == ENUM_CHECK_UNKNOWN)
+				f->flags |= PROTOBUF_C_FIELD_FLAG_ENUM_UNKNOWN;
+		}
+		f->encoded_tag = encoded_field_tag(f);
+
+		if (!resolve_field_type(pool, info, f))
+			return NULL;
+
+		if (info->has_default_value && f->label != PROTOBUF_C_LABEL_REPEATED) {
+			f->default_value = build_default_value(pool, info, f);
+			if (f->default_value == NULL)
+				return NULL;
+		} else if (entry->file->proto3 && f->type == PROTOBUF_C_TYPE_STRING &&
+			   f->label != PROTOBUF_C_LABEL_REPEATED) {
+			f->default_value = &protobuf_c_empty_string;
+		} else if (!entry->file->proto3 && f->type == PROTOBUF_C_TYPE_ENUM &&
+			   f->label == PROTOBUF_C_LABEL_OPTIONAL &&
+			   !(f->flags & PROTOBUF_C_FIELD_FLAG_ONEOF)) {
+			/* not required ones: a default lets those be omitted */
+			f->default_value = enum_first_value(pool, info);
+		}
+	}
+
+	for (i = 0; i < n_fields; i++) {
+		names[i].name = fields[i].name;
+		names[i].index = i;
+	}
+	qsort(names, n_fields, sizeof(FieldName), compare_field_names);
+	for (i = 0; i < n_fields; i++)
+		sorted_by_name[i] = names[i].index;
+
+	desc->magic = PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC;
+	desc->name = entry->name;
+	desc->short_name = entry->short_name;
+	desc->c_name = NULL;
+	desc->package_name = entry->file->package;
+	desc->sizeof_message = (offset + max_align - 1) & ~(max_align - 1);
+	desc->n_fields = n_fields;
+	desc->fields = fields;
+	desc->fields_sorted_by_name = sorted_by_name;
+	desc->field_ranges = build_ranges(pool, n_fields, numbers, &n_ranges);
+	desc->n_field_ranges = n_ranges;
+	desc->message_init = NULL;
+	if (desc->field_ranges == NULL)
+		return NULL;
+	return desc;
+}
+
+/*
+ * Build a message descriptor, or return the one being built. It only becomes
+ * BUILT once the whole lookup that started it has succeeded.
+ */
+static const ProtobufCMessageDescriptor *
+build_message(ProtobufCDescriptorPool *pool, PoolEntry *entry)
+{
+	const ProtobufCMessageDescriptor *rv;
+
+	switch (entry->state) {
+	case ENTRY_BUILDING:
+	case ENTRY_BUILT:
+		return entry->descriptor;
+	case ENTRY_FAILED:
+		return NULL;
+	case ENTRY_UNBUILT:
+		break;
+	}
+
+	rv = build_message_definition(pool, entry);
+	if (rv == NULL && pool->failed == NULL)
+		pool->failed = entry;
+	return rv;
+}
+
+/**@}*/
+
+ProtobufCDescriptorPool *
+protobuf_c_descriptor_pool_new(ProtobufCAllocator *allocator,
+			       size_t len, const uint8_t *data)
+{
+	ProtobufCDescriptorPool *pool;
+	Slice set;
+	Reader reader;
+	WireField field;
+	int rc;
+
+	if (allocator == NULL)
+		allocator = &dynamic__allocator;
+
+	pool = do_alloc(allocator, sizeof(ProtobufCDescriptorPool));
+	if (pool == NULL)
+		return NULL;
+	memset(pool, 0, sizeof(ProtobufCDescriptorPool));
+	pool->allocator = allocator;
+
+	pool->data = do_alloc(allocator, len ? len : 1);
+	if (pool->data == NULL)
+		goto error;
+	if (len != 0)
+		memcpy(pool->data, data, len);
+	set.data = pool->data;
+	set.len = len;
+
+	reader_init(&reader, set);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		if (field.tag == FILE_SET_FILE &&
+		    field.wire_type == PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED &&
+		    !index_file(pool, field.bytes))
+			goto error;
+	}
+	if (rc < 0)
+		goto error;
+
+	if (pool->n_entries != 0)
+		qsort(pool->entries, pool->n_entries, sizeof(PoolEntry),
+		      compare_entries_by_name);
+	return pool;
+
+error:
+	protobuf_c_descriptor_pool_free(pool);
+	return NULL;
+}
+
+const ProtobufCMessageDescriptor *
+protobuf_c_descriptor_pool_find_message(ProtobufCDescriptorPool *pool,
+					const char *name)
+{
+	PoolEntry *entry = find_entry(pool, name, strlen(name));
+	const ProtobufCMessageDescriptor *rv;
+	size_t i;
+
+	if (entry == NULL || entry->kind != ENTRY_MESSAGE)
+		return NULL;
+	pool->n_pending = 0;
+	pool->failed = NULL;
+	rv = build_message(pool, entry);
+
+	/*
+	 * On failure, only the type that could not be built is given up on;
+	 * the others it pulled in may still build when looked up themselves.
+	 */
+	for (i = 0; i < pool->n_pending; i++) {
+		PoolEntry *pending = pool->pending[i];
+
+		if (rv != NULL)
+			pending->state = ENTRY_BUILT;
+		else if (pending == pool->failed)
+			pending->state = ENTRY_FAILED;
+		else
+			pending->state = ENTRY_UNBUILT;
+	}
+	pool->n_pending = 0;
+	return rv;
+}
+
+const ProtobufCEnumDescriptor *
+protobuf_c_descriptor_pool_find_enum(ProtobufCDescriptorPool *pool,
+				     const char *name)
+{
+	PoolEntry *entry = find_entry(pool, name, strlen(name));
+
+	if (entry == NULL || entry->kind != ENTRY_ENUM)
+		return NULL;
+	return build_enum(pool, entry);
+}
+
+void
+protobuf_c_descriptor_pool_free(ProtobufCDescriptorPool *pool)
+{
+	ProtobufCAllocator *allocator;
+	ArenaChunk *chunk;
+
+	if (pool == NULL)
+		return;
+	allocator = pool->allocator;
+	chunk = pool->chunks;
+	while (chunk != NULL) {
+		ArenaChunk *next = chunk->next;
+		do_free(allocator, chunk);
+		chunk = next;
+	}
+	do_free(allocator, pool->entries);
+	do_free(allocator, pool->pending);
+	do_free(allocator, pool->data);
+	do_free(allocator, pool);
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2026, the protobuf-c authors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file
+ * Descriptors built at runtime from a serialised
+ * `google.protobuf.FileDescriptorSet`, as written by
+ * `protoc --descriptor_set_out --include_imports`.
+ *
+ * The returned `ProtobufCMessageDescriptor`s work with every `protobuf_c_`
+ * message function. Since there is no generated C structure behind them,
+ * messages use a generic layout: a `ProtobufCMessage` followed by one member
+ * per field in field number order, laid out the way `protoc-gen-c` would lay
+ * out the corresponding struct members (`has_` flags, `n_` counts and oneof
+ * `_case` members included), with `sizeof_message` and every offset computed
+ * for the host ABI. Use protobuf_c_message_descriptor_get_field_by_name() and
+ * the field `offset` to reach individual members.
+ *
+ * Descriptors are built lazily the first time they are looked up, so loading
+ * a set only indexes the type names it contains. Dynamic descriptors carry no
+ * C identifiers (`c_name` is NULL) and have no `message_init` function;
+ * protobuf_c_message_init() handles that case. Fields using
+ * `REPEATED_LAYOUT_SOA` are not supported, so their messages cannot be built.
+ */
+
+#ifndef PROTOBUF_C_DYNAMIC_H
+#define PROTOBUF_C_DYNAMIC_H
+
+#include <protobuf-c/protobuf-c.h>
+
+PROTOBUF_C__BEGIN_DECLS
+
+/** Opaque set of descriptors loaded from a `FileDescriptorSet`. */
+typedef struct ProtobufCDescriptorPool ProtobufCDescriptorPool;
+
+/**
+ * Index a serialised `google.protobuf.FileDescriptorSet`.
+ *
+ * The data is copied, so the caller may release it once this returns. All
+ * types referenced by the set must be defined in it, i.e. it should be
+ * produced with `--include_imports`.
+ *
+ * \param allocator
+ *      `ProtobufCAllocator` used for the pool and its descriptors. May be
+ *      NULL to specify the default allocator.
+ * \param len
+ *      Length in bytes of the serialised set.
+ * \param data
+ *      Pointer to the serialised set.
+ * \return
+ *      A new descriptor pool.
+ * \retval NULL
+ *      If the set could not be parsed or memory could not be allocated.
+ */
+PROTOBUF_C__API
+ProtobufCDescriptorPool *
+protobuf_c_descriptor_pool_new(
+	ProtobufCAllocator *allocator,
+	size_t len,
+	const uint8_t *data);
+
+/**
+ * Look up a message type, building its descriptor (and those of every type
+ * it refers to) on first use.
+ *
+ * Building mutates the pool, so concurrent lookups must be serialised by the
+ * caller. Descriptors, once returned, are immutable.
+ *
+ * \param pool
+ *      The descriptor pool.
+ * \param name
+ *      Fully qualified message name, e.g. "foo.bar.BazBah".
+ * \return
+ *      A `ProtobufCMessageDescriptor` owned by the pool.
+ * \retval NULL
+ *      If not found, if the type uses groups, or if the definition could not
+ *      be built.
+ */
+PROTOBUF_C__API
+const ProtobufCMessageDescriptor *
+protobuf_c_descriptor_pool_find_message(
+	ProtobufCDescriptorPool *pool,
+	const char *name);
+
+/**
+ * Look up an enum type, building its descriptor on first use.
+ *
+ * \param pool
+ *      The descriptor pool.
+ * \param name
+ *      Fully qualified enum name.
+ * \return
+ *      A `ProtobufCEnumDescriptor` owned by the pool.
+ * \retval NULL
+ *      If not found or if the definition could not be built.
+ */
+PROTOBUF_C__API
+const ProtobufCEnumDescriptor *
+protobuf_c_descriptor_pool_find_enum(
+	ProtobufCDescriptorPool *pool,
+	const char *name);
+
+/**
+ * Free a descriptor pool and every descriptor built from it.
+ *
+ * Messages using those descriptors must be freed first.
+ *
+ * \param pool
+ *      The descriptor pool to free. May be NULL.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_descriptor_pool_free(ProtobufCDescriptorPool *pool);
+
+PROTOBUF_C__END_DECLS
+
+#endif /* PROTOBUF_C_DYNAMIC_H */
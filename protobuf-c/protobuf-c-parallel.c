@@ -0,0 +1,458 @@
+/*
+ * Copyright (c) 2026, the protobuf-c authors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file
+ * Multi-threaded encoding and decoding.
+ *
+ * Work is a range of item indices. It is split evenly over per-worker
+ * queues up front; a worker takes `grain` items at a time from the front of
+ * its own queue and, once that is empty, steals the back half of another
+ * worker's queue. No work is added after the start, so a worker that finds
+ * every queue empty is done.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>	/* for uint8_t */
+#include <stdlib.h>	/* for malloc, free */
+#include <unistd.h>	/* for sysconf */
+
+#include "protobuf-c-parallel.h"
+#include "protobuf-c-private.h"
+
+#define TRUE				1
+#define FALSE				0
+
+#define CACHE_LINE			64
+
+/* Messages per unit of work in protobuf_c_message_unpack_batch(). */
+#define UNPACK_BATCH_GRAIN		16
+
+/* Elements per unit of work in protobuf_c_message_unpack_parallel(). */
+#define UNPACK_ELEMENTS_GRAIN		64
+
+/* Elements per unit of work in protobuf_c_message_pack_parallel(). */
+#define PACK_ELEMENTS_GRAIN		64
+
+#define DEFAULT_MIN_ELEMENTS		1024
+
+typedef void (*WorkFunc)(void *ctx, unsigned worker, size_t index);
+
+typedef struct {
+	pthread_mutex_t lock;
+	size_t begin;
+	size_t end;
+	uint8_t pad[CACHE_LINE];	/* keep queues off each other's lines */
+} WorkQueue;
+
+typedef struct {
+	WorkQueue *queues;
+	unsigned n_workers;
+	size_t grain;
+	WorkFunc func;
+	void *ctx;
+} Scheduler;
+
+typedef struct {
+	Scheduler *scheduler;
+	unsigned worker;
+} WorkerArg;
+
+static unsigned
+default_worker_count(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (unsigned) n : 1;
+}
+
+static protobuf_c_boolean
+take_local(Scheduler *s, unsigned worker, size_t *begin, size_t *end)
+{
+	WorkQueue *q = &s->queues[worker];
+	protobuf_c_boolean found = FALSE;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->begin != q->end) {
+		size_t n = q->end - q->begin;
+
+		*begin = q->begin;
+		*end = q->begin + (n < s->grain ? n : s->grain);
+		q->begin = *end;
+		found = TRUE;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return found;
+}
+
+/* Move the back half of some other worker's queue into our own. */
+static protobuf_c_boolean
+steal(Scheduler *s, unsigned thief)
+{
+	unsigned i;
+
+	for (i = 1; i < s->n_workers; i++) {
+		WorkQueue *victim = &s->queues[(thief + i) % s->n_workers];
+		size_t begin = 0, end = 0;
+
+		pthread_mutex_lock(&victim->lock);
+		if (victim->begin != victim->end) {
+			size_t n = victim->end - victim->begin;
+
+			end = victim->end;
+			begin = end - (n + 1) / 2;
+			victim->end = begin;
+		}
+		pthread_mutex_unlock(&victim->lock);
+
+		if (begin != end) {
+			WorkQueue *q = &s->queues[thief];
+
+			pthread_mutex_lock(&q->lock);
+			q->begin = begin;
+			q->end = end;
+			pthread_mutex_unlock(&q->lock);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static void
+run_worker(Scheduler *s, unsigned worker)
+{
+	size_t begin, end, i;
+
+	do {
+		while (take_local(s, worker, &begin, &end))
+			for (i = begin; i < end; i++)
+				s->func(s->ctx, worker, i);
+	} while (steal(s, worker));
+}
+
+static void *
+worker_main(void *arg)
+{
+	WorkerArg *w = arg;
+
+	run_worker(w->scheduler, w->worker);
+	return NULL;
+}
+
+/*
+ * Call `func` for every index in [0, n_items) on up to `n_workers` threads,
+ * the calling thread being worker 0. Workers that cannot be started leave
+ * their share to be stolen by the others.
+ */
+static protobuf_c_boolean
+run_parallel(size_t n_items, size_t grain, unsigned n_workers,
+	     WorkFunc func, void *ctx)
+{
+	Scheduler s;
+	pthread_t *threads;
+	WorkerArg *args;
+	unsigned n_started = 0;
+	unsigned i;
+
+	if (n_workers <= 1) {
+		size_t j;
+
+		for (j = 0; j < n_items; j++)
+			func(ctx, 0, j);
+		return TRUE;
+	}
+
+	s.queues = malloc(n_workers * sizeof(WorkQueue));
+	threads = malloc(n_workers * sizeof(pthread_t));
+	args = malloc(n_workers * sizeof(WorkerArg));
+	if (s.queues == NULL || threads == NULL || args == NULL) {
+		free(s.queues);
+		free(threads);
+		free(args);
+		return FALSE;
+	}
+	s.n_workers = n_workers;
+	s.grain = grain;
+	s.func = func;
+	s.ctx = ctx;
+	for (i = 0; i < n_workers; i++) {
+		pthread_mutex_init(&s.queues[i].lock, NULL);
+		s.queues[i].begin = n_items * i / n_workers;
+		s.queues[i].end = n_items * (i + 1) / n_workers;
+	}
+
+	for (i = 1; i < n_workers; i++) {
+		args[n_started].scheduler = &s;
+		args[n_started].worker = i;
+		if (pthread_create(&threads[n_started], NULL, worker_main,
+				   &args[n_started]) == 0)
+			n_started++;
+	}
+	run_worker(&s, 0);
+	for (i = 0; i < n_started; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < n_workers; i++)
+		pthread_mutex_destroy(&s.queues[i].lock);
+	free(s.queues);
+	free(threads);
+	free(args);
+	return TRUE;
+}
+
+/*
+ * Number of workers worth starting for `n_items` items handed out `grain`
+ * at a time, given a limit of `max_workers` (0 for one per online CPU).
+ */
+static unsigned
+worker_count(unsigned max_workers, size_t n_items, size_t grain)
+{
+	unsigned n_workers = max_workers;
+	size_t n_grains = n_items / grain + (n_items % grain != 0);
+
+	if (n_workers == 0)
+		n_workers = default_worker_count();
+	if (n_grains < n_workers)
+		n_workers = n_grains ? (unsigned) n_grains : 1;
+	return n_workers;
+}
+
+static unsigned
+factory_max_workers(const ProtobufCAllocatorFactory *factory)
+{
+	return factory != NULL ? factory->max_workers : 0;
+}
+
+/*
+ * Fetch the allocator of every worker. The array is owned by the caller and
+ * freed with free().
+ */
+static ProtobufCAllocator **
+get_allocators(const ProtobufCAllocatorFactory *factory, unsigned n_workers)
+{
+	ProtobufCAllocator **allocators;
+	unsigned i;
+
+	allocators = malloc(n_workers * sizeof(ProtobufCAllocator *));
+	if (allocators == NULL)
+		return NULL;
+	for (i = 0; i < n_workers; i++) {
+		if (factory != NULL && factory->get_allocator != NULL)
+			allocators[i] = factory->get_allocator(
+				factory->factory_data, i);
+		else
+			allocators[i] = NULL;
+	}
+	return allocators;
+}
+
+/* --- batch unpacking --- */
+
+typedef struct {
+	const ProtobufCMessageDescriptor *descriptor;
+	ProtobufCAllocator **allocators;
+	const size_t *lens;
+	const uint8_t *const *datas;
+	ProtobufCMessage **out;
+} UnpackBatch;
+
+static void
+unpack_batch_item(void *ctx, unsigned worker, size_t index)
+{
+	UnpackBatch *batch = ctx;
+
+	batch->out[index] = protobuf_c_message_unpack(batch->descriptor,
+						      batch->allocators[worker],
+						      batch->lens[index],
+						      batch->datas[index]);
+}
+
+size_t
+protobuf_c_message_unpack_batch(const ProtobufCMessageDescriptor *descriptor,
+				const ProtobufCAllocatorFactory *allocator_factory,
+				size_t n,
+				const size_t *lens,
+				const uint8_t *const *datas,
+				ProtobufCMessage **out)
+{
+	UnpackBatch batch;
+	unsigned n_workers;
+	size_t n_unpacked = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		out[i] = NULL;
+	if (n == 0)
+		return 0;
+
+	n_workers = worker_count(factory_max_workers(allocator_factory),
+				 n, UNPACK_BATCH_GRAIN);
+	batch.descriptor = descriptor;
+	batch.allocators = get_allocators(allocator_factory, n_workers);
+	batch.lens = lens;
+	batch.datas = datas;
+	batch.out = out;
+	if (batch.allocators == NULL)
+		return 0;
+	if (!run_parallel(n, UNPACK_BATCH_GRAIN, n_workers,
+			  unpack_batch_item, &batch)) {
+		/* out of memory for the workers: decode on this thread */
+		for (i = 0; i < n; i++)
+			unpack_batch_item(&batch, 0, i);
+	}
+	free(batch.allocators);
+
+	for (i = 0; i < n; i++)
+		if (out[i] != NULL)
+			n_unpacked++;
+	return n_unpacked;
+}
+
+/* --- parallel unpacking of large repeated fields --- */
+
+typedef struct {
+	ProtobufCUnpackDefer defer;
+	ProtobufCAllocator **allocators;
+	unsigned n_workers;
+	ProtobufCDeferredMessage *messages;
+	unsigned *owners;	/* worker that unpacked each element */
+	int failed;
+} UnpackElements;
+
+static void
+unpack_element(void *ctx, unsigned worker, size_t index)
+{
+	UnpackElements *u = ctx;
+	ProtobufCDeferredMessage *m = &u->messages[index];
+	ProtobufCUnpackOptions options = PROTOBUF_C_UNPACK_OPTIONS_INIT;
+
+	options.max_depth = u->defer.max_depth;
+	*m->slot = protobuf_c_message_unpack_with_options(m->descriptor,
+							  u->allocators[worker],
+							  &options,
+							  m->len, m->data);
+	u->owners[index] = worker;
+	if (*m->slot == NULL)
+		__atomic_store_n(&u->failed, TRUE, __ATOMIC_RELAXED);
+}
+
+static protobuf_c_boolean
+unpack_elements(void *defer_data, size_t n, ProtobufCDeferredMessage *messages)
+{
+	UnpackElements *u = defer_data;
+	unsigned n_workers = worker_count(u->n_workers, n,
+					  UNPACK_ELEMENTS_GRAIN);
+	size_t i;
+
+	u->messages = messages;
+	u->owners = malloc(n * sizeof(unsigned));
+	if (u->owners == NULL)
+		return FALSE;
+	u->failed = FALSE;
+	if (!run_parallel(n, UNPACK_ELEMENTS_GRAIN, n_workers,
+			  unpack_element, u)) {
+		for (i = 0; i < n; i++)
+			unpack_element(u, 0, i);
+	}
+
+	if (u->failed) {
+		for (i = 0; i < n; i++) {
+			protobuf_c_message_free_unpacked(*messages[i].slot,
+				u->allocators[u->owners[i]]);
+			*messages[i].slot = NULL;
+		}
+	}
+	free(u->owners);
+	return !u->failed;
+}
+
+ProtobufCMessage *
+protobuf_c_message_unpack_parallel(const ProtobufCMessageDescriptor *descriptor,
+				   const ProtobufCAllocatorFactory *allocator_factory,
+				   size_t min_elements,
+				   size_t len,
+				   const uint8_t *data)
+{
+	UnpackElements u;
+	ProtobufCMessage *rv;
+
+	u.n_workers = worker_count(factory_max_workers(allocator_factory),
+				   (size_t) -1, 1);
+	u.allocators = get_allocators(allocator_factory, u.n_workers);
+	if (u.allocators == NULL)
+		return NULL;
+	u.defer.min_elements = min_elements ? min_elements : DEFAULT_MIN_ELEMENTS;
+	u.defer.unpack = unpack_elements;
+	u.defer.defer_data = &u;
+	rv = protobuf_c_message_unpack_deferred(descriptor, u.allocators[0],
+						len, data, &u.defer);
+	free(u.allocators);
+	return rv;
+}
+
+/* --- parallel packing --- */
+
+static void
+pack_element(void *ctx, unsigned worker, size_t index)
+{
+	const ProtobufCDeferredPack *m = (ProtobufCDeferredPack *) ctx + index;
+	size_t len = protobuf_c_message_pack(m->message, m->out);
+
+	(void) worker;
+	assert(len == m->len);
+	(void) len;
+}
+
+static void
+pack_elements(void *defer_data, size_t n, ProtobufCDeferredPack *messages)
+{
+	unsigned n_workers = worker_count(*(const unsigned *) defer_data, n,
+					  PACK_ELEMENTS_GRAIN);
+	size_t i;
+
+	if (!run_parallel(n, PACK_ELEMENTS_GRAIN, n_workers, pack_element,
+			  messages)) {
+		for (i = 0; i < n; i++)
+			pack_element(messages, 0, i);
+	}
+}
+
+size_t
+protobuf_c_message_pack_parallel(const ProtobufCMessage *message,
+				 unsigned max_workers,
+				 size_t min_elements,
+				 uint8_t *out)
+{
+	ProtobufCPackDefer defer;
+
+	defer.min_elements = min_elements ? min_elements : DEFAULT_MIN_ELEMENTS;
+	defer.pack = pack_elements;
+	defer.defer_data = &max_workers;
+	return protobuf_c_message_pack_deferred(message, out, &defer);
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2026, the protobuf-c authors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file
+ * Multi-threaded encoding and decoding.
+ *
+ * The functions here split their work over a set of worker threads that
+ * balance load by stealing ranges of work from each other. The calling thread
+ * takes part as worker 0, and the other workers only live for the duration
+ * of the call.
+ *
+ * Each worker allocates from its own `ProtobufCAllocator`, obtained from a
+ * `ProtobufCAllocatorFactory`. Memory of the resulting messages therefore
+ * comes from several allocators; either hand out allocators that can free
+ * each other's blocks, such as the same protobuf_c_pool_allocator_new()
+ * allocator for every worker (whose per-thread caches then act as per-worker
+ * arenas), or release the arenas as a whole once the messages are no longer
+ * needed.
+ *
+ * Only available when libprotobuf-c is built with thread support.
+ */
+
+#ifndef PROTOBUF_C_PARALLEL_H
+#define PROTOBUF_C_PARALLEL_H
+
+#include <protobuf-c/protobuf-c.h>
+
+PROTOBUF_C__BEGIN_DECLS
+
+/**
+ * Source of the allocators used by worker threads.
+ */
+typedef struct ProtobufCAllocatorFactory {
+	/**
+	 * Return the allocator for worker `worker`, or NULL for the system
+	 * allocator. Called on the calling thread, once per worker and call,
+	 * before any worker starts.
+	 */
+	ProtobufCAllocator *(*get_allocator)(void *factory_data,
+					     unsigned worker);
+
+	/** Opaque pointer passed to `get_allocator`. */
+	void *factory_data;
+
+	/** Maximum number of workers, or 0 for one per online CPU. */
+	unsigned max_workers;
+} ProtobufCAllocatorFactory;
+
+/**
+ * Unpack a batch of independent serialised messages concurrently.
+ *
+ * `out[i]` receives the message unpacked from the `lens[i]` bytes at
+ * `datas[i]`, so the output order matches the input order however the work
+ * was scheduled. Messages that fail to unpack are left NULL in `out`.
+ *
+ * \param descriptor
+ *      The message descriptor of every message in the batch.
+ * \param allocator_factory
+ *      Source of the per-worker allocators. NULL uses the system allocator
+ *      and one worker per online CPU.
+ * \param n
+ *      Number of messages in the batch.
+ * \param lens
+ *      Length in bytes of each serialised message.
+ * \param datas
+ *      Pointer to each serialised message.
+ * \param[out] out
+ *      Array of `n` pointers receiving the unpacked messages.
+ * \return
+ *      Number of messages successfully unpacked.
+ */
+PROTOBUF_C__API
+size_t
+protobuf_c_message_unpack_batch(const ProtobufCMessageDescriptor *descriptor,
+				const ProtobufCAllocatorFactory *allocator_factory,
+				size_t n,
+				const size_t *lens,
+				const uint8_t *const *datas,
+				ProtobufCMessage **out);
+
+/**
+ * Unpack a single large message, decoding the elements of its big repeated
+ * message fields concurrently.
+ *
+ * The message is scanned and its other members unpacked on the calling
+ * thread as by protobuf_c_message_unpack(). Repeated message fields of the
+ * top-level message with at least `min_elements` elements are then split
+ * over the workers. Nested messages are not split further, and fields with
+ * the `map`, contiguous or structure-of-arrays layouts are always unpacked
+ * on the calling thread.
+ *
+ * The top-level message, and everything not split, is allocated from
+ * worker 0's allocator.
+ *
+ * \param descriptor
+ *      The message descriptor.
+ * \param allocator_factory
+ *      Source of the per-worker allocators. NULL uses the system allocator
+ *      and one worker per online CPU.
+ * \param min_elements
+ *      Smallest number of elements for a field to be split, or 0 for the
+ *      default of 1024.
+ * \param len
+ *      Length in bytes of the serialised message.
+ * \param data
+ *      Pointer to the serialised message.
+ * \return
+ *      An unpacked message object.
+ * \retval NULL
+ *      If an error occurred during unpacking.
+ */
+PROTOBUF_C__API
+ProtobufCMessage *
+protobuf_c_message_unpack_parallel(const ProtobufCMessageDescriptor *descriptor,
+				   const ProtobufCAllocatorFactory *allocator_factory,
+				   size_t min_elements,
+				   size_t len,
+				   const uint8_t *data);
+
+/**
+ * Serialise a large message, packing the elements of its big repeated
+ * message fields concurrently.
+ *
+ * The sizes of the elements of every repeated message field of the top-level
+ * message with at least `min_elements` elements are computed once on the
+ * calling thread, which also writes everything else and the tag and length
+ * prefix of each element. The elements themselves are then packed by the
+ * workers into their preassigned ranges of `out`. The output is identical to
+ * that of protobuf_c_message_pack().
+ *
+ * \param message
+ *      The message object to serialise.
+ * \param max_workers
+ *      Maximum number of workers, or 0 for one per online CPU.
+ * \param min_elements
+ *      Smallest number of elements for a field to be split, or 0 for the
+ *      default of 1024.
+ * \param[out] out
+ *      Packed message, of at least protobuf_c_message_get_packed_size()
+ *      bytes.
+ * \return
+ *      Number of bytes stored in `out`.
+ */
+PROTOBUF_C__API
+size_t
+protobuf_c_message_pack_parallel(const ProtobufCMessage *message,
+				 unsigned max_workers,
+				 size_t min_elements,
+				 uint8_t *out);
+
+PROTOBUF_C__END_DECLS
+
+#endif /* PROTOBUF_C_PARALLEL_H */
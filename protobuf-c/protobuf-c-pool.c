@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2026, the protobuf-c authors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file
+ * Size-class pool allocator with per-thread caches.
+ *
+ * Every block is preceded by a header naming its size class and the cache
+ * that carved it. A cache only touches its own free lists; frees from other
+ * threads are pushed onto the owning cache's `remote` list with a CAS and
+ * taken back in one exchange when the owner runs out of blocks, so the list
+ * only ever has one consumer and needs no ABA protection.
+ */
+
+#include <pthread.h>
+#include <stdint.h>	/* for uint8_t, uint16_t */
+#include <stdlib.h>	/* for malloc, calloc, free */
+
+#include "protobuf-c-pool.h"
+
+#define TRUE				1
+#define FALSE				0
+
+#define N_SIZE_CLASSES			16
+#define MAX_SMALL_SIZE			4096
+#define LARGE_CLASS			N_SIZE_CLASSES
+#define CHUNK_SIZE			(64 * 1024)
+#define CACHE_LINE			64
+
+/* Spaced so that the waste per block stays under a third. */
+static const uint16_t size_classes[N_SIZE_CLASSES] = {
+	16, 32, 48, 64, 96, 128, 192, 256,
+	384, 512, 768, 1024, 1536, 2048, 3072, 4096
+};
+
+typedef struct ThreadCache ThreadCache;
+typedef struct Pool Pool;
+
+/* Precedes every block; padded to keep blocks 16-byte aligned. */
+typedef union {
+	struct {
+		ThreadCache *owner;	/* NULL for large blocks */
+		unsigned size_class;
+	} h;
+	uint8_t pad[16];
+} BlockHeader;
+
+/* A free block; the link overlays the caller's data. */
+typedef struct FreeBlock {
+	struct FreeBlock *next;
+} FreeBlock;
+
+/* Start of a chunk that blocks are carved from. */
+typedef union Chunk {
+	union Chunk *next;
+	uint8_t pad[16];
+} Chunk;
+
+struct ThreadCache {
+	FreeBlock *free_lists[N_SIZE_CLASSES];
+	uint8_t *bump;
+	uint8_t *bump_end;
+	Chunk *chunks;
+	Pool *pool;
+	ThreadCache *next;		/* all caches of the pool */
+	ThreadCache *next_orphan;	/* caches of exited threads */
+
+	/* written by other threads, so kept off the lines above */
+	uint8_t pad1[CACHE_LINE];
+	FreeBlock *remote;
+	uint8_t pad2[CACHE_LINE];
+};
+
+struct Pool {
+	ProtobufCAllocator base;	/* must be first */
+	pthread_key_t key;
+	pthread_mutex_t lock;
+	ThreadCache *caches;
+	ThreadCache *orphans;
+	uint8_t class_of[MAX_SMALL_SIZE / 16 + 1];
+};
+
+/* Runs at thread exit: park the cache for the next thread to adopt. */
+static void
+thread_cache_release(void *value)
+{
+	ThreadCache *cache = value;
+	Pool *pool = cache->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	cache->next_orphan = pool->orphans;
+	pool->orphans = cache;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static ThreadCache *
+get_thread_cache(Pool *pool)
+{
+	ThreadCache *cache = pthread_getspecific(pool->key);
+
+	if (cache != NULL)
+		return cache;
+
+	pthread_mutex_lock(&pool->lock);
+	cache = pool->orphans;
+	if (cache != NULL) {
+		pool->orphans = cache->next_orphan;
+	} else {
+		cache = calloc(1, sizeof(ThreadCache));
+		if (cache != NULL) {
+			cache->pool = pool;
+			cache->next = pool->caches;
+			pool->caches = cache;
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (cache != NULL && pthread_setspecific(pool->key, cache) != 0) {
+		thread_cache_release(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+/* Move the blocks other threads have freed onto the local free lists. */
+static void
+drain_remote_frees(ThreadCache *cache)
+{
+	FreeBlock *block = __atomic_exchange_n(&cache->remote, NULL,
+					       __ATOMIC_ACQUIRE);
+
+	while (block != NULL) {
+		FreeBlock *next = block->next;
+		unsigned size_class = ((BlockHeader *) block - 1)->h.size_class;
+
+		block->next = cache->free_lists[size_class];
+		cache->free_lists[size_class] = block;
+		block = next;
+	}
+}
+
+static void *
+carve_block(ThreadCache *cache, unsigned size_class)
+{
+	size_t stride = sizeof(BlockHeader) + size_classes[size_class];
+	BlockHeader *header;
+
+	if ((size_t) (cache->bump_end - cache->bump) < stride) {
+		Chunk *chunk = malloc(CHUNK_SIZE);
+
+		if (chunk == NULL)
+			return NULL;
+		chunk->next = cache->chunks;
+		cache->chunks = chunk;
+		cache->bump = (uint8_t *) (chunk + 1);
+		cache->bump_end = (uint8_t *) chunk + CHUNK_SIZE;
+	}
+	header = (BlockHeader *) cache->bump;
+	cache->bump += stride;
+	header->h.owner = cache;
+	header->h.size_class = size_class;
+	return header + 1;
+}
+
+static void *
+pool_alloc(void *allocator_data, size_t size)
+{
+	Pool *pool = allocator_data;
+	ThreadCache *cache;
+	FreeBlock *block;
+	unsigned size_class;
+
+	if (size > MAX_SMALL_SIZE) {
+		BlockHeader *header = malloc(sizeof(BlockHeader) + size);
+
+		if (header == NULL)
+			return NULL;
+		header->h.owner = NULL;
+		header->h.size_class = LARGE_CLASS;
+		return header + 1;
+	}
+
+	cache = get_thread_cache(pool);
+	if (cache == NULL)
+		return NULL;
+	size_class = pool->class_of[(size + 15) / 16];
+	block = cache->free_lists[size_class];
+	if (block == NULL) {
+		drain_remote_frees(cache);
+		block = cache->free_lists[size_class];
+		if (block == NULL)
+			return carve_block(cache, size_class);
+	}
+	cache->free_lists[size_class] = block->next;
+	return block;
+}
+
+static void
+pool_free(void *allocator_data, void *data)
+{
+	Pool *pool = allocator_data;
+	BlockHeader *header = (BlockHeader *) data - 1;
+	ThreadCache *owner = header->h.owner;
+	FreeBlock *block = data;
+
+	if (owner == NULL) {
+		free(header);
+	} else if (owner == pthread_getspecific(pool->key)) {
+		block->next = owner->free_lists[header->h.size_class];
+		owner->free_lists[header->h.size_class] = block;
+	} else {
+		block->next = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&owner->remote, &block->next,
+						    block, TRUE,
+						    __ATOMIC_RELEASE,
+						    __ATOMIC_RELAXED))
+			;
+	}
+}
+
+ProtobufCAllocator *
+protobuf_c_pool_allocator_new(void)
+{
+	Pool *pool = calloc(1, sizeof(Pool));
+	unsigned size_class = 0;
+	unsigned i;
+
+	if (pool == NULL)
+		return NULL;
+	if (pthread_key_create(&pool->key, thread_cache_release) != 0) {
+		free(pool);
+		return NULL;
+	}
+	if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+		pthread_key_delete(pool->key);
+		free(pool);
+		return NULL;
+	}
+	for (i = 0; i <= MAX_SMALL_SIZE / 16; i++) {
+		while (size_classes[size_class] < i * 16)
+			size_class++;
+		pool->class_of[i] = size_class;
+	}
+	pool->base.alloc = pool_alloc;
+	pool->base.free = pool_free;
+	pool->base.allocator_data = pool;
+	return &pool->base;
+}
+
+void
+protobuf_c_pool_allocator_destroy(ProtobufCAllocator *allocator)
+{
+	Pool *pool;
+	ThreadCache *cache;
+
+	if (allocator == NULL)
+		return;
+	pool = allocator->allocator_data;
+	pthread_key_delete(pool->key);
+	while ((cache = pool->caches) != NULL) {
+		pool->caches = cache->next;
+		while (cache->chunks != NULL) {
+			Chunk *chunk = cache->chunks;
+
+			cache->chunks = chunk->next;
+			free(chunk);
+		}
+		free(cache);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
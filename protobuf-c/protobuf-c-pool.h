@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2026, the protobuf-c authors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file
+ * A size-class pool allocator with per-thread caches, usable wherever a
+ * `ProtobufCAllocator` is accepted.
+ *
+ * Requests of up to 4 KiB, which covers message structures, most strings and
+ * most repeated arrays produced by protobuf_c_message_unpack(), are served
+ * from per-thread free lists without locking. Memory may be freed on a
+ * different thread than the one that allocated it: such frees are pushed onto
+ * a lock-free list of the allocating thread's cache, which reclaims them on
+ * its next miss. Larger requests go straight to malloc().
+ *
+ * Memory held by the caches is reused but only returned to the system by
+ * protobuf_c_pool_allocator_destroy(). The caches of threads that exit are
+ * handed to the next thread that starts using the pool.
+ *
+ * Only available when libprotobuf-c is built with thread support.
+ */
+
+#ifndef PROTOBUF_C_POOL_H
+#define PROTOBUF_C_POOL_H
+
+#include <protobuf-c/protobuf-c.h>
+
+PROTOBUF_C__BEGIN_DECLS
+
+/**
+ * Create a pool allocator.
+ *
+ * \return
+ *      A `ProtobufCAllocator` drawing from a new pool.
+ * \retval NULL
+ *      If memory could not be allocated.
+ */
+PROTOBUF_C__API
+ProtobufCAllocator *
+protobuf_c_pool_allocator_new(void);
+
+/**
+ * Destroy a pool allocator and release all of its memory.
+ *
+ * Everything allocated from the pool must have been freed, or be abandoned,
+ * and no other thread may be using it.
+ *
+ * \param allocator
+ *      An allocator returned by protobuf_c_pool_allocator_new(). May be NULL.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_pool_allocator_destroy(ProtobufCAllocator *allocator);
+
+PROTOBUF_C__END_DECLS
+
+#endif /* PROTOBUF_C_POOL_H */
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2026, the protobuf-c authors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file
+ * Interfaces between the translation units of libprotobuf-c. Not installed.
+ */
+
+#ifndef PROTOBUF_C_PRIVATE_H
+#define PROTOBUF_C_PRIVATE_H
+
+#include "protobuf-c.h"
+
+/** An element of a repeated message field whose unpacking was deferred. */
+typedef struct ProtobufCDeferredMessage {
+	/** Where the unpacked element goes; NULL until then. */
+	ProtobufCMessage **slot;
+	const ProtobufCMessageDescriptor *descriptor;
+	size_t len;
+	const uint8_t *data;
+} ProtobufCDeferredMessage;
+
+/** How protobuf_c_message_unpack_deferred() hands off elements. */
+typedef struct ProtobufCUnpackDefer {
+	/**
+	 * Repeated message fields of the top-level message with at least this
+	 * many elements are deferred.
+	 */
+	size_t min_elements;
+
+	/**
+	 * Unpack the deferred elements into their slots. On failure every slot
+	 * must be left NULL, freeing whatever was unpacked.
+	 */
+	protobuf_c_boolean (*unpack)(void *defer_data, size_t n,
+				     ProtobufCDeferredMessage *messages);
+
+	void *defer_data;
+
+	/**
+	 * Set before `unpack` is called: the nesting depth left for each
+	 * deferred element, that is the unpack depth limit less one for the
+	 * top-level message.
+	 */
+	unsigned max_depth;
+} ProtobufCUnpackDefer;
+
+/**
+ * Like protobuf_c_message_unpack(), except that the elements of large
+ * repeated message fields of the top-level message are collected after the
+ * scan and unpacked by `defer->unpack` once everything else is in place.
+ * Only fields holding an array of message pointers are deferred.
+ */
+ProtobufCMessage *
+protobuf_c_message_unpack_deferred(const ProtobufCMessageDescriptor *descriptor,
+				   ProtobufCAllocator *allocator,
+				   size_t len,
+				   const uint8_t *data,
+				   ProtobufCUnpackDefer *defer);
+
+/** An element of a repeated message field whose packing was deferred. */
+typedef struct ProtobufCDeferredPack {
+	const ProtobufCMessage *message;
+	/** Where the element goes; exactly `len` bytes are reserved. */
+	uint8_t *out;
+	size_t len;
+} ProtobufCDeferredPack;
+
+/** How protobuf_c_message_pack_deferred() hands off elements. */
+typedef struct ProtobufCPackDefer {
+	/**
+	 * Repeated message fields of the top-level message with at least this
+	 * many elements are deferred.
+	 */
+	size_t min_elements;
+
+	/** Pack every deferred element into its reserved range. */
+	void (*pack)(void *defer_data, size_t n,
+		     ProtobufCDeferredPack *messages);
+
+	void *defer_data;
+} ProtobufCPackDefer;
+
+/**
+ * Like protobuf_c_message_pack(), except that the elements of large repeated
+ * message fields of the top-level message are only sized, and packed by
+ * `defer->pack` after everything around them has been written. The output is
+ * identical to protobuf_c_message_pack()'s.
+ */
+size_t
+protobuf_c_message_pack_deferred(const ProtobufCMessage *message,
+				 uint8_t *out,
+				 const ProtobufCPackDefer *defer);
+
+#endif /* PROTOBUF_C_PRIVATE_H */
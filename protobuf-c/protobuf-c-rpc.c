@@ -0,0 +1,1050 @@
+/*
+ * Copyright (c) 2026, the protobuf-c authors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file
+ * Event-loop RPC transport.
+ *
+ * Every file descriptor is watched through a `Watch` registered with epoll.
+ * Closing a watch removes it from epoll at once but only frees it at the end
+ * of protobuf_c_rpc_dispatch_run(), since events for it may still be queued
+ * in the batch being handled.
+ *
+ * Connections buffer their output; appending to an empty buffer puts the
+ * connection on the dispatch's dirty list, which is flushed after the events
+ * have been handled. EPOLLOUT is only requested while a flush leaves data
+ * behind.
+ *
+ * A server connection stops reading requests while more than
+ * OUTPUT_HIGH_WATER bytes of responses wait to be written, and resumes once
+ * they are down to OUTPUT_LOW_WATER, so that a client that never reads its
+ * responses cannot make the server queue them without bound.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stddef.h>	/* for offsetof */
+#include <stdint.h>	/* for uint8_t, uint32_t */
+#include <stdlib.h>	/* for malloc, realloc, free */
+#include <string.h>	/* for memcpy, memmove, strlen, strchr */
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "protobuf-c-rpc.h"
+
+#define TRUE				1
+#define FALSE				0
+
+#define MAX_EVENTS			64
+#define READ_SIZE			(64 * 1024)
+#define FRAME_HEADER_SIZE		12
+
+/* Larger frames are treated as a protocol error. */
+#define MAX_FRAME_LENGTH		(256 * 1024 * 1024)
+
+/* Queued output at which a server connection stops and resumes reading. */
+#define OUTPUT_HIGH_WATER		(1024 * 1024)
+#define OUTPUT_LOW_WATER		(256 * 1024)
+
+typedef struct Watch Watch;
+typedef struct Connection Connection;
+typedef struct ServerConnection ServerConnection;
+typedef struct ServerRequest ServerRequest;
+typedef struct ClientCall ClientCall;
+typedef struct Client Client;
+
+struct Watch {
+	int fd;				/* -1 once closed */
+	uint32_t events;
+	void (*handle)(Watch *watch, uint32_t events);
+	void (*destroy)(Watch *watch);
+	Watch *next_garbage;
+};
+
+struct ProtobufCRpcDispatch {
+	int epoll_fd;
+	Connection *dirty;
+	Watch *garbage;
+};
+
+typedef struct {
+	uint8_t *data;
+	size_t start;
+	size_t end;
+	size_t alloced;
+} Buffer;
+
+struct Connection {
+	Watch watch;			/* must be first */
+	ProtobufCRpcDispatch *dispatch;
+	Buffer in;
+	Buffer out;
+	protobuf_c_boolean is_dirty;
+	Connection *next_dirty;
+	protobuf_c_boolean limit_output;	/* stop reading while output backs up */
+	protobuf_c_boolean is_throttled;	/* not reading for now */
+
+	/* one complete frame; returns FALSE to drop the connection */
+	protobuf_c_boolean (*handle_frame)(Connection *conn,
+					   const uint8_t *header,
+					   size_t len, const uint8_t *data);
+	/* the peer went away or the connection failed */
+	void (*handle_close)(Connection *conn);
+};
+
+struct ProtobufCRpcServer {
+	Watch watch;			/* must be first */
+	ProtobufCRpcDispatch *dispatch;
+	ProtobufCService *service;
+	ServerConnection *connections;
+	char *path;			/* socket file to unlink */
+};
+
+struct ServerConnection {
+	Connection base;		/* must be first */
+	ProtobufCRpcServer *server;
+	ServerConnection *prev;
+	ServerConnection *next;
+	ServerRequest *requests;	/* waiting for their closure */
+};
+
+struct ServerRequest {
+	ServerConnection *conn;		/* NULL once the connection is gone */
+	uint32_t request_id;
+	unsigned method_index;
+	ServerRequest *prev;
+	ServerRequest *next;
+};
+
+struct ClientCall {
+	ProtobufCClosure closure;	/* NULL for a free slot */
+	void *closure_data;
+	unsigned method_index;
+	uint32_t next_free;
+};
+
+struct Client {
+	ProtobufCService base;		/* must be first */
+	Connection conn;
+	protobuf_c_boolean is_closed;
+	protobuf_c_boolean is_destroyed;	/* by the user */
+	protobuf_c_boolean is_collected;	/* by the dispatch */
+	ClientCall *calls;		/* indexed by request id */
+	uint32_t n_calls;
+	uint32_t first_free;
+	size_t n_pending;
+};
+
+#define NO_FREE_CALL			UINT32_MAX
+
+/* --- framing --- */
+
+static inline void
+write_uint32_le(uint8_t *out, uint32_t value)
+{
+	out[0] = (uint8_t) value;
+	out[1] = (uint8_t) (value >> 8);
+	out[2] = (uint8_t) (value >> 16);
+	out[3] = (uint8_t) (value >> 24);
+}
+
+static inline uint32_t
+read_uint32_le(const uint8_t *in)
+{
+	return (uint32_t) in[0] |
+		((uint32_t) in[1] << 8) |
+		((uint32_t) in[2] << 16) |
+		((uint32_t) in[3] << 24);
+}
+
+/* --- buffers --- */
+
+/* Make room for `len` more bytes and return where they go. */
+static uint8_t *
+buffer_reserve(Buffer *buffer, size_t len)
+{
+	if (buffer->alloced - buffer->end < len) {
+		size_t used = buffer->end - buffer->start;
+
+		if (buffer->start != 0) {
+			memmove(buffer->data, buffer->data + buffer->start, used);
+			buffer->start = 0;
+			buffer->end = used;
+		}
+		if (buffer->alloced - used < len) {
+			size_t alloced = buffer->alloced ? buffer->alloced : 4096;
+			uint8_t *data;
+
+			while (alloced - used < len)
+				alloced *= 2;
+			data = realloc(buffer->data, alloced);
+			if (data == NULL)
+				return NULL;
+			buffer->data = data;
+			buffer->alloced = alloced;
+		}
+	}
+	return buffer->data + buffer->end;
+}
+
+static void
+buffer_clear(Buffer *buffer)
+{
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->start = buffer->end = buffer->alloced = 0;
+}
+
+/* --- dispatch --- */
+
+static int
+watch_add(ProtobufCRpcDispatch *dispatch, Watch *watch, uint32_t events)
+{
+	struct epoll_event ev;
+
+	ev.events = events;
+	ev.data.ptr = watch;
+	watch->events = events;
+	return epoll_ctl(dispatch->epoll_fd, EPOLL_CTL_ADD, watch->fd, &ev);
+}
+
+static void
+watch_modify(ProtobufCRpcDispatch *dispatch, Watch *watch, uint32_t events)
+{
+	struct epoll_event ev;
+
+	if (watch->events == events || watch->fd < 0)
+		return;
+	ev.events = events;
+	ev.data.ptr = watch;
+	watch->events = events;
+	epoll_ctl(dispatch->epoll_fd, EPOLL_CTL_MOD, watch->fd, &ev);
+}
+
+/* Stop watching and close the descriptor; free the watch later. */
+static void
+watch_close(ProtobufCRpcDispatch *dispatch, Watch *watch)
+{
+	if (watch->fd >= 0) {
+		epoll_ctl(dispatch->epoll_fd, EPOLL_CTL_DEL, watch->fd, NULL);
+		close(watch->fd);
+		watch->fd = -1;
+	}
+	watch->next_garbage = dispatch->garbage;
+	dispatch->garbage = watch;
+}
+
+static void
+collect_garbage(ProtobufCRpcDispatch *dispatch)
+{
+	while (dispatch->garbage != NULL) {
+		Watch *watch = dispatch->garbage;
+
+		dispatch->garbage = watch->next_garbage;
+		watch->destroy(watch);
+	}
+}
+
+static protobuf_c_boolean
+set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+ProtobufCRpcDispatch *
+protobuf_c_rpc_dispatch_new(void)
+{
+	ProtobufCRpcDispatch *dispatch = malloc(sizeof(ProtobufCRpcDispatch));
+
+	if (dispatch == NULL)
+		return NULL;
+	dispatch->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (dispatch->epoll_fd < 0) {
+		free(dispatch);
+		return NULL;
+	}
+	dispatch->dirty = NULL;
+	dispatch->garbage = NULL;
+	return dispatch;
+}
+
+void
+protobuf_c_rpc_dispatch_free(ProtobufCRpcDispatch *dispatch)
+{
+	if (dispatch == NULL)
+		return;
+	collect_garbage(dispatch);
+	close(dispatch->epoll_fd);
+	free(dispatch);
+}
+
+/* --- connections --- */
+
+static void connection_fail(Connection *conn);
+static void connection_process_input(Connection *conn);
+
+static void
+connection_mark_dirty(Connection *conn)
+{
+	if (!conn->is_dirty) {
+		conn->is_dirty = TRUE;
+		conn->next_dirty = conn->dispatch->dirty;
+		conn->dispatch->dirty = conn;
+	}
+}
+
+/*
+ * Queue a frame, packing `message` straight into the output buffer. Returns
+ * FALSE if memory ran out, in which case nothing was queued.
+ */
+static protobuf_c_boolean
+connection_queue_frame(Connection *conn, uint32_t word0, uint32_t request_id,
+		       const ProtobufCMessage *message)
+{
+	size_t len = message != NULL ?
+		protobuf_c_message_get_packed_size(message) : 0;
+	uint8_t *out;
+
+	if (len > MAX_FRAME_LENGTH)
+		return FALSE;
+	out = buffer_reserve(&conn->out, FRAME_HEADER_SIZE + len);
+	if (out == NULL)
+		return FALSE;
+	write_uint32_le(out, word0);
+	write_uint32_le(out + 4, request_id);
+	write_uint32_le(out + 8, (uint32_t) len);
+	if (message != NULL)
+		protobuf_c_message_pack(message, out + FRAME_HEADER_SIZE);
+	conn->out.end += FRAME_HEADER_SIZE + len;
+	if (conn->limit_output &&
+	    conn->out.end - conn->out.start >= OUTPUT_HIGH_WATER)
+		conn->is_throttled = TRUE;
+	connection_mark_dirty(conn);
+	return TRUE;
+}
+
+/*
+ * Write as much output as the socket takes, and resume reading once enough of
+ * it is gone.
+ */
+static void
+connection_flush(Connection *conn)
+{
+	Buffer *out = &conn->out;
+	uint32_t events;
+
+	while (out->start < out->end) {
+		ssize_t n = send(conn->watch.fd, out->data + out->start,
+				 out->end - out->start, MSG_NOSIGNAL);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			connection_fail(conn);
+			return;
+		}
+		out->start += n;
+	}
+	if (out->start == out->end) {
+		out->start = out->end = 0;
+		events = 0;
+	} else {
+		events = EPOLLOUT;
+	}
+	if (conn->is_throttled && out->end - out->start <= OUTPUT_LOW_WATER) {
+		/* frames that were read before reading stopped come first */
+		conn->is_throttled = FALSE;
+		connection_process_input(conn);
+		if (conn->watch.fd < 0)
+			return;
+	}
+	if (!conn->is_throttled)
+		events |= EPOLLIN;
+	watch_modify(conn->dispatch, &conn->watch, events);
+}
+
+static void
+flush_dirty_connections(ProtobufCRpcDispatch *dispatch)
+{
+	while (dispatch->dirty != NULL) {
+		Connection *conn = dispatch->dirty;
+
+		dispatch->dirty = conn->next_dirty;
+		conn->is_dirty = FALSE;
+		if (conn->watch.fd >= 0)
+			connection_flush(conn);
+	}
+}
+
+/* Hand every complete frame in the input buffer to the owner. */
+static void
+connection_process_input(Connection *conn)
+{
+	Buffer *in = &conn->in;
+
+	while (conn->watch.fd >= 0 && !conn->is_throttled &&
+	       in->end - in->start >= FRAME_HEADER_SIZE)
+	{
+		const uint8_t *header = in->data + in->start;
+		uint32_t len = read_uint32_le(header + 8);
+
+		if (len > MAX_FRAME_LENGTH) {
+			connection_fail(conn);
+			return;
+		}
+		if (in->end - in->start < FRAME_HEADER_SIZE + len)
+			break;
+		in->start += FRAME_HEADER_SIZE + len;
+		if (!conn->handle_frame(conn, header, len,
+					header + FRAME_HEADER_SIZE)) {
+			connection_fail(conn);
+			return;
+		}
+	}
+	if (in->start == in->end)
+		in->start = in->end = 0;
+}
+
+static void
+connection_handle(Watch *watch, uint32_t events)
+{
+	Connection *conn = (Connection *) watch;
+
+	if (0 != (events & EPOLLOUT))
+		connection_flush(conn);
+	if (conn->watch.fd < 0)
+		return;
+	if (conn->is_throttled) {
+		/* nobody is left to read what is still queued */
+		if (0 != (events & (EPOLLHUP | EPOLLERR)))
+			connection_fail(conn);
+		return;
+	}
+	if (0 != (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+		for (;;) {
+			uint8_t *at = buffer_reserve(&conn->in, READ_SIZE);
+			ssize_t n;
+
+			if (at == NULL) {
+				connection_fail(conn);
+				return;
+			}
+			n = recv(conn->watch.fd, at, READ_SIZE, 0);
+			if (n > 0) {
+				/*
+				 * Hand over complete frames before reading
+				 * more, so that a peer writing faster than
+				 * this drains cannot grow the buffer.
+				 */
+				conn->in.end += n;
+				connection_process_input(conn);
+				if (conn->watch.fd < 0 || conn->is_throttled ||
+				    n < READ_SIZE)
+					return;
+				continue;
+			}
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				return;
+			/* EOF or error; what had arrived was handled */
+			connection_fail(conn);
+			return;
+		}
+	}
+}
+
+static void
+connection_init(Connection *conn, int fd, ProtobufCRpcDispatch *dispatch)
+{
+	memset(&conn->in, 0, sizeof(Buffer));
+	memset(&conn->out, 0, sizeof(Buffer));
+	conn->watch.fd = fd;
+	conn->watch.handle = connection_handle;
+	conn->dispatch = dispatch;
+	conn->is_dirty = FALSE;
+	conn->next_dirty = NULL;
+	conn->limit_output = FALSE;
+	conn->is_throttled = FALSE;
+}
+
+static void
+connection_fail(Connection *conn)
+{
+	if (conn->watch.fd < 0)
+		return;
+	watch_close(conn->dispatch, &conn->watch);
+	conn->handle_close(conn);
+}
+
+int
+protobuf_c_rpc_dispatch_run(ProtobufCRpcDispatch *dispatch, int timeout_ms)
+{
+	struct epoll_event events[MAX_EVENTS];
+	int n;
+	int i;
+
+	flush_dirty_connections(dispatch);
+	collect_garbage(dispatch);
+	n = epoll_wait(dispatch->epoll_fd, events, MAX_EVENTS, timeout_ms);
+	if (n < 0)
+		return errno == EINTR ? 0 : -1;
+	for (i = 0; i < n; i++) {
+		Watch *watch = events[i].data.ptr;
+
+		if (watch->fd >= 0)
+			watch->handle(watch, events[i].events);
+	}
+	flush_dirty_connections(dispatch);
+	collect_garbage(dispatch);
+	return n;
+}
+
+/* --- addresses --- */
+
+/*
+ * A non-blocking connect() that has not failed yet. The connection completes
+ * or fails in the background; output queued meanwhile waits for EPOLLOUT and
+ * a failure shows up as EPOLLERR.
+ */
+static protobuf_c_boolean
+connect_started(int fd, const struct sockaddr *addr, socklen_t addr_len)
+{
+	int rv;
+
+	do
+		rv = connect(fd, addr, addr_len);
+	while (rv != 0 && errno == EINTR);
+	return rv == 0 || errno == EINPROGRESS;
+}
+
+/*
+ * Create a non-blocking socket for `name`, then bind and listen or start
+ * connecting it.
+ */
+static int
+open_socket(ProtobufCRpcAddressType type, const char *name,
+	    protobuf_c_boolean is_server)
+{
+	int fd = -1;
+
+	if (type == PROTOBUF_C_RPC_ADDRESS_LOCAL) {
+		struct sockaddr_un addr;
+		struct stat st;
+
+		if (strlen(name) >= sizeof(addr.sun_path))
+			return -1;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		memcpy(addr.sun_path, name, strlen(name) + 1);
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -1;
+		if (is_server) {
+			/* only a stale socket is replaced, never another file */
+			if (lstat(name, &st) == 0 && S_ISSOCK(st.st_mode))
+				unlink(name);
+			if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+			    listen(fd, SOMAXCONN) == 0)
+				return fd;
+		} else if (connect_started(fd, (struct sockaddr *) &addr,
+					   sizeof(addr))) {
+			return fd;
+		}
+	} else if (type == PROTOBUF_C_RPC_ADDRESS_TCP) {
+		struct addrinfo hints, *res, *ai;
+		const char *colon = strrchr(name, ':');
+		char *host = NULL;
+		const char *port = name;
+		int one = 1;
+
+		if (colon != NULL) {
+			host = malloc(colon - name + 1);
+			if (host == NULL)
+				return -1;
+			memcpy(host, name, colon - name);
+			host[colon - name] = '\0';
+			port = colon + 1;
+		}
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = is_server ? AI_PASSIVE : 0;
+		if (getaddrinfo(host != NULL && host[0] != '\0' ? host : NULL,
+				port, &hints, &res) != 0) {
+			free(host);
+			return -1;
+		}
+		free(host);
+		for (ai = res; ai != NULL; ai = ai->ai_next) {
+			fd = socket(ai->ai_family,
+				    ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				    ai->ai_protocol);
+			if (fd < 0)
+				continue;
+			if (is_server) {
+				setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
+					   &one, sizeof(one));
+				if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+				    listen(fd, SOMAXCONN) == 0)
+					break;
+			} else if (connect_started(fd, ai->ai_addr, ai->ai_addrlen)) {
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
+					   &one, sizeof(one));
+				break;
+			}
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(res);
+		return fd;
+	}
+	if (fd >= 0)
+		close(fd);
+	return -1;
+}
+
+/* --- server --- */
+
+static void
+server_request_unlink(ServerRequest *req)
+{
+	if (req->prev != NULL)
+		req->prev->next = req->next;
+	else
+		req->conn->requests = req->next;
+	if (req->next != NULL)
+		req->next->prev = req->prev;
+}
+
+static void
+server_closure(const ProtobufCMessage *output, void *closure_data)
+{
+	ServerRequest *req = closure_data;
+	ServerConnection *conn = req->conn;
+
+	if (conn != NULL) {
+		const ProtobufCMethodDescriptor *method =
+			conn->server->service->descriptor->methods +
+			req->method_index;
+
+		server_request_unlink(req);
+		if (output == NULL || output->descriptor != method->output)
+			output = NULL;
+		if (!connection_queue_frame(&conn->base,
+					    output != NULL ?
+					    PROTOBUF_C_RPC_STATUS_SUCCESS :
+					    PROTOBUF_C_RPC_STATUS_SERVICE_FAILED,
+					    req->request_id, output))
+			connection_fail(&conn->base);
+	}
+	free(req);
+}
+
+static protobuf_c_boolean
+server_handle_frame(Connection *base, const uint8_t *header,
+		    size_t len, const uint8_t *data)
+{
+	ServerConnection *conn = (ServerConnection *) base;
+	ProtobufCService *service = conn->server->service;
+	uint32_t method_index = read_uint32_le(header);
+	uint32_t request_id = read_uint32_le(header + 4);
+	uint64_t scratch[PROTOBUF_C_SERVICE_ARENA_SIZE / sizeof(uint64_t)];
+	ProtobufCArena arena;
+	ProtobufCMessage *input;
+	ServerRequest *req;
+
+	if (method_index >= service->descriptor->n_methods)
+		return connection_queue_frame(base,
+					      PROTOBUF_C_RPC_STATUS_BAD_METHOD,
+					      request_id, NULL);
+	/* the request only has to live until invoke() returns */
+	protobuf_c_arena_init(&arena, scratch, sizeof(scratch));
+	input = protobuf_c_message_unpack(
+		service->descriptor->methods[method_index].input,
+		&arena.base, len, data);
+	if (input == NULL) {
+		protobuf_c_arena_clear(&arena);
+		return connection_queue_frame(base,
+					      PROTOBUF_C_RPC_STATUS_BAD_REQUEST,
+					      request_id, NULL);
+	}
+
+	req = malloc(sizeof(ServerRequest));
+	if (req == NULL) {
+		protobuf_c_arena_clear(&arena);
+		return FALSE;
+	}
+	req->conn = conn;
+	req->request_id = request_id;
+	req->method_index = method_index;
+	req->prev = NULL;
+	req->next = conn->requests;
+	if (conn->requests != NULL)
+		conn->requests->prev = req;
+	conn->requests = req;
+
+	service->invoke(service, method_index, input, server_closure, req);
+	protobuf_c_arena_clear(&arena);
+	return TRUE;
+}
+
+/* Detach the connection from the server and from its pending requests. */
+static void
+server_connection_close(Connection *base)
+{
+	ServerConnection *conn = (ServerConnection *) base;
+	ServerRequest *req;
+
+	for (req = conn->requests; req != NULL; req = req->next)
+		req->conn = NULL;
+	conn->requests = NULL;
+	if (conn->prev != NULL)
+		conn->prev->next = conn->next;
+	else
+		conn->server->connections = conn->next;
+	if (conn->next != NULL)
+		conn->next->prev = conn->prev;
+}
+
+static void
+server_connection_destroy(Watch *watch)
+{
+	ServerConnection *conn = (ServerConnection *) watch;
+
+	buffer_clear(&conn->base.in);
+	buffer_clear(&conn->base.out);
+	free(conn);
+}
+
+static void
+server_accept(Watch *watch, uint32_t events)
+{
+	ProtobufCRpcServer *server = (ProtobufCRpcServer *) watch;
+
+	(void) events;
+	for (;;) {
+		int fd = accept(server->watch.fd, NULL, NULL);
+		ServerConnection *conn;
+		int one = 1;
+
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return;
+		}
+		conn = malloc(sizeof(ServerConnection));
+		if (conn == NULL || !set_nonblocking(fd)) {
+			free(conn);
+			close(fd);
+			continue;
+		}
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		connection_init(&conn->base, fd, server->dispatch);
+		conn->base.watch.destroy = server_connection_destroy;
+		conn->base.handle_frame = server_handle_frame;
+		conn->base.handle_close = server_connection_close;
+		conn->base.limit_output = TRUE;
+		conn->server = server;
+		conn->requests = NULL;
+		if (watch_add(server->dispatch, &conn->base.watch, EPOLLIN) != 0) {
+			server_connection_destroy(&conn->base.watch);
+			close(fd);
+			continue;
+		}
+		conn->prev = NULL;
+		conn->next = server->connections;
+		if (server->connections != NULL)
+			server->connections->prev = conn;
+		server->connections = conn;
+	}
+}
+
+static void
+server_destroy(Watch *watch)
+{
+	ProtobufCRpcServer *server = (ProtobufCRpcServer *) watch;
+
+	free(server->path);
+	free(server);
+}
+
+ProtobufCRpcServer *
+protobuf_c_rpc_server_new(ProtobufCRpcAddressType type,
+			  const char *name,
+			  ProtobufCService *service,
+			  ProtobufCRpcDispatch *dispatch)
+{
+	ProtobufCRpcServer *server = malloc(sizeof(ProtobufCRpcServer));
+	int fd;
+
+	if (server == NULL)
+		return NULL;
+	server->path = NULL;
+	if (type == PROTOBUF_C_RPC_ADDRESS_LOCAL) {
+		server->path = malloc(strlen(name) + 1);
+		if (server->path == NULL) {
+			free(server);
+			return NULL;
+		}
+		memcpy(server->path, name, strlen(name) + 1);
+	}
+	fd = open_socket(type, name, TRUE);
+	if (fd < 0) {
+		server_destroy(&server->watch);
+		return NULL;
+	}
+	server->watch.fd = fd;
+	server->watch.handle = server_accept;
+	server->watch.destroy = server_destroy;
+	server->dispatch = dispatch;
+	server->service = service;
+	server->connections = NULL;
+	if (watch_add(dispatch, &server->watch, EPOLLIN) != 0) {
+		close(fd);
+		server_destroy(&server->watch);
+		return NULL;
+	}
+	return server;
+}
+
+void
+protobuf_c_rpc_server_destroy(ProtobufCRpcServer *server)
+{
+	if (server == NULL)
+		return;
+	while (server->connections != NULL)
+		connection_fail(&server->connections->base);
+	if (server->path != NULL)
+		unlink(server->path);
+	watch_close(server->dispatch, &server->watch);
+}
+
+/* --- client --- */
+
+/* Fail every outstanding call. */
+static void
+client_fail_calls(Client *client)
+{
+	uint32_t i;
+
+	for (i = 0; i < client->n_calls; i++) {
+		ClientCall *call = &client->calls[i];
+		ProtobufCClosure closure = call->closure;
+
+		if (closure == NULL)
+			continue;
+		call->closure = NULL;
+		call->next_free = client->first_free;
+		client->first_free = i;
+		client->n_pending--;
+		closure(NULL, call->closure_data);
+	}
+}
+
+static void
+client_connection_close(Connection *conn)
+{
+	Client *client = (Client *) ((char *) conn - offsetof(Client, conn));
+
+	client->is_closed = TRUE;
+	client_fail_calls(client);
+}
+
+static protobuf_c_boolean
+client_handle_frame(Connection *conn, const uint8_t *header,
+		    size_t len, const uint8_t *data)
+{
+	Client *client = (Client *) ((char *) conn - offsetof(Client, conn));
+	uint32_t status = read_uint32_le(header);
+	uint32_t request_id = read_uint32_le(header + 4);
+	uint64_t scratch[PROTOBUF_C_SERVICE_ARENA_SIZE / sizeof(uint64_t)];
+	ProtobufCArena arena;
+	ProtobufCMessage *output = NULL;
+	ClientCall *call;
+	ProtobufCClosure closure;
+
+	if (request_id >= client->n_calls ||
+	    client->calls[request_id].closure == NULL)
+		return FALSE;
+	call = &client->calls[request_id];
+	protobuf_c_arena_init(&arena, scratch, sizeof(scratch));
+	if (status == PROTOBUF_C_RPC_STATUS_SUCCESS) {
+		const ProtobufCMethodDescriptor *method =
+			client->base.descriptor->methods + call->method_index;
+
+		output = protobuf_c_message_unpack(method->output, &arena.base,
+						   len, data);
+	}
+
+	/* free the slot first, so that the closure can make new calls */
+	closure = call->closure;
+	call->closure = NULL;
+	call->next_free = client->first_free;
+	client->first_free = request_id;
+	client->n_pending--;
+	closure(output, call->closure_data);
+	protobuf_c_arena_clear(&arena);
+	return TRUE;
+}
+
+static void
+client_invoke(ProtobufCService *service,
+	      unsigned method_index,
+	      const ProtobufCMessage *input,
+	      ProtobufCClosure closure,
+	      void *closure_data)
+{
+	Client *client = (Client *) service;
+	uint32_t request_id;
+	ClientCall *call;
+
+	if (client->is_closed || method_index >= service->descriptor->n_methods)
+		goto fail;
+	if (client->first_free == NO_FREE_CALL) {
+		uint32_t n = client->n_calls ? client->n_calls * 2 : 16;
+		ClientCall *calls;
+		uint32_t i;
+
+		calls = realloc(client->calls, n * sizeof(ClientCall));
+		if (calls == NULL)
+			goto fail;
+		for (i = client->n_calls; i < n; i++) {
+			calls[i].closure = NULL;
+			calls[i].next_free = i + 1 < n ? i + 1 : NO_FREE_CALL;
+		}
+		client->calls = calls;
+		client->first_free = client->n_calls;
+		client->n_calls = n;
+	}
+	request_id = client->first_free;
+	call = &client->calls[request_id];
+	if (!connection_queue_frame(&client->conn, method_index, request_id,
+				    input))
+		goto fail;
+	client->first_free = call->next_free;
+	call->closure = closure;
+	call->closure_data = closure_data;
+	call->method_index = method_index;
+	client->n_pending++;
+	return;
+
+fail:
+	closure(NULL, closure_data);
+}
+
+static void
+client_free(Client *client)
+{
+	buffer_clear(&client->conn.in);
+	buffer_clear(&client->conn.out);
+	free(client->calls);
+	free(client);
+}
+
+/*
+ * The client is freed once both the user has destroyed it and the dispatch
+ * has let go of its watch, whichever comes last.
+ */
+static void
+client_watch_destroy(Watch *watch)
+{
+	Client *client = (Client *) ((char *) watch -
+				     offsetof(Client, conn.watch));
+
+	client->is_collected = TRUE;
+	if (client->is_destroyed)
+		client_free(client);
+}
+
+static void
+client_destroy(ProtobufCService *service)
+{
+	Client *client = (Client *) service;
+
+	client->is_destroyed = TRUE;
+	if (client->conn.watch.fd >= 0)
+		connection_fail(&client->conn);
+	else if (client->is_collected)
+		client_free(client);
+}
+
+ProtobufCService *
+protobuf_c_rpc_client_new(ProtobufCRpcAddressType type,
+			  const char *name,
+			  const ProtobufCServiceDescriptor *descriptor,
+			  ProtobufCRpcDispatch *dispatch)
+{
+	Client *client;
+	int fd = open_socket(type, name, FALSE);
+
+	if (fd < 0)
+		return NULL;
+	client = malloc(sizeof(Client));
+	if (client == NULL) {
+		close(fd);
+		return NULL;
+	}
+	client->base.descriptor = descriptor;
+	client->base.invoke = client_invoke;
+	client->base.destroy = client_destroy;
+	connection_init(&client->conn, fd, dispatch);
+	client->conn.watch.destroy = client_watch_destroy;
+	client->conn.handle_frame = client_handle_frame;
+	client->conn.handle_close = client_connection_close;
+	client->is_closed = FALSE;
+	client->is_destroyed = FALSE;
+	client->is_collected = FALSE;
+	client->calls = NULL;
+	client->n_calls = 0;
+	client->first_free = NO_FREE_CALL;
+	client->n_pending = 0;
+	if (watch_add(dispatch, &client->conn.watch, EPOLLIN) != 0) {
+		close(fd);
+		free(client);
+		return NULL;
+	}
+	return &client->base;
+}
+
+size_t
+protobuf_c_rpc_client_n_pending(const ProtobufCService *client)
+{
+	return ((const Client *) client)->n_pending;
+}
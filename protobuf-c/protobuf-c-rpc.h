@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2026, the protobuf-c authors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file
+ * An event-loop RPC transport for generated services over Unix-domain and
+ * TCP sockets.
+ *
+ * A server exposes a `ProtobufCService`, such as one built with the
+ * generated `*__INIT()` macro, and a client is a `ProtobufCService` whose
+ * methods send requests to a server; both run on a
+ * `ProtobufCRpcDispatch`, an epoll(7) event loop driven by
+ * protobuf_c_rpc_dispatch_run().
+ *
+ * Every message travels in a frame with a little-endian header. A request
+ * header holds the method index, a request id and the payload length; a
+ * response header holds a status code (a `ProtobufCRpcStatus`), the request
+ * id and the payload length. Request ids let a client keep any number of
+ * calls outstanding on one connection, and a server may complete them in
+ * any order. Output produced while handling events is written in as few
+ * system calls as possible once the events have been handled. A server stops
+ * reading the requests of a client whose responses back up until the client
+ * has caught up.
+ *
+ * A server handler must call its closure exactly once, either before
+ * returning or later, e.g. from another event. The request message is only
+ * valid until the handler returns. A client closure receives NULL if the
+ * call failed; the response message is freed when the closure returns.
+ *
+ * Nothing here is thread-safe: a dispatch and everything attached to it
+ * must be used from a single thread. Only available on systems with epoll.
+ */
+
+#ifndef PROTOBUF_C_RPC_H
+#define PROTOBUF_C_RPC_H
+
+#include <protobuf-c/protobuf-c.h>
+
+PROTOBUF_C__BEGIN_DECLS
+
+/** An epoll-based event loop. */
+typedef struct ProtobufCRpcDispatch ProtobufCRpcDispatch;
+
+/** A listening socket serving a `ProtobufCService`. */
+typedef struct ProtobufCRpcServer ProtobufCRpcServer;
+
+/** How the `name` of a server or client is interpreted. */
+typedef enum {
+	/** A filesystem path to a Unix-domain socket. */
+	PROTOBUF_C_RPC_ADDRESS_LOCAL,
+	/** "host:port", or just "port" to listen on all addresses. */
+	PROTOBUF_C_RPC_ADDRESS_TCP,
+} ProtobufCRpcAddressType;
+
+/** Status code of a response frame. */
+typedef enum {
+	PROTOBUF_C_RPC_STATUS_SUCCESS,
+	/** The handler completed the call with a NULL message. */
+	PROTOBUF_C_RPC_STATUS_SERVICE_FAILED,
+	/** The method index was out of range. */
+	PROTOBUF_C_RPC_STATUS_BAD_METHOD,
+	/** The request could not be unpacked. */
+	PROTOBUF_C_RPC_STATUS_BAD_REQUEST,
+} ProtobufCRpcStatus;
+
+/**
+ * Create an event loop.
+ *
+ * \return
+ *      The new dispatch, or NULL if it could not be created.
+ */
+PROTOBUF_C__API
+ProtobufCRpcDispatch *
+protobuf_c_rpc_dispatch_new(void);
+
+/**
+ * Free an event loop. All servers and clients using it must have been
+ * destroyed.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_rpc_dispatch_free(ProtobufCRpcDispatch *dispatch);
+
+/**
+ * Flush pending output, wait for events, handle them and flush the output
+ * they produced.
+ *
+ * \param dispatch
+ *      The event loop.
+ * \param timeout_ms
+ *      Maximum time to wait for events in milliseconds; -1 waits
+ *      indefinitely and 0 only handles events that are already pending.
+ * \return
+ *      Number of events handled, or -1 on error.
+ */
+PROTOBUF_C__API
+int
+protobuf_c_rpc_dispatch_run(ProtobufCRpcDispatch *dispatch, int timeout_ms);
+
+/**
+ * Start serving `service` on a new listening socket. A stale socket at a
+ * `PROTOBUF_C_RPC_ADDRESS_LOCAL` path is replaced; any other file there is
+ * left alone and makes this fail.
+ *
+ * \param type
+ *      How `name` is interpreted.
+ * \param name
+ *      Address to listen on.
+ * \param service
+ *      Service whose methods are invoked for incoming requests. It is not
+ *      destroyed with the server.
+ * \param dispatch
+ *      Event loop the server runs on.
+ * \return
+ *      The new server, or NULL if the socket could not be set up.
+ */
+PROTOBUF_C__API
+ProtobufCRpcServer *
+protobuf_c_rpc_server_new(ProtobufCRpcAddressType type,
+			  const char *name,
+			  ProtobufCService *service,
+			  ProtobufCRpcDispatch *dispatch);
+
+/**
+ * Close a server's listening socket and all of its connections. Calls that
+ * are still outstanding complete silently.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_rpc_server_destroy(ProtobufCRpcServer *server);
+
+/**
+ * Connect to a server. The returned service sends each method invocation as
+ * a request; responses are delivered to the closures from
+ * protobuf_c_rpc_dispatch_run(). Free it with protobuf_c_service_destroy(),
+ * which fails the calls still outstanding.
+ *
+ * The connection is completed by the event loop, so calls may be made at
+ * once; if it cannot be established, they fail. Only the lookup of a TCP
+ * host name blocks, which a numeric address avoids.
+ *
+ * \param type
+ *      How `name` is interpreted.
+ * \param name
+ *      Address of the server.
+ * \param descriptor
+ *      Descriptor of the service the server provides.
+ * \param dispatch
+ *      Event loop the client runs on.
+ * \return
+ *      The client service, or NULL if the connection could not be
+ *      started.
+ */
+PROTOBUF_C__API
+ProtobufCService *
+protobuf_c_rpc_client_new(ProtobufCRpcAddressType type,
+			  const char *name,
+			  const ProtobufCServiceDescriptor *descriptor,
+			  ProtobufCRpcDispatch *dispatch);
+
+/**
+ * Number of calls of a client still waiting for their response.
+ */
+PROTOBUF_C__API
+size_t
+protobuf_c_rpc_client_n_pending(const ProtobufCService *client);
+
+PROTOBUF_C__END_DECLS
+
+#endif /* PROTOBUF_C_RPC_H */
@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2026, the protobuf-c authors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file
+ * Shared-memory message ring.
+ *
+ * The memfd holds a `RingHeader` followed by the data area. Positions are
+ * 64-bit byte counts that only grow; a position's offset in the data area is
+ * the position modulo the capacity. Each message is a `RecordHeader` followed
+ * by the packed message, padded to a multiple of 8 bytes. A record never
+ * wraps: a producer that would run off the end of the data area first fills
+ * the rest of it with a padding record.
+ *
+ * Producers reserve space by advancing `head`, which needs a CAS in MPSC
+ * mode. In SPSC mode `head` is only advanced once the record is written, and
+ * the consumer reads up to it. In MPSC mode records are completed out of
+ * order, so the consumer instead waits for the `state` of the next record to
+ * be set, and zeroes each record it consumes so that the space is clean for
+ * the next lap.
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE		/* for memfd_create */
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>	/* for uint8_t, uint32_t, uint64_t */
+#include <stdlib.h>	/* for malloc, free */
+#include <string.h>	/* for memset */
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "protobuf-c-shm.h"
+
+#define TRUE				1
+#define FALSE				0
+
+#define RING_MAGIC			0x52434250	/* "PBCR" */
+#define CACHE_LINE			64
+#define MIN_CAPACITY			4096
+#define RECORD_HEADER_SIZE		8
+#define RECORD_ALIGN(len)		(((len) + 7) & ~(uint64_t) 7)
+
+/* RecordHeader.state */
+#define RECORD_EMPTY			0
+#define RECORD_MESSAGE			1
+#define RECORD_PADDING			2
+
+typedef struct {
+	uint32_t magic;
+	uint32_t mode;
+	uint64_t capacity;		/* size of the data area, a power of two */
+	char pad0[CACHE_LINE - 16];
+
+	uint64_t head;			/* written by producers */
+	char pad1[CACHE_LINE - 8];
+
+	uint64_t tail;			/* written by the consumer */
+	uint32_t consumer_waiting;
+	char pad2[CACHE_LINE - 12];
+} RingHeader;
+
+typedef struct {
+	uint32_t length;		/* of the message, without padding */
+	uint32_t state;
+} RecordHeader;
+
+struct ProtobufCShmRing {
+	RingHeader *header;
+	uint8_t *data;
+	uint64_t mask;
+	size_t map_size;
+	int shm_fd;
+	int event_fd;
+};
+
+static ProtobufCShmRing *
+ring_map(int shm_fd, int event_fd, size_t map_size)
+{
+	ProtobufCShmRing *ring;
+	void *map;
+
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   shm_fd, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+	ring = malloc(sizeof(ProtobufCShmRing));
+	if (ring == NULL) {
+		munmap(map, map_size);
+		errno = ENOMEM;
+		return NULL;
+	}
+	ring->header = map;
+	ring->data = (uint8_t *) map + sizeof(RingHeader);
+	ring->map_size = map_size;
+	ring->shm_fd = shm_fd;
+	ring->event_fd = event_fd;
+	return ring;
+}
+
+ProtobufCShmRing *
+protobuf_c_shm_ring_new(ProtobufCShmRingMode mode, size_t capacity)
+{
+	ProtobufCShmRing *ring;
+	uint64_t size = MIN_CAPACITY;
+	int shm_fd, event_fd;
+	int saved_errno;
+
+	while (size < capacity && size <= UINT32_MAX)
+		size *= 2;
+	if (size > UINT32_MAX || size > SIZE_MAX - sizeof(RingHeader)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	shm_fd = memfd_create("protobuf-c-shm-ring", MFD_CLOEXEC);
+	if (shm_fd < 0)
+		return NULL;
+	event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (event_fd < 0)
+		goto fail;
+	if (ftruncate(shm_fd, (off_t) (sizeof(RingHeader) + size)) < 0)
+		goto fail;
+	ring = ring_map(shm_fd, event_fd, sizeof(RingHeader) + size);
+	if (ring == NULL)
+		goto fail;
+
+	/* the memfd starts out zeroed, so every record is RECORD_EMPTY */
+	ring->header->mode = mode;
+	ring->header->capacity = size;
+	ring->mask = size - 1;
+	__atomic_store_n(&ring->header->magic, RING_MAGIC, __ATOMIC_RELEASE);
+	return ring;
+
+fail:
+	saved_errno = errno;
+	close(shm_fd);
+	if (event_fd >= 0)
+		close(event_fd);
+	errno = saved_errno;
+	return NULL;
+}
+
+ProtobufCShmRing *
+protobuf_c_shm_ring_attach(int shm_fd, int event_fd)
+{
+	ProtobufCShmRing *ring;
+	struct stat st;
+	uint64_t capacity;
+
+	if (fstat(shm_fd, &st) < 0)
+		return NULL;
+	if ((uint64_t) st.st_size < sizeof(RingHeader) + MIN_CAPACITY ||
+	    (uint64_t) st.st_size > SIZE_MAX)
+		goto invalid;
+	ring = ring_map(shm_fd, event_fd, (size_t) st.st_size);
+	if (ring == NULL)
+		return NULL;
+
+	capacity = ring->header->capacity;
+	if (__atomic_load_n(&ring->header->magic, __ATOMIC_ACQUIRE) != RING_MAGIC ||
+	    ring->header->mode > (uint32_t) PROTOBUF_C_SHM_RING_MPSC ||
+	    capacity < MIN_CAPACITY || (capacity & (capacity - 1)) != 0 ||
+	    capacity > ring->map_size - sizeof(RingHeader))
+	{
+		munmap(ring->header, ring->map_size);
+		free(ring);
+		goto invalid;
+	}
+	ring->mask = capacity - 1;
+	return ring;
+
+invalid:
+	errno = EINVAL;
+	return NULL;
+}
+
+void
+protobuf_c_shm_ring_free(ProtobufCShmRing *ring)
+{
+	if (ring == NULL)
+		return;
+	munmap(ring->header, ring->map_size);
+	close(ring->shm_fd);
+	close(ring->event_fd);
+	free(ring);
+}
+
+int
+protobuf_c_shm_ring_shm_fd(const ProtobufCShmRing *ring)
+{
+	return ring->shm_fd;
+}
+
+int
+protobuf_c_shm_ring_event_fd(const ProtobufCShmRing *ring)
+{
+	return ring->event_fd;
+}
+
+static inline RecordHeader *
+record_at(const ProtobufCShmRing *ring, uint64_t pos)
+{
+	return (RecordHeader *) (ring->data + (pos & ring->mask));
+}
+
+static void
+wake_consumer(ProtobufCShmRing *ring)
+{
+	uint64_t one = 1;
+
+	/*
+	 * Pairs with the fence in protobuf_c_shm_ring_wait(): either the
+	 * consumer sees the record we just committed, or we see its flag.
+	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->header->consumer_waiting, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(&ring->header->consumer_waiting, 0,
+				__ATOMIC_RELAXED))
+	{
+		ssize_t rv = write(ring->event_fd, &one, sizeof(one));
+		(void) rv;	/* fails only if the counter is saturated */
+	}
+}
+
+protobuf_c_boolean
+protobuf_c_shm_ring_send(ProtobufCShmRing *ring,
+			 const ProtobufCMessage *message)
+{
+	RingHeader *header = ring->header;
+	uint64_t capacity = ring->mask + 1;
+	size_t len = protobuf_c_message_get_packed_size(message);
+	uint64_t need, pos, pad, tail;
+	RecordHeader *record;
+	size_t packed;
+
+	if (len > capacity / 2 - RECORD_HEADER_SIZE)
+		return FALSE;
+	need = RECORD_HEADER_SIZE + RECORD_ALIGN(len);
+
+	pos = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+	for (;;) {
+		uint64_t left = capacity - (pos & ring->mask);
+
+		pad = left < need ? left : 0;
+		/* the consumer's zeroing of released records happens-before */
+		tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+		if (pos + pad + need - tail > capacity)
+			return FALSE;
+		if (header->mode == PROTOBUF_C_SHM_RING_SPSC)
+			break;
+		if (__atomic_compare_exchange_n(&header->head, &pos,
+						pos + pad + need, TRUE,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+			break;
+	}
+
+	if (pad != 0) {
+		record = record_at(ring, pos);
+		record->length = (uint32_t) (pad - RECORD_HEADER_SIZE);
+		__atomic_store_n(&record->state, RECORD_PADDING,
+				 __ATOMIC_RELEASE);
+	}
+	record = record_at(ring, pos + pad);
+	packed = protobuf_c_message_pack(message, (uint8_t *) (record + 1));
+	assert(packed == len);
+	record->length = (uint32_t) packed;
+	__atomic_store_n(&record->state, RECORD_MESSAGE, __ATOMIC_RELEASE);
+	if (header->mode == PROTOBUF_C_SHM_RING_SPSC)
+		__atomic_store_n(&header->head, pos + pad + need,
+				 __ATOMIC_RELEASE);
+
+	wake_consumer(ring);
+	return TRUE;
+}
+
+/*
+ * The header of the record at the tail if it has been committed, after
+ * checking that its length is plausible: the memory is shared with another
+ * process that we need not trust to be well-behaved.
+ */
+static RecordHeader *
+committed_record(ProtobufCShmRing *ring, uint64_t tail)
+{
+	RingHeader *header = ring->header;
+	RecordHeader *record = record_at(ring, tail);
+	uint64_t left = ring->mask + 1 - (tail & ring->mask);
+	uint32_t state;
+
+	if (header->mode == PROTOBUF_C_SHM_RING_SPSC &&
+	    __atomic_load_n(&header->head, __ATOMIC_ACQUIRE) == tail)
+		return NULL;
+	state = __atomic_load_n(&record->state, __ATOMIC_ACQUIRE);
+	if (state == RECORD_EMPTY)
+		return NULL;
+	if (left < RECORD_HEADER_SIZE ||
+	    RECORD_ALIGN((uint64_t) record->length) > left - RECORD_HEADER_SIZE)
+		return NULL;
+	return record;
+}
+
+static void
+consume(ProtobufCShmRing *ring, RecordHeader *record, uint64_t tail)
+{
+	uint64_t size = RECORD_HEADER_SIZE + RECORD_ALIGN((uint64_t) record->length);
+
+	if (ring->header->mode == PROTOBUF_C_SHM_RING_MPSC)
+		memset(record, 0, size);
+	__atomic_store_n(&ring->header->tail, tail + size, __ATOMIC_RELEASE);
+}
+
+const uint8_t *
+protobuf_c_shm_ring_peek(ProtobufCShmRing *ring, size_t *len)
+{
+	for (;;) {
+		uint64_t tail = __atomic_load_n(&ring->header->tail,
+						__ATOMIC_RELAXED);
+		RecordHeader *record = committed_record(ring, tail);
+
+		if (record == NULL)
+			return NULL;
+		if (record->state == RECORD_MESSAGE) {
+			*len = record->length;
+			return (const uint8_t *) (record + 1);
+		}
+		consume(ring, record, tail);
+	}
+}
+
+void
+protobuf_c_shm_ring_release(ProtobufCShmRing *ring)
+{
+	uint64_t tail = __atomic_load_n(&ring->header->tail, __ATOMIC_RELAXED);
+	RecordHeader *record = committed_record(ring, tail);
+
+	if (record != NULL)
+		consume(ring, record, tail);
+}
+
+static int64_t
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+protobuf_c_boolean
+protobuf_c_shm_ring_wait(ProtobufCShmRing *ring, int timeout_ms)
+{
+	int64_t deadline = timeout_ms > 0 ? now_ms() + timeout_ms : 0;
+	struct pollfd pfd;
+	uint64_t count;
+	size_t len;
+	ssize_t rv;
+	int n;
+
+	pfd.fd = ring->event_fd;
+	pfd.events = POLLIN;
+	for (;;) {
+		if (protobuf_c_shm_ring_peek(ring, &len) != NULL)
+			return TRUE;
+
+		__atomic_store_n(&ring->header->consumer_waiting, 1,
+				 __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		n = 1;
+		if (protobuf_c_shm_ring_peek(ring, &len) == NULL) {
+			n = poll(&pfd, 1, timeout_ms);
+			if (n > 0) {
+				rv = read(ring->event_fd, &count, sizeof(count));
+				(void) rv;
+			}
+		}
+		__atomic_store_n(&ring->header->consumer_waiting, 0,
+				 __ATOMIC_RELAXED);
+		if (n <= 0)
+			return protobuf_c_shm_ring_peek(ring, &len) != NULL;
+
+		/*
+		 * The wakeup may be left over from a message that has already
+		 * been consumed, so wait again for whatever time is left.
+		 */
+		if (timeout_ms > 0) {
+			int64_t left = deadline - now_ms();
+			timeout_ms = left > 0 ? (int) left : 0;
+		}
+	}
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2026, the protobuf-c authors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file
+ * A lock-free message ring in shared memory, for passing messages between
+ * co-located processes without a socket copy or a system call per message.
+ *
+ * The ring lives in a memfd. Its creator hands the memfd and the ring's
+ * eventfd to the peer process, by inheritance across fork() or as
+ * `SCM_RIGHTS` over a Unix-domain socket, and the peer maps the same memory
+ * with protobuf_c_shm_ring_attach().
+ *
+ * Producers pack messages with protobuf_c_message_pack() straight into a slot
+ * of the ring. The single consumer reads each packed message where it lies,
+ * typically handing it to protobuf_c_message_unpack(), and then releases the
+ * slot. A `PROTOBUF_C_SHM_RING_SPSC` ring allows one producer at a time; a
+ * `PROTOBUF_C_SHM_RING_MPSC` ring allows any number of producers, in any of
+ * the attached processes, to send concurrently.
+ *
+ * The eventfd is only written when the consumer is blocked in
+ * protobuf_c_shm_ring_wait(), so a busy consumer costs its producers no
+ * system calls.
+ *
+ * Only available on systems with memfd_create() and eventfd().
+ */
+
+#ifndef PROTOBUF_C_SHM_H
+#define PROTOBUF_C_SHM_H
+
+#include <protobuf-c/protobuf-c.h>
+
+PROTOBUF_C__BEGIN_DECLS
+
+/** Who may write to a ring. */
+typedef enum {
+	/** One producer at a time. */
+	PROTOBUF_C_SHM_RING_SPSC,
+	/** Any number of concurrent producers. */
+	PROTOBUF_C_SHM_RING_MPSC,
+} ProtobufCShmRingMode;
+
+/**
+ * One process's handle on a shared ring. Handles are not shared between
+ * processes, but producers in one process may share a handle.
+ */
+typedef struct ProtobufCShmRing ProtobufCShmRing;
+
+/**
+ * Create a ring in a new memfd.
+ *
+ * \param mode
+ *      Whether more than one producer may send at a time.
+ * \param capacity
+ *      Bytes of message data the ring can hold, rounded up to a power of two
+ *      of at least 4 KiB. Each message also takes 8 bytes of header and is
+ *      padded to a multiple of 8 bytes. Messages may be at most half this
+ *      size.
+ * \return
+ *      A handle on the new ring.
+ * \retval NULL
+ *      If the ring could not be created; `errno` says why.
+ */
+PROTOBUF_C__API
+ProtobufCShmRing *
+protobuf_c_shm_ring_new(ProtobufCShmRingMode mode, size_t capacity);
+
+/**
+ * Map a ring created by another process.
+ *
+ * \param shm_fd
+ *      The ring's memfd, see protobuf_c_shm_ring_shm_fd().
+ * \param event_fd
+ *      The ring's eventfd, see protobuf_c_shm_ring_event_fd().
+ * \return
+ *      A handle on the ring, which owns both descriptors from now on.
+ * \retval NULL
+ *      If `shm_fd` does not hold a ring or could not be mapped. The
+ *      descriptors are left open.
+ */
+PROTOBUF_C__API
+ProtobufCShmRing *
+protobuf_c_shm_ring_attach(int shm_fd, int event_fd);
+
+/**
+ * Unmap a ring and close its descriptors. The ring itself goes away with the
+ * last process that has it mapped.
+ *
+ * \param ring
+ *      The handle to free. May be NULL.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_shm_ring_free(ProtobufCShmRing *ring);
+
+/** The memfd holding the ring, to be passed to the peer process. */
+PROTOBUF_C__API
+int
+protobuf_c_shm_ring_shm_fd(const ProtobufCShmRing *ring);
+
+/** The eventfd used for wakeups, to be passed to the peer process. */
+PROTOBUF_C__API
+int
+protobuf_c_shm_ring_event_fd(const ProtobufCShmRing *ring);
+
+/**
+ * Pack a message into the ring and wake the consumer if it is waiting.
+ * Never blocks.
+ *
+ * \param ring
+ *      The ring to send on.
+ * \param message
+ *      The message to pack.
+ * \retval TRUE
+ *      The message was sent.
+ * \retval FALSE
+ *      The ring is too full to take the message at the moment, or the
+ *      message is larger than half the ring's capacity.
+ */
+PROTOBUF_C__API
+protobuf_c_boolean
+protobuf_c_shm_ring_send(ProtobufCShmRing *ring,
+			 const ProtobufCMessage *message);
+
+/**
+ * Look at the oldest message in the ring without consuming it. Only the
+ * consumer may call this.
+ *
+ * The returned bytes are the packed message in shared memory. They stay valid
+ * and unchanged until protobuf_c_shm_ring_release() is called.
+ *
+ * \param ring
+ *      The ring to read from.
+ * \param[out] len
+ *      Length of the packed message.
+ * \return
+ *      The packed message.
+ * \retval NULL
+ *      If the ring is empty, or a peer has corrupted it.
+ */
+PROTOBUF_C__API
+const uint8_t *
+protobuf_c_shm_ring_peek(ProtobufCShmRing *ring, size_t *len);
+
+/**
+ * Consume the message returned by the last protobuf_c_shm_ring_peek(),
+ * freeing its slot for producers.
+ *
+ * \param ring
+ *      The ring to read from.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_shm_ring_release(ProtobufCShmRing *ring);
+
+/**
+ * Wait until the ring holds a message. Only the consumer may call this.
+ *
+ * \param ring
+ *      The ring to wait on.
+ * \param timeout_ms
+ *      The longest time to wait, -1 meaning forever.
+ * \retval TRUE
+ *      A message is ready to be peeked at.
+ * \retval FALSE
+ *      The wait timed out or was interrupted.
+ */
+PROTOBUF_C__API
+protobuf_c_boolean
+protobuf_c_shm_ring_wait(ProtobufCShmRing *ring, int timeout_ms);
+
+PROTOBUF_C__END_DECLS
+
+#endif /* PROTOBUF_C_SHM_H */
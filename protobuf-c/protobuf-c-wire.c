@@ -0,0 +1,1272 @@
+/*
+ * Copyright (c) 2026, the protobuf-c authors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file
+ * Wire-level operations on serialised messages.
+ *
+ * Like protobuf-c-dynamic.c, this has a small wire reader of its own: every
+ * operation here is a walk over the fields of a buffer that only descends
+ * into the submessages it was told about.
+ */
+
+#include <assert.h>
+#include <stdlib.h>	/* for malloc, free */
+#include <string.h>	/* for strchr, strlen, strncmp, memcpy, memset */
+
+#include "protobuf-c-wire.h"
+
+#define TRUE				1
+#define FALSE				0
+
+/* Workaround for Microsoft compilers. */
+#ifdef _MSC_VER
+# define inline __inline
+#endif
+
+/* The largest valid field number. */
+#define MAX_FIELD_NUMBER		((1U << 29) - 1)
+
+/**
+ * \defgroup wire wire reader
+ *
+ * \ingroup internal
+ * @{
+ */
+
+typedef struct {
+	const uint8_t *at;
+	const uint8_t *end;
+} Reader;
+
+/* A field as it appears on the wire. */
+typedef struct {
+	uint32_t tag;
+	ProtobufCWireType wire_type;
+	const uint8_t *start;		/* first byte of the key */
+	const uint8_t *value;		/* first byte after the key */
+	const uint8_t *end;		/* one past the last byte of the field */
+	const uint8_t *payload;		/* the value, minus any length prefix */
+} WireField;
+
+static void *
+system_alloc(void *allocator_data, size_t size)
+{
+	(void)allocator_data;
+	return malloc(size);
+}
+
+static void
+system_free(void *allocator_data, void *data)
+{
+	(void)allocator_data;
+	free(data);
+}
+
+static ProtobufCAllocator wire__allocator = {
+	.alloc = &system_alloc,
+	.free = &system_free,
+	.allocator_data = NULL,
+};
+
+static inline void *
+do_alloc(ProtobufCAllocator *allocator, size_t size)
+{
+	return allocator->alloc(allocator->allocator_data, size);
+}
+
+static inline void
+do_free(ProtobufCAllocator *allocator, void *data)
+{
+	if (data != NULL)
+		allocator->free(allocator->allocator_data, data);
+}
+
+static inline void
+reader_init(Reader *reader, size_t len, const uint8_t *data)
+{
+	reader->at = data;
+	reader->end = data + len;
+}
+
+static protobuf_c_boolean
+read_varint(Reader *reader, uint64_t *out)
+{
+	uint64_t v = 0;
+	unsigned shift = 0;
+
+	do {
+		if (reader->at == reader->end || shift >= 64)
+			return FALSE;
+		v |= (uint64_t) (*reader->at & 0x7f) << shift;
+		shift += 7;
+	} while (*reader->at++ & 0x80);
+	*out = v;
+	return TRUE;
+}
+
+/*
+ * Read the next field without looking at its value. Returns 1 on success, 0
+ * at the end of the data and -1 on malformed input.
+ */
+static int
+next_field(Reader *reader, WireField *field)
+{
+	uint64_t key;
+	uint64_t v;
+
+	if (reader->at == reader->end)
+		return 0;
+	field->start = reader->at;
+	if (!read_varint(reader, &key) ||
+	    (key >> 3) == 0 || (key >> 3) > MAX_FIELD_NUMBER)
+		return -1;
+	field->tag = (uint32_t) (key >> 3);
+	field->wire_type = key & 7;
+	field->value = reader->at;
+	field->payload = reader->at;
+	switch (field->wire_type) {
+	case PROTOBUF_C_WIRE_TYPE_VARINT:
+		if (!read_varint(reader, &v))
+			return -1;
+		break;
+	case PROTOBUF_C_WIRE_TYPE_64BIT:
+		if (reader->end - reader->at < 8)
+			return -1;
+		reader->at += 8;
+		break;
+	case PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED:
+		if (!read_varint(reader, &v) ||
+		    v > (uint64_t) (reader->end - reader->at))
+			return -1;
+		field->payload = reader->at;
+		reader->at += v;
+		break;
+	case PROTOBUF_C_WIRE_TYPE_32BIT:
+		if (reader->end - reader->at < 4)
+			return -1;
+		reader->at += 4;
+		break;
+	default:
+		return -1;
+	}
+	field->end = reader->at;
+	return 1;
+}
+
+static size_t
+varint_pack(uint64_t value, uint8_t *out)
+{
+	size_t rv = 0;
+
+	while (value >= 0x80) {
+		out[rv++] = (uint8_t) (value | 0x80);
+		value >>= 7;
+	}
+	out[rv++] = (uint8_t) value;
+	return rv;
+}
+
+/* Find a field by a name that is not NUL-terminated. */
+static const ProtobufCFieldDescriptor *
+find_field(const ProtobufCMessageDescriptor *desc,
+	   const char *name, size_t name_len)
+{
+	unsigned i;
+
+	for (i = 0; i < desc->n_fields; i++) {
+		const ProtobufCFieldDescriptor *field = desc->fields + i;
+
+		if (strncmp(field->name, name, name_len) == 0 &&
+		    field->name[name_len] == '\0')
+			return field;
+	}
+	return NULL;
+}
+
+/**@}*/
+
+/**
+ * \defgroup paths field paths
+ *
+ * Field sets and key paths are compiled into a tree with a node for the
+ * top-level message and for each submessage field that a path descends into.
+ * Each node has an entry per field of its descriptor.
+ *
+ * \ingroup internal
+ * @{
+ */
+
+typedef struct FieldSetNode FieldSetNode;
+
+typedef struct {
+	protobuf_c_boolean selected;
+	unsigned key;			/* key paths: index of the key */
+	FieldSetNode *child;
+} FieldAction;
+
+struct FieldSetNode {
+	const ProtobufCMessageDescriptor *descriptor;
+	FieldAction *fields;		/* indexed like descriptor->fields */
+};
+
+static FieldSetNode *
+node_new(ProtobufCAllocator *allocator,
+	 const ProtobufCMessageDescriptor *desc)
+{
+	size_t size = sizeof(FieldSetNode) + desc->n_fields * sizeof(FieldAction);
+	FieldSetNode *node = do_alloc(allocator, size);
+
+	if (node == NULL)
+		return NULL;
+	memset(node, 0, size);
+	node->descriptor = desc;
+	node->fields = (FieldAction *) (node + 1);
+	return node;
+}
+
+static void
+node_free(ProtobufCAllocator *allocator, FieldSetNode *node)
+{
+	unsigned i;
+
+	if (node == NULL)
+		return;
+	for (i = 0; i < node->descriptor->n_fields; i++)
+		node_free(allocator, node->fields[i].child);
+	do_free(allocator, node);
+}
+
+/* Number of fields on a path. */
+static unsigned
+path_depth(const char *path)
+{
+	unsigned depth = 1;
+
+	while ((path = strchr(path, '.')) != NULL) {
+		depth++;
+		path++;
+	}
+	return depth;
+}
+
+/*
+ * Add the nodes a path descends through to the tree under `node` and return
+ * the entry of the field it names, or NULL if it names none. With `singular`
+ * set, no field along the path may be repeated. The fields on the path, the
+ * named one last, are stored in `chain` unless it is NULL.
+ */
+static FieldAction *
+add_path(ProtobufCAllocator *allocator,
+	 FieldSetNode *node,
+	 const char *path,
+	 protobuf_c_boolean singular,
+	 const ProtobufCFieldDescriptor **chain)
+{
+	for (;;) {
+		const char *dot = strchr(path, '.');
+		size_t name_len = dot != NULL ? (size_t) (dot - path) : strlen(path);
+		const ProtobufCFieldDescriptor *field;
+		FieldAction *action;
+
+		field = find_field(node->descriptor, path, name_len);
+		if (field == NULL ||
+		    (singular && field->label == PROTOBUF_C_LABEL_REPEATED))
+			return NULL;
+		action = &node->fields[field - node->descriptor->fields];
+		if (chain != NULL)
+			*chain++ = field;
+		if (dot == NULL)
+			return action;
+		if (field->type != PROTOBUF_C_TYPE_MESSAGE)
+			return NULL;
+		if (action->child == NULL) {
+			action->child = node_new(allocator, field->descriptor);
+			if (action->child == NULL)
+				return NULL;
+		}
+		node = action->child;
+		path = dot + 1;
+	}
+}
+
+/**@}*/
+
+/**
+ * \defgroup filter field filtering
+ *
+ * \ingroup internal
+ * @{
+ */
+
+struct ProtobufCWireFieldSet {
+	ProtobufCAllocator *allocator;
+	ProtobufCWireFilterMode mode;
+	FieldSetNode *root;
+};
+
+/* Append to `out`, or only count the bytes if it is NULL. */
+static inline void
+emit(ProtobufCBuffer *out, size_t *out_len, size_t len, const uint8_t *data)
+{
+	*out_len += len;
+	if (out != NULL && len != 0)
+		out->append(out, len, data);
+}
+
+static void
+emit_blank(ProtobufCBuffer *out, size_t *out_len, const WireField *field)
+{
+	static const uint8_t zeros[8];
+
+	emit(out, out_len, field->value - field->start, field->start);
+	switch (field->wire_type) {
+	case PROTOBUF_C_WIRE_TYPE_64BIT:
+		emit(out, out_len, 8, zeros);
+		break;
+	case PROTOBUF_C_WIRE_TYPE_32BIT:
+		emit(out, out_len, 4, zeros);
+		break;
+	default:
+		/* a zero varint, or a zero length */
+		emit(out, out_len, 1, zeros);
+		break;
+	}
+}
+
+/*
+ * Filter one message. With `out` NULL, this only computes the filtered
+ * length, which the caller needs before it can write the length prefix of a
+ * submessage. Submessages nested n levels below the top-level message are
+ * therefore walked n + 1 times.
+ */
+static protobuf_c_boolean
+filter_message(ProtobufCWireFilterMode mode,
+	       const FieldSetNode *node,
+	       size_t len,
+	       const uint8_t *data,
+	       ProtobufCBuffer *out,
+	       size_t *out_len)
+{
+	const ProtobufCMessageDescriptor *desc = node->descriptor;
+	Reader reader;
+	WireField field;
+	int rc;
+
+	reader_init(&reader, len, data);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		const ProtobufCFieldDescriptor *f;
+		const FieldAction *action = NULL;
+		protobuf_c_boolean keep;
+
+		f = protobuf_c_message_descriptor_get_field(desc, field.tag);
+		if (f != NULL)
+			action = &node->fields[f - desc->fields];
+
+		if (action != NULL && action->child != NULL && !action->selected &&
+		    field.wire_type == PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+		{
+			size_t sub_len = 0;
+			uint8_t prefix[10];
+
+			if (!filter_message(mode, action->child,
+					    field.end - field.payload,
+					    field.payload, NULL, &sub_len))
+				return FALSE;
+			emit(out, out_len, field.value - field.start, field.start);
+			emit(out, out_len, varint_pack(sub_len, prefix), prefix);
+			if (out == NULL)
+				*out_len += sub_len;
+			else if (!filter_message(mode, action->child,
+						 field.end - field.payload,
+						 field.payload, out, out_len))
+				return FALSE;
+			continue;
+		}
+
+		if (action != NULL && action->selected) {
+			if (mode == PROTOBUF_C_WIRE_FILTER_BLANK) {
+				emit_blank(out, out_len, &field);
+				continue;
+			}
+			keep = mode == PROTOBUF_C_WIRE_FILTER_KEEP;
+		} else {
+			keep = mode != PROTOBUF_C_WIRE_FILTER_KEEP;
+		}
+		if (keep)
+			emit(out, out_len, field.end - field.start, field.start);
+	}
+	return rc == 0;
+}
+
+/**@}*/
+
+/**
+ * \defgroup view message views
+ *
+ * Index entries hold the offset of the key of an occurrence plus one, so
+ * that zero means none.
+ *
+ * \ingroup internal
+ * @{
+ */
+
+static inline int32_t
+unzigzag32(uint32_t v)
+{
+	return (int32_t) ((v >> 1) ^ -(v & 1));
+}
+
+static inline int64_t
+unzigzag64(uint64_t v)
+{
+	return (int64_t) ((v >> 1) ^ -(v & 1));
+}
+
+static inline uint32_t
+parse_fixed_uint32(const uint8_t *data)
+{
+	return (uint32_t) data[0] | ((uint32_t) data[1] << 8) |
+		((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+static inline uint64_t
+parse_fixed_uint64(const uint8_t *data)
+{
+	return (uint64_t) parse_fixed_uint32(data) |
+		((uint64_t) parse_fixed_uint32(data + 4) << 32);
+}
+
+/* The wire type of a field, or of the elements of a packed field. */
+static ProtobufCWireType
+field_wire_type(ProtobufCType type)
+{
+	switch (type) {
+	case PROTOBUF_C_TYPE_SFIXED32:
+	case PROTOBUF_C_TYPE_FIXED32:
+	case PROTOBUF_C_TYPE_FLOAT:
+		return PROTOBUF_C_WIRE_TYPE_32BIT;
+	case PROTOBUF_C_TYPE_SFIXED64:
+	case PROTOBUF_C_TYPE_FIXED64:
+	case PROTOBUF_C_TYPE_DOUBLE:
+		return PROTOBUF_C_WIRE_TYPE_64BIT;
+	case PROTOBUF_C_TYPE_STRING:
+	case PROTOBUF_C_TYPE_BYTES:
+	case PROTOBUF_C_TYPE_MESSAGE:
+		return PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED;
+	default:
+		return PROTOBUF_C_WIRE_TYPE_VARINT;
+	}
+}
+
+/*
+ * Decode a value of `field` with the given wire type from the reader.
+ * Length-prefixed values must have been read already: the reader then spans
+ * the data, which is returned as a whole.
+ */
+static protobuf_c_boolean
+decode_value(const ProtobufCFieldDescriptor *field,
+	     ProtobufCWireType wire_type,
+	     Reader *reader,
+	     void *value)
+{
+	uint64_t v;
+
+	if (wire_type != field_wire_type(field->type))
+		return FALSE;
+	switch (wire_type) {
+	case PROTOBUF_C_WIRE_TYPE_VARINT:
+		if (!read_varint(reader, &v))
+			return FALSE;
+		switch (field->type) {
+		case PROTOBUF_C_TYPE_INT32:
+		case PROTOBUF_C_TYPE_ENUM:
+			*(int32_t *) value = (int32_t) v;
+			break;
+		case PROTOBUF_C_TYPE_SINT32:
+			*(int32_t *) value = unzigzag32((uint32_t) v);
+			break;
+		case PROTOBUF_C_TYPE_UINT32:
+			*(uint32_t *) value = (uint32_t) v;
+			break;
+		case PROTOBUF_C_TYPE_SINT64:
+			*(int64_t *) value = unzigzag64(v);
+			break;
+		case PROTOBUF_C_TYPE_BOOL:
+			*(protobuf_c_boolean *) value = v != 0;
+			break;
+		default:
+			/* int64, uint64 */
+			*(uint64_t *) value = v;
+			break;
+		}
+		return TRUE;
+	case PROTOBUF_C_WIRE_TYPE_32BIT:
+		if (reader->end - reader->at < 4)
+			return FALSE;
+		v = parse_fixed_uint32(reader->at);
+		reader->at += 4;
+		if (field->type == PROTOBUF_C_TYPE_FLOAT) {
+			uint32_t bits = (uint32_t) v;
+			memcpy(value, &bits, 4);
+		} else {
+			*(uint32_t *) value = (uint32_t) v;
+		}
+		return TRUE;
+	case PROTOBUF_C_WIRE_TYPE_64BIT:
+		if (reader->end - reader->at < 8)
+			return FALSE;
+		v = parse_fixed_uint64(reader->at);
+		reader->at += 8;
+		memcpy(value, &v, 8);
+		return TRUE;
+	default: {
+		ProtobufCBinaryData *bd = value;
+
+		bd->len = reader->end - reader->at;
+		bd->data = (uint8_t *) reader->at;
+		reader->at = reader->end;
+		return TRUE;
+	}
+	}
+}
+
+/* Size of a value as protobuf_c_wire_view_get() stores it. */
+static size_t
+value_size(ProtobufCType type)
+{
+	switch (type) {
+	case PROTOBUF_C_TYPE_INT32:
+	case PROTOBUF_C_TYPE_SINT32:
+	case PROTOBUF_C_TYPE_SFIXED32:
+	case PROTOBUF_C_TYPE_UINT32:
+	case PROTOBUF_C_TYPE_FIXED32:
+	case PROTOBUF_C_TYPE_FLOAT:
+	case PROTOBUF_C_TYPE_ENUM:
+		return 4;
+	case PROTOBUF_C_TYPE_BOOL:
+		return sizeof(protobuf_c_boolean);
+	case PROTOBUF_C_TYPE_STRING:
+	case PROTOBUF_C_TYPE_BYTES:
+	case PROTOBUF_C_TYPE_MESSAGE:
+		return sizeof(ProtobufCBinaryData);
+	default:
+		return 8;
+	}
+}
+
+static void
+default_value(const ProtobufCFieldDescriptor *field, void *value)
+{
+	ProtobufCBinaryData *bd = value;
+
+	if (field->default_value == NULL) {
+		memset(value, 0, value_size(field->type));
+	} else if (field->type == PROTOBUF_C_TYPE_STRING) {
+		bd->data = (uint8_t *) field->default_value;
+		bd->len = strlen(field->default_value);
+	} else if (field->type != PROTOBUF_C_TYPE_MESSAGE) {
+		memcpy(value, field->default_value, value_size(field->type));
+	} else {
+		bd->len = 0;
+		bd->data = NULL;
+	}
+}
+
+/* Stop tracking the other members of a oneof whose member `i` occurred. */
+static void
+clear_oneof(ProtobufCWireView *view, unsigned i)
+{
+	const ProtobufCMessageDescriptor *desc = view->descriptor;
+	unsigned j;
+
+	for (j = 0; j < desc->n_fields; j++)
+		if (j != i &&
+		    (desc->fields[j].flags & PROTOBUF_C_FIELD_FLAG_ONEOF) &&
+		    desc->fields[j].quantifier_offset ==
+		    desc->fields[i].quantifier_offset)
+			view->fields[j].first = view->fields[j].last = 0;
+}
+
+/**@}*/
+
+/**
+ * \defgroup extract key extraction
+ *
+ * \ingroup internal
+ * @{
+ */
+
+typedef struct {
+	unsigned depth;
+	/* the fields on the path, outermost first */
+	const ProtobufCFieldDescriptor **chain;
+} KeyInfo;
+
+struct ProtobufCWireKeyPath {
+	ProtobufCAllocator *allocator;
+	FieldSetNode *root;
+	size_t n_keys;
+	KeyInfo *keys;
+	/* what each key reads as when its field is missing */
+	ProtobufCWireKey *defaults;
+};
+
+static protobuf_c_boolean
+extract_message(const FieldSetNode *node,
+		size_t len,
+		const uint8_t *data,
+		ProtobufCWireKey *keys)
+{
+	const ProtobufCMessageDescriptor *desc = node->descriptor;
+	Reader reader;
+	WireField field;
+	int rc;
+
+	reader_init(&reader, len, data);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		const ProtobufCFieldDescriptor *f;
+		const FieldAction *action;
+
+		f = protobuf_c_message_descriptor_get_field(desc, field.tag);
+		if (f == NULL)
+			continue;
+		action = &node->fields[f - desc->fields];
+		if (action->selected) {
+			ProtobufCWireKey *key = &keys[action->key];
+			Reader value;
+
+			value.at = field.payload;
+			value.end = field.end;
+			if (decode_value(f, field.wire_type, &value, &key->value))
+				key->present = TRUE;
+		} else if (action->child != NULL &&
+			   field.wire_type == PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+		{
+			if (!extract_message(action->child,
+					     field.end - field.payload,
+					     field.payload, keys))
+				return FALSE;
+		}
+	}
+	return rc == 0;
+}
+
+/**@}*/
+
+/**
+ * \defgroup patch field patching
+ *
+ * \ingroup internal
+ * @{
+ */
+
+/* The new encoding of a value: `head`, then `tail_len` bytes at `tail`. */
+typedef struct {
+	uint8_t head[10];
+	size_t head_len;
+	const uint8_t *tail;
+	size_t tail_len;
+} Replacement;
+
+static inline uint32_t
+zigzag32(int32_t v)
+{
+	return ((uint32_t) v << 1) ^ -((uint32_t) v >> 31);
+}
+
+static inline uint64_t
+zigzag64(int64_t v)
+{
+	return ((uint64_t) v << 1) ^ -((uint64_t) v >> 63);
+}
+
+static void
+fixed_pack(uint64_t value, size_t len, uint8_t *out)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		out[i] = (uint8_t) (value >> (8 * i));
+}
+
+/* Encode a value stored as by protobuf_c_wire_view_get(). */
+static void
+encode_value(const ProtobufCFieldDescriptor *field,
+	     const void *value,
+	     Replacement *rep)
+{
+	uint64_t v;
+	uint32_t bits;
+
+	rep->tail = NULL;
+	rep->tail_len = 0;
+	switch (field->type) {
+	case PROTOBUF_C_TYPE_INT32:
+	case PROTOBUF_C_TYPE_ENUM:
+		/* negative values are sign-extended to 64 bits */
+		v = (uint64_t) (int64_t) *(const int32_t *) value;
+		break;
+	case PROTOBUF_C_TYPE_SINT32:
+		v = zigzag32(*(const int32_t *) value);
+		break;
+	case PROTOBUF_C_TYPE_UINT32:
+		v = *(const uint32_t *) value;
+		break;
+	case PROTOBUF_C_TYPE_SINT64:
+		v = zigzag64(*(const int64_t *) value);
+		break;
+	case PROTOBUF_C_TYPE_INT64:
+	case PROTOBUF_C_TYPE_UINT64:
+		v = *(const uint64_t *) value;
+		break;
+	case PROTOBUF_C_TYPE_BOOL:
+		v = *(const protobuf_c_boolean *) value ? 1 : 0;
+		break;
+	case PROTOBUF_C_TYPE_SFIXED32:
+	case PROTOBUF_C_TYPE_FIXED32:
+	case PROTOBUF_C_TYPE_FLOAT:
+		memcpy(&bits, value, 4);
+		fixed_pack(bits, 4, rep->head);
+		rep->head_len = 4;
+		return;
+	case PROTOBUF_C_TYPE_SFIXED64:
+	case PROTOBUF_C_TYPE_FIXED64:
+	case PROTOBUF_C_TYPE_DOUBLE:
+		memcpy(&v, value, 8);
+		fixed_pack(v, 8, rep->head);
+		rep->head_len = 8;
+		return;
+	default: {
+		/* strings and bytes */
+		const ProtobufCBinaryData *bd = value;
+
+		rep->head_len = varint_pack(bd->len, rep->head);
+		rep->tail = bd->data;
+		rep->tail_len = bd->len;
+		return;
+	}
+	}
+	rep->head_len = varint_pack(v, rep->head);
+}
+
+/* Find the occurrence of key `key` that wins, i.e. the last one. */
+static protobuf_c_boolean
+locate_key(const FieldSetNode *node,
+	   unsigned key,
+	   size_t len,
+	   const uint8_t *data,
+	   WireField *found,
+	   protobuf_c_boolean *present)
+{
+	const ProtobufCMessageDescriptor *desc = node->descriptor;
+	Reader reader;
+	WireField field;
+	int rc;
+
+	reader_init(&reader, len, data);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		const ProtobufCFieldDescriptor *f;
+		const FieldAction *action;
+
+		f = protobuf_c_message_descriptor_get_field(desc, field.tag);
+		if (f == NULL)
+			continue;
+		action = &node->fields[f - desc->fields];
+		if (action->selected) {
+			if (action->key == key &&
+			    field.wire_type == field_wire_type(f->type))
+			{
+				*found = field;
+				*present = TRUE;
+			}
+		} else if (action->child != NULL &&
+			   field.wire_type == PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+		{
+			if (!locate_key(action->child, key,
+					field.end - field.payload,
+					field.payload, found, present))
+				return FALSE;
+		}
+	}
+	return rc == 0;
+}
+
+/*
+ * Copy a message to `out`, replacing the value of `target`, which lies
+ * somewhere inside it, and rewriting the length prefixes of the submessages
+ * enclosing it. Everything else is copied in as few pieces as possible.
+ *
+ * With `out` NULL, this only computes the length of the result, which is
+ * added to `*out_len`. As a prefix may change size itself, the new length of
+ * each enclosing submessage is computed this way before it is written.
+ */
+static void
+splice_message(size_t len,
+	       const uint8_t *data,
+	       const WireField *target,
+	       const Replacement *rep,
+	       ProtobufCBuffer *out,
+	       size_t *out_len)
+{
+	Reader reader;
+	WireField field;
+
+	reader_init(&reader, len, data);
+	while (next_field(&reader, &field) > 0 && field.end <= target->start)
+		;
+	emit(out, out_len, field.value - data, data);
+	if (field.start == target->start) {
+		emit(out, out_len, rep->head_len, rep->head);
+		emit(out, out_len, rep->tail_len, rep->tail);
+	} else {
+		size_t sub_len = 0;
+		uint8_t prefix[10];
+
+		splice_message(field.end - field.payload, field.payload,
+			       target, rep, NULL, &sub_len);
+		emit(out, out_len, varint_pack(sub_len, prefix), prefix);
+		if (out == NULL)
+			*out_len += sub_len;
+		else
+			splice_message(field.end - field.payload,
+				       field.payload, target, rep,
+				       out, out_len);
+	}
+	emit(out, out_len, data + len - field.end, field.end);
+}
+
+static size_t
+varint_size(uint64_t value)
+{
+	size_t rv = 1;
+
+	while (value >= 0x80) {
+		value >>= 7;
+		rv++;
+	}
+	return rv;
+}
+
+/* Size of the encoding of the fields on a key's path from `i` inwards. */
+static size_t
+chain_size(const KeyInfo *info, unsigned i, const Replacement *rep)
+{
+	const ProtobufCFieldDescriptor *f = info->chain[i];
+	size_t inner;
+
+	if (i == info->depth - 1) {
+		inner = rep->head_len + rep->tail_len;
+	} else {
+		inner = chain_size(info, i + 1, rep);
+		inner += varint_size(inner);
+	}
+	return varint_size((uint64_t) f->id << 3) + inner;
+}
+
+/*
+ * Write a new occurrence of a key, wrapped in new occurrences of the
+ * submessages on its path from `i` inwards.
+ */
+static void
+append_chain(const KeyInfo *info,
+	     unsigned i,
+	     const Replacement *rep,
+	     ProtobufCBuffer *out)
+{
+	const ProtobufCFieldDescriptor *f = info->chain[i];
+	uint8_t buf[10];
+
+	if (i == info->depth - 1) {
+		out->append(out, varint_pack(((uint64_t) f->id << 3) |
+					     field_wire_type(f->type), buf), buf);
+		out->append(out, rep->head_len, rep->head);
+		if (rep->tail_len != 0)
+			out->append(out, rep->tail_len, rep->tail);
+		return;
+	}
+	out->append(out, varint_pack(((uint64_t) f->id << 3) |
+				     PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED, buf),
+		    buf);
+	out->append(out, varint_pack(chain_size(info, i + 1, rep), buf), buf);
+	append_chain(info, i + 1, rep, out);
+}
+
+/**@}*/
+
+ProtobufCWireFieldSet *
+protobuf_c_wire_field_set_new(ProtobufCAllocator *allocator,
+			      const ProtobufCMessageDescriptor *descriptor,
+			      ProtobufCWireFilterMode mode,
+			      size_t n_paths,
+			      const char *const *paths)
+{
+	ProtobufCWireFieldSet *set;
+	size_t i;
+
+	assert(descriptor->magic == PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC);
+	if (allocator == NULL)
+		allocator = &wire__allocator;
+
+	set = do_alloc(allocator, sizeof(ProtobufCWireFieldSet));
+	if (set == NULL)
+		return NULL;
+	set->allocator = allocator;
+	set->mode = mode;
+	set->root = node_new(allocator, descriptor);
+	if (set->root == NULL)
+		goto error;
+	for (i = 0; i < n_paths; i++) {
+		FieldAction *action = add_path(allocator, set->root, paths[i],
+					       FALSE, NULL);
+
+		if (action == NULL)
+			goto error;
+		action->selected = TRUE;
+	}
+	return set;
+
+error:
+	protobuf_c_wire_field_set_free(set);
+	return NULL;
+}
+
+void
+protobuf_c_wire_field_set_free(ProtobufCWireFieldSet *set)
+{
+	if (set == NULL)
+		return;
+	node_free(set->allocator, set->root);
+	do_free(set->allocator, set);
+}
+
+protobuf_c_boolean
+protobuf_c_wire_filter(const ProtobufCMessageDescriptor *descriptor,
+		       const ProtobufCWireFieldSet *set,
+		       size_t len,
+		       const uint8_t *data,
+		       ProtobufCBuffer *out)
+{
+	size_t out_len = 0;
+
+	if (set->root->descriptor != descriptor)
+		return FALSE;
+	return filter_message(set->mode, set->root, len, data, out, &out_len);
+}
+
+void
+protobuf_c_wire_view_init(ProtobufCWireView *view,
+			  const ProtobufCMessageDescriptor *descriptor,
+			  ProtobufCWireViewField *fields,
+			  size_t len,
+			  const uint8_t *data)
+{
+	view->descriptor = descriptor;
+	view->len = len;
+	view->data = data;
+	view->state = 0;
+	view->fields = fields;
+}
+
+protobuf_c_boolean
+protobuf_c_wire_view_index(ProtobufCWireView *view)
+{
+	const ProtobufCMessageDescriptor *desc = view->descriptor;
+	Reader reader;
+	WireField field;
+	int rc;
+
+	if (view->state != 0)
+		return view->state > 0;
+
+	memset(view->fields, 0, desc->n_fields * sizeof(ProtobufCWireViewField));
+	reader_init(&reader, view->len, view->data);
+	while ((rc = next_field(&reader, &field)) > 0) {
+		const ProtobufCFieldDescriptor *f;
+		ProtobufCWireViewField *entry;
+		size_t offset = field.start - view->data;
+
+		f = protobuf_c_message_descriptor_get_field(desc, field.tag);
+		if (f == NULL)
+			continue;
+		entry = &view->fields[f - desc->fields];
+		if (entry->first == 0)
+			entry->first = offset + 1;
+		entry->last = offset + 1;
+		if ((f->flags & PROTOBUF_C_FIELD_FLAG_ONEOF) != 0)
+			clear_oneof(view, f - desc->fields);
+	}
+	if (rc < 0) {
+		memset(view->fields, 0,
+		       desc->n_fields * sizeof(ProtobufCWireViewField));
+		view->state = -1;
+		return FALSE;
+	}
+	view->state = 1;
+	return TRUE;
+}
+
+protobuf_c_boolean
+protobuf_c_wire_view_get(ProtobufCWireView *view,
+			 unsigned field_index,
+			 void *value)
+{
+	const ProtobufCFieldDescriptor *f = view->descriptor->fields + field_index;
+	size_t last;
+	Reader reader;
+	WireField field;
+
+	protobuf_c_wire_view_index(view);
+	last = view->fields[field_index].last;
+	if (last != 0) {
+		reader_init(&reader, view->len - (last - 1), view->data + last - 1);
+		next_field(&reader, &field);
+		reader.at = field.payload;
+		reader.end = field.end;
+		if (decode_value(f, field.wire_type, &reader, value))
+			return TRUE;
+	}
+	default_value(f, value);
+	return FALSE;
+}
+
+void
+protobuf_c_wire_view_iter_init(ProtobufCWireView *view,
+			       unsigned field_index,
+			       ProtobufCWireViewIter *iter)
+{
+	size_t first;
+
+	protobuf_c_wire_view_index(view);
+	first = view->fields[field_index].first;
+	iter->field = view->descriptor->fields + field_index;
+	iter->at = first != 0 ? view->data + first - 1 : NULL;
+	iter->end = first != 0 ? view->data + view->len : NULL;
+	iter->packed_at = NULL;
+	iter->packed_end = NULL;
+}
+
+protobuf_c_boolean
+protobuf_c_wire_view_iter_next(ProtobufCWireViewIter *iter, void *value)
+{
+	ProtobufCWireType element_type = field_wire_type(iter->field->type);
+	Reader reader;
+	WireField field;
+
+	for (;;) {
+		if (iter->packed_at != iter->packed_end) {
+			reader.at = iter->packed_at;
+			reader.end = iter->packed_end;
+			if (!decode_value(iter->field, element_type, &reader, value))
+				break;
+			iter->packed_at = reader.at;
+			return TRUE;
+		}
+
+		reader.at = iter->at;
+		reader.end = iter->end;
+		if (next_field(&reader, &field) <= 0)
+			break;
+		iter->at = reader.at;
+		if (field.tag != iter->field->id)
+			continue;
+		if (field.wire_type == PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED &&
+		    element_type != PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+		{
+			iter->packed_at = field.payload;
+			iter->packed_end = field.end;
+			continue;
+		}
+		reader.at = field.payload;
+		reader.end = field.end;
+		if (!decode_value(iter->field, field.wire_type, &reader, value))
+			break;
+		return TRUE;
+	}
+	iter->at = iter->end;
+	iter->packed_at = iter->packed_end;
+	return FALSE;
+}
+
+ProtobufCWireKeyPath *
+protobuf_c_wire_key_path_new(ProtobufCAllocator *allocator,
+			     const ProtobufCMessageDescriptor *descriptor,
+			     size_t n_paths,
+			     const char *const *paths)
+{
+	ProtobufCWireKeyPath *path;
+	size_t i;
+
+	assert(descriptor->magic == PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC);
+	if (allocator == NULL)
+		allocator = &wire__allocator;
+
+	path = do_alloc(allocator, sizeof(ProtobufCWireKeyPath));
+	if (path == NULL)
+		return NULL;
+	path->allocator = allocator;
+	path->n_keys = 0;
+	path->root = node_new(allocator, descriptor);
+	path->keys = do_alloc(allocator, (n_paths ? n_paths : 1) * sizeof(KeyInfo));
+	path->defaults = do_alloc(allocator,
+				  (n_paths ? n_paths : 1) * sizeof(ProtobufCWireKey));
+	if (path->root == NULL || path->keys == NULL || path->defaults == NULL)
+		goto error;
+	for (i = 0; i < n_paths; i++) {
+		KeyInfo *info = &path->keys[i];
+		const ProtobufCFieldDescriptor *field;
+		FieldAction *action;
+
+		info->depth = path_depth(paths[i]);
+		info->chain = do_alloc(allocator, info->depth *
+				       sizeof(const ProtobufCFieldDescriptor *));
+		if (info->chain == NULL)
+			goto error;
+		path->n_keys++;
+		action = add_path(allocator, path->root, paths[i], TRUE,
+				  info->chain);
+		if (action == NULL)
+			goto error;
+		field = info->chain[info->depth - 1];
+		if (action->selected || field->type == PROTOBUF_C_TYPE_MESSAGE)
+			goto error;
+		action->selected = TRUE;
+		action->key = i;
+		path->defaults[i].field = field;
+		path->defaults[i].present = FALSE;
+		default_value(field, &path->defaults[i].value);
+	}
+	return path;
+
+error:
+	protobuf_c_wire_key_path_free(path);
+	return NULL;
+}
+
+void
+protobuf_c_wire_key_path_free(ProtobufCWireKeyPath *path)
+{
+	size_t i;
+
+	if (path == NULL)
+		return;
+	node_free(path->allocator, path->root);
+	for (i = 0; i < path->n_keys; i++)
+		do_free(path->allocator, path->keys[i].chain);
+	do_free(path->allocator, path->keys);
+	do_free(path->allocator, path->defaults);
+	do_free(path->allocator, path);
+}
+
+protobuf_c_boolean
+protobuf_c_wire_extract(const ProtobufCWireKeyPath *path,
+			size_t len,
+			const uint8_t *data,
+			ProtobufCWireKey *keys)
+{
+	size_t size = path->n_keys * sizeof(ProtobufCWireKey);
+
+	memcpy(keys, path->defaults, size);
+	if (extract_message(path->root, len, data, keys))
+		return TRUE;
+	memcpy(keys, path->defaults, size);
+	return FALSE;
+}
+
+size_t
+protobuf_c_wire_extract_batch(const ProtobufCWireKeyPath *path,
+			      size_t n,
+			      const size_t *lens,
+			      const uint8_t *const *datas,
+			      ProtobufCWireKey *keys)
+{
+	size_t n_extracted = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		if (protobuf_c_wire_extract(path, lens[i], datas[i],
+					    keys + i * path->n_keys))
+			n_extracted++;
+	return n_extracted;
+}
+
+protobuf_c_boolean
+protobuf_c_wire_patch_in_place(const ProtobufCWireKeyPath *path,
+			       unsigned key,
+			       size_t len,
+			       uint8_t *data,
+			       const void *value)
+{
+	const KeyInfo *info = &path->keys[key];
+	protobuf_c_boolean present = FALSE;
+	WireField target;
+	Replacement rep;
+	uint8_t *at;
+
+	assert(key < path->n_keys);
+	if (!locate_key(path->root, key, len, data, &target, &present) ||
+	    !present)
+		return FALSE;
+	encode_value(info->chain[info->depth - 1], value, &rep);
+	if (rep.head_len + rep.tail_len != (size_t) (target.end - target.value))
+		return FALSE;
+	at = data + (target.value - data);
+	memcpy(at, rep.head, rep.head_len);
+	if (rep.tail_len != 0)
+		memmove(at + rep.head_len, rep.tail, rep.tail_len);
+	return TRUE;
+}
+
+protobuf_c_boolean
+protobuf_c_wire_patch(const ProtobufCWireKeyPath *path,
+		      unsigned key,
+		      size_t len,
+		      const uint8_t *data,
+		      const void *value,
+		      ProtobufCBuffer *out)
+{
+	const KeyInfo *info = &path->keys[key];
+	protobuf_c_boolean present = FALSE;
+	WireField target;
+	Replacement rep;
+
+	assert(key < path->n_keys);
+	if (!locate_key(path->root, key, len, data, &target, &present))
+		return FALSE;
+	encode_value(info->chain[info->depth - 1], value, &rep);
+	if (present) {
+		size_t out_len = 0;
+
+		splice_message(len, data, &target, &rep, out, &out_len);
+	} else {
+		if (len != 0)
+			out->append(out, len, data);
+		append_chain(info, 0, &rep, out);
+	}
+	return TRUE;
+}
@@ -0,0 +1,488 @@
+/*
+ * Copyright (c) 2026, the protobuf-c authors.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file
+ * Operations on serialised messages that work directly on the wire format,
+ * guided by a `ProtobufCMessageDescriptor`, without unpacking the message:
+ * filtering fields, reading individual fields through a view, extracting
+ * key fields and patching them.
+ *
+ * Field sets and key paths name fields by dotted paths of field names
+ * relative to the top-level message, e.g. `"sender.address"` for the
+ * `address` field of the `sender` submessage. Every component but the last
+ * must name a message field; if it is repeated, the path applies to each of
+ * its elements.
+ *
+ * Unknown fields, and fields whose wire type does not match the descriptor,
+ * are treated as opaque byte ranges. Groups are not supported.
+ */
+
+#ifndef PROTOBUF_C_WIRE_H
+#define PROTOBUF_C_WIRE_H
+
+#include <protobuf-c/protobuf-c.h>
+
+PROTOBUF_C__BEGIN_DECLS
+
+/** What protobuf_c_wire_filter() does with the fields of a field set. */
+typedef enum {
+	/** Copy only the fields in the set; everything else is dropped. */
+	PROTOBUF_C_WIRE_FILTER_KEEP,
+
+	/** Copy everything except the fields in the set. */
+	PROTOBUF_C_WIRE_FILTER_DROP,
+
+	/**
+	 * Copy everything, replacing the value of each field in the set with
+	 * zero or, for length-prefixed fields, the empty string. Unlike
+	 * `PROTOBUF_C_WIRE_FILTER_DROP`, required fields stay present.
+	 */
+	PROTOBUF_C_WIRE_FILTER_BLANK,
+} ProtobufCWireFilterMode;
+
+/** Opaque set of fields, compiled against a message descriptor. */
+typedef struct ProtobufCWireFieldSet ProtobufCWireFieldSet;
+
+/**
+ * Compile a set of field paths for protobuf_c_wire_filter().
+ *
+ * Naming a message field selects it as a whole; naming fields inside it
+ * applies the filter to its contents only. A field that is selected as a
+ * whole is not also descended into.
+ *
+ * \param allocator
+ *      `ProtobufCAllocator` used for the set. May be NULL to specify the
+ *      default allocator.
+ * \param descriptor
+ *      The message descriptor the paths are relative to.
+ * \param mode
+ *      What the filter does with the selected fields.
+ * \param n_paths
+ *      Number of paths.
+ * \param paths
+ *      Dotted field paths.
+ * \return
+ *      A new field set.
+ * \retval NULL
+ *      If a path does not name a field or memory could not be allocated.
+ */
+PROTOBUF_C__API
+ProtobufCWireFieldSet *
+protobuf_c_wire_field_set_new(
+	ProtobufCAllocator *allocator,
+	const ProtobufCMessageDescriptor *descriptor,
+	ProtobufCWireFilterMode mode,
+	size_t n_paths,
+	const char *const *paths);
+
+/**
+ * Free a field set.
+ *
+ * \param set
+ *      A set returned by protobuf_c_wire_field_set_new(). May be NULL.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_wire_field_set_free(ProtobufCWireFieldSet *set);
+
+/**
+ * Copy a serialised message to `out`, keeping, dropping or blanking the
+ * fields of `set`.
+ *
+ * The message is never unpacked: fields are copied as byte ranges, and only
+ * submessages with selected fields inside them are parsed, recursively, so
+ * that their length prefixes can be rewritten. The output is a valid
+ * serialisation of `descriptor` as long as the filter leaves no required
+ * field missing.
+ *
+ * \param descriptor
+ *      The message descriptor `set` was compiled against.
+ * \param set
+ *      The fields to filter.
+ * \param len
+ *      Length in bytes of the serialised message.
+ * \param data
+ *      Pointer to the serialised message.
+ * \param out
+ *      Buffer the filtered message is appended to.
+ * \retval TRUE
+ *      On success.
+ * \retval FALSE
+ *      If the message is malformed or `set` was compiled against another
+ *      descriptor. Part of the output may already have been appended to
+ *      `out`.
+ */
+PROTOBUF_C__API
+protobuf_c_boolean
+protobuf_c_wire_filter(
+	const ProtobufCMessageDescriptor *descriptor,
+	const ProtobufCWireFieldSet *set,
+	size_t len,
+	const uint8_t *data,
+	ProtobufCBuffer *out);
+
+/** Where a field occurs in the data of a view. Internal to the view. */
+typedef struct {
+	size_t first;
+	size_t last;
+} ProtobufCWireViewField;
+
+/**
+ * A read-only view of a serialised message, reading fields straight from
+ * the serialised data.
+ *
+ * The first access builds an index of where each field occurs, in a single
+ * pass over the top-level fields of the message that does not allocate.
+ * Each access then decodes only the field it asks for. Strings, bytes and
+ * submessages are returned as `ProtobufCBinaryData` pointing into the data,
+ * which must therefore outlive the view; strings are not NUL-terminated.
+ *
+ * Generated code embeds a view, along with storage for its index, in a
+ * `$classname$View` type with typed accessors. A view refers to its own index,
+ * so it must not be copied.
+ *
+ * Singular fields read their last occurrence, or the last occurrence of any
+ * member of their oneof. A submessage split over several occurrences is only
+ * read from the last one.
+ */
+typedef struct {
+	const ProtobufCMessageDescriptor *descriptor;
+	size_t len;
+	const uint8_t *data;
+	/** 0 before the index is built, 1 after, -1 if `data` is malformed. */
+	int state;
+	/** The index, with an entry per field of `descriptor`. */
+	ProtobufCWireViewField *fields;
+} ProtobufCWireView;
+
+/** Iterator over the values of a repeated field of a view. */
+typedef struct {
+	const ProtobufCFieldDescriptor *field;
+	const uint8_t *at;
+	const uint8_t *end;
+	/* the rest of the current packed run */
+	const uint8_t *packed_at;
+	const uint8_t *packed_end;
+} ProtobufCWireViewIter;
+
+/**
+ * Set up a view of a serialised message. Nothing is read yet.
+ *
+ * \param view
+ *      The view to initialise.
+ * \param descriptor
+ *      The message descriptor.
+ * \param fields
+ *      Storage for the index, with `descriptor->n_fields` entries.
+ * \param len
+ *      Length in bytes of the serialised message.
+ * \param data
+ *      Pointer to the serialised message.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_wire_view_init(
+	ProtobufCWireView *view,
+	const ProtobufCMessageDescriptor *descriptor,
+	ProtobufCWireViewField *fields,
+	size_t len,
+	const uint8_t *data);
+
+/**
+ * Build the index of a view, if that has not happened yet. Accessors do this
+ * on their own; calling it explicitly tells malformed data apart from
+ * missing fields.
+ *
+ * \param view
+ *      The view.
+ * \retval TRUE
+ *      If the top-level fields of the message are well-formed.
+ * \retval FALSE
+ *      If they are not. Every field of the view then reads as missing.
+ */
+PROTOBUF_C__API
+protobuf_c_boolean
+protobuf_c_wire_view_index(ProtobufCWireView *view);
+
+/**
+ * Read a singular field of a view.
+ *
+ * `value` receives the field's value in the type used for it in message
+ * structures, except that strings, bytes and submessages are returned as
+ * `ProtobufCBinaryData`. If the field is missing or cannot be decoded, its
+ * default value is returned.
+ *
+ * \param view
+ *      The view.
+ * \param field_index
+ *      Index of the field in `view->descriptor->fields`.
+ * \param[out] value
+ *      Where the value is stored.
+ * \retval TRUE
+ *      If the field is present.
+ * \retval FALSE
+ *      If the field is missing or malformed.
+ */
+PROTOBUF_C__API
+protobuf_c_boolean
+protobuf_c_wire_view_get(
+	ProtobufCWireView *view,
+	unsigned field_index,
+	void *value);
+
+/**
+ * Start iterating over the values of a repeated field of a view, packed or
+ * not.
+ *
+ * \param view
+ *      The view.
+ * \param field_index
+ *      Index of the field in `view->descriptor->fields`.
+ * \param[out] iter
+ *      The iterator to initialise.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_wire_view_iter_init(
+	ProtobufCWireView *view,
+	unsigned field_index,
+	ProtobufCWireViewIter *iter);
+
+/**
+ * Read the next value of a repeated field, stored as by
+ * protobuf_c_wire_view_get().
+ *
+ * \param iter
+ *      The iterator.
+ * \param[out] value
+ *      Where the value is stored.
+ * \retval TRUE
+ *      If there was another value.
+ * \retval FALSE
+ *      At the end of the field, or at the first value that cannot be
+ *      decoded.
+ */
+PROTOBUF_C__API
+protobuf_c_boolean
+protobuf_c_wire_view_iter_next(
+	ProtobufCWireViewIter *iter,
+	void *value);
+
+/** Opaque list of key fields, compiled against a message descriptor. */
+typedef struct ProtobufCWireKeyPath ProtobufCWireKeyPath;
+
+/** A key value extracted by protobuf_c_wire_extract(). */
+typedef struct {
+	/** The key field. */
+	const ProtobufCFieldDescriptor	*field;
+	/** Whether the field was present; if not, `value` is its default. */
+	protobuf_c_boolean		present;
+	/**
+	 * The value, stored as by protobuf_c_wire_view_get(). Enum values are
+	 * in `v_int32`, strings and bytes in `v_binary`, pointing into the
+	 * serialised data.
+	 */
+	union {
+		int32_t			v_int32;
+		uint32_t		v_uint32;
+		int64_t			v_int64;
+		uint64_t		v_uint64;
+		float			v_float;
+		double			v_double;
+		protobuf_c_boolean	v_boolean;
+		ProtobufCBinaryData	v_binary;
+	} value;
+} ProtobufCWireKey;
+
+/**
+ * Compile the key fields for protobuf_c_wire_extract().
+ *
+ * Each path must name a different singular scalar, string or bytes field,
+ * and only pass through singular message fields.
+ *
+ * \param allocator
+ *      `ProtobufCAllocator` used for the key path. May be NULL to specify
+ *      the default allocator.
+ * \param descriptor
+ *      The message descriptor the paths are relative to.
+ * \param n_paths
+ *      Number of key fields.
+ * \param paths
+ *      Dotted field paths of the key fields.
+ * \return
+ *      A new key path.
+ * \retval NULL
+ *      If a path does not name a suitable field, or memory could not be
+ *      allocated.
+ */
+PROTOBUF_C__API
+ProtobufCWireKeyPath *
+protobuf_c_wire_key_path_new(
+	ProtobufCAllocator *allocator,
+	const ProtobufCMessageDescriptor *descriptor,
+	size_t n_paths,
+	const char *const *paths);
+
+/**
+ * Free a key path.
+ *
+ * \param path
+ *      A key path returned by protobuf_c_wire_key_path_new(). May be NULL.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_wire_key_path_free(ProtobufCWireKeyPath *path);
+
+/**
+ * Extract the key fields from a serialised message.
+ *
+ * The message is read in a single pass that skips over every field that is
+ * not a key or does not contain one, without decoding it. As when
+ * unpacking, the last occurrence of a field wins.
+ *
+ * \param path
+ *      The key fields.
+ * \param len
+ *      Length in bytes of the serialised message.
+ * \param data
+ *      Pointer to the serialised message.
+ * \param[out] keys
+ *      Array receiving one value per key field, in the order of the paths.
+ * \retval TRUE
+ *      On success.
+ * \retval FALSE
+ *      If the message is malformed. Every key then reads as missing.
+ */
+PROTOBUF_C__API
+protobuf_c_boolean
+protobuf_c_wire_extract(
+	const ProtobufCWireKeyPath *path,
+	size_t len,
+	const uint8_t *data,
+	ProtobufCWireKey *keys);
+
+/**
+ * Extract the key fields from each of a batch of serialised messages, as
+ * protobuf_c_wire_extract() does.
+ *
+ * \param path
+ *      The key fields.
+ * \param n
+ *      Number of messages in the batch.
+ * \param lens
+ *      Length in bytes of each serialised message.
+ * \param datas
+ *      Pointer to each serialised message.
+ * \param[out] keys
+ *      Array receiving the keys of each message in turn, i.e. `n` times as
+ *      many values as there are key fields.
+ * \return
+ *      Number of messages that were not malformed.
+ */
+PROTOBUF_C__API
+size_t
+protobuf_c_wire_extract_batch(
+	const ProtobufCWireKeyPath *path,
+	size_t n,
+	const size_t *lens,
+	const uint8_t *const *datas,
+	ProtobufCWireKey *keys);
+
+/**
+ * Overwrite the value of a key field in a serialised message, in place.
+ *
+ * This only succeeds if the field is present and its new encoding is the
+ * same size as the old one, which is always the case for fixed32, fixed64,
+ * sfixed32, sfixed64, float and double fields; nothing else in the message
+ * is touched. As when unpacking, the last occurrence of the field is the
+ * one that is patched.
+ *
+ * \param path
+ *      The key fields.
+ * \param key
+ *      Index of the key field to patch.
+ * \param len
+ *      Length in bytes of the serialised message.
+ * \param data
+ *      Pointer to the serialised message.
+ * \param value
+ *      The new value, stored as in `ProtobufCWireKey`.
+ * \retval TRUE
+ *      If the message was patched.
+ * \retval FALSE
+ *      If the field is missing, its new encoding has a different size, or
+ *      the message is malformed. The message is left unchanged.
+ */
+PROTOBUF_C__API
+protobuf_c_boolean
+protobuf_c_wire_patch_in_place(
+	const ProtobufCWireKeyPath *path,
+	unsigned key,
+	size_t len,
+	uint8_t *data,
+	const void *value);
+
+/**
+ * Copy a serialised message to `out`, setting the value of a key field.
+ *
+ * The last occurrence of the field is replaced and the length prefixes of
+ * the submessages enclosing it are rewritten; the rest of the message is
+ * copied as is. If the field is missing, it is appended together with the
+ * submessages on its path, which merge with any existing ones on unpacking.
+ *
+ * \param path
+ *      The key fields.
+ * \param key
+ *      Index of the key field to set.
+ * \param len
+ *      Length in bytes of the serialised message.
+ * \param data
+ *      Pointer to the serialised message.
+ * \param value
+ *      The new value, stored as in `ProtobufCWireKey`.
+ * \param out
+ *      Buffer receiving the patched message.
+ * \retval TRUE
+ *      On success.
+ * \retval FALSE
+ *      If the message is malformed. Nothing is written to `out`.
+ */
+PROTOBUF_C__API
+protobuf_c_boolean
+protobuf_c_wire_patch(
+	const ProtobufCWireKeyPath *path,
+	unsigned key,
+	size_t len,
+	const uint8_t *data,
+	const void *value,
+	ProtobufCBuffer *out);
+
+PROTOBUF_C__END_DECLS
+
+#endif /* PROTOBUF_C_WIRE_H */
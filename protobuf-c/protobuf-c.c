@@ -39,16 +39,19 @@
  */
 
 /**
- * \todo 64-BIT OPTIMIZATION: certain implementations use 32-bit math
- * even on 64-bit platforms (uint64_size, uint64_pack, parse_uint64).
- *
  * \todo Use size_t consistently.
  */
 
 #include <stdlib.h>	/* for malloc, free */
 #include <string.h>	/* for strcmp, strlen, memcpy, memmove, memset */
 
+#if defined(__BMI2__) && defined(__x86_64__)
+# include <immintrin.h>	/* for _pdep_u64, _pext_u64 */
+# define HAVE_BMI2 1
+#endif
+
 #include "protobuf-c.h"
+#include "protobuf-c-private.h"
 
 #define TRUE				1
 #define FALSE				0
@@ -80,6 +83,21 @@
 /** The maximum length of a 64-bit integer in varint encoding. */
 #define MAX_UINT64_ENCODED_SIZE		10
 
+/**
+ * Size of the blocks that packed repeated varints are encoded into before
+ * being appended to a `ProtobufCBuffer`.
+ */
+#define PACKED_BLOCK_SIZE		4096
+
+/* Keeps a large stack buffer out of the frames of recursive callers. */
+#if defined(__GNUC__)
+# define NOINLINE __attribute__((__noinline__))
+#elif defined(_MSC_VER)
+# define NOINLINE __declspec(noinline)
+#else
+# define NOINLINE
+#endif
+
 #ifndef PROTOBUF_C_UNPACK_ERROR
 # define PROTOBUF_C_UNPACK_ERROR(...)
 #endif
@@ -145,6 +163,166 @@ protobuf_c_version_number(void)
 	return PROTOBUF_C_VERSION_NUMBER;
 }
 
+/* --- statistics --- */
+
+#ifdef PROTOBUF_C_ENABLE_STATS
+
+#if defined(__GNUC__)
+# define STATS_ADD(counter, n) \
+	((void) __atomic_fetch_add(&(counter), (uint64_t) (n), __ATOMIC_RELAXED))
+# define STATS_LOAD(value) __atomic_load_n(&(value), __ATOMIC_RELAXED)
+#else
+# define STATS_ADD(counter, n) ((void) ((counter) += (n)))
+# define STATS_LOAD(value) (value)
+#endif
+
+static ProtobufCStats stats_global;
+static ProtobufCStatsMessage stats_messages[PROTOBUF_C_STATS_MAX_MESSAGES];
+static ProtobufCTraceFunc stats_trace_func;
+static void *stats_trace_data;
+
+/*
+ * Find or claim the counters of a message type in an open-addressed table.
+ * Returns NULL once the table is full.
+ */
+static ProtobufCStatsMessage *
+stats_message_slot(const ProtobufCMessageDescriptor *desc)
+{
+	size_t hash = ((uintptr_t) desc >> 4) * 2654435761u;
+	unsigned i;
+
+	for (i = 0; i < PROTOBUF_C_STATS_MAX_MESSAGES; i++) {
+		ProtobufCStatsMessage *slot = stats_messages +
+			((hash + i) & (PROTOBUF_C_STATS_MAX_MESSAGES - 1));
+		const ProtobufCMessageDescriptor *cur =
+			STATS_LOAD(slot->descriptor);
+
+		if (cur == desc)
+			return slot;
+		if (cur != NULL)
+			continue;
+#if defined(__GNUC__)
+		if (__atomic_compare_exchange_n(&slot->descriptor, &cur, desc,
+						FALSE, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED) ||
+		    cur == desc)
+			return slot;
+#else
+		slot->descriptor = desc;
+		return slot;
+#endif
+	}
+	return NULL;
+}
+
+static void
+stats_record(ProtobufCTraceEvent event,
+	     const ProtobufCMessageDescriptor *desc,
+	     size_t size)
+{
+	ProtobufCStatsMessage *slot;
+
+	switch (event) {
+	case PROTOBUF_C_TRACE_ALLOC:
+		STATS_ADD(stats_global.n_allocs, 1);
+		STATS_ADD(stats_global.alloc_bytes, size);
+		break;
+	case PROTOBUF_C_TRACE_FREE:
+		STATS_ADD(stats_global.n_frees, 1);
+		break;
+	case PROTOBUF_C_TRACE_PACK:
+		slot = stats_message_slot(desc);
+		if (slot != NULL) {
+			STATS_ADD(slot->n_packed, 1);
+			STATS_ADD(slot->packed_bytes, size);
+		}
+		break;
+	case PROTOBUF_C_TRACE_UNPACK:
+		slot = stats_message_slot(desc);
+		if (slot != NULL) {
+			STATS_ADD(slot->n_unpacked, 1);
+			STATS_ADD(slot->unpacked_bytes, size);
+		}
+		break;
+	case PROTOBUF_C_TRACE_SCANNED_MEMBER_SPILL:
+		STATS_ADD(stats_global.n_scanned_member_spills, 1);
+		break;
+	case PROTOBUF_C_TRACE_UNKNOWN_FIELDS:
+		STATS_ADD(stats_global.n_unknown_fields, size);
+		break;
+	}
+	if (stats_trace_func != NULL)
+		stats_trace_func(event, desc, size, stats_trace_data);
+}
+
+# define STATS_RECORD(event, desc, size) stats_record((event), (desc), (size))
+#else
+# define STATS_RECORD(event, desc, size) do { } while (0)
+#endif /* PROTOBUF_C_ENABLE_STATS */
+
+protobuf_c_boolean
+protobuf_c_stats_snapshot(ProtobufCStats *stats,
+			  size_t max_messages,
+			  ProtobufCStatsMessage *messages)
+{
+#ifdef PROTOBUF_C_ENABLE_STATS
+	unsigned i;
+
+	stats->n_allocs = STATS_LOAD(stats_global.n_allocs);
+	stats->alloc_bytes = STATS_LOAD(stats_global.alloc_bytes);
+	stats->n_frees = STATS_LOAD(stats_global.n_frees);
+	stats->n_scanned_member_spills =
+		STATS_LOAD(stats_global.n_scanned_member_spills);
+	stats->n_unknown_fields = STATS_LOAD(stats_global.n_unknown_fields);
+	stats->n_messages = 0;
+	for (i = 0; i < PROTOBUF_C_STATS_MAX_MESSAGES; i++) {
+		ProtobufCStatsMessage *slot = stats_messages + i;
+		const ProtobufCMessageDescriptor *desc =
+			STATS_LOAD(slot->descriptor);
+
+		if (desc == NULL)
+			continue;
+		if (stats->n_messages < max_messages) {
+			ProtobufCStatsMessage *out = messages + stats->n_messages;
+
+			out->descriptor = desc;
+			out->n_packed = STATS_LOAD(slot->n_packed);
+			out->packed_bytes = STATS_LOAD(slot->packed_bytes);
+			out->n_unpacked = STATS_LOAD(slot->n_unpacked);
+			out->unpacked_bytes = STATS_LOAD(slot->unpacked_bytes);
+		}
+		stats->n_messages++;
+	}
+	return TRUE;
+#else
+	(void) max_messages;
+	(void) messages;
+	memset(stats, 0, sizeof(*stats));
+	return FALSE;
+#endif
+}
+
+void
+protobuf_c_stats_reset(void)
+{
+#ifdef PROTOBUF_C_ENABLE_STATS
+	memset(&stats_global, 0, sizeof(stats_global));
+	memset(stats_messages, 0, sizeof(stats_messages));
+#endif
+}
+
+void
+protobuf_c_stats_set_trace(ProtobufCTraceFunc func, void *trace_data)
+{
+#ifdef PROTOBUF_C_ENABLE_STATS
+	stats_trace_func = func;
+	stats_trace_data = trace_data;
+#else
+	(void) func;
+	(void) trace_data;
+#endif
+}
+
 /* --- allocator --- */
 
 static void *
@@ -164,14 +342,17 @@ system_free(void *allocator_data, void *data)
 static inline void *
 do_alloc(ProtobufCAllocator *allocator, size_t size)
 {
+	STATS_RECORD(PROTOBUF_C_TRACE_ALLOC, NULL, size);
 	return allocator->alloc(allocator->allocator_data, size);
 }
 
 static inline void
 do_free(ProtobufCAllocator *allocator, void *data)
 {
-	if (data != NULL)
+	if (data != NULL) {
+		STATS_RECORD(PROTOBUF_C_TRACE_FREE, NULL, 0);
 		allocator->free(allocator->allocator_data, data);
+	}
 }
 
 /*
@@ -218,6 +399,83 @@ protobuf_c_buffer_simple_append(ProtobufCBuffer *buffer,
 	simp->len = new_len;
 }
 
+/* === arena === */
+
+/* Header of a block obtained from the system allocator by an arena. */
+typedef union ArenaBlock {
+	union ArenaBlock *next;
+	uint64_t align_u64;
+	double align_double;
+} ArenaBlock;
+
+#define ARENA_ALIGN(size) \
+	(((size) + sizeof(ArenaBlock) - 1) & ~(sizeof(ArenaBlock) - 1))
+
+static void *
+arena_alloc(void *allocator_data, size_t size)
+{
+	ProtobufCArena *arena = allocator_data;
+	size_t start = ARENA_ALIGN(arena->used);
+	ArenaBlock *block;
+
+	if (arena->data != NULL &&
+	    start <= arena->size && size <= arena->size - start)
+	{
+		arena->used = start + size;
+		return arena->data + start;
+	}
+	if (size > SIZE_MAX - sizeof(ArenaBlock))
+		return NULL;
+	block = malloc(sizeof(ArenaBlock) + size);
+	if (block == NULL)
+		return NULL;
+	block->next = arena->overflow;
+	arena->overflow = block;
+	return block + 1;
+}
+
+static void
+arena_free(void *allocator_data, void *data)
+{
+	(void) allocator_data;
+	(void) data;
+}
+
+void
+protobuf_c_arena_init(ProtobufCArena *arena, void *scratch, size_t size)
+{
+	size_t skip = (sizeof(ArenaBlock) -
+		       (uintptr_t) scratch % sizeof(ArenaBlock)) %
+		      sizeof(ArenaBlock);
+
+	arena->base.alloc = arena_alloc;
+	arena->base.free = arena_free;
+	arena->base.allocator_data = arena;
+	if (scratch == NULL || size <= skip) {
+		arena->data = NULL;
+		arena->size = 0;
+	} else {
+		arena->data = (uint8_t *) scratch + skip;
+		arena->size = size - skip;
+	}
+	arena->used = 0;
+	arena->overflow = NULL;
+}
+
+void
+protobuf_c_arena_clear(ProtobufCArena *arena)
+{
+	ArenaBlock *block = arena->overflow;
+
+	while (block != NULL) {
+		ArenaBlock *next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->used = 0;
+	arena->overflow = NULL;
+}
+
 /**
  * \defgroup packedsz protobuf_c_message_get_packed_size() implementation
  *
@@ -264,6 +522,10 @@ get_tag_size(uint32_t number)
 static inline size_t
 uint32_size(uint32_t v)
 {
+#if defined(__GNUC__)
+	/* one byte per 7 bits up to and including the highest set bit */
+	return ((31 - __builtin_clz(v | 1)) * 9 + 73) / 64;
+#else
 	if (v < (1UL << 7)) {
 		return 1;
 	} else if (v < (1UL << 14)) {
@@ -275,6 +537,7 @@ uint32_size(uint32_t v)
 	} else {
 		return 5;
 	}
+#endif
 }
 
 /**
@@ -348,6 +611,9 @@ sint32_size(int32_t v)
 static inline size_t
 uint64_size(uint64_t v)
 {
+#if defined(__GNUC__)
+	return ((63 - __builtin_clzll(v | 1)) * 9 + 73) / 64;
+#else
 	uint32_t upper_v = (uint32_t) (v >> 32);
 
 	if (upper_v == 0) {
@@ -365,6 +631,7 @@ uint64_size(uint64_t v)
 	} else {
 		return 10;
 	}
+#endif
 }
 
 /**
@@ -593,6 +860,63 @@ unlabeled_field_get_packed_size(const ProtobufCFieldDescriptor *field,
 	return required_field_get_packed_size(field, member);
 }
 
+/** Whether the array of a repeated message field holds the structures. */
+#define FIELD_HAS_INLINE_MESSAGES(field) \
+	(0 != ((field)->flags & (PROTOBUF_C_FIELD_FLAG_MAP | \
+				 PROTOBUF_C_FIELD_FLAG_CONTIGUOUS)))
+
+/**
+ * Whether the elements of a field may be handed to a ProtobufCUnpackDefer or
+ * ProtobufCPackDefer: repeated message fields holding an array of pointers.
+ */
+#define FIELD_IS_DEFERRABLE(field)					\
+	((field)->label == PROTOBUF_C_LABEL_REPEATED &&			\
+	 (field)->type == PROTOBUF_C_TYPE_MESSAGE &&			\
+	 0 == ((field)->flags & (PROTOBUF_C_FIELD_FLAG_MAP |		\
+				 PROTOBUF_C_FIELD_FLAG_CONTIGUOUS |	\
+				 PROTOBUF_C_FIELD_FLAG_SOA)))
+
+/**
+ * Return element `i` of a repeated message field. Map and contiguous fields
+ * store their messages inline; other message fields hold an array of
+ * pointers.
+ */
+static inline const ProtobufCMessage *
+repeated_message_at(const ProtobufCFieldDescriptor *field,
+		    const void *array, size_t i)
+{
+	if (FIELD_HAS_INLINE_MESSAGES(field)) {
+		const ProtobufCMessageDescriptor *desc = field->descriptor;
+		return (const ProtobufCMessage *)
+			((const char *) array + i * desc->sizeof_message);
+	}
+	return ((ProtobufCMessage * const *) array)[i];
+}
+
+/* Decoded extensions of a message, sorted by field number. */
+struct ProtobufCExtensionSet {
+	unsigned n_values;
+	unsigned n_alloced;
+	ProtobufCExtensionValue *values;
+};
+
+#define EXTENSION_SET_MEMBER(message, desc) \
+	STRUCT_MEMBER_PTR(ProtobufCExtensionSet *, (message), \
+			  (desc)->extensions->set_offset)
+
+/** Return the extension table of a message, or NULL if it has none. */
+static inline ProtobufCExtensionSet *
+message_extension_set(const ProtobufCMessage *message)
+{
+	if (message->descriptor->extensions == NULL)
+		return NULL;
+	return *EXTENSION_SET_MEMBER(message, message->descriptor);
+}
+
+static size_t
+soa_element_get_packed_size(const ProtobufCFieldDescriptor *field,
+			    const void *member, size_t i);
+
 /**
  * Calculate the serialized size of repeated message fields, which may consist
  * of any number of values (including 0). Includes the space needed by the
@@ -671,9 +995,17 @@ repeated_field_get_packed_size(const ProtobufCFieldDescriptor *field,
 		}
 		break;
 	case PROTOBUF_C_TYPE_MESSAGE:
+		if (0 != (field->flags & PROTOBUF_C_FIELD_FLAG_SOA)) {
+			for (i = 0; i < count; i++) {
+				size_t len =
+					soa_element_get_packed_size(field, member, i);
+				rv += uint32_size(len) + len;
+			}
+			break;
+		}
 		for (i = 0; i < count; i++) {
 			size_t len = protobuf_c_message_get_packed_size(
-				((ProtobufCMessage **) array)[i]);
+				repeated_message_at(field, array, i));
 			rv += uint32_size(len) + len;
 		}
 		break;
@@ -707,6 +1039,7 @@ unknown_field_get_packed_size(const ProtobufCMessageUnknownField *field)
  */
 size_t protobuf_c_message_get_packed_size(const ProtobufCMessage *message)
 {
+	const ProtobufCExtensionSet *set;
 	unsigned i;
 	size_t rv = 0;
 
@@ -748,6 +1081,11 @@ size_t protobuf_c_message_get_packed_size(const ProtobufCMessage *message)
 			);
 		}
 	}
+	set = message_extension_set(message);
+	if (set != NULL) {
+		for (i = 0; i < set->n_values; i++)
+			rv += protobuf_c_message_get_packed_size(&set->values[i].base);
+	}
 	for (i = 0; i < message->n_unknown_fields; i++)
 		rv += unknown_field_get_packed_size(&message->unknown_fields[i]);
 	return rv;
@@ -845,6 +1183,28 @@ sint32_pack(int32_t value, uint8_t *out)
 	return uint32_pack(zigzag32(value), out);
 }
 
+/*
+ * Spread the low 56 bits of `value` into the low 7 bits of each byte of a
+ * little-endian word: the inverse of varint_word_value().
+ */
+static inline uint64_t
+varint_word_bytes(uint64_t value)
+{
+#if defined(HAVE_BMI2)
+	return _pdep_u64(value, UINT64_C(0x7f7f7f7f7f7f7f7f));
+#else
+	uint64_t w = value;
+
+	w = ((w & UINT64_C(0x00fffffff0000000)) << 4) |
+		(w & UINT64_C(0x000000000fffffff));
+	w = ((w & UINT64_C(0x0fffc0000fffc000)) << 2) |
+		(w & UINT64_C(0x00003fff00003fff));
+	w = ((w & UINT64_C(0x3f803f803f803f80)) << 1) |
+		(w & UINT64_C(0x007f007f007f007f));
+	return w;
+#endif
+}
+
 /**
  * Pack a 64-bit unsigned integer using base-128 varint encoding and return the
  * number of bytes written.
@@ -856,32 +1216,45 @@ sint32_pack(int32_t value, uint8_t *out)
  * \return
  *      Number of bytes written to `out`.
  */
-static size_t
+static inline size_t
 uint64_pack(uint64_t value, uint8_t *out)
 {
-	uint32_t hi = (uint32_t) (value >> 32);
-	uint32_t lo = (uint32_t) value;
-	unsigned rv;
+	unsigned rv = 0;
 
-	if (hi == 0)
-		return uint32_pack((uint32_t) lo, out);
-	out[0] = (lo) | 0x80;
-	out[1] = (lo >> 7) | 0x80;
-	out[2] = (lo >> 14) | 0x80;
-	out[3] = (lo >> 21) | 0x80;
-	if (hi < 8) {
-		out[4] = (hi << 4) | (lo >> 28);
-		return 5;
-	} else {
-		out[4] = ((hi & 7) << 4) | (lo >> 28) | 0x80;
-		hi >>= 3;
+#if defined(__GNUC__) && !defined(WORDS_BIGENDIAN)
+	if (value < 0x80) {
+		out[0] = (uint8_t) value;
+		return 1;
+	}
+	rv = uint64_size(value);
+	if (rv <= 8) {
+		/* the bytes of the varint, with continuation bits but the last */
+		uint64_t w = varint_word_bytes(value) |
+			(UINT64_C(0x8080808080808080) & (UINT64_MAX >> (72 - 8 * rv)));
+
+		/* two overlapping stores write exactly `rv` bytes */
+		if (rv >= 4) {
+			uint32_t lo = (uint32_t) w;
+			uint32_t hi = (uint32_t) (w >> (8 * (rv - 4)));
+
+			memcpy(out + rv - 4, &hi, 4);
+			memcpy(out, &lo, 4);
+		} else {
+			uint16_t lo = (uint16_t) w;
+			uint16_t hi = (uint16_t) (w >> (8 * (rv - 2)));
+
+			memcpy(out + rv - 2, &hi, 2);
+			memcpy(out, &lo, 2);
+		}
+		return rv;
 	}
-	rv = 5;
-	while (hi >= 128) {
-		out[rv++] = hi | 0x80;
-		hi >>= 7;
+	rv = 0;
+#endif
+	while (value >= 0x80) {
+		out[rv++] = (uint8_t) value | 0x80;
+		value >>= 7;
 	}
-	out[rv++] = hi;
+	out[rv++] = (uint8_t) value;
 	return rv;
 }
 
@@ -1074,6 +1447,35 @@ tag_pack(uint32_t id, uint8_t *out)
 		return uint64_pack(((uint64_t) id) << 3, out);
 }
 
+/**
+ * Pack the tag of a field, like tag_pack(), from the field's pre-encoded key
+ * when it has one. The wire-type bits are left clear for the caller to set.
+ *
+ * A tag is always followed by at least one more byte, so the second byte is
+ * written even for one-byte tags.
+ *
+ * \param field
+ *      Field descriptor.
+ * \param[out] out
+ *      Packed value.
+ * \return
+ *      Number of bytes written to `out`.
+ */
+static inline size_t
+field_tag_pack(const ProtobufCFieldDescriptor *field, uint8_t *out)
+{
+	unsigned key = field->encoded_tag;
+
+	if (key == 0)
+		return tag_pack(field->id, out);
+	out[0] = (uint8_t) (key & ~7U);
+	out[1] = (uint8_t) (key >> 8);
+	if (key <= 0xffff)
+		return 1 + (key > 0xff);
+	out[2] = (uint8_t) (key >> 16);
+	return 3;
+}
+
 /**
  * Pack a required field and return the number of bytes written.
  *
@@ -1090,7 +1492,7 @@ static size_t
 required_field_pack(const ProtobufCFieldDescriptor *field,
 		    const void *member, uint8_t *out)
 {
-	size_t rv = tag_pack(field->id, out);
+	size_t rv = field_tag_pack(field, out);
 
 	switch (field->type) {
 	case PROTOBUF_C_TYPE_SINT32:
@@ -1264,6 +1666,59 @@ sizeof_elt_in_repeated_array(ProtobufCType type)
 	return 0;
 }
 
+/**
+ * Like sizeof_elt_in_repeated_array(), but for the array of a particular
+ * field, whose elements are whole message structures for map and contiguous
+ * fields.
+ */
+static inline size_t
+sizeof_elt_in_field_array(const ProtobufCFieldDescriptor *field)
+{
+	if (FIELD_HAS_INLINE_MESSAGES(field))
+		return ((const ProtobufCMessageDescriptor *)
+			field->descriptor)->sizeof_message;
+	return sizeof_elt_in_repeated_array(field->type);
+}
+
+/**
+ * Return element `i` of the array of member `j` of a structure-of-arrays
+ * field. `member` points at the field's first array pointer.
+ */
+static inline void *
+soa_member_at(const ProtobufCFieldDescriptor *field, const void *member,
+	      unsigned j, size_t i)
+{
+	const ProtobufCMessageDescriptor *desc = field->descriptor;
+	char *array = ((char * const *) member)[j];
+
+	return array + i * sizeof_elt_in_repeated_array(desc->fields[j].type);
+}
+
+/*
+ * Serialized size of element `i` of a structure-of-arrays field, excluding
+ * its tag and length prefix. Members are always present, except for
+ * zero-valued ones without field presence.
+ */
+static size_t
+soa_element_get_packed_size(const ProtobufCFieldDescriptor *field,
+			    const void *member, size_t i)
+{
+	const ProtobufCMessageDescriptor *desc = field->descriptor;
+	size_t rv = 0;
+	unsigned j;
+
+	for (j = 0; j < desc->n_fields; j++) {
+		const ProtobufCFieldDescriptor *f = desc->fields + j;
+		const void *value = soa_member_at(field, member, j, i);
+
+		if (f->label == PROTOBUF_C_LABEL_NONE &&
+		    field_is_zeroish(f, value))
+			continue;
+		rv += required_field_get_packed_size(f, value);
+	}
+	return rv;
+}
+
 /**
  * Pack an array of 32-bit quantities.
  *
@@ -1337,6 +1792,32 @@ get_type_min_size(ProtobufCType type)
 	return 1;
 }
 
+/**
+ * Pack element `i` of a structure-of-arrays field as an embedded message.
+ */
+static size_t
+soa_element_pack(const ProtobufCFieldDescriptor *field, const void *member,
+		 size_t i, uint8_t *out)
+{
+	const ProtobufCMessageDescriptor *desc = field->descriptor;
+	size_t rv = field_tag_pack(field, out);
+	unsigned j;
+
+	out[0] |= PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED;
+	rv += uint32_pack(soa_element_get_packed_size(field, member, i),
+			  out + rv);
+	for (j = 0; j < desc->n_fields; j++) {
+		const ProtobufCFieldDescriptor *f = desc->fields + j;
+		const void *value = soa_member_at(field, member, j, i);
+
+		if (f->label == PROTOBUF_C_LABEL_NONE &&
+		    field_is_zeroish(f, value))
+			continue;
+		rv += required_field_pack(f, value, out + rv);
+	}
+	return rv;
+}
+
 /**
  * Packs the elements of a repeated field and returns the serialised field and
  * its length.
@@ -1370,7 +1851,7 @@ repeated_field_pack(const ProtobufCFieldDescriptor *field,
 
 		if (count == 0)
 			return 0;
-		header_len = tag_pack(field->id, out);
+		header_len = field_tag_pack(field, out);
 		out[0] |= PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED;
 		len_start = header_len;
 		min_length = get_type_min_size(field->type) * count;
@@ -1449,6 +1930,19 @@ repeated_field_pack(const ProtobufCFieldDescriptor *field,
 		size_t rv = 0;
 		unsigned siz = sizeof_elt_in_repeated_array(field->type);
 
+		if (0 != (field->flags & PROTOBUF_C_FIELD_FLAG_SOA)) {
+			for (i = 0; i < count; i++)
+				rv += soa_element_pack(field, member, i, out + rv);
+			return rv;
+		}
+		if (FIELD_HAS_INLINE_MESSAGES(field)) {
+			for (i = 0; i < count; i++) {
+				const ProtobufCMessage *entry =
+					repeated_message_at(field, array, i);
+				rv += required_field_pack(field, &entry, out + rv);
+			}
+			return rv;
+		}
 		for (i = 0; i < count; i++) {
 			rv += required_field_pack(field, array, out + rv);
 			array = (char *)array + siz;
@@ -1466,8 +1960,71 @@ unknown_field_pack(const ProtobufCMessageUnknownField *field, uint8_t *out)
 	return rv + field->len;
 }
 
+/* Pack the extensions and unknown fields that follow the declared fields. */
+static size_t
+message_trailer_pack(const ProtobufCMessage *message, uint8_t *out)
+{
+	const ProtobufCExtensionSet *set = message_extension_set(message);
+	size_t rv = 0;
+	unsigned i;
+
+	if (set != NULL) {
+		for (i = 0; i < set->n_values; i++)
+			rv += protobuf_c_message_pack(&set->values[i].base, out + rv);
+	}
+	for (i = 0; i < message->n_unknown_fields; i++)
+		rv += unknown_field_pack(&message->unknown_fields[i], out + rv);
+	return rv;
+}
+
 /**@}*/
 
+/* Pack one declared field of `message`. */
+static inline size_t
+message_field_pack(const ProtobufCMessage *message,
+		   const ProtobufCFieldDescriptor *field,
+		   uint8_t *out)
+{
+	const void *member = ((const char *) message) + field->offset;
+
+	/*
+	 * It doesn't hurt to compute qmember (a pointer to the
+	 * quantifier field of the structure), but the pointer is only
+	 * valid if the field is:
+	 *  - a repeated field, or
+	 *  - a field that is part of a oneof
+	 *  - an optional field that isn't a pointer type
+	 * (Meaning: not a message or a string).
+	 */
+	const void *qmember =
+		((const char *) message) + field->quantifier_offset;
+
+	if (field->label == PROTOBUF_C_LABEL_REQUIRED) {
+		return required_field_pack(field, member, out);
+	} else if ((field->label == PROTOBUF_C_LABEL_OPTIONAL ||
+		    field->label == PROTOBUF_C_LABEL_NONE) &&
+		   (0 != (field->flags & PROTOBUF_C_FIELD_FLAG_ONEOF))) {
+		return oneof_field_pack(
+			field,
+			*(const uint32_t *) qmember,
+			member,
+			out
+		);
+	} else if (field->label == PROTOBUF_C_LABEL_OPTIONAL) {
+		return optional_field_pack(
+			field,
+			*(const protobuf_c_boolean *) qmember,
+			member,
+			out
+		);
+	} else if (field->label == PROTOBUF_C_LABEL_NONE) {
+		return unlabeled_field_pack(field, member, out);
+	} else {
+		return repeated_field_pack(field, *(const size_t *) qmember,
+			member, out);
+	}
+}
+
 size_t
 protobuf_c_message_pack(const ProtobufCMessage *message, uint8_t *out)
 {
@@ -1475,55 +2032,450 @@ protobuf_c_message_pack(const ProtobufCMessage *message, uint8_t *out)
 	size_t rv = 0;
 
 	ASSERT_IS_MESSAGE(message);
-	for (i = 0; i < message->descriptor->n_fields; i++) {
-		const ProtobufCFieldDescriptor *field =
-			message->descriptor->fields + i;
-		const void *member = ((const char *) message) + field->offset;
-
-		/*
-		 * It doesn't hurt to compute qmember (a pointer to the
-		 * quantifier field of the structure), but the pointer is only
-		 * valid if the field is:
-		 *  - a repeated field, or
-		 *  - a field that is part of a oneof
-		 *  - an optional field that isn't a pointer type
-		 * (Meaning: not a message or a string).
-		 */
-		const void *qmember =
-			((const char *) message) + field->quantifier_offset;
+	for (i = 0; i < message->descriptor->n_fields; i++)
+		rv += message_field_pack(message,
+					 message->descriptor->fields + i,
+					 out + rv);
+	rv += message_trailer_pack(message, out + rv);
+	STATS_RECORD(PROTOBUF_C_TRACE_PACK, message->descriptor, rv);
+	return rv;
+}
 
-		if (field->label == PROTOBUF_C_LABEL_REQUIRED) {
-			rv += required_field_pack(field, member, out + rv);
-		} else if ((field->label == PROTOBUF_C_LABEL_OPTIONAL ||
-			    field->label == PROTOBUF_C_LABEL_NONE) &&
-			   (0 != (field->flags & PROTOBUF_C_FIELD_FLAG_ONEOF))) {
-			rv += oneof_field_pack(
-				field,
-				*(const uint32_t *) qmember,
-				member,
-				out + rv
-			);
-		} else if (field->label == PROTOBUF_C_LABEL_OPTIONAL) {
-			rv += optional_field_pack(
-				field,
-				*(const protobuf_c_boolean *) qmember,
-				member,
-				out + rv
-			);
-		} else if (field->label == PROTOBUF_C_LABEL_NONE) {
-			rv += unlabeled_field_pack(field, member, out + rv);
-		} else {
-			rv += repeated_field_pack(field, *(const size_t *) qmember,
-				member, out + rv);
+/*
+ * Write the tags and length prefixes of a deferred field, leaving room for
+ * each element and recording where it goes in `messages`.
+ */
+static size_t
+deferred_field_pack(const ProtobufCFieldDescriptor *field,
+		    size_t count, const void *member, uint8_t *out,
+		    ProtobufCDeferredPack *messages, size_t *n_messages)
+{
+	ProtobufCMessage * const *array = *(ProtobufCMessage * const * const *) member;
+	size_t rv = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		size_t tag_len = field_tag_pack(field, out + rv);
+		size_t len = 0;
+
+		out[rv] |= PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED;
+		rv += tag_len;
+		if (array[i] != NULL)
+			len = protobuf_c_message_get_packed_size(array[i]);
+		rv += uint32_pack((uint32_t) len, out + rv);
+		if (len != 0) {
+			ProtobufCDeferredPack *m = messages + (*n_messages)++;
+
+			m->message = array[i];
+			m->out = out + rv;
+			m->len = len;
 		}
+		rv += len;
 	}
-	for (i = 0; i < message->n_unknown_fields; i++)
-		rv += unknown_field_pack(&message->unknown_fields[i], out + rv);
 	return rv;
 }
 
-/**
- * \defgroup packbuf protobuf_c_message_pack_to_buffer() implementation
+size_t
+protobuf_c_message_pack_deferred(const ProtobufCMessage *message,
+				 uint8_t *out,
+				 const ProtobufCPackDefer *defer)
+{
+	const ProtobufCMessageDescriptor *desc = message->descriptor;
+	ProtobufCDeferredPack *messages;
+	size_t n_messages = 0;
+	size_t rv = 0;
+	unsigned i;
+
+	ASSERT_IS_MESSAGE(message);
+	for (i = 0; i < desc->n_fields; i++) {
+		const ProtobufCFieldDescriptor *field = desc->fields + i;
+		size_t count;
+
+		if (!FIELD_IS_DEFERRABLE(field))
+			continue;
+		count = STRUCT_MEMBER(size_t, message, field->quantifier_offset);
+		if (count != 0 && count >= defer->min_elements)
+			n_messages += count;
+	}
+	if (n_messages == 0)
+		return protobuf_c_message_pack(message, out);
+	messages = do_alloc(&protobuf_c__allocator,
+			    n_messages * sizeof(ProtobufCDeferredPack));
+	if (messages == NULL)
+		return protobuf_c_message_pack(message, out);
+
+	n_messages = 0;
+	for (i = 0; i < desc->n_fields; i++) {
+		const ProtobufCFieldDescriptor *field = desc->fields + i;
+		const void *member = (const char *) message + field->offset;
+		size_t count;
+
+		if (FIELD_IS_DEFERRABLE(field)) {
+			count = STRUCT_MEMBER(size_t, message,
+					      field->quantifier_offset);
+			if (count != 0 && count >= defer->min_elements) {
+				rv += deferred_field_pack(field, count, member,
+							  out + rv, messages,
+							  &n_messages);
+				continue;
+			}
+		}
+		rv += message_field_pack(message, field, out + rv);
+	}
+	rv += message_trailer_pack(message, out + rv);
+
+	if (n_messages != 0)
+		defer->pack(defer->defer_data, n_messages, messages);
+	do_free(&protobuf_c__allocator, messages);
+	STATS_RECORD(PROTOBUF_C_TRACE_PACK, desc, rv);
+	return rv;
+}
+
+/*
+ * Deterministic packing: fields, extensions and unknown fields are merged in
+ * field number order, and map entries sorted by key.
+ */
+
+typedef struct {
+	const void *item;
+	size_t index;
+} SortedItem;
+
+/*
+ * Visits the map entries of a field, or the unknown fields of a message, in
+ * sorted order. They are sorted up front when memory can be had for it; if
+ * not, each next item is found with a scan.
+ */
+typedef struct {
+	const ProtobufCFieldDescriptor *field;	/* NULL for unknown fields */
+	const void *array;
+	size_t n;
+	int (*compare)(const void *, const void *);
+	SortedItem *sorted;
+	protobuf_c_boolean in_order;
+	size_t pos;
+	SortedItem last;
+} SortedCursor;
+
+static int
+compare_indices(const SortedItem *a, const SortedItem *b)
+{
+	return (a->index > b->index) - (a->index < b->index);
+}
+
+#define COMPARE_KEYS(type, a, b) \
+	((*(const type *) (a) > *(const type *) (b)) - \
+	 (*(const type *) (a) < *(const type *) (b)))
+
+/* Compare the keys of two map entries. A NULL entry sorts first. */
+static int
+compare_map_keys(const ProtobufCMessage *ex, const ProtobufCMessage *ey)
+{
+	const ProtobufCFieldDescriptor *key;
+	const void *kx;
+	const void *ky;
+	int cmp = 0;
+
+	if (ex == NULL || ey == NULL)
+		return (ex != NULL) - (ey != NULL);
+	key = ex->descriptor->fields;
+	kx = (const char *) ex + key->offset;
+	ky = (const char *) ey + key->offset;
+	switch (key->type) {
+	case PROTOBUF_C_TYPE_INT32:
+	case PROTOBUF_C_TYPE_SINT32:
+	case PROTOBUF_C_TYPE_SFIXED32:
+	case PROTOBUF_C_TYPE_ENUM:
+		cmp = COMPARE_KEYS(int32_t, kx, ky);
+		break;
+	case PROTOBUF_C_TYPE_INT64:
+	case PROTOBUF_C_TYPE_SINT64:
+	case PROTOBUF_C_TYPE_SFIXED64:
+		cmp = COMPARE_KEYS(int64_t, kx, ky);
+		break;
+	case PROTOBUF_C_TYPE_UINT32:
+	case PROTOBUF_C_TYPE_FIXED32:
+		cmp = COMPARE_KEYS(uint32_t, kx, ky);
+		break;
+	case PROTOBUF_C_TYPE_UINT64:
+	case PROTOBUF_C_TYPE_FIXED64:
+		cmp = COMPARE_KEYS(uint64_t, kx, ky);
+		break;
+	case PROTOBUF_C_TYPE_BOOL:
+		cmp = (*(const protobuf_c_boolean *) kx != 0) -
+		      (*(const protobuf_c_boolean *) ky != 0);
+		break;
+	case PROTOBUF_C_TYPE_STRING: {
+		const char *sx = *(char * const *) kx;
+		const char *sy = *(char * const *) ky;
+
+		cmp = strcmp(sx != NULL ? sx : "", sy != NULL ? sy : "");
+		break;
+	}
+	default:
+		/* not a valid map key type */
+		break;
+	}
+	return cmp;
+}
+
+#undef COMPARE_KEYS
+
+static int
+compare_map_entries(const void *a, const void *b)
+{
+	const SortedItem *x = a;
+	const SortedItem *y = b;
+	int cmp = compare_map_keys(x->item, y->item);
+
+	return cmp != 0 ? cmp : compare_indices(x, y);
+}
+
+static int
+compare_unknown_fields(const void *a, const void *b)
+{
+	const SortedItem *x = a;
+	const SortedItem *y = b;
+	uint32_t tx = ((const ProtobufCMessageUnknownField *) x->item)->tag;
+	uint32_t ty = ((const ProtobufCMessageUnknownField *) y->item)->tag;
+
+	if (tx != ty)
+		return tx < ty ? -1 : 1;
+	return compare_indices(x, y);
+}
+
+static void
+sorted_cursor_item(const SortedCursor *cursor, size_t i, SortedItem *item)
+{
+	item->index = i;
+	if (cursor->field != NULL)
+		item->item = repeated_message_at(cursor->field, cursor->array, i);
+	else
+		item->item = (const ProtobufCMessageUnknownField *)
+			cursor->array + i;
+}
+
+static void
+sorted_cursor_init(SortedCursor *cursor,
+		   const ProtobufCFieldDescriptor *field,
+		   const void *array, size_t n,
+		   int (*compare)(const void *, const void *))
+{
+	SortedItem prev, item;
+	size_t i;
+
+	cursor->field = field;
+	cursor->array = array;
+	cursor->n = n;
+	cursor->compare = compare;
+	cursor->sorted = NULL;
+	cursor->in_order = TRUE;
+	cursor->pos = 0;
+
+	/* items that already are in order, the common case, need no sorting */
+	for (i = 1; i < n; i++) {
+		sorted_cursor_item(cursor, i - 1, &prev);
+		sorted_cursor_item(cursor, i, &item);
+		if (compare(&prev, &item) > 0) {
+			cursor->in_order = FALSE;
+			break;
+		}
+	}
+	if (cursor->in_order)
+		return;
+	cursor->sorted = do_alloc(&protobuf_c__allocator, n * sizeof(SortedItem));
+	if (cursor->sorted == NULL)
+		return;
+	for (i = 0; i < n; i++)
+		sorted_cursor_item(cursor, i, &cursor->sorted[i]);
+	qsort(cursor->sorted, n, sizeof(SortedItem), compare);
+}
+
+static protobuf_c_boolean
+sorted_cursor_next(SortedCursor *cursor, SortedItem *out)
+{
+	SortedItem item;
+	protobuf_c_boolean found = FALSE;
+	size_t i;
+
+	if (cursor->pos == cursor->n)
+		return FALSE;
+	if (cursor->in_order) {
+		sorted_cursor_item(cursor, cursor->pos++, out);
+		return TRUE;
+	}
+	if (cursor->sorted != NULL) {
+		*out = cursor->sorted[cursor->pos++];
+		return TRUE;
+	}
+	/* no memory to sort into: find the least item after the last one */
+	for (i = 0; i < cursor->n; i++) {
+		sorted_cursor_item(cursor, i, &item);
+		if (cursor->pos != 0 && cursor->compare(&item, &cursor->last) <= 0)
+			continue;
+		if (!found || cursor->compare(&item, out) < 0) {
+			*out = item;
+			found = TRUE;
+		}
+	}
+	cursor->last = *out;
+	cursor->pos++;
+	return TRUE;
+}
+
+static void
+sorted_cursor_clear(SortedCursor *cursor)
+{
+	do_free(&protobuf_c__allocator, cursor->sorted);
+}
+
+static size_t
+deterministic_prefixed_message_pack(const ProtobufCMessage *message,
+				    uint8_t *out)
+{
+	size_t rv;
+	uint32_t rv_packed_size;
+
+	if (message == NULL) {
+		out[0] = 0;
+		return 1;
+	}
+	rv = protobuf_c_message_pack_deterministic(message, out + 1);
+	rv_packed_size = uint32_size(rv);
+	if (rv_packed_size != 1)
+		memmove(out + rv_packed_size, out + 1, rv);
+	return uint32_pack(rv, out) + rv;
+}
+
+static size_t
+deterministic_embedded_pack(const ProtobufCFieldDescriptor *field,
+			    const ProtobufCMessage *message, uint8_t *out)
+{
+	size_t rv = field_tag_pack(field, out);
+
+	out[0] |= PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED;
+	return rv + deterministic_prefixed_message_pack(message, out + rv);
+}
+
+/*
+ * Pack one declared field of `message`. Only message fields differ from
+ * message_field_pack(): their messages are packed deterministically, and map
+ * entries in key order.
+ */
+static size_t
+deterministic_field_pack(const ProtobufCMessage *message,
+			 const ProtobufCFieldDescriptor *field,
+			 uint8_t *out)
+{
+	const void *member = (const char *) message + field->offset;
+	const void *array;
+	SortedCursor cursor;
+	SortedItem entry;
+	SortedItem next;
+	size_t count;
+	size_t rv = 0;
+	size_t i;
+
+	if (field->type != PROTOBUF_C_TYPE_MESSAGE ||
+	    0 != (field->flags & PROTOBUF_C_FIELD_FLAG_SOA))
+		return message_field_pack(message, field, out);
+
+	if (field->label != PROTOBUF_C_LABEL_REPEATED) {
+		const ProtobufCMessage *sub =
+			*(const ProtobufCMessage * const *) member;
+
+		if (field->label != PROTOBUF_C_LABEL_REQUIRED) {
+			if (0 != (field->flags & PROTOBUF_C_FIELD_FLAG_ONEOF) &&
+			    STRUCT_MEMBER(uint32_t, message,
+					  field->quantifier_offset) != field->id)
+				return 0;
+			if (sub == NULL || sub == field->default_value)
+				return 0;
+		}
+		return deterministic_embedded_pack(field, sub, out);
+	}
+
+	count = STRUCT_MEMBER(size_t, message, field->quantifier_offset);
+	array = *(const void * const *) member;
+	if (0 == (field->flags & (PROTOBUF_C_FIELD_FLAG_MAP |
+				  PROTOBUF_C_FIELD_FLAG_MAP_ENTRIES)))
+	{
+		for (i = 0; i < count; i++)
+			rv += deterministic_embedded_pack(field,
+				repeated_message_at(field, array, i), out + rv);
+		return rv;
+	}
+	/* of entries with equal keys, only the last one, which wins, is kept */
+	sorted_cursor_init(&cursor, field, array, count, compare_map_entries);
+	if (sorted_cursor_next(&cursor, &entry)) {
+		while (sorted_cursor_next(&cursor, &next)) {
+			if (compare_map_keys(entry.item, next.item) != 0)
+				rv += deterministic_embedded_pack(field,
+						entry.item, out + rv);
+			entry = next;
+		}
+		rv += deterministic_embedded_pack(field, entry.item, out + rv);
+	}
+	sorted_cursor_clear(&cursor);
+	return rv;
+}
+
+size_t
+protobuf_c_message_pack_deterministic(const ProtobufCMessage *message,
+				      uint8_t *out)
+{
+	const ProtobufCMessageDescriptor *desc;
+	const ProtobufCExtensionSet *set;
+	SortedCursor unknown;
+	SortedItem next;
+	protobuf_c_boolean have_unknown;
+	unsigned n_extensions;
+	unsigned i = 0;
+	unsigned j = 0;
+	size_t rv = 0;
+
+	ASSERT_IS_MESSAGE(message);
+	desc = message->descriptor;
+	set = message_extension_set(message);
+	n_extensions = set != NULL ? set->n_values : 0;
+	sorted_cursor_init(&unknown, NULL, message->unknown_fields,
+			   message->n_unknown_fields, compare_unknown_fields);
+	have_unknown = sorted_cursor_next(&unknown, &next);
+
+	/* on equal numbers: declared field, then extension, then unknown */
+	for (;;) {
+		uint32_t field_id = i < desc->n_fields ?
+			desc->fields[i].id : UINT32_MAX;
+		uint32_t ext_id = j < n_extensions ?
+			set->values[j].base.descriptor->fields[0].id : UINT32_MAX;
+		uint32_t unknown_id = have_unknown ?
+			((const ProtobufCMessageUnknownField *) next.item)->tag :
+			UINT32_MAX;
+
+		if (i < desc->n_fields &&
+		    field_id <= ext_id && field_id <= unknown_id)
+		{
+			rv += deterministic_field_pack(message, desc->fields + i,
+						       out + rv);
+			i++;
+		} else if (j < n_extensions && ext_id <= unknown_id) {
+			rv += protobuf_c_message_pack_deterministic(
+				&set->values[j].base, out + rv);
+			j++;
+		} else if (have_unknown) {
+			rv += unknown_field_pack(next.item, out + rv);
+			have_unknown = sorted_cursor_next(&unknown, &next);
+		} else {
+			break;
+		}
+	}
+	sorted_cursor_clear(&unknown);
+	STATS_RECORD(PROTOBUF_C_TRACE_PACK, desc, rv);
+	return rv;
+}
+
+/**
+ * \defgroup packbuf protobuf_c_message_pack_to_buffer() implementation
  *
  * Routines mainly used by protobuf_c_message_pack_to_buffer().
  *
@@ -1550,7 +2502,7 @@ required_field_pack_to_buffer(const ProtobufCFieldDescriptor *field,
 	size_t rv;
 	uint8_t scratch[MAX_UINT64_ENCODED_SIZE * 2];
 
-	rv = tag_pack(field->id, scratch);
+	rv = field_tag_pack(field, scratch);
 	switch (field->type) {
 	case PROTOBUF_C_TYPE_SINT32:
 		scratch[0] |= PROTOBUF_C_WIRE_TYPE_VARINT;
@@ -1727,6 +2679,28 @@ unlabeled_field_pack_to_buffer(const ProtobufCFieldDescriptor *field,
 	return required_field_pack_to_buffer(field, member, buffer);
 }
 
+/*
+ * Branch-free forms of uint32_size() and uint64_size(), for summing over arrays
+ * of mixed-width values without mispredictions; the loops can also be
+ * vectorised.
+ */
+static inline unsigned
+uint32_size_flat(uint32_t v)
+{
+	return 1 + (v >= (1UL << 7)) + (v >= (1UL << 14)) +
+		(v >= (1UL << 21)) + (v >= (1UL << 28));
+}
+
+static inline unsigned
+uint64_size_flat(uint64_t v)
+{
+	return 1 + (v >= (UINT64_C(1) << 7)) + (v >= (UINT64_C(1) << 14)) +
+		(v >= (UINT64_C(1) << 21)) + (v >= (UINT64_C(1) << 28)) +
+		(v >= (UINT64_C(1) << 35)) + (v >= (UINT64_C(1) << 42)) +
+		(v >= (UINT64_C(1) << 49)) + (v >= (UINT64_C(1) << 56)) +
+		(v >= (UINT64_C(1) << 63));
+}
+
 /**
  * Get the packed size of an array of same field type.
  *
@@ -1743,7 +2717,7 @@ static size_t
 get_packed_payload_length(const ProtobufCFieldDescriptor *field,
 			  unsigned count, const void *array)
 {
-	unsigned rv = 0;
+	size_t rv = 0;
 	unsigned i;
 
 	switch (field->type) {
@@ -1757,34 +2731,35 @@ get_packed_payload_length(const ProtobufCFieldDescriptor *field,
 		return count * 8;
 	case PROTOBUF_C_TYPE_ENUM:
 	case PROTOBUF_C_TYPE_INT32: {
+		/* negative values take 10 bytes, 5 more than the largest uint32 */
 		const int32_t *arr = (const int32_t *) array;
 		for (i = 0; i < count; i++)
-			rv += int32_size(arr[i]);
+			rv += uint32_size_flat((uint32_t) arr[i]) + 5 * (arr[i] < 0);
 		break;
 	}
 	case PROTOBUF_C_TYPE_SINT32: {
 		const int32_t *arr = (const int32_t *) array;
 		for (i = 0; i < count; i++)
-			rv += sint32_size(arr[i]);
+			rv += uint32_size_flat(zigzag32(arr[i]));
 		break;
 	}
 	case PROTOBUF_C_TYPE_UINT32: {
 		const uint32_t *arr = (const uint32_t *) array;
 		for (i = 0; i < count; i++)
-			rv += uint32_size(arr[i]);
+			rv += uint32_size_flat(arr[i]);
 		break;
 	}
 	case PROTOBUF_C_TYPE_SINT64: {
 		const int64_t *arr = (const int64_t *) array;
 		for (i = 0; i < count; i++)
-			rv += sint64_size(arr[i]);
+			rv += uint64_size_flat(zigzag64(arr[i]));
 		break;
 	}
 	case PROTOBUF_C_TYPE_INT64:
 	case PROTOBUF_C_TYPE_UINT64: {
 		const uint64_t *arr = (const uint64_t *) array;
 		for (i = 0; i < count; i++)
-			rv += uint64_size(arr[i]);
+			rv += uint64_size_flat(arr[i]);
 		break;
 	}
 	case PROTOBUF_C_TYPE_BOOL:
@@ -1796,14 +2771,89 @@ get_packed_payload_length(const ProtobufCFieldDescriptor *field,
 }
 
 /**
- * Pack an array of same field type to a virtual buffer.
+ * Encode the elements of a packed varint or bool array, starting at `*start`,
+ * into `block` until it is full or the array ends.
+ *
+ * \param field
+ *      Field descriptor.
+ * \param count
+ *      Number of elements in the array.
+ * \param array
+ *      The elements to encode.
+ * \param[in,out] start
+ *      Index of the first element to encode; set to the index of the first
+ *      element not encoded.
+ * \param[out] block
+ *      `PACKED_BLOCK_SIZE` bytes to encode into.
+ * \return
+ *      Number of bytes written to `block`.
+ */
+static size_t
+packed_varint_block(const ProtobufCFieldDescriptor *field,
+		    unsigned count, const void *array,
+		    unsigned *start, uint8_t *block)
+{
+	const uint8_t *end = block + PACKED_BLOCK_SIZE - MAX_UINT64_ENCODED_SIZE;
+	uint8_t *at = block;
+	unsigned i = *start;
+
+	switch (field->type) {
+	case PROTOBUF_C_TYPE_ENUM:
+	case PROTOBUF_C_TYPE_INT32: {
+		const int32_t *arr = (const int32_t *) array;
+		for (; i < count && at <= end; i++)
+			at += int32_pack(arr[i], at);
+		break;
+	}
+	case PROTOBUF_C_TYPE_SINT32: {
+		const int32_t *arr = (const int32_t *) array;
+		for (; i < count && at <= end; i++)
+			at += sint32_pack(arr[i], at);
+		break;
+	}
+	case PROTOBUF_C_TYPE_UINT32: {
+		const uint32_t *arr = (const uint32_t *) array;
+		for (; i < count && at <= end; i++)
+			at += uint32_pack(arr[i], at);
+		break;
+	}
+	case PROTOBUF_C_TYPE_SINT64: {
+		const int64_t *arr = (const int64_t *) array;
+		for (; i < count && at <= end; i++)
+			at += sint64_pack(arr[i], at);
+		break;
+	}
+	case PROTOBUF_C_TYPE_INT64:
+	case PROTOBUF_C_TYPE_UINT64: {
+		const uint64_t *arr = (const uint64_t *) array;
+		for (; i < count && at <= end; i++)
+			at += uint64_pack(arr[i], at);
+		break;
+	}
+	case PROTOBUF_C_TYPE_BOOL: {
+		const protobuf_c_boolean *arr = (const protobuf_c_boolean *) array;
+		for (; i < count && at <= end; i++)
+			at += boolean_pack(arr[i], at);
+		break;
+	}
+	default:
+		PROTOBUF_C__ASSERT_NOT_REACHED();
+	}
+	*start = i;
+	return at - block;
+}
+
+/**
+ * Pack an array of same field type to a virtual buffer, one block at a time.
  *
  * \param field
  *      Field descriptor.
  * \param count
  *      Number of elements of this type.
  * \param array
- *      The elements to get the size of.
+ *      The elements to pack.
+ * \param block
+ *      `PACKED_BLOCK_SIZE` bytes of scratch space.
  * \param[out] buffer
  *      Virtual buffer to append data to.
  * \return
@@ -1812,11 +2862,10 @@ get_packed_payload_length(const ProtobufCFieldDescriptor *field,
 static size_t
 pack_buffer_packed_payload(const ProtobufCFieldDescriptor *field,
 			   unsigned count, const void *array,
-			   ProtobufCBuffer *buffer)
+			   uint8_t *block, ProtobufCBuffer *buffer)
 {
-	uint8_t scratch[16];
 	size_t rv = 0;
-	unsigned i;
+	unsigned i = 0;
 
 	switch (field->type) {
 	case PROTOBUF_C_TYPE_SFIXED32:
@@ -1826,12 +2875,16 @@ pack_buffer_packed_payload(const ProtobufCFieldDescriptor *field,
 		rv = count * 4;
 		goto no_packing_needed;
 #else
-		for (i = 0; i < count; i++) {
-			unsigned len = fixed32_pack(((uint32_t *) array)[i], scratch);
-			buffer->append(buffer, len, scratch);
-			rv += len;
+		while (i < count) {
+			unsigned n = count - i;
+			if (n > PACKED_BLOCK_SIZE / 4)
+				n = PACKED_BLOCK_SIZE / 4;
+			copy_to_little_endian_32(block,
+						 (const uint32_t *) array + i, n);
+			buffer->append(buffer, n * 4, block);
+			i += n;
 		}
-		break;
+		return count * 4;
 #endif
 	case PROTOBUF_C_TYPE_SFIXED64:
 	case PROTOBUF_C_TYPE_FIXED64:
@@ -1840,60 +2893,26 @@ pack_buffer_packed_payload(const ProtobufCFieldDescriptor *field,
 		rv = count * 8;
 		goto no_packing_needed;
 #else
-		for (i = 0; i < count; i++) {
-			unsigned len = fixed64_pack(((uint64_t *) array)[i], scratch);
-			buffer->append(buffer, len, scratch);
-			rv += len;
+		while (i < count) {
+			unsigned n = count - i;
+			if (n > PACKED_BLOCK_SIZE / 8)
+				n = PACKED_BLOCK_SIZE / 8;
+			copy_to_little_endian_64(block,
+						 (const uint64_t *) array + i, n);
+			buffer->append(buffer, n * 8, block);
+			i += n;
 		}
-		break;
+		return count * 8;
 #endif
-	case PROTOBUF_C_TYPE_ENUM:
-	case PROTOBUF_C_TYPE_INT32:
-		for (i = 0; i < count; i++) {
-			unsigned len = int32_pack(((int32_t *) array)[i], scratch);
-			buffer->append(buffer, len, scratch);
-			rv += len;
-		}
-		break;
-	case PROTOBUF_C_TYPE_SINT32:
-		for (i = 0; i < count; i++) {
-			unsigned len = sint32_pack(((int32_t *) array)[i], scratch);
-			buffer->append(buffer, len, scratch);
-			rv += len;
-		}
-		break;
-	case PROTOBUF_C_TYPE_UINT32:
-		for (i = 0; i < count; i++) {
-			unsigned len = uint32_pack(((uint32_t *) array)[i], scratch);
-			buffer->append(buffer, len, scratch);
-			rv += len;
-		}
-		break;
-	case PROTOBUF_C_TYPE_SINT64:
-		for (i = 0; i < count; i++) {
-			unsigned len = sint64_pack(((int64_t *) array)[i], scratch);
-			buffer->append(buffer, len, scratch);
-			rv += len;
-		}
-		break;
-	case PROTOBUF_C_TYPE_INT64:
-	case PROTOBUF_C_TYPE_UINT64:
-		for (i = 0; i < count; i++) {
-			unsigned len = uint64_pack(((uint64_t *) array)[i], scratch);
-			buffer->append(buffer, len, scratch);
+	default:
+		while (i < count) {
+			size_t len = packed_varint_block(field, count, array,
+							 &i, block);
+			buffer->append(buffer, len, block);
 			rv += len;
 		}
-		break;
-	case PROTOBUF_C_TYPE_BOOL:
-		for (i = 0; i < count; i++) {
-			unsigned len = boolean_pack(((protobuf_c_boolean *) array)[i], scratch);
-			buffer->append(buffer, len, scratch);
-		}
-		return count;
-	default:
-		PROTOBUF_C__ASSERT_NOT_REACHED();
+		return rv;
 	}
-	return rv;
 
 #if !defined(WORDS_BIGENDIAN)
 no_packing_needed:
@@ -1902,34 +2921,111 @@ no_packing_needed:
 #endif
 }
 
-static size_t
-repeated_field_pack_to_buffer(const ProtobufCFieldDescriptor *field,
-			      unsigned count, const void *member,
-			      ProtobufCBuffer *buffer)
+/**
+ * Pack a packed repeated field to a virtual buffer.
+ *
+ * Varint elements are encoded ahead of the length prefix, into the first
+ * block: an array that fits in it needs no separate sizing pass, and only the
+ * elements past it are sized.
+ */
+static NOINLINE size_t
+packed_field_pack_to_buffer(const ProtobufCFieldDescriptor *field,
+			    unsigned count, const void *array,
+			    ProtobufCBuffer *buffer)
 {
-	char *array = *(char * const *) member;
+	uint8_t block[PACKED_BLOCK_SIZE];
+	uint8_t scratch[MAX_UINT64_ENCODED_SIZE * 2];
+	size_t rv = field_tag_pack(field, scratch);
+	size_t siz = sizeof_elt_in_repeated_array(field->type);
+	size_t block_len = 0;
+	size_t payload_len;
+	unsigned done = 0;
+	size_t tmp;
+
+	scratch[0] |= PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED;
+	if (get_type_min_size(field->type) == 1) {
+		/* varint or bool */
+		block_len = packed_varint_block(field, count, array, &done,
+						block);
+		payload_len = block_len;
+		if (done < count)
+			payload_len += get_packed_payload_length(field,
+				count - done, (const char *) array + done * siz);
+	} else {
+		payload_len = get_packed_payload_length(field, count, array);
+	}
+	rv += uint32_pack(payload_len, scratch + rv);
+	buffer->append(buffer, rv, scratch);
+	if (block_len != 0)
+		buffer->append(buffer, block_len, block);
+	tmp = block_len + pack_buffer_packed_payload(field, count - done,
+		(const char *) array + done * siz, block, buffer);
+	assert(tmp == payload_len);
+	(void)tmp;
+	return rv + payload_len;
+}
+
+/**
+ * Pack element `i` of a structure-of-arrays field to a virtual buffer.
+ */
+static size_t
+soa_element_pack_to_buffer(const ProtobufCFieldDescriptor *field,
+			   const void *member, size_t i,
+			   ProtobufCBuffer *buffer)
+{
+	const ProtobufCMessageDescriptor *desc = field->descriptor;
+	uint8_t scratch[MAX_UINT64_ENCODED_SIZE * 2];
+	size_t rv = field_tag_pack(field, scratch);
+	unsigned j;
+
+	scratch[0] |= PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED;
+	rv += uint32_pack(soa_element_get_packed_size(field, member, i),
+			  scratch + rv);
+	buffer->append(buffer, rv, scratch);
+	for (j = 0; j < desc->n_fields; j++) {
+		const ProtobufCFieldDescriptor *f = desc->fields + j;
+		const void *value = soa_member_at(field, member, j, i);
+
+		if (f->label == PROTOBUF_C_LABEL_NONE &&
+		    field_is_zeroish(f, value))
+			continue;
+		rv += required_field_pack_to_buffer(f, value, buffer);
+	}
+	return rv;
+}
+
+static size_t
+repeated_field_pack_to_buffer(const ProtobufCFieldDescriptor *field,
+			      unsigned count, const void *member,
+			      ProtobufCBuffer *buffer)
+{
+	char *array = *(char * const *) member;
 
 	if (count == 0)
 		return 0;
 	if (0 != (field->flags & PROTOBUF_C_FIELD_FLAG_PACKED)) {
-		uint8_t scratch[MAX_UINT64_ENCODED_SIZE * 2];
-		size_t rv = tag_pack(field->id, scratch);
-		size_t payload_len = get_packed_payload_length(field, count, array);
-		size_t tmp;
-
-		scratch[0] |= PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED;
-		rv += uint32_pack(payload_len, scratch + rv);
-		buffer->append(buffer, rv, scratch);
-		tmp = pack_buffer_packed_payload(field, count, array, buffer);
-		assert(tmp == payload_len);
-		(void)tmp;
-		return rv + payload_len;
+		return packed_field_pack_to_buffer(field, count, array, buffer);
 	} else {
 		size_t siz;
 		unsigned i;
 		/* CONSIDER: optimize this case a bit (by putting the loop inside the switch) */
 		unsigned rv = 0;
 
+		if (0 != (field->flags & PROTOBUF_C_FIELD_FLAG_SOA)) {
+			for (i = 0; i < count; i++)
+				rv += soa_element_pack_to_buffer(field, member,
+								 i, buffer);
+			return rv;
+		}
+		if (FIELD_HAS_INLINE_MESSAGES(field)) {
+			for (i = 0; i < count; i++) {
+				const ProtobufCMessage *entry =
+					repeated_message_at(field, array, i);
+				rv += required_field_pack_to_buffer(field, &entry,
+								    buffer);
+			}
+			return rv;
+		}
 		siz = sizeof_elt_in_repeated_array(field->type);
 		for (i = 0; i < count; i++) {
 			rv += required_field_pack_to_buffer(field, array, buffer);
@@ -1958,6 +3054,7 @@ size_t
 protobuf_c_message_pack_to_buffer(const ProtobufCMessage *message,
 				  ProtobufCBuffer *buffer)
 {
+	const ProtobufCExtensionSet *set;
 	unsigned i;
 	size_t rv = 0;
 
@@ -2003,9 +3100,16 @@ protobuf_c_message_pack_to_buffer(const ProtobufCMessage *message,
 			);
 		}
 	}
+	set = message_extension_set(message);
+	if (set != NULL) {
+		for (i = 0; i < set->n_values; i++)
+			rv += protobuf_c_message_pack_to_buffer(&set->values[i].base,
+								buffer);
+	}
 	for (i = 0; i < message->n_unknown_fields; i++)
 		rv += unknown_field_pack_to_buffer(&message->unknown_fields[i], buffer);
 
+	STATS_RECORD(PROTOBUF_C_TRACE_PACK, message->descriptor, rv);
 	return rv;
 }
 
@@ -2059,6 +3163,24 @@ int_range_lookup(unsigned n_ranges, const ProtobufCIntRange *ranges, int value)
 	return -1;
 }
 
+/*
+ * Enums without gaps have a single value range, so looking up their values
+ * is a bounds check; the others fall back to int_range_lookup().
+ */
+static inline int
+enum_value_index(const ProtobufCEnumDescriptor *desc, int value)
+{
+	if (desc->n_value_ranges == 1) {
+		const ProtobufCIntRange *range = desc->value_ranges;
+		unsigned index = (unsigned) value - (unsigned) range[0].start_value;
+
+		if (index < range[1].orig_index - range[0].orig_index)
+			return index + range[0].orig_index;
+		return -1;
+	}
+	return int_range_lookup(desc->n_value_ranges, desc->value_ranges, value);
+}
+
 static size_t
 parse_tag_and_wiretype(size_t len,
 		       const uint8_t *data,
@@ -2093,6 +3215,29 @@ parse_tag_and_wiretype(size_t len,
 	return 0; /* error: bad header */
 }
 
+/*
+ * Return the length of the field's pre-encoded key if `data` starts with it,
+ * else 0.
+ */
+static inline size_t
+field_tag_match(const ProtobufCFieldDescriptor *field,
+		size_t len, const uint8_t *data)
+{
+	unsigned key = field->encoded_tag;
+
+	if (key == 0 || data[0] != (uint8_t) key)
+		return 0;
+	if (key <= 0xff)
+		return 1;
+	if (len < 2 || data[1] != (uint8_t) (key >> 8))
+		return 0;
+	if (key <= 0xffff)
+		return 2;
+	if (len < 3 || data[2] != (uint8_t) (key >> 16))
+		return 0;
+	return 3;
+}
+
 /* sizeof(ScannedMember) must be <= (1UL<<BOUND_SIZEOF_SCANNED_MEMBER_LOG2) */
 #define BOUND_SIZEOF_SCANNED_MEMBER_LOG2 5
 typedef struct ScannedMember ScannedMember;
@@ -2101,11 +3246,41 @@ struct ScannedMember {
 	uint32_t tag;              /**< Field tag. */
 	uint8_t wire_type;         /**< Field type. */
 	uint8_t length_prefix_len; /**< Prefix length. */
+	uint8_t merged;            /**< Parsed with an earlier occurrence. */
 	const ProtobufCFieldDescriptor *field; /**< Field descriptor. */
 	size_t len;                /**< Field length. */
 	const uint8_t *data;       /**< Pointer to field data. */
 };
 
+/** State shared by the messages unpacked in one call. */
+typedef struct {
+	unsigned depth;            /**< Nesting depth of the current message. */
+	unsigned max_depth;        /**< Deepest nesting accepted. */
+	size_t n_elements;         /**< Repeated elements scanned so far. */
+	size_t max_elements;
+	size_t n_unknown_fields;   /**< Unknown fields scanned so far. */
+	size_t max_unknown_fields;
+	size_t n_submessages;      /**< Submessages scanned so far. */
+	size_t max_submessages;
+	/** Extensions to decode, or NULL. */
+	const ProtobufCExtensionRegistry *extensions;
+} UnpackContext;
+
+static protobuf_c_boolean
+message_unpack_to(const ProtobufCMessageDescriptor *desc,
+		  ProtobufCAllocator *allocator,
+		  size_t len, const uint8_t *data,
+		  ProtobufCMessage *rv,
+		  ProtobufCUnpackDefer *defer,
+		  UnpackContext *ctx);
+
+static ProtobufCMessage *
+message_unpack(const ProtobufCMessageDescriptor *desc,
+	       ProtobufCAllocator *allocator,
+	       size_t len, const uint8_t *data,
+	       ProtobufCUnpackDefer *defer,
+	       UnpackContext *ctx);
+
 static inline size_t
 scan_length_prefixed_data(size_t len, const uint8_t *data,
 			  size_t *prefix_len_out)
@@ -2156,6 +3331,66 @@ max_b128_numbers(size_t len, const uint8_t *data)
 
 /**@}*/
 
+static protobuf_c_boolean
+merge_extensions(ProtobufCMessage *earlier_msg,
+		 ProtobufCMessage *latter_msg,
+		 ProtobufCAllocator *allocator);
+
+/* Concatenate each member array of a structure-of-arrays field. */
+static protobuf_c_boolean
+merge_soa_arrays(const ProtobufCFieldDescriptor *field,
+		 ProtobufCMessage *earlier_msg,
+		 ProtobufCMessage *latter_msg,
+		 ProtobufCAllocator *allocator)
+{
+	const ProtobufCMessageDescriptor *desc = field->descriptor;
+	size_t *n_earlier = STRUCT_MEMBER_PTR(size_t, earlier_msg,
+					      field->quantifier_offset);
+	size_t *n_latter = STRUCT_MEMBER_PTR(size_t, latter_msg,
+					     field->quantifier_offset);
+	uint8_t **p_earlier = STRUCT_MEMBER_PTR(uint8_t *, earlier_msg,
+						field->offset);
+	uint8_t **p_latter = STRUCT_MEMBER_PTR(uint8_t *, latter_msg,
+					       field->offset);
+	unsigned j;
+
+	if (*n_earlier == 0)
+		return TRUE;
+	if (*n_latter == 0) {
+		/* Zero copy the arrays from the earlier message */
+		for (j = 0; j < desc->n_fields; j++) {
+			p_latter[j] = p_earlier[j];
+			p_earlier[j] = NULL;
+		}
+		*n_latter = *n_earlier;
+		*n_earlier = 0;
+		return TRUE;
+	}
+
+	/*
+	 * On failure some arrays are longer than the count says, which is
+	 * harmless: both messages are about to be freed.
+	 */
+	for (j = 0; j < desc->n_fields; j++) {
+		size_t el_size = sizeof_elt_in_repeated_array(desc->fields[j].type);
+		uint8_t *merged;
+
+		merged = do_alloc(allocator, (*n_earlier + *n_latter) * el_size);
+		if (merged == NULL)
+			return FALSE;
+		memcpy(merged, p_earlier[j], *n_earlier * el_size);
+		memcpy(merged + *n_earlier * el_size, p_latter[j],
+		       *n_latter * el_size);
+		do_free(allocator, p_earlier[j]);
+		do_free(allocator, p_latter[j]);
+		p_earlier[j] = NULL;
+		p_latter[j] = merged;
+	}
+	*n_latter += *n_earlier;
+	*n_earlier = 0;
+	return TRUE;
+}
+
 /**
  * Merge earlier message into a latter message.
  *
@@ -2179,7 +3414,12 @@ merge_messages(ProtobufCMessage *earlier_msg,
 	const ProtobufCFieldDescriptor *fields =
 		latter_msg->descriptor->fields;
 	for (i = 0; i < latter_msg->descriptor->n_fields; i++) {
-		if (fields[i].label == PROTOBUF_C_LABEL_REPEATED) {
+		if (fields[i].label == PROTOBUF_C_LABEL_REPEATED &&
+		    0 != (fields[i].flags & PROTOBUF_C_FIELD_FLAG_SOA)) {
+			if (!merge_soa_arrays(&fields[i], earlier_msg,
+					      latter_msg, allocator))
+				return FALSE;
+		} else if (fields[i].label == PROTOBUF_C_LABEL_REPEATED) {
 			size_t *n_earlier =
 				STRUCT_MEMBER_PTR(size_t, earlier_msg,
 						  fields[i].quantifier_offset);
@@ -2197,7 +3437,7 @@ merge_messages(ProtobufCMessage *earlier_msg,
 				if (*n_latter > 0) {
 					/* Concatenate the repeated field */
 					size_t el_size =
-						sizeof_elt_in_repeated_array(fields[i].type);
+						sizeof_elt_in_field_array(&fields[i]);
 					uint8_t *new_field;
 
 					new_field = do_alloc(allocator,
@@ -2341,6 +3581,8 @@ merge_messages(ProtobufCMessage *earlier_msg,
 			}
 		}
 	}
+	if (latter_msg->descriptor->extensions != NULL)
+		return merge_extensions(earlier_msg, latter_msg, allocator);
 	return TRUE;
 }
 
@@ -2396,6 +3638,66 @@ count_packed_elements(ProtobufCType type,
 	}
 }
 
+/*
+ * Gather the low 7 bits of each byte of a little-endian word: the value of a
+ * varint of up to 8 bytes, once the bytes past its end are masked off. The
+ * inverse of varint_word_bytes().
+ */
+static inline uint64_t
+varint_word_value(uint64_t w)
+{
+#if defined(HAVE_BMI2)
+	return _pext_u64(w, UINT64_C(0x7f7f7f7f7f7f7f7f));
+#else
+	w &= UINT64_C(0x7f7f7f7f7f7f7f7f);
+	w = ((w & UINT64_C(0x7f007f007f007f00)) >> 1) |
+		(w & UINT64_C(0x007f007f007f007f));
+	w = ((w & UINT64_C(0x3fff00003fff0000)) >> 2) |
+		(w & UINT64_C(0x00003fff00003fff));
+	w = ((w & UINT64_C(0x0fffffff00000000)) >> 4) |
+		(w & UINT64_C(0x000000000fffffff));
+	return w;
+#endif
+}
+
+/*
+ * Decode a varint from the `len` bytes at `data`, reading a whole word at a
+ * time where 8 bytes are available. Returns the number of bytes used, or 0 if
+ * the varint does not end within `len` or 10 bytes.
+ */
+static inline unsigned
+parse_varint(size_t len, const uint8_t *data, uint64_t *value_out)
+{
+	uint64_t rv = 0;
+	unsigned i = 0;
+
+#if defined(__GNUC__) && !defined(WORDS_BIGENDIAN)
+	if (len >= 8) {
+		uint64_t w;
+		uint64_t stop;
+
+		memcpy(&w, data, 8);
+		stop = ~w & UINT64_C(0x8080808080808080);
+		if (stop != 0) {
+			unsigned n = __builtin_ctzll(stop) / 8 + 1;
+
+			*value_out = varint_word_value(w & (UINT64_MAX >> (64 - 8 * n)));
+			return n;
+		}
+		rv = varint_word_value(w);
+		i = 8;
+	}
+#endif
+	for (; i < len && i < 10; i++) {
+		rv |= (uint64_t) (data[i] & 0x7f) << (7 * i);
+		if ((data[i] & 0x80) == 0) {
+			*value_out = rv;
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
 static inline uint32_t
 parse_uint32(unsigned len, const uint8_t *data)
 {
@@ -2442,23 +3744,14 @@ parse_fixed_uint32(const uint8_t *data)
 #endif
 }
 
-static uint64_t
+static inline uint64_t
 parse_uint64(unsigned len, const uint8_t *data)
 {
-	unsigned shift, i;
-	uint64_t rv;
-
-	if (len < 5)
-		return parse_uint32(len, data);
-	rv = ((uint64_t) (data[0] & 0x7f)) |
-		((uint64_t) (data[1] & 0x7f) << 7) |
-		((uint64_t) (data[2] & 0x7f) << 14) |
-		((uint64_t) (data[3] & 0x7f) << 21);
-	shift = 28;
-	for (i = 4; i < len; i++) {
-		rv |= (((uint64_t) (data[i] & 0x7f)) << shift);
-		shift += 7;
-	}
+	uint64_t rv = 0;
+	unsigned i;
+
+	for (i = 0; i < len; i++)
+		rv |= (uint64_t) (data[i] & 0x7f) << (7 * i);
 	return rv;
 }
 
@@ -2496,7 +3789,8 @@ static protobuf_c_boolean
 parse_required_member(ScannedMember *scanned_member,
 		      void *member,
 		      ProtobufCAllocator *allocator,
-		      protobuf_c_boolean maybe_clear)
+		      protobuf_c_boolean maybe_clear,
+		      UnpackContext *ctx)
 {
 	unsigned len = scanned_member->len;
 	const uint8_t *data = scanned_member->data;
@@ -2604,10 +3898,11 @@ parse_required_member(ScannedMember *scanned_member,
 
 		def_mess = scanned_member->field->default_value;
 		if (len >= pref_len)
-			subm = protobuf_c_message_unpack(scanned_member->field->descriptor,
-							 allocator,
-							 len - pref_len,
-							 data + pref_len);
+			subm = message_unpack(scanned_member->field->descriptor,
+					      allocator,
+					      len - pref_len,
+					      data + pref_len,
+					      NULL, ctx);
 		else
 			subm = NULL;
 
@@ -2633,7 +3928,8 @@ static protobuf_c_boolean
 parse_oneof_member (ScannedMember *scanned_member,
 		    void *member,
 		    ProtobufCMessage *message,
-		    ProtobufCAllocator *allocator)
+		    ProtobufCAllocator *allocator,
+		    UnpackContext *ctx)
 {
 	uint32_t *oneof_case = STRUCT_MEMBER_PTR(uint32_t, message,
 					       scanned_member->field->quantifier_offset);
@@ -2683,7 +3979,8 @@ parse_oneof_member (ScannedMember *scanned_member,
 
 		memset (member, 0, el_size);
 	}
-	if (!parse_required_member (scanned_member, member, allocator, TRUE))
+	if (!parse_required_member (scanned_member, member, allocator, TRUE,
+				    ctx))
 		return FALSE;
 
 	*oneof_case = scanned_member->tag;
@@ -2695,9 +3992,10 @@ static protobuf_c_boolean
 parse_optional_member(ScannedMember *scanned_member,
 		      void *member,
 		      ProtobufCMessage *message,
-		      ProtobufCAllocator *allocator)
+		      ProtobufCAllocator *allocator,
+		      UnpackContext *ctx)
 {
-	if (!parse_required_member(scanned_member, member, allocator, TRUE))
+	if (!parse_required_member(scanned_member, member, allocator, TRUE, ctx))
 		return FALSE;
 	if (scanned_member->field->quantifier_offset != 0)
 		STRUCT_MEMBER(protobuf_c_boolean,
@@ -2706,19 +4004,138 @@ parse_optional_member(ScannedMember *scanned_member,
 	return TRUE;
 }
 
+/*
+ * Unpack a map entry or an element of a contiguous field straight into its
+ * slot of the array. On failure the slot holds nothing that needs freeing.
+ */
+static protobuf_c_boolean
+parse_inline_message_member(ScannedMember *scanned_member,
+			    void *entry,
+			    ProtobufCAllocator *allocator,
+			    UnpackContext *ctx)
+{
+	unsigned pref_len = scanned_member->length_prefix_len;
+
+	if (scanned_member->wire_type != PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+		return FALSE;
+	return message_unpack_to(scanned_member->field->descriptor, allocator,
+				 scanned_member->len - pref_len,
+				 scanned_member->data + pref_len,
+				 entry, NULL, ctx);
+}
+
+static unsigned
+scan_varint(unsigned len, const uint8_t *data);
+
+/*
+ * Unpack an element of a structure-of-arrays field into element `i` of each
+ * member array. Members that are absent take their default value; unknown
+ * members are dropped.
+ */
+static protobuf_c_boolean
+parse_soa_element_member(ScannedMember *scanned_member, void *member, size_t i)
+{
+	const ProtobufCFieldDescriptor *field = scanned_member->field;
+	const ProtobufCMessageDescriptor *desc = field->descriptor;
+	const uint8_t *at = scanned_member->data + scanned_member->length_prefix_len;
+	size_t rem = scanned_member->len - scanned_member->length_prefix_len;
+	unsigned j;
+
+	if (scanned_member->wire_type != PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+		return FALSE;
+	for (j = 0; j < desc->n_fields; j++) {
+		const ProtobufCFieldDescriptor *f = desc->fields + j;
+		void *value = soa_member_at(field, member, j, i);
+		size_t siz = sizeof_elt_in_repeated_array(f->type);
+
+		if (f->default_value != NULL)
+			memcpy(value, f->default_value, siz);
+		else
+			memset(value, 0, siz);
+	}
+
+	while (rem > 0) {
+		ScannedMember tmp;
+		uint32_t tag;
+		uint8_t wire_type;
+		size_t used = parse_tag_and_wiretype(rem, at, &tag, &wire_type);
+		int index;
+
+		if (used == 0)
+			return FALSE;
+		at += used;
+		rem -= used;
+		tmp.tag = tag;
+		tmp.wire_type = wire_type;
+		tmp.data = at;
+		tmp.length_prefix_len = 0;
+		switch (wire_type) {
+		case PROTOBUF_C_WIRE_TYPE_VARINT:
+			tmp.len = scan_varint(rem < 10 ? rem : 10, at);
+			if (tmp.len == 0)
+				return FALSE;
+			break;
+		case PROTOBUF_C_WIRE_TYPE_64BIT:
+			if (rem < 8)
+				return FALSE;
+			tmp.len = 8;
+			break;
+		case PROTOBUF_C_WIRE_TYPE_32BIT:
+			if (rem < 4)
+				return FALSE;
+			tmp.len = 4;
+			break;
+		case PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED: {
+			size_t pref_len;
+
+			tmp.len = scan_length_prefixed_data(rem, at, &pref_len);
+			if (tmp.len == 0)
+				return FALSE;
+			tmp.length_prefix_len = pref_len;
+			break;
+		}
+		default:
+			return FALSE;
+		}
+
+		index = int_range_lookup(desc->n_field_ranges,
+					 desc->field_ranges, tag);
+		if (index >= 0) {
+			tmp.field = desc->fields + index;
+			if (!parse_required_member(&tmp,
+						   soa_member_at(field, member,
+								 index, i),
+						   NULL, FALSE, NULL))
+				return FALSE;
+		}
+		at += tmp.len;
+		rem -= tmp.len;
+	}
+	return TRUE;
+}
+
 static protobuf_c_boolean
 parse_repeated_member(ScannedMember *scanned_member,
 		      void *member,
 		      ProtobufCMessage *message,
-		      ProtobufCAllocator *allocator)
+		      ProtobufCAllocator *allocator,
+		      UnpackContext *ctx)
 {
 	const ProtobufCFieldDescriptor *field = scanned_member->field;
 	size_t *p_n = STRUCT_MEMBER_PTR(size_t, message, field->quantifier_offset);
-	size_t siz = sizeof_elt_in_repeated_array(field->type);
+	size_t siz = sizeof_elt_in_field_array(field);
 	char *array = *(char **) member;
 
-	if (!parse_required_member(scanned_member, array + siz * (*p_n),
-				   allocator, FALSE))
+	if (0 != (field->flags & PROTOBUF_C_FIELD_FLAG_SOA)) {
+		if (!parse_soa_element_member(scanned_member, member, *p_n))
+			return FALSE;
+	} else if (FIELD_HAS_INLINE_MESSAGES(field)) {
+		if (!parse_inline_message_member(scanned_member,
+						 array + siz * (*p_n),
+						 allocator, ctx))
+			return FALSE;
+	} else if (!parse_required_member(scanned_member, array + siz * (*p_n),
+					  allocator, FALSE, ctx))
 	{
 		return FALSE;
 	}
@@ -2730,6 +4147,17 @@ static unsigned
 scan_varint(unsigned len, const uint8_t *data)
 {
 	unsigned i;
+#if defined(__GNUC__) && !defined(WORDS_BIGENDIAN)
+	if (len >= 8) {
+		uint64_t w;
+		uint64_t stop;
+
+		memcpy(&w, data, 8);
+		stop = ~w & UINT64_C(0x8080808080808080);
+		if (stop != 0)
+			return __builtin_ctzll(stop) / 8 + 1;
+	}
+#endif
 	if (len > 10)
 		len = 10;
 	for (i = 0; i < len; i++)
@@ -2786,36 +4214,39 @@ parse_packed_repeated_member(ScannedMember *scanned_member,
 	case PROTOBUF_C_TYPE_ENUM:
 	case PROTOBUF_C_TYPE_INT32:
 		while (rem > 0) {
-			unsigned s = scan_varint(rem, at);
+			uint64_t v;
+			unsigned s = parse_varint(rem, at, &v);
 			if (s == 0) {
 				PROTOBUF_C_UNPACK_ERROR("bad packed-repeated int32 value");
 				return FALSE;
 			}
-			((int32_t *) array)[count++] = parse_int32(s, at);
+			((int32_t *) array)[count++] = (int32_t) (uint32_t) v;
 			at += s;
 			rem -= s;
 		}
 		break;
 	case PROTOBUF_C_TYPE_SINT32:
 		while (rem > 0) {
-			unsigned s = scan_varint(rem, at);
+			uint64_t v;
+			unsigned s = parse_varint(rem, at, &v);
 			if (s == 0) {
 				PROTOBUF_C_UNPACK_ERROR("bad packed-repeated sint32 value");
 				return FALSE;
 			}
-			((int32_t *) array)[count++] = unzigzag32(parse_uint32(s, at));
+			((int32_t *) array)[count++] = unzigzag32((uint32_t) v);
 			at += s;
 			rem -= s;
 		}
 		break;
 	case PROTOBUF_C_TYPE_UINT32:
 		while (rem > 0) {
-			unsigned s = scan_varint(rem, at);
+			uint64_t v;
+			unsigned s = parse_varint(rem, at, &v);
 			if (s == 0) {
 				PROTOBUF_C_UNPACK_ERROR("bad packed-repeated enum or uint32 value");
 				return FALSE;
 			}
-			((uint32_t *) array)[count++] = parse_uint32(s, at);
+			((uint32_t *) array)[count++] = (uint32_t) v;
 			at += s;
 			rem -= s;
 		}
@@ -2823,12 +4254,13 @@ parse_packed_repeated_member(ScannedMember *scanned_member,
 
 	case PROTOBUF_C_TYPE_SINT64:
 		while (rem > 0) {
-			unsigned s = scan_varint(rem, at);
+			uint64_t v;
+			unsigned s = parse_varint(rem, at, &v);
 			if (s == 0) {
 				PROTOBUF_C_UNPACK_ERROR("bad packed-repeated sint64 value");
 				return FALSE;
 			}
-			((int64_t *) array)[count++] = unzigzag64(parse_uint64(s, at));
+			((int64_t *) array)[count++] = unzigzag64(v);
 			at += s;
 			rem -= s;
 		}
@@ -2836,12 +4268,13 @@ parse_packed_repeated_member(ScannedMember *scanned_member,
 	case PROTOBUF_C_TYPE_INT64:
 	case PROTOBUF_C_TYPE_UINT64:
 		while (rem > 0) {
-			unsigned s = scan_varint(rem, at);
+			uint64_t v;
+			unsigned s = parse_varint(rem, at, &v);
 			if (s == 0) {
 				PROTOBUF_C_UNPACK_ERROR("bad packed-repeated int64/uint64 value");
 				return FALSE;
 			}
-			((int64_t *) array)[count++] = parse_uint64(s, at);
+			((uint64_t *) array)[count++] = v;
 			at += s;
 			rem -= s;
 		}
@@ -2872,6 +4305,90 @@ no_unpacking_needed:
 #endif
 }
 
+/*
+ * Count the values of an enum field that its enum does not declare. Only
+ * used for fields flagged PROTOBUF_C_FIELD_FLAG_ENUM_REJECT or
+ * PROTOBUF_C_FIELD_FLAG_ENUM_UNKNOWN.
+ */
+static protobuf_c_boolean
+count_undeclared_enum_values(const ScannedMember *scanned_member,
+			     size_t *count_out)
+{
+	const ProtobufCEnumDescriptor *desc = scanned_member->field->descriptor;
+	const uint8_t *at = scanned_member->data + scanned_member->length_prefix_len;
+	size_t rem = scanned_member->len - scanned_member->length_prefix_len;
+	size_t count = 0;
+
+	switch (scanned_member->wire_type) {
+	case PROTOBUF_C_WIRE_TYPE_VARINT:
+		if (enum_value_index(desc, parse_int32(rem, at)) < 0)
+			count++;
+		break;
+	case PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED:
+		while (rem > 0) {
+			unsigned s = scan_varint(rem, at);
+			if (s == 0) {
+				PROTOBUF_C_UNPACK_ERROR("bad packed-repeated enum value");
+				return FALSE;
+			}
+			if (enum_value_index(desc, parse_int32(s, at)) < 0)
+				count++;
+			at += s;
+			rem -= s;
+		}
+		break;
+	default:
+		break;
+	}
+	*count_out = count;
+	return TRUE;
+}
+
+/*
+ * Packed enum values the enum does not declare go to unknown_fields, one
+ * varint field each, as the proto2 runtimes do for closed enums.
+ */
+static protobuf_c_boolean
+parse_packed_closed_enum_member(ScannedMember *scanned_member,
+				void *member,
+				ProtobufCMessage *message,
+				ProtobufCAllocator *allocator)
+{
+	const ProtobufCFieldDescriptor *field = scanned_member->field;
+	size_t *p_n = STRUCT_MEMBER_PTR(size_t, message, field->quantifier_offset);
+	int32_t *array = *(int32_t **) member;
+	const uint8_t *at = scanned_member->data + scanned_member->length_prefix_len;
+	size_t rem = scanned_member->len - scanned_member->length_prefix_len;
+
+	while (rem > 0) {
+		unsigned s = scan_varint(rem, at);
+		int32_t value;
+
+		if (s == 0) {
+			PROTOBUF_C_UNPACK_ERROR("bad packed-repeated enum value");
+			return FALSE;
+		}
+		value = parse_int32(s, at);
+		if (enum_value_index(field->descriptor, value) >= 0) {
+			array[(*p_n)++] = value;
+		} else {
+			ProtobufCMessageUnknownField *ufield =
+				message->unknown_fields +
+				(message->n_unknown_fields++);
+			ufield->tag = scanned_member->tag;
+			ufield->wire_type = PROTOBUF_C_WIRE_TYPE_VARINT;
+			ufield->len = s;
+			ufield->data = do_alloc(allocator, s);
+			if (ufield->data == NULL)
+				return FALSE;
+			memcpy(ufield->data, at, s);
+		}
+		at += s;
+		rem -= s;
+	}
+	return TRUE;
+}
+
 static protobuf_c_boolean
 is_packable_type(ProtobufCType type)
 {
@@ -2884,7 +4401,8 @@ is_packable_type(ProtobufCType type)
 static protobuf_c_boolean
 parse_member(ScannedMember *scanned_member,
 	     ProtobufCMessage *message,
-	     ProtobufCAllocator *allocator)
+	     ProtobufCAllocator *allocator,
+	     UnpackContext *ctx)
 {
 	const ProtobufCFieldDescriptor *field = scanned_member->field;
 	void *member;
@@ -2906,15 +4424,15 @@ parse_member(ScannedMember *scanned_member,
 	switch (field->label) {
 	case PROTOBUF_C_LABEL_REQUIRED:
 		return parse_required_member(scanned_member, member,
-					     allocator, TRUE);
+					     allocator, TRUE, ctx);
 	case PROTOBUF_C_LABEL_OPTIONAL:
 	case PROTOBUF_C_LABEL_NONE:
 		if (0 != (field->flags & PROTOBUF_C_FIELD_FLAG_ONEOF)) {
 			return parse_oneof_member(scanned_member, member,
-						  message, allocator);
+						  message, allocator, ctx);
 		} else {
 			return parse_optional_member(scanned_member, member,
-						     message, allocator);
+						     message, allocator, ctx);
 		}
 	case PROTOBUF_C_LABEL_REPEATED:
 		if (scanned_member->wire_type ==
@@ -2922,12 +4440,16 @@ parse_member(ScannedMember *scanned_member,
 		    (0 != (field->flags & PROTOBUF_C_FIELD_FLAG_PACKED) ||
 		     is_packable_type(field->type)))
 		{
+			if (0 != (field->flags & PROTOBUF_C_FIELD_FLAG_ENUM_UNKNOWN))
+				return parse_packed_closed_enum_member(scanned_member,
+								       member, message,
+								       allocator);
 			return parse_packed_repeated_member(scanned_member,
 							    member, message);
 		} else {
 			return parse_repeated_member(scanned_member,
 						     member, message,
-						     allocator);
+						     allocator, ctx);
 		}
 	}
 	PROTOBUF_C__ASSERT_NOT_REACHED();
@@ -3024,22 +4546,191 @@ message_init_generic(const ProtobufCMessageDescriptor *desc,
 #define REQUIRED_FIELD_BITMAP_IS_SET(index)	\
 	(required_fields_bitmap[(index)/8] & (1UL<<((index)%8)))
 
-ProtobufCMessage *
-protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
+#define FIELD_BITMAP_SET(bitmap, index)		\
+	((bitmap)[(index)/8] |= (1UL<<((index)%8)))
+
+#define FIELD_BITMAP_IS_SET(bitmap, index)	\
+	((bitmap)[(index)/8] & (1UL<<((index)%8)))
+
+static void
+message_free_members(ProtobufCMessage *message, ProtobufCAllocator *allocator);
+
+static protobuf_c_boolean
+message_unpack_extensions(ProtobufCMessage *message,
 			  ProtobufCAllocator *allocator,
-			  size_t len, const uint8_t *data)
+			  UnpackContext *ctx);
+
+/* Elements collected for ProtobufCUnpackDefer while unpacking a message. */
+typedef struct {
+	unsigned char *fields;		/* bitmap of the deferred fields */
+	ProtobufCDeferredMessage *messages;
+	size_t n_messages;
+} DeferredMembers;
+
+#define DEFERRED_FIELD_IS_SET(deferred, index)				\
+	((deferred)->fields[(index)/8] & (1UL<<((index)%8)))
+
+/*
+ * Pick the fields to defer from the element counts the scan left in the
+ * quantifiers, and allocate room for their elements.
+ */
+static protobuf_c_boolean
+deferred_members_init(DeferredMembers *deferred,
+		      const ProtobufCMessageDescriptor *desc,
+		      const ProtobufCMessage *message,
+		      ProtobufCUnpackDefer *defer,
+		      ProtobufCAllocator *allocator)
 {
-	ProtobufCMessage *rv;
-	size_t rem = len;
-	const uint8_t *at = data;
-	const ProtobufCFieldDescriptor *last_field = desc->fields + 0;
-	ScannedMember first_member_slab[1UL <<
-					FIRST_SCANNED_MEMBER_SLAB_SIZE_LOG2];
+	size_t n_messages = 0;
+	unsigned f;
 
-	/*
-	 * scanned_member_slabs[i] is an array of arrays of ScannedMember.
-	 * The first slab (scanned_member_slabs[0] is just a pointer to
-	 * first_member_slab), above. All subsequent slabs will be allocated
+	for (f = 0; f < desc->n_fields; f++) {
+		const ProtobufCFieldDescriptor *field = desc->fields + f;
+		size_t n;
+
+		if (!FIELD_IS_DEFERRABLE(field))
+			continue;
+		n = STRUCT_MEMBER(size_t, message, field->quantifier_offset);
+		if (n != 0 && n >= defer->min_elements)
+			n_messages += n;
+	}
+	if (n_messages == 0)
+		return TRUE;
+
+	deferred->fields = do_alloc(allocator, (desc->n_fields + 7) / 8);
+	if (deferred->fields == NULL)
+		return FALSE;
+	memset(deferred->fields, 0, (desc->n_fields + 7) / 8);
+	deferred->messages = do_alloc(allocator,
+				      n_messages * sizeof(ProtobufCDeferredMessage));
+	if (deferred->messages == NULL)
+		return FALSE;
+	for (f = 0; f < desc->n_fields; f++) {
+		const ProtobufCFieldDescriptor *field = desc->fields + f;
+		size_t n;
+
+		if (!FIELD_IS_DEFERRABLE(field))
+			continue;
+		n = STRUCT_MEMBER(size_t, message, field->quantifier_offset);
+		if (n != 0 && n >= defer->min_elements)
+			deferred->fields[f / 8] |= 1UL << (f % 8);
+	}
+	return TRUE;
+}
+
+/* Reserve the next slot of a deferred field for `scanned_member`. */
+static void
+defer_member(DeferredMembers *deferred,
+	     const ScannedMember *scanned_member,
+	     ProtobufCMessage *message)
+{
+	const ProtobufCFieldDescriptor *field = scanned_member->field;
+	size_t *p_n = STRUCT_MEMBER_PTR(size_t, message, field->quantifier_offset);
+	ProtobufCMessage **array = STRUCT_MEMBER(ProtobufCMessage **, message,
+						 field->offset);
+	ProtobufCDeferredMessage *m = deferred->messages + deferred->n_messages++;
+	unsigned pref_len = scanned_member->length_prefix_len;
+
+	array[*p_n] = NULL;
+	m->slot = array + *p_n;
+	m->descriptor = field->descriptor;
+	m->len = scanned_member->len - pref_len;
+	m->data = scanned_member->data + pref_len;
+	*p_n += 1;
+}
+
+/*
+ * Add up the payloads of the occurrences of `field` from member `j` of slab
+ * `i_slab` on. If `out` is given, also copy the payloads there and mark the
+ * occurrences as merged.
+ */
+static size_t
+concat_message_occurrences(ScannedMember **slabs,
+			   unsigned which_slab, unsigned in_slab_index,
+			   unsigned i_slab, unsigned j,
+			   const ProtobufCFieldDescriptor *field,
+			   uint8_t *out)
+{
+	size_t rv = 0;
+
+	for (; i_slab <= which_slab; i_slab++, j = 0) {
+		unsigned max = (i_slab == which_slab) ? in_slab_index :
+			(1UL << (i_slab + FIRST_SCANNED_MEMBER_SLAB_SIZE_LOG2));
+
+		for (; j < max; j++) {
+			ScannedMember *sm = slabs[i_slab] + j;
+			size_t len = sm->len - sm->length_prefix_len;
+
+			if (sm->field != field ||
+			    sm->wire_type != PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+				continue;
+			if (out != NULL) {
+				memcpy(out + rv, sm->data + sm->length_prefix_len,
+				       len);
+				sm->merged = 1;
+			}
+			rv += len;
+		}
+	}
+	return rv;
+}
+
+/*
+ * Unpack all occurrences of a singular message field as one message.
+ *
+ * Merging the occurrences is defined as unpacking the concatenation of their
+ * payloads. Doing just that takes time linear in their total length, where
+ * merging each into the previous ones with merge_messages() copies the
+ * repeated fields collected so far every time.
+ */
+static protobuf_c_boolean
+parse_merged_message_member(ScannedMember **slabs,
+			    unsigned which_slab, unsigned in_slab_index,
+			    unsigned i_slab, unsigned j,
+			    ProtobufCMessage *message,
+			    ProtobufCAllocator *allocator,
+			    UnpackContext *ctx)
+{
+	ScannedMember merged = slabs[i_slab][j];
+	size_t len;
+	uint8_t *buf = NULL;
+	protobuf_c_boolean rv;
+
+	len = concat_message_occurrences(slabs, which_slab, in_slab_index,
+					 i_slab, j, merged.field, NULL);
+	if (len != 0) {
+		buf = do_alloc(allocator, len);
+		if (buf == NULL)
+			return FALSE;
+	}
+	concat_message_occurrences(slabs, which_slab, in_slab_index,
+				   i_slab, j, merged.field, buf);
+	merged.data = buf;
+	merged.len = len;
+	merged.length_prefix_len = 0;
+	rv = parse_member(&merged, message, allocator, ctx);
+	do_free(allocator, buf);
+	return rv;
+}
+
+static protobuf_c_boolean
+message_unpack_members(const ProtobufCMessageDescriptor *desc,
+		       ProtobufCAllocator *allocator,
+		       size_t len, const uint8_t *data,
+		       ProtobufCMessage *rv,
+		       ProtobufCUnpackDefer *defer,
+		       UnpackContext *ctx)
+{
+	size_t rem = len;
+	const uint8_t *at = data;
+	const ProtobufCFieldDescriptor *last_field = desc->fields + 0;
+	ScannedMember first_member_slab[1UL <<
+					FIRST_SCANNED_MEMBER_SLAB_SIZE_LOG2];
+
+	/*
+	 * scanned_member_slabs[i] is an array of arrays of ScannedMember.
+	 * The first slab (scanned_member_slabs[0] is just a pointer to
+	 * first_member_slab), above. All subsequent slabs will be allocated
 	 * using the allocator.
 	 */
 	ScannedMember *scanned_member_slabs[MAX_SCANNED_MEMBER_SLAB + 1];
@@ -3051,30 +4742,31 @@ protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
 	unsigned i_slab;
 	unsigned last_field_index = 0;
 	unsigned required_fields_bitmap_len;
-	unsigned char required_fields_bitmap_stack[16];
+	unsigned char required_fields_bitmap_stack[48];
 	unsigned char *required_fields_bitmap = required_fields_bitmap_stack;
 	protobuf_c_boolean required_fields_bitmap_alloced = FALSE;
+	unsigned char *message_fields_seen;
+	unsigned char *message_fields_merged;
+	protobuf_c_boolean have_merged_messages = FALSE;
+	DeferredMembers deferred = { NULL, NULL, 0 };
 
-	ASSERT_IS_MESSAGE_DESCRIPTOR(desc);
-
-	if (allocator == NULL)
-		allocator = &protobuf_c__allocator;
-
-	rv = do_alloc(allocator, desc->sizeof_message);
-	if (!rv)
-		return (NULL);
 	scanned_member_slabs[0] = first_member_slab;
 
+	/*
+	 * The required fields seen, followed by bitmaps of the singular
+	 * message fields seen and of those seen more than once.
+	 */
 	required_fields_bitmap_len = (desc->n_fields + 7) / 8;
-	if (required_fields_bitmap_len > sizeof(required_fields_bitmap_stack)) {
-		required_fields_bitmap = do_alloc(allocator, required_fields_bitmap_len);
-		if (!required_fields_bitmap) {
-			do_free(allocator, rv);
-			return (NULL);
-		}
+	if (3 * required_fields_bitmap_len > sizeof(required_fields_bitmap_stack)) {
+		required_fields_bitmap = do_alloc(allocator,
+						  3 * required_fields_bitmap_len);
+		if (!required_fields_bitmap)
+			return FALSE;
 		required_fields_bitmap_alloced = TRUE;
 	}
-	memset(required_fields_bitmap, 0, required_fields_bitmap_len);
+	memset(required_fields_bitmap, 0, 3 * required_fields_bitmap_len);
+	message_fields_seen = required_fields_bitmap + required_fields_bitmap_len;
+	message_fields_merged = message_fields_seen + required_fields_bitmap_len;
 
 	/*
 	 * Generated code always defines "message_init". However, we provide a
@@ -3090,40 +4782,55 @@ protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
 	while (rem > 0) {
 		uint32_t tag;
 		uint8_t wire_type;
-		size_t used = parse_tag_and_wiretype(rem, at, &tag, &wire_type);
+		size_t used;
 		const ProtobufCFieldDescriptor *field;
 		ScannedMember tmp;
 
-		if (used == 0) {
-			PROTOBUF_C_UNPACK_ERROR("error parsing tag/wiretype at offset %u",
-						(unsigned) (at - data));
-			goto error_cleanup_during_scan;
-		}
 		/*
-		 * \todo Consider optimizing for field[1].id == tag, if field[1]
-		 * exists!
+		 * Fields mostly arrive in order, so first try the pre-encoded
+		 * keys of the last field seen and of the one after it.
 		 */
-		if (last_field == NULL || last_field->id != tag) {
-			/* lookup field */
-			int field_index =
-			    int_range_lookup(desc->n_field_ranges,
-					     desc->field_ranges,
-					     tag);
-			if (field_index < 0) {
-				field = NULL;
-				n_unknown++;
-			} else {
-				field = desc->fields + field_index;
-				last_field = field;
-				last_field_index = field_index;
+		used = 0;
+		if (last_field != NULL) {
+			used = field_tag_match(last_field, rem, at);
+			if (used == 0 && last_field_index + 1 < desc->n_fields) {
+				used = field_tag_match(last_field + 1, rem, at);
+				if (used != 0) {
+					last_field++;
+					last_field_index++;
+				}
 			}
-		} else {
+		}
+		if (used != 0) {
 			field = last_field;
+			tag = field->id;
+			wire_type = at[0] & 7;
+		} else {
+			used = parse_tag_and_wiretype(rem, at, &tag, &wire_type);
+			if (used == 0) {
+				PROTOBUF_C_UNPACK_ERROR("error parsing tag/wiretype at offset %u",
+							(unsigned) (at - data));
+				goto error_cleanup_during_scan;
+			}
+			if (last_field == NULL || last_field->id != tag) {
+				/* lookup field */
+				int field_index =
+				    int_range_lookup(desc->n_field_ranges,
+						     desc->field_ranges,
+						     tag);
+				if (field_index < 0) {
+					field = NULL;
+					n_unknown++;
+				} else {
+					field = desc->fields + field_index;
+					last_field = field;
+					last_field_index = field_index;
+				}
+			} else {
+				field = last_field;
+			}
 		}
 
-		if (field != NULL && field->label == PROTOBUF_C_LABEL_REQUIRED)
-			REQUIRED_FIELD_BITMAP_SET(last_field_index);
-
 		at += used;
 		rem -= used;
 		tmp.tag = tag;
@@ -3131,23 +4838,17 @@ protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
 		tmp.field = field;
 		tmp.data = at;
 		tmp.length_prefix_len = 0;
+		tmp.merged = 0;
 
 		switch (wire_type) {
-		case PROTOBUF_C_WIRE_TYPE_VARINT: {
-			unsigned max_len = rem < 10 ? rem : 10;
-			unsigned i;
-
-			for (i = 0; i < max_len; i++)
-				if ((at[i] & 0x80) == 0)
-					break;
-			if (i == max_len) {
+		case PROTOBUF_C_WIRE_TYPE_VARINT:
+			tmp.len = scan_varint(rem < 10 ? rem : 10, at);
+			if (tmp.len == 0) {
 				PROTOBUF_C_UNPACK_ERROR("unterminated varint at offset %u",
 							(unsigned) (at - data));
 				goto error_cleanup_during_scan;
 			}
-			tmp.len = i + 1;
 			break;
-		}
 		case PROTOBUF_C_WIRE_TYPE_64BIT:
 			if (rem < 8) {
 				PROTOBUF_C_UNPACK_ERROR("too short after 64bit wiretype at offset %u",
@@ -3181,6 +4882,50 @@ protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
 			goto error_cleanup_during_scan;
 		}
 
+		if (field != NULL &&
+		    0 != (field->flags & (PROTOBUF_C_FIELD_FLAG_ENUM_REJECT |
+					  PROTOBUF_C_FIELD_FLAG_ENUM_UNKNOWN)))
+		{
+			size_t n_undeclared;
+
+			if (!count_undeclared_enum_values(&tmp, &n_undeclared))
+				goto error_cleanup_during_scan;
+			if (n_undeclared != 0) {
+				if (0 != (field->flags & PROTOBUF_C_FIELD_FLAG_ENUM_REJECT)) {
+					PROTOBUF_C_UNPACK_ERROR("undeclared value for enum field %s at offset %u",
+								field->name, (unsigned) (at - data));
+					goto error_cleanup_during_scan;
+				}
+				n_unknown += n_undeclared;
+				if (wire_type == PROTOBUF_C_WIRE_TYPE_VARINT) {
+					/* the whole member is an unknown field */
+					field = NULL;
+					tmp.field = NULL;
+				}
+			}
+		}
+
+		if (field != NULL && field->label == PROTOBUF_C_LABEL_REQUIRED)
+			REQUIRED_FIELD_BITMAP_SET(last_field_index);
+
+		if (field != NULL &&
+		    field->type == PROTOBUF_C_TYPE_MESSAGE &&
+		    field->label != PROTOBUF_C_LABEL_REPEATED &&
+		    0 == (field->flags & PROTOBUF_C_FIELD_FLAG_ONEOF) &&
+		    wire_type == PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+		{
+			if (FIELD_BITMAP_IS_SET(message_fields_seen,
+						last_field_index))
+			{
+				FIELD_BITMAP_SET(message_fields_merged,
+						 last_field_index);
+				have_merged_messages = TRUE;
+			} else {
+				FIELD_BITMAP_SET(message_fields_seen,
+						 last_field_index);
+			}
+		}
+
 		if (in_slab_index == (1UL <<
 			(which_slab + FIRST_SCANNED_MEMBER_SLAB_SIZE_LOG2)))
 		{
@@ -3194,6 +4939,8 @@ protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
 			which_slab++;
 			size = sizeof(ScannedMember)
 				<< (which_slab + FIRST_SCANNED_MEMBER_SLAB_SIZE_LOG2);
+			STATS_RECORD(PROTOBUF_C_TRACE_SCANNED_MEMBER_SPILL,
+				     desc, size);
 			scanned_member_slabs[which_slab] = do_alloc(allocator, size);
 			if (scanned_member_slabs[which_slab] == NULL)
 				goto error_cleanup_during_scan;
@@ -3203,11 +4950,12 @@ protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
 		if (field != NULL && field->label == PROTOBUF_C_LABEL_REPEATED) {
 			size_t *n = STRUCT_MEMBER_PTR(size_t, rv,
 						      field->quantifier_offset);
+			size_t count = 1;
+
 			if (wire_type == PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED &&
 			    (0 != (field->flags & PROTOBUF_C_FIELD_FLAG_PACKED) ||
 			     is_packable_type(field->type)))
 			{
-				size_t count;
 				if (!count_packed_elements(field->type,
 							   tmp.len -
 							   tmp.length_prefix_len,
@@ -3218,16 +4966,39 @@ protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
 					PROTOBUF_C_UNPACK_ERROR("counting packed elements");
 					goto error_cleanup_during_scan;
 				}
-				*n += count;
-			} else {
-				*n += 1;
 			}
+			if (count > ctx->max_elements - ctx->n_elements) {
+				PROTOBUF_C_UNPACK_ERROR("more than %lu repeated elements",
+							(unsigned long) ctx->max_elements);
+				goto error_cleanup_during_scan;
+			}
+			ctx->n_elements += count;
+			*n += count;
+		}
+		if (field != NULL && field->type == PROTOBUF_C_TYPE_MESSAGE) {
+			if (ctx->n_submessages == ctx->max_submessages) {
+				PROTOBUF_C_UNPACK_ERROR("more than %lu submessages",
+							(unsigned long) ctx->max_submessages);
+				goto error_cleanup_during_scan;
+			}
+			ctx->n_submessages++;
 		}
 
 		at += tmp.len;
 		rem -= tmp.len;
 	}
 
+	if (n_unknown > ctx->max_unknown_fields - ctx->n_unknown_fields) {
+		PROTOBUF_C_UNPACK_ERROR("more than %lu unknown fields",
+					(unsigned long) ctx->max_unknown_fields);
+		goto error_cleanup_during_scan;
+	}
+	ctx->n_unknown_fields += n_unknown;
+
+	if (defer != NULL &&
+	    !deferred_members_init(&deferred, desc, rv, defer, allocator))
+		goto error_cleanup_during_scan;
+
 	/* allocate space for repeated fields, also check that all required fields have been set */
 	for (f = 0; f < desc->n_fields; f++) {
 		const ProtobufCFieldDescriptor *field = desc->fields + f;
@@ -3235,8 +5006,7 @@ protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
 			continue;
 		}
 		if (field->label == PROTOBUF_C_LABEL_REPEATED) {
-			size_t siz =
-			    sizeof_elt_in_repeated_array(field->type);
+			size_t siz = sizeof_elt_in_field_array(field);
 			size_t *n_ptr =
 			    STRUCT_MEMBER_PTR(size_t, rv,
 					      field->quantifier_offset);
@@ -3252,6 +5022,24 @@ protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
                   if (field->label == PROTOBUF_C_LABEL_REPEATED)              \
                     STRUCT_MEMBER (size_t, rv, field->quantifier_offset) = 0; \
                 }
+				if (0 != (field->flags & PROTOBUF_C_FIELD_FLAG_SOA)) {
+					const ProtobufCMessageDescriptor *elt_desc =
+						field->descriptor;
+					void **arrays = STRUCT_MEMBER_PTR(void *, rv,
+									  field->offset);
+					unsigned k;
+
+					for (k = 0; k < elt_desc->n_fields; k++) {
+						arrays[k] = do_alloc(allocator,
+							sizeof_elt_in_repeated_array(
+								elt_desc->fields[k].type) * n);
+						if (!arrays[k]) {
+							CLEAR_REMAINING_N_PTRS();
+							goto error_cleanup;
+						}
+					}
+					continue;
+				}
 				a = do_alloc(allocator, siz * n);
 				if (!a) {
 					CLEAR_REMAINING_N_PTRS();
@@ -3289,7 +5077,37 @@ protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
 		ScannedMember *slab = scanned_member_slabs[i_slab];
 
 		for (j = 0; j < max; j++) {
-			if (!parse_member(slab + j, rv, allocator)) {
+			if (deferred.fields != NULL &&
+			    slab[j].field != NULL &&
+			    slab[j].wire_type == PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED &&
+			    DEFERRED_FIELD_IS_SET(&deferred,
+						  slab[j].field - desc->fields))
+			{
+				defer_member(&deferred, slab + j, rv);
+				continue;
+			}
+			if (slab[j].merged)
+				continue;
+			if (have_merged_messages &&
+			    slab[j].field != NULL &&
+			    slab[j].wire_type == PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED &&
+			    FIELD_BITMAP_IS_SET(message_fields_merged,
+						slab[j].field - desc->fields))
+			{
+				if (!parse_merged_message_member(scanned_member_slabs,
+								 which_slab,
+								 in_slab_index,
+								 i_slab, j, rv,
+								 allocator, ctx))
+				{
+					PROTOBUF_C_UNPACK_ERROR("error parsing member %s of %s",
+								slab[j].field->name,
+								desc->name);
+					goto error_cleanup;
+				}
+				continue;
+			}
+			if (!parse_member(slab + j, rv, allocator, ctx)) {
 				PROTOBUF_C_UNPACK_ERROR("error parsing member %s of %s",
 							slab->field ? slab->field->name : "*unknown-field*",
 					desc->name);
@@ -3298,46 +5116,240 @@ protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
 		}
 	}
 
+	if (deferred.n_messages != 0) {
+		if (ctx->depth == ctx->max_depth) {
+			PROTOBUF_C_UNPACK_ERROR("members of '%s' nested more than %u deep",
+						desc->name, ctx->max_depth);
+			goto error_cleanup;
+		}
+		defer->max_depth = ctx->max_depth - ctx->depth;
+		if (!defer->unpack(defer->defer_data, deferred.n_messages,
+				   deferred.messages))
+		{
+			PROTOBUF_C_UNPACK_ERROR("error parsing deferred members of %s",
+						desc->name);
+			goto error_cleanup;
+		}
+	}
+
+	if (desc->extensions != NULL &&
+	    !message_unpack_extensions(rv, allocator, ctx))
+		goto error_cleanup;
+
+	if (rv->n_unknown_fields != 0)
+		STATS_RECORD(PROTOBUF_C_TRACE_UNKNOWN_FIELDS, desc,
+			     rv->n_unknown_fields);
+	STATS_RECORD(PROTOBUF_C_TRACE_UNPACK, desc, len);
+
 	/* cleanup */
 	for (j = 1; j <= which_slab; j++)
 		do_free(allocator, scanned_member_slabs[j]);
 	if (required_fields_bitmap_alloced)
 		do_free(allocator, required_fields_bitmap);
-	return rv;
+	do_free(allocator, deferred.fields);
+	do_free(allocator, deferred.messages);
+	return TRUE;
 
 error_cleanup:
-	protobuf_c_message_free_unpacked(rv, allocator);
+	message_free_members(rv, allocator);
 	for (j = 1; j <= which_slab; j++)
 		do_free(allocator, scanned_member_slabs[j]);
 	if (required_fields_bitmap_alloced)
 		do_free(allocator, required_fields_bitmap);
-	return NULL;
+	do_free(allocator, deferred.fields);
+	do_free(allocator, deferred.messages);
+	return FALSE;
 
 error_cleanup_during_scan:
-	do_free(allocator, rv);
 	for (j = 1; j <= which_slab; j++)
 		do_free(allocator, scanned_member_slabs[j]);
 	if (required_fields_bitmap_alloced)
 		do_free(allocator, required_fields_bitmap);
-	return NULL;
+	do_free(allocator, deferred.fields);
+	do_free(allocator, deferred.messages);
+	return FALSE;
 }
 
-void
-protobuf_c_message_free_unpacked(ProtobufCMessage *message,
-				 ProtobufCAllocator *allocator)
+/*
+ * Unpack into caller-provided storage of desc->sizeof_message bytes. On
+ * failure everything allocated for the message has been released again.
+ * `defer` is only given for the top-level message.
+ */
+static protobuf_c_boolean
+message_unpack_to(const ProtobufCMessageDescriptor *desc,
+		  ProtobufCAllocator *allocator,
+		  size_t len, const uint8_t *data,
+		  ProtobufCMessage *rv,
+		  ProtobufCUnpackDefer *defer,
+		  UnpackContext *ctx)
 {
-	const ProtobufCMessageDescriptor *desc;
-	unsigned f;
+	protobuf_c_boolean ok;
 
-	if (message == NULL)
-		return;
+	if (ctx->depth == ctx->max_depth) {
+		PROTOBUF_C_UNPACK_ERROR("message '%s' nested more than %u deep",
+					desc->name, ctx->max_depth);
+		return FALSE;
+	}
+	ctx->depth++;
+	ok = message_unpack_members(desc, allocator, len, data, rv, defer, ctx);
+	ctx->depth--;
+	return ok;
+}
 
-	desc = message->descriptor;
+static ProtobufCMessage *
+message_unpack(const ProtobufCMessageDescriptor *desc,
+	       ProtobufCAllocator *allocator,
+	       size_t len, const uint8_t *data,
+	       ProtobufCUnpackDefer *defer,
+	       UnpackContext *ctx)
+{
+	ProtobufCMessage *rv;
 
-	ASSERT_IS_MESSAGE(message);
+	rv = do_alloc(allocator, desc->sizeof_message);
+	if (!rv)
+		return (NULL);
+	if (!message_unpack_to(desc, allocator, len, data, rv, defer, ctx)) {
+		do_free(allocator, rv);
+		return (NULL);
+	}
+	return rv;
+}
+
+ProtobufCMessage *
+protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
+			  ProtobufCAllocator *allocator,
+			  size_t len, const uint8_t *data)
+{
+	return protobuf_c_message_unpack_deferred(desc, allocator, len, data,
+						  NULL);
+}
+
+/*
+ * A member of ProtobufCUnpackOptions, or 0 if the caller's structure, as
+ * given by its `size`, ends before it.
+ */
+#define UNPACK_OPTION(options, member) \
+	(offsetof(ProtobufCUnpackOptions, member) + sizeof((options)->member) <= \
+	 (options)->size ? (options)->member : 0)
+
+/* A limit of 0 in ProtobufCUnpackOptions means none. */
+#define UNPACK_LIMIT(options, member) \
+	(UNPACK_OPTION(options, member) != 0 ? \
+	 UNPACK_OPTION(options, member) : SIZE_MAX)
+
+static protobuf_c_boolean
+unpack_context_init(UnpackContext *ctx, const ProtobufCUnpackOptions *options)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->max_depth = PROTOBUF_C_DEFAULT_MAX_DEPTH;
+	ctx->max_elements = SIZE_MAX;
+	ctx->max_unknown_fields = SIZE_MAX;
+	ctx->max_submessages = SIZE_MAX;
+	if (options == NULL)
+		return TRUE;
+	if (options->size < sizeof(options->size) ||
+	    options->size > sizeof(ProtobufCUnpackOptions))
+	{
+		PROTOBUF_C_UNPACK_ERROR("unpack options of unknown size %lu",
+					(unsigned long) options->size);
+		return FALSE;
+	}
+	if (UNPACK_OPTION(options, max_depth) != 0)
+		ctx->max_depth = options->max_depth;
+	ctx->max_elements = UNPACK_LIMIT(options, max_elements);
+	ctx->max_unknown_fields = UNPACK_LIMIT(options, max_unknown_fields);
+	ctx->max_submessages = UNPACK_LIMIT(options, max_submessages);
+	ctx->extensions = UNPACK_OPTION(options, extensions);
+	return TRUE;
+}
+
+/* Passes allocations on to another allocator up to a total size. */
+typedef struct {
+	ProtobufCAllocator base;
+	ProtobufCAllocator *allocator;
+	size_t allocated;
+	size_t max_allocated;
+} QuotaAllocator;
+
+static void *
+quota_alloc(void *allocator_data, size_t size)
+{
+	QuotaAllocator *quota = allocator_data;
+
+	if (size > quota->max_allocated - quota->allocated) {
+		PROTOBUF_C_UNPACK_ERROR("more than %lu bytes allocated",
+					(unsigned long) quota->max_allocated);
+		return NULL;
+	}
+	quota->allocated += size;
+	return quota->allocator->alloc(quota->allocator->allocator_data, size);
+}
+
+static void
+quota_free(void *allocator_data, void *data)
+{
+	QuotaAllocator *quota = allocator_data;
+
+	quota->allocator->free(quota->allocator->allocator_data, data);
+}
+
+ProtobufCMessage *
+protobuf_c_message_unpack_with_options(const ProtobufCMessageDescriptor *desc,
+				       ProtobufCAllocator *allocator,
+				       const ProtobufCUnpackOptions *options,
+				       size_t len, const uint8_t *data)
+{
+	UnpackContext ctx;
+	QuotaAllocator quota;
+
+	ASSERT_IS_MESSAGE_DESCRIPTOR(desc);
 
 	if (allocator == NULL)
 		allocator = &protobuf_c__allocator;
+	if (!unpack_context_init(&ctx, options))
+		return NULL;
+	if (options != NULL) {
+		if (len > UNPACK_LIMIT(options, max_message_size)) {
+			PROTOBUF_C_UNPACK_ERROR("message of %lu bytes is too large",
+						(unsigned long) len);
+			return NULL;
+		}
+		if (UNPACK_OPTION(options, max_allocated) != 0) {
+			quota.base.alloc = quota_alloc;
+			quota.base.free = quota_free;
+			quota.base.allocator_data = &quota;
+			quota.allocator = allocator;
+			quota.allocated = 0;
+			quota.max_allocated = options->max_allocated;
+			allocator = &quota.base;
+		}
+	}
+	return message_unpack(desc, allocator, len, data, NULL, &ctx);
+}
+
+ProtobufCMessage *
+protobuf_c_message_unpack_deferred(const ProtobufCMessageDescriptor *desc,
+				   ProtobufCAllocator *allocator,
+				   size_t len, const uint8_t *data,
+				   ProtobufCUnpackDefer *defer)
+{
+	UnpackContext ctx;
+
+	ASSERT_IS_MESSAGE_DESCRIPTOR(desc);
+
+	if (allocator == NULL)
+		allocator = &protobuf_c__allocator;
+	unpack_context_init(&ctx, NULL);
+	return message_unpack(desc, allocator, len, data, defer, &ctx);
+}
+
+/* Free everything a message owns, but not the message structure itself. */
+static void
+message_free_members(ProtobufCMessage *message, ProtobufCAllocator *allocator)
+{
+	const ProtobufCMessageDescriptor *desc = message->descriptor;
+	unsigned f;
+
 	message->descriptor = NULL;
 	for (f = 0; f < desc->n_fields; f++) {
 		if (0 != (desc->fields[f].flags & PROTOBUF_C_FIELD_FLAG_ONEOF) &&
@@ -3348,7 +5360,16 @@ protobuf_c_message_free_unpacked(ProtobufCMessage *message,
 			continue;
 		}
 
-		if (desc->fields[f].label == PROTOBUF_C_LABEL_REPEATED) {
+		if (0 != (desc->fields[f].flags & PROTOBUF_C_FIELD_FLAG_SOA)) {
+			const ProtobufCMessageDescriptor *elt_desc =
+				desc->fields[f].descriptor;
+			void **arrays = STRUCT_MEMBER_PTR(void *, message,
+							  desc->fields[f].offset);
+			unsigned k;
+
+			for (k = 0; k < elt_desc->n_fields; k++)
+				do_free(allocator, arrays[k]);
+		} else if (desc->fields[f].label == PROTOBUF_C_LABEL_REPEATED) {
 			size_t n = STRUCT_MEMBER(size_t,
 						 message,
 						 desc->fields[f].quantifier_offset);
@@ -3365,6 +5386,15 @@ protobuf_c_message_free_unpacked(ProtobufCMessage *message,
 					unsigned i;
 					for (i = 0; i < n; i++)
 						do_free(allocator, ((ProtobufCBinaryData *) arr)[i].data);
+				} else if (FIELD_HAS_INLINE_MESSAGES(&desc->fields[f])) {
+					unsigned i;
+					for (i = 0; i < n; i++)
+						message_free_members(
+							(ProtobufCMessage *)
+							repeated_message_at(&desc->fields[f],
+									    arr, i),
+							allocator
+						);
 				} else if (desc->fields[f].type == PROTOBUF_C_TYPE_MESSAGE) {
 					unsigned i;
 					for (i = 0; i < n; i++)
@@ -3375,6 +5405,9 @@ protobuf_c_message_free_unpacked(ProtobufCMessage *message,
 				}
 				do_free(allocator, arr);
 			}
+			if (0 != (desc->fields[f].flags & PROTOBUF_C_FIELD_FLAG_MAP))
+				protobuf_c_message_map_invalidate(message,
+								  &desc->fields[f]);
 		} else if (desc->fields[f].type == PROTOBUF_C_TYPE_STRING) {
 			char *str = STRUCT_MEMBER(char *, message,
 						  desc->fields[f].offset);
@@ -3408,6 +5441,31 @@ protobuf_c_message_free_unpacked(ProtobufCMessage *message,
 	if (message->unknown_fields != NULL)
 		do_free(allocator, message->unknown_fields);
 
+	if (desc->extensions != NULL) {
+		ProtobufCExtensionSet *set = *EXTENSION_SET_MEMBER(message, desc);
+
+		if (set != NULL) {
+			for (f = 0; f < set->n_values; f++)
+				message_free_members(&set->values[f].base,
+						     allocator);
+			do_free(allocator, set->values);
+			do_free(allocator, set);
+		}
+	}
+}
+
+void
+protobuf_c_message_free_unpacked(ProtobufCMessage *message,
+				 ProtobufCAllocator *allocator)
+{
+	if (message == NULL)
+		return;
+
+	ASSERT_IS_MESSAGE(message);
+
+	if (allocator == NULL)
+		allocator = &protobuf_c__allocator;
+	message_free_members(message, allocator);
 	do_free(allocator, message);
 }
 
@@ -3415,17 +5473,23 @@ void
 protobuf_c_message_init(const ProtobufCMessageDescriptor * descriptor,
 			void *message)
 {
-	descriptor->message_init((ProtobufCMessage *) (message));
+	if (descriptor->message_init != NULL)
+		descriptor->message_init((ProtobufCMessage *) (message));
+	else
+		message_init_generic(descriptor, (ProtobufCMessage *) (message));
 }
 
-protobuf_c_boolean
-protobuf_c_message_check(const ProtobufCMessage *message)
+/* `depth` is the number of messages enclosing `message`. */
+static protobuf_c_boolean
+message_check(const ProtobufCMessage *message, unsigned depth)
 {
+	const ProtobufCExtensionSet *set;
 	unsigned i;
 
 	if (!message ||
 	    !message->descriptor ||
-	    message->descriptor->magic != PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC)
+	    message->descriptor->magic != PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC ||
+	    depth == PROTOBUF_C_DEFAULT_MAX_DEPTH)
 	{
 		return FALSE;
 	}
@@ -3450,11 +5514,20 @@ protobuf_c_message_check(const ProtobufCMessage *message)
 				return FALSE;
 			}
 
-			if (type == PROTOBUF_C_TYPE_MESSAGE) {
-				ProtobufCMessage **submessage = *(ProtobufCMessage ***) field;
+			if (f->flags & PROTOBUF_C_FIELD_FLAG_SOA) {
+				const ProtobufCMessageDescriptor *elt_desc = f->descriptor;
+				unsigned j;
+				for (j = 1; j < elt_desc->n_fields; j++) {
+					if (*quantity > 0 && ((void **) field)[j] == NULL)
+						return FALSE;
+				}
+			} else if (type == PROTOBUF_C_TYPE_MESSAGE) {
+				void *array = *(void **) field;
 				unsigned j;
 				for (j = 0; j < *quantity; j++) {
-					if (!protobuf_c_message_check(submessage[j]))
+					if (!message_check(
+						repeated_message_at(f, array, j),
+						depth + 1))
 						return FALSE;
 				}
 			} else if (type == PROTOBUF_C_TYPE_STRING) {
@@ -3478,7 +5551,7 @@ protobuf_c_message_check(const ProtobufCMessage *message)
 			if (type == PROTOBUF_C_TYPE_MESSAGE) {
 				ProtobufCMessage *submessage = *(ProtobufCMessage **) field;
 				if (label == PROTOBUF_C_LABEL_REQUIRED || submessage != NULL) {
-					if (!protobuf_c_message_check(submessage))
+					if (!message_check(submessage, depth + 1))
 						return FALSE;
 				}
 			} else if (type == PROTOBUF_C_TYPE_STRING) {
@@ -3496,9 +5569,598 @@ protobuf_c_message_check(const ProtobufCMessage *message)
 		}
 	}
 
+	set = message_extension_set(message);
+	if (set != NULL) {
+		for (i = 0; i < set->n_values; i++) {
+			if (!message_check(&set->values[i].base, depth + 1))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+protobuf_c_boolean
+protobuf_c_message_check(const ProtobufCMessage *message)
+{
+	return message_check(message, 0);
+}
+
+/* === maps === */
+
+/* Maps with at most this many entries are scanned instead of indexed. */
+#define MAP_LINEAR_SCAN_MAX	8
+
+struct ProtobufCMapIndex {
+	const void *entries;	/* the entry array the index was built for */
+	size_t n_entries;
+	size_t mask;		/* number of slots - 1 */
+	size_t slots[1];	/* entry index + 1, or 0 if the slot is empty */
+};
+
+#define MAP_INDEX_MEMBER(message, field) \
+	STRUCT_MEMBER_PTR(ProtobufCMapIndex *, (message), \
+			  (field)->offset + sizeof(void *))
+
+/*
+ * Load an integral or bool key. Keys are only compared with keys of the same
+ * field, so zero-extending signed 32-bit values is fine.
+ */
+static inline uint64_t
+map_key_scalar(ProtobufCType type, const void *key)
+{
+	switch (type) {
+	case PROTOBUF_C_TYPE_BOOL:
+		return *(const protobuf_c_boolean *) key != 0;
+	case PROTOBUF_C_TYPE_SINT64:
+	case PROTOBUF_C_TYPE_INT64:
+	case PROTOBUF_C_TYPE_UINT64:
+	case PROTOBUF_C_TYPE_SFIXED64:
+	case PROTOBUF_C_TYPE_FIXED64:
+		return *(const uint64_t *) key;
+	default:
+		return *(const uint32_t *) key;
+	}
+}
+
+static inline const char *
+map_key_string(const void *key)
+{
+	const char *str = *(const char * const *) key;
+	return str != NULL ? str : "";
+}
+
+static uint64_t
+map_key_hash(const ProtobufCFieldDescriptor *key_field, const void *key)
+{
+	uint64_t h;
+
+	if (key_field->type == PROTOBUF_C_TYPE_STRING) {
+		/* FNV-1a */
+		const unsigned char *str =
+			(const unsigned char *) map_key_string(key);
+		h = UINT64_C(14695981039346656037);
+		while (*str != 0) {
+			h ^= *str++;
+			h *= UINT64_C(1099511628211);
+		}
+	} else {
+		h = map_key_scalar(key_field->type, key);
+	}
+	h ^= h >> 33;
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	return h;
+}
+
+static protobuf_c_boolean
+map_key_equal(const ProtobufCFieldDescriptor *key_field,
+	      const void *a, const void *b)
+{
+	if (key_field->type == PROTOBUF_C_TYPE_STRING)
+		return strcmp(map_key_string(a), map_key_string(b)) == 0;
+	return map_key_scalar(key_field->type, a) ==
+		map_key_scalar(key_field->type, b);
+}
+
+static ProtobufCMapIndex *
+map_index_build(const ProtobufCFieldDescriptor *key_field,
+		const char *entries, size_t n, size_t stride)
+{
+	ProtobufCMapIndex *index;
+	size_t n_slots = 16;
+	size_t i;
+
+	while (n_slots < 2 * n)
+		n_slots *= 2;
+	index = do_alloc(&protobuf_c__allocator,
+			 offsetof(ProtobufCMapIndex, slots) +
+			 n_slots * sizeof(size_t));
+	if (index == NULL)
+		return NULL;
+	index->entries = entries;
+	index->n_entries = n;
+	index->mask = n_slots - 1;
+	memset(index->slots, 0, n_slots * sizeof(size_t));
+
+	for (i = 0; i < n; i++) {
+		const void *key = entries + i * stride + key_field->offset;
+		size_t slot = (size_t) map_key_hash(key_field, key) & index->mask;
+
+		/* a later duplicate replaces the earlier entry */
+		while (index->slots[slot] != 0 &&
+		       !map_key_equal(key_field, key,
+				      entries + (index->slots[slot] - 1) * stride +
+				      key_field->offset))
+			slot = (slot + 1) & index->mask;
+		index->slots[slot] = i + 1;
+	}
+	return index;
+}
+
+const ProtobufCMessage *
+protobuf_c_message_map_lookup(ProtobufCMessage *message,
+			      const ProtobufCFieldDescriptor *field,
+			      const void *key)
+{
+	const ProtobufCMessageDescriptor *entry_desc = field->descriptor;
+	const ProtobufCFieldDescriptor *key_field = entry_desc->fields + 0;
+	size_t n = STRUCT_MEMBER(size_t, message, field->quantifier_offset);
+	const char *entries = STRUCT_MEMBER(const char *, message, field->offset);
+	size_t stride = entry_desc->sizeof_message;
+	ProtobufCMapIndex **pindex = MAP_INDEX_MEMBER(message, field);
+	ProtobufCMapIndex *index = *pindex;
+	size_t slot;
+
+	ASSERT_IS_MESSAGE(message);
+	assert(0 != (field->flags & PROTOBUF_C_FIELD_FLAG_MAP));
+	assert(key_field->id == 1);
+
+	if (n == 0)
+		return NULL;
+
+	if (index != NULL && (index->entries != entries || index->n_entries != n)) {
+		do_free(&protobuf_c__allocator, index);
+		*pindex = index = NULL;
+	}
+	if (index == NULL && n > MAP_LINEAR_SCAN_MAX)
+		*pindex = index = map_index_build(key_field, entries, n, stride);
+
+	if (index == NULL) {
+		/* small map, or no memory for an index: scan, last entry wins */
+		while (n-- > 0) {
+			const char *entry = entries + n * stride;
+			if (map_key_equal(key_field, entry + key_field->offset, key))
+				return (const ProtobufCMessage *) entry;
+		}
+		return NULL;
+	}
+
+	slot = (size_t) map_key_hash(key_field, key) & index->mask;
+	while (index->slots[slot] != 0) {
+		const char *entry = entries + (index->slots[slot] - 1) * stride;
+		if (map_key_equal(key_field, entry + key_field->offset, key))
+			return (const ProtobufCMessage *) entry;
+		slot = (slot + 1) & index->mask;
+	}
+	return NULL;
+}
+
+void
+protobuf_c_message_map_invalidate(ProtobufCMessage *message,
+				  const ProtobufCFieldDescriptor *field)
+{
+	ProtobufCMapIndex **pindex = MAP_INDEX_MEMBER(message, field);
+
+	assert(0 != (field->flags & PROTOBUF_C_FIELD_FLAG_MAP));
+	if (*pindex != NULL) {
+		do_free(&protobuf_c__allocator, *pindex);
+		*pindex = NULL;
+	}
+}
+
+/* === extensions === */
+
+struct ProtobufCExtensionRegistry {
+	ProtobufCAllocator *allocator;
+	unsigned n_extensions;
+	unsigned n_alloced;
+	/* sorted by extendee, then by field number */
+	const ProtobufCExtensionDescriptor **extensions;
+};
+
+static inline uint32_t
+extension_value_number(const ProtobufCExtensionValue *value)
+{
+	return value->base.descriptor->fields[0].id;
+}
+
+/*
+ * Find `number` in an extension table. Returns its index, or the index it
+ * would be inserted at if it is not present.
+ */
+static unsigned
+extension_set_search(const ProtobufCExtensionSet *set, uint32_t number,
+		     protobuf_c_boolean *found)
+{
+	unsigned start = 0;
+	unsigned end = set->n_values;
+
+	while (start < end) {
+		unsigned mid = start + (end - start) / 2;
+		uint32_t id = extension_value_number(&set->values[mid]);
+
+		if (id == number) {
+			*found = TRUE;
+			return mid;
+		}
+		if (id < number)
+			start = mid + 1;
+		else
+			end = mid;
+	}
+	*found = FALSE;
+	return start;
+}
+
+/*
+ * Return the value described by `value_desc` in the extension table of
+ * `message`, adding an initialised one if there is none yet.
+ */
+static ProtobufCExtensionValue *
+extension_set_slot(ProtobufCMessage *message,
+		   const ProtobufCMessageDescriptor *value_desc,
+		   ProtobufCAllocator *allocator)
+{
+	ProtobufCExtensionSet **pset =
+		EXTENSION_SET_MEMBER(message, message->descriptor);
+	ProtobufCExtensionSet *set = *pset;
+	protobuf_c_boolean found;
+	unsigned i;
+
+	if (set == NULL) {
+		set = do_alloc(allocator, sizeof(ProtobufCExtensionSet));
+		if (set == NULL)
+			return NULL;
+		set->n_values = 0;
+		set->n_alloced = 0;
+		set->values = NULL;
+		*pset = set;
+	}
+	i = extension_set_search(set, value_desc->fields[0].id, &found);
+	if (found)
+		return &set->values[i];
+
+	if (set->n_values == set->n_alloced) {
+		unsigned n_alloced = set->n_alloced ? set->n_alloced * 2 : 4;
+		ProtobufCExtensionValue *values;
+
+		values = do_alloc(allocator,
+				  n_alloced * sizeof(ProtobufCExtensionValue));
+		if (values == NULL)
+			return NULL;
+		if (set->n_values != 0)
+			memcpy(values, set->values,
+			       set->n_values * sizeof(ProtobufCExtensionValue));
+		do_free(allocator, set->values);
+		set->values = values;
+		set->n_alloced = n_alloced;
+	}
+	memmove(&set->values[i + 1], &set->values[i],
+		(set->n_values - i) * sizeof(ProtobufCExtensionValue));
+	set->n_values++;
+	message_init_generic(value_desc, &set->values[i].base);
+	return &set->values[i];
+}
+
+/* Whether an extension value would be packed, i.e. whether it is set. */
+static protobuf_c_boolean
+extension_value_is_present(const ProtobufCExtensionValue *value)
+{
+	const ProtobufCFieldDescriptor *field = value->base.descriptor->fields;
+
+	if (field->label == PROTOBUF_C_LABEL_REPEATED)
+		return value->n != 0;
+	switch (field->type) {
+	case PROTOBUF_C_TYPE_STRING:
+		return value->value.v_string != NULL &&
+			value->value.v_string != field->default_value;
+	case PROTOBUF_C_TYPE_MESSAGE:
+		return value->value.v_message != NULL;
+	default:
+		return value->has;
+	}
+}
+
+/*
+ * Move the unknown fields of a freshly unpacked message that are extensions
+ * known to the unpack options' registry into its extension table. All occurrences
+ * of an extension are decoded together, so that repeated extensions
+ * accumulate and message extensions are merged as they would be as fields.
+ */
+static protobuf_c_boolean
+message_unpack_extensions(ProtobufCMessage *message,
+			  ProtobufCAllocator *allocator,
+			  UnpackContext *ctx)
+{
+	const ProtobufCExtensionRegistry *registry = ctx->extensions;
+	ProtobufCMessageUnknownField *ufields = message->unknown_fields;
+	unsigned n_kept = 0;
+	unsigned i, j;
+
+	if (registry == NULL || message->n_unknown_fields == 0)
+		return TRUE;
+
+	for (i = 0; i < message->n_unknown_fields; i++) {
+		const ProtobufCExtensionDescriptor *ext;
+		ProtobufCExtensionValue value;
+		ProtobufCExtensionValue *slot;
+		uint32_t tag = ufields[i].tag;
+		size_t len = 0;
+		uint8_t *buf;
+		uint8_t *at;
+		protobuf_c_boolean ok;
+
+		if (ufields[i].data == NULL)
+			continue;	/* already decoded */
+		ext = protobuf_c_extension_registry_find(registry,
+							 message->descriptor,
+							 tag);
+		if (ext == NULL)
+			continue;
+
+		for (j = i; j < message->n_unknown_fields; j++) {
+			if (ufields[j].tag == tag)
+				len += get_tag_size(tag) + ufields[j].len;
+		}
+		buf = do_alloc(allocator, len);
+		if (buf == NULL)
+			return FALSE;
+		at = buf;
+		for (j = i; j < message->n_unknown_fields; j++) {
+			if (ufields[j].tag == tag) {
+				size_t tag_len = tag_pack(tag, at);
+
+				at[0] |= ufields[j].wire_type;
+				memcpy(at + tag_len, ufields[j].data, ufields[j].len);
+				at += tag_len + ufields[j].len;
+				do_free(allocator, ufields[j].data);
+				ufields[j].data = NULL;
+			}
+		}
+		ok = message_unpack_to(&ext->value_descriptor, allocator,
+				       len, buf, &value.base, NULL, ctx);
+		do_free(allocator, buf);
+		if (!ok) {
+			PROTOBUF_C_UNPACK_ERROR("error parsing extension %s of %s",
+						ext->value_descriptor.fields[0].name,
+						message->descriptor->name);
+			return FALSE;
+		}
+		slot = extension_set_slot(message, &ext->value_descriptor,
+					  allocator);
+		if (slot == NULL) {
+			message_free_members(&value.base, allocator);
+			return FALSE;
+		}
+		*slot = value;
+	}
+
+	for (i = 0; i < message->n_unknown_fields; i++) {
+		if (ufields[i].data != NULL)
+			ufields[n_kept++] = ufields[i];
+	}
+	message->n_unknown_fields = n_kept;
+	if (n_kept == 0) {
+		do_free(allocator, ufields);
+		message->unknown_fields = NULL;
+	}
+	return TRUE;
+}
+
+/* Extensions are merged like fields, see merge_messages(). */
+static protobuf_c_boolean
+merge_extensions(ProtobufCMessage *earlier_msg,
+		 ProtobufCMessage *latter_msg,
+		 ProtobufCAllocator *allocator)
+{
+	ProtobufCExtensionSet *earlier = message_extension_set(earlier_msg);
+	unsigned i;
+
+	if (earlier == NULL)
+		return TRUE;
+	for (i = 0; i < earlier->n_values; i++) {
+		ProtobufCExtensionValue *ev = &earlier->values[i];
+		const ProtobufCMessageDescriptor *value_desc = ev->base.descriptor;
+		ProtobufCExtensionValue *lv;
+
+		lv = extension_set_slot(latter_msg, value_desc, allocator);
+		if (lv == NULL)
+			return FALSE;
+		if (extension_value_is_present(lv)) {
+			if (!merge_messages(&ev->base, &lv->base, allocator))
+				return FALSE;
+		} else {
+			/* Zero copy the value from the earlier message */
+			message_free_members(&lv->base, allocator);
+			*lv = *ev;
+			message_init_generic(value_desc, &ev->base);
+		}
+	}
 	return TRUE;
 }
 
+const ProtobufCExtensionValue *
+protobuf_c_message_get_extension(const ProtobufCMessage *message,
+				 const ProtobufCExtensionDescriptor *extension)
+{
+	const ProtobufCExtensionSet *set;
+	protobuf_c_boolean found;
+	unsigned i;
+
+	ASSERT_IS_MESSAGE(message);
+	if (message->descriptor != extension->extendee)
+		return NULL;
+	set = message_extension_set(message);
+	if (set == NULL)
+		return NULL;
+	i = extension_set_search(set, extension->value_descriptor.fields[0].id,
+				 &found);
+	if (!found || !extension_value_is_present(&set->values[i]))
+		return NULL;
+	return &set->values[i];
+}
+
+ProtobufCExtensionValue *
+protobuf_c_message_set_extension(ProtobufCMessage *message,
+				 const ProtobufCExtensionDescriptor *extension,
+				 ProtobufCAllocator *allocator)
+{
+	ASSERT_IS_MESSAGE(message);
+	if (message->descriptor != extension->extendee ||
+	    message->descriptor->extensions == NULL)
+		return NULL;
+	if (allocator == NULL)
+		allocator = &protobuf_c__allocator;
+	return extension_set_slot(message, &extension->value_descriptor,
+				  allocator);
+}
+
+void
+protobuf_c_message_clear_extensions(ProtobufCMessage *message,
+				    ProtobufCAllocator *allocator)
+{
+	ProtobufCExtensionSet **pset;
+
+	ASSERT_IS_MESSAGE(message);
+	if (message->descriptor->extensions == NULL)
+		return;
+	if (allocator == NULL)
+		allocator = &protobuf_c__allocator;
+	pset = EXTENSION_SET_MEMBER(message, message->descriptor);
+	if (*pset != NULL) {
+		do_free(allocator, (*pset)->values);
+		do_free(allocator, *pset);
+		*pset = NULL;
+	}
+}
+
+/* Order registered extensions by extendee, then by field number. */
+static int
+extension_compare(const ProtobufCMessageDescriptor *extendee, uint32_t number,
+		  const ProtobufCExtensionDescriptor *ext)
+{
+	uint32_t id = ext->value_descriptor.fields[0].id;
+
+	if (extendee != ext->extendee)
+		return (uintptr_t) extendee < (uintptr_t) ext->extendee ? -1 : 1;
+	if (number != id)
+		return number < id ? -1 : 1;
+	return 0;
+}
+
+static unsigned
+extension_registry_search(const ProtobufCExtensionRegistry *registry,
+			  const ProtobufCMessageDescriptor *extendee,
+			  uint32_t number, protobuf_c_boolean *found)
+{
+	unsigned start = 0;
+	unsigned end = registry->n_extensions;
+
+	while (start < end) {
+		unsigned mid = start + (end - start) / 2;
+		int rv = extension_compare(extendee, number,
+					   registry->extensions[mid]);
+
+		if (rv == 0) {
+			*found = TRUE;
+			return mid;
+		}
+		if (rv > 0)
+			start = mid + 1;
+		else
+			end = mid;
+	}
+	*found = FALSE;
+	return start;
+}
+
+ProtobufCExtensionRegistry *
+protobuf_c_extension_registry_new(ProtobufCAllocator *allocator)
+{
+	ProtobufCExtensionRegistry *registry;
+
+	if (allocator == NULL)
+		allocator = &protobuf_c__allocator;
+	registry = do_alloc(allocator, sizeof(ProtobufCExtensionRegistry));
+	if (registry == NULL)
+		return NULL;
+	registry->allocator = allocator;
+	registry->n_extensions = 0;
+	registry->n_alloced = 0;
+	registry->extensions = NULL;
+	return registry;
+}
+
+protobuf_c_boolean
+protobuf_c_extension_registry_add(ProtobufCExtensionRegistry *registry,
+				  const ProtobufCExtensionDescriptor *extension)
+{
+	protobuf_c_boolean found;
+	unsigned i;
+
+	ASSERT_IS_MESSAGE_DESCRIPTOR(&extension->value_descriptor);
+	i = extension_registry_search(registry, extension->extendee,
+				      extension->value_descriptor.fields[0].id,
+				      &found);
+	if (found) {
+		registry->extensions[i] = extension;
+		return TRUE;
+	}
+	if (registry->n_extensions == registry->n_alloced) {
+		unsigned n_alloced = registry->n_alloced ?
+			registry->n_alloced * 2 : 16;
+		const ProtobufCExtensionDescriptor **extensions;
+
+		extensions = do_alloc(registry->allocator,
+				      n_alloced * sizeof(*extensions));
+		if (extensions == NULL)
+			return FALSE;
+		if (registry->n_extensions != 0)
+			memcpy(extensions, registry->extensions,
+			       registry->n_extensions * sizeof(*extensions));
+		do_free(registry->allocator, registry->extensions);
+		registry->extensions = extensions;
+		registry->n_alloced = n_alloced;
+	}
+	memmove(&registry->extensions[i + 1], &registry->extensions[i],
+		(registry->n_extensions - i) * sizeof(*registry->extensions));
+	registry->extensions[i] = extension;
+	registry->n_extensions++;
+	return TRUE;
+}
+
+const ProtobufCExtensionDescriptor *
+protobuf_c_extension_registry_find(const ProtobufCExtensionRegistry *registry,
+				   const ProtobufCMessageDescriptor *extendee,
+				   uint32_t number)
+{
+	protobuf_c_boolean found;
+	unsigned i;
+
+	i = extension_registry_search(registry, extendee, number, &found);
+	return found ? registry->extensions[i] : NULL;
+}
+
+void
+protobuf_c_extension_registry_free(ProtobufCExtensionRegistry *registry)
+{
+	if (registry == NULL)
+		return;
+	do_free(registry->allocator, registry->extensions);
+	do_free(registry->allocator, registry);
+}
+
 /* === services === */
 
 typedef void (*GenericHandler) (void *service,
@@ -3516,11 +6178,13 @@ protobuf_c_service_invoke_internal(ProtobufCService *service,
 	GenericHandler handler;
 
 	/*
-	 * Verify that method_index is within range. If this fails, you are
-	 * likely invoking a newly added method on an old service. (Although
-	 * other memory corruption bugs can cause this assertion too.)
+	 * An index out of range is likely a newly added method invoked on an
+	 * old service. It fails the call.
 	 */
-	assert(method_index < service->descriptor->n_methods);
+	if (method_index >= service->descriptor->n_methods) {
+		closure(NULL, closure_data);
+		return;
+	}
 
 	/*
 	 * Get the array of virtual methods (which are enumerated by the
@@ -3529,11 +6193,14 @@ protobuf_c_service_invoke_internal(ProtobufCService *service,
 	handlers = (GenericHandler *) (service + 1);
 
 	/*
-	 * Get our method and invoke it.
-	 * \todo Seems like handler == NULL is a situation that needs handling.
+	 * Get our method and invoke it. A method the service does not
+	 * implement fails the call.
 	 */
 	handler = handlers[method_index];
-	(*handler)(service, input, closure, closure_data);
+	if (handler == NULL)
+		closure(NULL, closure_data);
+	else
+		(*handler)(service, input, closure, closure_data);
 }
 
 void
@@ -3589,7 +6256,7 @@ const ProtobufCEnumValue *
 protobuf_c_enum_descriptor_get_value(const ProtobufCEnumDescriptor *desc,
 				     int value)
 {
-	int rv = int_range_lookup(desc->n_value_ranges, desc->value_ranges, value);
+	int rv = enum_value_index(desc, value);
 	if (rv < 0)
 		return NULL;
 	return desc->values + rv;
@@ -266,6 +266,47 @@ typedef enum {
 
 	/** Set if the field is a member of a oneof (union). */
 	PROTOBUF_C_FIELD_FLAG_ONEOF		= (1 << 2),
+
+	/**
+	 * Set if unpacking should fail when an enum field holds a value not
+	 * declared by its enum.
+	 */
+	PROTOBUF_C_FIELD_FLAG_ENUM_REJECT	= (1 << 3),
+
+	/**
+	 * Set if an enum field value not declared by its enum should be kept
+	 * in `unknown_fields` instead of the field (proto2 closed enums).
+	 */
+	PROTOBUF_C_FIELD_FLAG_ENUM_UNKNOWN	= (1 << 4),
+
+	/**
+	 * Set if the field is a `map<K,V>` stored as a contiguous array of
+	 * entry structures rather than an array of pointers. The member after
+	 * the array pointer holds a `ProtobufCMapIndex *` used by
+	 * protobuf_c_message_map_lookup().
+	 */
+	PROTOBUF_C_FIELD_FLAG_MAP		= (1 << 5),
+
+	/**
+	 * Set if a repeated message field is stored as a contiguous array of
+	 * message structures rather than an array of pointers.
+	 */
+	PROTOBUF_C_FIELD_FLAG_CONTIGUOUS	= (1 << 6),
+
+	/**
+	 * Set if a repeated message field is stored as a structure of arrays:
+	 * the member at `offset` is the first of one array pointer per field
+	 * of the element message, in field number order, all of `n` elements.
+	 * The element message may only have singular numeric, bool and enum
+	 * fields; its unknown fields are not kept.
+	 */
+	PROTOBUF_C_FIELD_FLAG_SOA		= (1 << 7),
+
+	/**
+	 * Set if the field is a `map<K,V>`, whatever its storage. Used by
+	 * protobuf_c_message_pack_deterministic() to order the entries by key.
+	 */
+	PROTOBUF_C_FIELD_FLAG_MAP_ENTRIES	= (1 << 8),
 } ProtobufCFieldFlag;
 
 /**
@@ -344,37 +385,81 @@ typedef enum {
 	PROTOBUF_C_WIRE_TYPE_32BIT = 5,
 } ProtobufCWireType;
 
+/**
+ * Events reported to a `ProtobufCTraceFunc`. The `size` passed along with
+ * each event is given in brackets.
+ *
+ * \see protobuf_c_stats_set_trace()
+ */
+typedef enum {
+	/** Memory was allocated for a message [bytes requested]. */
+	PROTOBUF_C_TRACE_ALLOC,
+	/** Memory was released [0]. */
+	PROTOBUF_C_TRACE_FREE,
+	/** A message was packed [packed size]. */
+	PROTOBUF_C_TRACE_PACK,
+	/** A message was unpacked [packed size]. */
+	PROTOBUF_C_TRACE_UNPACK,
+	/**
+	 * A message had more fields than fit in the scratch space used to
+	 * scan it, so another slab was allocated [slab size in bytes].
+	 */
+	PROTOBUF_C_TRACE_SCANNED_MEMBER_SPILL,
+	/** Unknown fields were kept while unpacking a message [count]. */
+	PROTOBUF_C_TRACE_UNKNOWN_FIELDS,
+} ProtobufCTraceEvent;
+
 struct ProtobufCAllocator;
+struct ProtobufCArena;
 struct ProtobufCBinaryData;
 struct ProtobufCBuffer;
 struct ProtobufCBufferSimple;
 struct ProtobufCEnumDescriptor;
 struct ProtobufCEnumValue;
 struct ProtobufCEnumValueIndex;
+struct ProtobufCExtensionDescriptor;
+struct ProtobufCExtensionRegistry;
+struct ProtobufCExtensionSet;
+struct ProtobufCExtensionValue;
 struct ProtobufCFieldDescriptor;
 struct ProtobufCIntRange;
+struct ProtobufCMapIndex;
 struct ProtobufCMessage;
 struct ProtobufCMessageDescriptor;
+struct ProtobufCMessageExtensions;
 struct ProtobufCMessageUnknownField;
 struct ProtobufCMethodDescriptor;
 struct ProtobufCService;
 struct ProtobufCServiceDescriptor;
+struct ProtobufCStats;
+struct ProtobufCStatsMessage;
+struct ProtobufCUnpackOptions;
 
 typedef struct ProtobufCAllocator ProtobufCAllocator;
+typedef struct ProtobufCArena ProtobufCArena;
 typedef struct ProtobufCBinaryData ProtobufCBinaryData;
 typedef struct ProtobufCBuffer ProtobufCBuffer;
 typedef struct ProtobufCBufferSimple ProtobufCBufferSimple;
 typedef struct ProtobufCEnumDescriptor ProtobufCEnumDescriptor;
 typedef struct ProtobufCEnumValue ProtobufCEnumValue;
 typedef struct ProtobufCEnumValueIndex ProtobufCEnumValueIndex;
+typedef struct ProtobufCExtensionDescriptor ProtobufCExtensionDescriptor;
+typedef struct ProtobufCExtensionRegistry ProtobufCExtensionRegistry;
+typedef struct ProtobufCExtensionSet ProtobufCExtensionSet;
+typedef struct ProtobufCExtensionValue ProtobufCExtensionValue;
 typedef struct ProtobufCFieldDescriptor ProtobufCFieldDescriptor;
 typedef struct ProtobufCIntRange ProtobufCIntRange;
+typedef struct ProtobufCMapIndex ProtobufCMapIndex;
 typedef struct ProtobufCMessage ProtobufCMessage;
 typedef struct ProtobufCMessageDescriptor ProtobufCMessageDescriptor;
+typedef struct ProtobufCMessageExtensions ProtobufCMessageExtensions;
 typedef struct ProtobufCMessageUnknownField ProtobufCMessageUnknownField;
 typedef struct ProtobufCMethodDescriptor ProtobufCMethodDescriptor;
 typedef struct ProtobufCService ProtobufCService;
 typedef struct ProtobufCServiceDescriptor ProtobufCServiceDescriptor;
+typedef struct ProtobufCStats ProtobufCStats;
+typedef struct ProtobufCStatsMessage ProtobufCStatsMessage;
+typedef struct ProtobufCUnpackOptions ProtobufCUnpackOptions;
 
 /** Boolean type. */
 typedef int protobuf_c_boolean;
@@ -382,6 +467,10 @@ typedef int protobuf_c_boolean;
 typedef void (*ProtobufCClosure)(const ProtobufCMessage *, void *closure_data);
 typedef void (*ProtobufCMessageInit)(ProtobufCMessage *);
 typedef void (*ProtobufCServiceDestroy)(ProtobufCService *);
+typedef void (*ProtobufCTraceFunc)(ProtobufCTraceEvent event,
+				   const ProtobufCMessageDescriptor *descriptor,
+				   size_t size,
+				   void *trace_data);
 
 /**
  * Structure for defining a custom memory allocator.
@@ -397,6 +486,39 @@ struct ProtobufCAllocator {
 	void		*allocator_data;
 };
 
+/**
+ * An allocator that carves memory out of a scratch buffer provided by the
+ * user, for messages that are all freed together. A `ProtobufCArena` object
+ * is typically declared on the stack:
+ *
+~~~{.c}
+uint64_t scratch[128];
+ProtobufCArena arena;
+
+protobuf_c_arena_init(&arena, scratch, sizeof(scratch));
+msg = protobuf_c_message_unpack(desc, &arena.base, len, data);
+...
+protobuf_c_arena_clear(&arena);
+~~~
+ *
+ * Requests that do not fit in the scratch buffer are passed on to the system
+ * allocator. Freeing does nothing: all of the memory is reclaimed at once by
+ * protobuf_c_arena_clear(), so protobuf_c_message_free_unpacked() need not be
+ * called.
+ */
+struct ProtobufCArena {
+	/** "Base class", to pass wherever an allocator is accepted. */
+	ProtobufCAllocator	base;
+	/** Scratch buffer. */
+	uint8_t			*data;
+	/** Size of `data`. */
+	size_t			size;
+	/** Number of bytes of `data` handed out. */
+	size_t			used;
+	/** Blocks obtained from the system allocator. */
+	void			*overflow;
+};
+
 /**
  * Structure for the protobuf `bytes` scalar type.
  *
@@ -610,8 +732,13 @@ struct ProtobufCFieldDescriptor {
 	 */
 	uint32_t		flags;
 
-	/** Reserved for future use. */
-	unsigned		reserved_flags;
+	/**
+	 * The field's key (tag and wire type) as it is encoded on the wire,
+	 * first byte in the low-order bits, or 0 if not known. Only keys of at
+	 * most 3 bytes, i.e. field numbers below 2^18, are given. The wire
+	 * type is `PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED` for packed fields.
+	 */
+	unsigned		encoded_tag;
 	/** Reserved for future use. */
 	void			*reserved2;
 	/** Reserved for future use. */
@@ -697,14 +824,73 @@ struct ProtobufCMessageDescriptor {
 	/** Message initialisation function. */
 	ProtobufCMessageInit		message_init;
 
-	/** Reserved for future use. */
-	void				*reserved1;
+	/**
+	 * Extension support. NULL unless the message declares extension
+	 * ranges.
+	 */
+	const ProtobufCMessageExtensions	*extensions;
 	/** Reserved for future use. */
 	void				*reserved2;
 	/** Reserved for future use. */
 	void				*reserved3;
 };
 
+/**
+ * Extension support of an extendable message.
+ */
+struct ProtobufCMessageExtensions {
+	/**
+	 * Offset in bytes of the `ProtobufCExtensionSet *` member holding the
+	 * decoded extensions of a message.
+	 */
+	unsigned			set_offset;
+};
+
+/**
+ * The value of one extension of a message.
+ *
+ * A value is itself a message whose descriptor is the `value_descriptor` of
+ * its `ProtobufCExtensionDescriptor`, with a single field: the extension.
+ * Which members are meaningful follows from that field, exactly as for a
+ * generated structure: `has` is the presence flag of an optional scalar or
+ * bytes extension, `n` the element count of a repeated one, and `value`
+ * holds the member itself.
+ */
+struct ProtobufCExtensionValue {
+	ProtobufCMessage		base;
+	/** Whether an optional scalar or bytes extension is present. */
+	protobuf_c_boolean		has;
+	/** Number of elements of a repeated extension. */
+	size_t				n;
+	/** The extension value, or the array of a repeated extension. */
+	union {
+		int32_t			v_int32;
+		uint32_t		v_uint32;
+		int64_t			v_int64;
+		uint64_t		v_uint64;
+		float			v_float;
+		double			v_double;
+		protobuf_c_boolean	v_boolean;
+		char			*v_string;
+		ProtobufCBinaryData	v_binary;
+		ProtobufCMessage	*v_message;
+		void			*v_array;
+	} value;
+};
+
+/**
+ * Describes an extension field.
+ */
+struct ProtobufCExtensionDescriptor {
+	/** The message type being extended. */
+	const ProtobufCMessageDescriptor	*extendee;
+	/**
+	 * Descriptor of the `ProtobufCExtensionValue` holding the extension;
+	 * its only field describes the extension itself.
+	 */
+	ProtobufCMessageDescriptor	value_descriptor;
+};
+
 /**
  * An unknown message field.
  */
@@ -770,6 +956,101 @@ struct ProtobufCServiceDescriptor {
 	const unsigned			*method_indices_by_name;
 };
 
+/**
+ * Per-message-type counters kept when statistics are enabled. Nested
+ * messages are counted under their own type.
+ */
+struct ProtobufCStatsMessage {
+	/** The message type. */
+	const ProtobufCMessageDescriptor	*descriptor;
+	/** Number of messages packed. */
+	uint64_t				n_packed;
+	/** Total packed size of the messages packed. */
+	uint64_t				packed_bytes;
+	/** Number of messages unpacked. */
+	uint64_t				n_unpacked;
+	/** Total packed size of the messages unpacked. */
+	uint64_t				unpacked_bytes;
+};
+
+/**
+ * Runtime statistics.
+ *
+ * \see protobuf_c_stats_snapshot()
+ */
+struct ProtobufCStats {
+	/** Calls to the allocator's `alloc` function. */
+	uint64_t	n_allocs;
+	/** Total bytes requested from the allocator. */
+	uint64_t	alloc_bytes;
+	/** Calls to the allocator's `free` function. */
+	uint64_t	n_frees;
+	/** Scratch slabs allocated to scan messages with many fields. */
+	uint64_t	n_scanned_member_spills;
+	/** Unknown fields kept while unpacking. */
+	uint64_t	n_unknown_fields;
+	/**
+	 * Number of message types with counters. Types seen after
+	 * `PROTOBUF_C_STATS_MAX_MESSAGES` distinct ones are not tracked.
+	 */
+	size_t		n_messages;
+};
+
+/** Maximum number of message types that statistics are kept for. */
+#define PROTOBUF_C_STATS_MAX_MESSAGES	256
+
+/**
+ * Limits on the resources protobuf_c_message_unpack_with_options() may use,
+ * and the extensions it decodes.
+ *
+ * A limit of 0 means no limit, except for `max_depth`, where it selects
+ * `PROTOBUF_C_DEFAULT_MAX_DEPTH`. The counts cover the whole message tree and
+ * are checked as the input is scanned, before anything is allocated for them.
+ *
+ * Initialise objects with `PROTOBUF_C_UNPACK_OPTIONS_INIT`, which records the
+ * size of the structure the caller was compiled with. Fields added in later
+ * versions are appended, and read as 0 when the caller's structure ends
+ * before them.
+ */
+struct ProtobufCUnpackOptions {
+	/** Size of this structure, `sizeof(ProtobufCUnpackOptions)`. */
+	size_t		size;
+
+	/**
+	 * Deepest nesting of messages, counting the top-level message: 1
+	 * rejects any submessage. Unpacking recurses once per level, so this
+	 * bounds the stack used for adversarial input.
+	 */
+	unsigned	max_depth;
+
+	/** Largest input accepted, in bytes. */
+	size_t		max_message_size;
+
+	/** Total number of bytes requested from the allocator. */
+	size_t		max_allocated;
+
+	/** Total number of elements of repeated fields. */
+	size_t		max_elements;
+
+	/** Total number of unknown fields kept. */
+	size_t		max_unknown_fields;
+
+	/** Total number of submessages, not counting the top-level message. */
+	size_t		max_submessages;
+
+	/**
+	 * Extensions to decode into the extension table of extendable
+	 * messages, where protobuf_c_message_get_extension() and the generated
+	 * accessors find them. NULL keeps all extensions as unknown fields.
+	 * The registry must not be modified while in use.
+	 */
+	const ProtobufCExtensionRegistry *extensions;
+};
+
+/** Initialise a `ProtobufCUnpackOptions` object, without any limits. */
+#define PROTOBUF_C_UNPACK_OPTIONS_INIT \
+	{ sizeof(ProtobufCUnpackOptions), 0, 0, 0, 0, 0, 0, NULL }
+
 /**
  * Get the version of the protobuf-c library. Note that this is the version of
  * the library linked against, not the version of the headers compiled against.
@@ -809,6 +1090,12 @@ protobuf_c_version_number(void);
  */
 #define PROTOBUF_C_MIN_COMPILER_VERSION	1000000
 
+/**
+ * The deepest nesting of messages that protobuf_c_message_unpack() accepts,
+ * as in the C++ implementation.
+ */
+#define PROTOBUF_C_DEFAULT_MAX_DEPTH	100
+
 /**
  * Look up a `ProtobufCEnumValue` from a `ProtobufCEnumDescriptor` by name.
  *
@@ -919,6 +1206,34 @@ PROTOBUF_C__API
 size_t
 protobuf_c_message_pack(const ProtobufCMessage *message, uint8_t *out);
 
+/**
+ * Serialise a message in canonical form.
+ *
+ * Like protobuf_c_message_pack(), but the output depends only on the values
+ * held by the message, so that equal messages pack to identical bytes which
+ * can serve as cache keys or be hashed. Fields, extensions and unknown fields
+ * are written in field number order, map entries in key order, and embedded
+ * messages in canonical form as well. As with protobuf_c_message_pack(),
+ * proto3 fields holding their default value are left out.
+ *
+ * Of map entries with equal keys, only the last one is written, as it is the
+ * one that wins on unpacking. Unknown fields with equal numbers keep their
+ * relative order.
+ *
+ * \param message
+ *      The message object to serialise.
+ * \param[out] out
+ *      Buffer of at least protobuf_c_message_get_packed_size() bytes.
+ * \return
+ *      Number of bytes stored in `out`. This is
+ *      protobuf_c_message_get_packed_size() unless a map holds entries with
+ *      equal keys, which makes it less.
+ */
+PROTOBUF_C__API
+size_t
+protobuf_c_message_pack_deterministic(const ProtobufCMessage *message,
+				      uint8_t *out);
+
 /**
  * Serialise a message from its in-memory representation to a virtual buffer.
  *
@@ -941,6 +1256,9 @@ protobuf_c_message_pack_to_buffer(
 /**
  * Unpack a serialised message into an in-memory representation.
  *
+ * Messages nested more than `PROTOBUF_C_DEFAULT_MAX_DEPTH` deep, counting the
+ * top-level message, are rejected.
+ *
  * \param descriptor
  *      The message descriptor.
  * \param allocator
@@ -963,11 +1281,47 @@ protobuf_c_message_unpack(
 	size_t len,
 	const uint8_t *data);
 
+/**
+ * Unpack a serialised message within the limits given by `options`, decoding
+ * the extensions in `options->extensions`.
+ *
+ * Fails as soon as the input is found to exceed a limit, without allocating
+ * the memory it asks for. Memory freed during unpacking still counts towards
+ * `max_allocated`.
+ *
+ * \param descriptor
+ *      The message descriptor.
+ * \param allocator
+ *      `ProtobufCAllocator` to use for memory allocation. May be NULL to
+ *      specify the default allocator.
+ * \param options
+ *      The limits to enforce. May be NULL for the defaults of
+ *      protobuf_c_message_unpack().
+ * \param len
+ *      Length in bytes of the serialised message.
+ * \param data
+ *      Pointer to the serialised message.
+ * \return
+ *      An unpacked message object.
+ * \retval NULL
+ *      If an error occurred during unpacking, a limit was exceeded, or
+ *      `options->size` is larger than this version of the library knows.
+ */
+PROTOBUF_C__API
+ProtobufCMessage *
+protobuf_c_message_unpack_with_options(
+	const ProtobufCMessageDescriptor *descriptor,
+	ProtobufCAllocator *allocator,
+	const ProtobufCUnpackOptions *options,
+	size_t len,
+	const uint8_t *data);
+
 /**
  * Free an unpacked message object.
  *
  * This function should be used to deallocate the memory used by a call to
- * protobuf_c_message_unpack().
+ * protobuf_c_message_unpack(). It recurses once per level of nesting, which
+ * unpacking has bounded.
  *
  * \param message
  *      The message object to free. May be NULL.
@@ -985,7 +1339,8 @@ protobuf_c_message_free_unpacked(
  * Check the validity of a message object.
  *
  * Makes sure all required fields (`PROTOBUF_C_LABEL_REQUIRED`) are present.
- * Recursively checks nested messages.
+ * Recursively checks nested messages, up to `PROTOBUF_C_DEFAULT_MAX_DEPTH`
+ * deep; deeper messages are invalid.
  *
  * \retval TRUE
  *      Message is valid.
@@ -996,12 +1351,188 @@ PROTOBUF_C__API
 protobuf_c_boolean
 protobuf_c_message_check(const ProtobufCMessage *);
 
+/**
+ * Look up an entry of a map field by key.
+ *
+ * The field must have `PROTOBUF_C_FIELD_FLAG_MAP` set. Small maps are scanned
+ * directly; larger ones get an open-addressing hash index, built on the first
+ * lookup and rebuilt whenever the entry array or its length changes. As on
+ * the wire, the last entry wins when a key occurs more than once.
+ *
+ * Building the index modifies `message`, so lookups on a shared message must
+ * be serialised by the caller. The index is allocated with the default
+ * allocator and released by protobuf_c_message_free_unpacked() or
+ * protobuf_c_message_map_invalidate().
+ *
+ * \param message
+ *      The message containing the map.
+ * \param field
+ *      Descriptor of the map field.
+ * \param key
+ *      Pointer to the key, using the C type of the entry's `key` member
+ *      (e.g. `const char **` for string keys).
+ * \return
+ *      The matching entry, or NULL if the key is not present.
+ */
+PROTOBUF_C__API
+const ProtobufCMessage *
+protobuf_c_message_map_lookup(
+	ProtobufCMessage *message,
+	const ProtobufCFieldDescriptor *field,
+	const void *key);
+
+/**
+ * Discard the lookup index of a map field.
+ *
+ * Must be called after modifying keys of existing entries in place, and
+ * before freeing a message that was not obtained from
+ * protobuf_c_message_unpack().
+ *
+ * \param message
+ *      The message containing the map.
+ * \param field
+ *      Descriptor of the map field.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_message_map_invalidate(
+	ProtobufCMessage *message,
+	const ProtobufCFieldDescriptor *field);
+
+/**
+ * Get the value of an extension of a message.
+ *
+ * \param message
+ *      The extended message.
+ * \param extension
+ *      Descriptor of the extension.
+ * \return
+ *      The value, owned by `message` and valid until the next call to
+ *      protobuf_c_message_set_extension() on it.
+ * \retval NULL
+ *      If the extension is not present or does not extend this message type.
+ */
+PROTOBUF_C__API
+const ProtobufCExtensionValue *
+protobuf_c_message_get_extension(
+	const ProtobufCMessage *message,
+	const ProtobufCExtensionDescriptor *extension);
+
+/**
+ * Get the value of an extension of a message for modification, adding it if
+ * it is not present yet.
+ *
+ * A new value is initialised like a message, i.e. it is absent until its
+ * `has` flag, `n` count or pointer is set. As with other members of a message
+ * built by hand, the value's storage is not copied and remains owned by the
+ * caller; protobuf_c_message_clear_extensions() releases the table itself.
+ *
+ * \param message
+ *      The extended message.
+ * \param extension
+ *      Descriptor of the extension.
+ * \param allocator
+ *      `ProtobufCAllocator` for the extension table. May be NULL to specify
+ *      the default allocator.
+ * \return
+ *      The value, valid until the next call to this function on `message`.
+ * \retval NULL
+ *      If the extension does not extend this message type or memory could
+ *      not be allocated.
+ */
+PROTOBUF_C__API
+ProtobufCExtensionValue *
+protobuf_c_message_set_extension(
+	ProtobufCMessage *message,
+	const ProtobufCExtensionDescriptor *extension,
+	ProtobufCAllocator *allocator);
+
+/**
+ * Release the extension table of a message that was not obtained from
+ * protobuf_c_message_unpack(), without freeing the values it refers to.
+ *
+ * \param message
+ *      The extended message.
+ * \param allocator
+ *      `ProtobufCAllocator` passed to protobuf_c_message_set_extension().
+ *      May be NULL to specify the default allocator.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_message_clear_extensions(
+	ProtobufCMessage *message,
+	ProtobufCAllocator *allocator);
+
+/**
+ * Create an empty extension registry.
+ *
+ * \param allocator
+ *      `ProtobufCAllocator` for the registry. May be NULL to specify the
+ *      default allocator.
+ * \return
+ *      A new registry.
+ * \retval NULL
+ *      If memory could not be allocated.
+ */
+PROTOBUF_C__API
+ProtobufCExtensionRegistry *
+protobuf_c_extension_registry_new(ProtobufCAllocator *allocator);
+
+/**
+ * Register an extension. A previously registered extension of the same
+ * message type with the same number is replaced.
+ *
+ * \param registry
+ *      The registry.
+ * \param extension
+ *      Descriptor of the extension; must outlive the registry.
+ * \return
+ *      TRUE on success, FALSE if memory could not be allocated.
+ */
+PROTOBUF_C__API
+protobuf_c_boolean
+protobuf_c_extension_registry_add(
+	ProtobufCExtensionRegistry *registry,
+	const ProtobufCExtensionDescriptor *extension);
+
+/**
+ * Look up a registered extension.
+ *
+ * \param registry
+ *      The registry.
+ * \param extendee
+ *      Descriptor of the extended message type.
+ * \param number
+ *      The extension's field number.
+ * \return
+ *      The extension descriptor, or NULL if none is registered.
+ */
+PROTOBUF_C__API
+const ProtobufCExtensionDescriptor *
+protobuf_c_extension_registry_find(
+	const ProtobufCExtensionRegistry *registry,
+	const ProtobufCMessageDescriptor *extendee,
+	uint32_t number);
+
+/**
+ * Free an extension registry. It must not be in use by any unpacking.
+ *
+ * \param registry
+ *      The registry to free. May be NULL.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_extension_registry_free(ProtobufCExtensionRegistry *registry);
+
 /** Message initialiser. */
 #define PROTOBUF_C_MESSAGE_INIT(descriptor) { descriptor, 0, NULL }
 
 /**
  * Initialise a message object from a message descriptor.
  *
+ * Descriptors without a `message_init` function, such as those built at
+ * runtime, are initialised from their field default values.
+ *
  * \param descriptor
  *      Message descriptor.
  * \param message
@@ -1013,6 +1544,57 @@ protobuf_c_message_init(
 	const ProtobufCMessageDescriptor *descriptor,
 	void *message);
 
+/**
+ * Read the runtime statistics.
+ *
+ * Statistics are only collected when protobuf-c is built with
+ * `--enable-stats` (CMake: `-DENABLE_STATS=ON`); otherwise the counting code
+ * is compiled out and this function reports nothing. Counters are updated
+ * atomically where the compiler allows, but a snapshot taken while other
+ * threads pack or unpack is not a consistent cut.
+ *
+ * \param[out] stats
+ *      Global counters.
+ * \param max_messages
+ *      Number of elements in `messages`.
+ * \param[out] messages
+ *      Per-message-type counters; the first
+ *      min(`stats->n_messages`, `max_messages`) elements are filled in, in no
+ *      particular order. May be NULL if `max_messages` is 0.
+ * \return
+ *      TRUE if statistics are enabled, FALSE (with everything zeroed) if not.
+ */
+PROTOBUF_C__API
+protobuf_c_boolean
+protobuf_c_stats_snapshot(
+	ProtobufCStats *stats,
+	size_t max_messages,
+	ProtobufCStatsMessage *messages);
+
+/**
+ * Reset all statistics to zero. Must not race with packing or unpacking.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_stats_reset(void);
+
+/**
+ * Install a function to be called on every `ProtobufCTraceEvent`. Has no
+ * effect unless statistics are enabled.
+ *
+ * The function is called synchronously from whichever thread caused the
+ * event and must not call back into protobuf-c. It must be installed before,
+ * and not changed during, any concurrent use of the library.
+ *
+ * \param func
+ *      The trace function, or NULL to stop tracing.
+ * \param trace_data
+ *      Passed to `func`.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_stats_set_trace(ProtobufCTraceFunc func, void *trace_data);
+
 /**
  * Free a service.
  *
@@ -1042,6 +1624,36 @@ protobuf_c_service_descriptor_get_method_by_name(
 	const ProtobufCServiceDescriptor *desc,
 	const char *name);
 
+/**
+ * Initialise a `ProtobufCArena` object.
+ *
+ * \param arena
+ *      The arena to initialise.
+ * \param scratch
+ *      Buffer to allocate from first. May be NULL if `size` is 0.
+ * \param size
+ *      Size of `scratch`.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_arena_init(ProtobufCArena *arena, void *scratch, size_t size);
+
+/**
+ * Free everything allocated from an arena, which may then be used again.
+ *
+ * \param arena
+ *      The arena to clear.
+ */
+PROTOBUF_C__API
+void
+protobuf_c_arena_clear(ProtobufCArena *arena);
+
+/**
+ * Size of the scratch buffer on the stack into which the generated
+ * `*__invoke_packed()` functions unpack requests.
+ */
+#define PROTOBUF_C_SERVICE_ARENA_SIZE	1024
+
 /**
  * Initialise a `ProtobufCBufferSimple` object.
  */
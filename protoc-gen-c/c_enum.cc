@@ -61,7 +61,9 @@
 
 // Modified to implement C code by Dave Benson.
 
+#include <algorithm>
 #include <map>
+#include <vector>
 
 #include <google/protobuf/io/printer.h>
 
@@ -134,7 +136,8 @@ void EnumGenerator::GenerateDescriptorDeclarations(google::protobuf::io::Printer
   vars["lcclassname"] = FullNameToLower(descriptor_->full_name(), descriptor_->file());
 
   printer->Print(vars,
-    "extern $dllexport$const ProtobufCEnumDescriptor    $lcclassname$__descriptor;\n");
+    "extern $dllexport$const ProtobufCEnumDescriptor    $lcclassname$__descriptor;\n"
+    "$dllexport$protobuf_c_boolean $lcclassname$__is_valid (int value);\n");
 }
 
 struct ValueIndex
@@ -318,6 +321,43 @@ void EnumGenerator::GenerateEnumDescriptor(google::protobuf::io::Printer* printe
         "  NULL,NULL,NULL,NULL   /* reserved[1234] */\n"
         "};\n");
   }
+
+  GenerateValidator(printer);
+}
+
+void EnumGenerator::GenerateValidator(google::protobuf::io::Printer* printer) {
+  std::map<std::string, std::string> vars;
+  vars["lcclassname"] = FullNameToLower(descriptor_->full_name(), descriptor_->file());
+
+  std::vector<int> values;
+  for (int j = 0; j < descriptor_->value_count(); j++)
+    values.push_back(descriptor_->value(j)->number());
+  std::sort(values.begin(), values.end());
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+
+  printer->Print(vars,
+      "protobuf_c_boolean $lcclassname$__is_valid (int value)\n"
+      "{\n");
+  if (values.empty()) {
+    printer->Print("  (void) value;\n"
+                   "  return 0;\n");
+  } else if ((int64_t) values.back() - values.front() + 1 == (int64_t) values.size()) {
+    // No gaps: a range check is enough.
+    vars["min"] = SimpleItoa(values.front());
+    vars["max"] = SimpleItoa(values.back());
+    printer->Print(vars, "  return value >= $min$ && value <= $max$;\n");
+  } else {
+    printer->Print("  switch (value) {\n");
+    for (int value : values) {
+      vars["value"] = SimpleItoa(value);
+      printer->Print(vars, "    case $value$:\n");
+    }
+    printer->Print("      return 1;\n"
+                   "    default:\n"
+                   "      return 0;\n"
+                   "  }\n");
+  }
+  printer->Print("}\n");
 }
 
 }  // namespace protobuf_c
@@ -93,6 +93,9 @@ class EnumGenerator {
   // Generate the ProtobufCEnumDescriptor for this enum
   void GenerateEnumDescriptor(google::protobuf::io::Printer* printer);
 
+  // Generate the $lcclassname$__is_valid() function for this enum
+  void GenerateValidator(google::protobuf::io::Printer* printer);
+
   // Generate static initializer for a ProtobufCEnumValue
   // given the index of the value in the enum.
   void GenerateValueInitializer(google::protobuf::io::Printer *printer, int index);
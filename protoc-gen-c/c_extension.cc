@@ -64,22 +64,205 @@
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/io/printer.h>
 
+#include <protobuf-c/protobuf-c.pb.h>
+
 #include "c_extension.h"
+#include "c_helpers.h"
 
 namespace protobuf_c {
 
+// C type of a single value of an extension.
+static std::string ExtensionValueCType(const google::protobuf::FieldDescriptor* descriptor)
+{
+  switch (descriptor->cpp_type()) {
+    case google::protobuf::FieldDescriptor::CPPTYPE_INT32: return "int32_t";
+    case google::protobuf::FieldDescriptor::CPPTYPE_INT64: return "int64_t";
+    case google::protobuf::FieldDescriptor::CPPTYPE_UINT32: return "uint32_t";
+    case google::protobuf::FieldDescriptor::CPPTYPE_UINT64: return "uint64_t";
+    case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT: return "float";
+    case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE: return "double";
+    case google::protobuf::FieldDescriptor::CPPTYPE_BOOL: return "protobuf_c_boolean";
+    case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
+      return FullNameToC(descriptor->enum_type()->full_name(), descriptor->enum_type()->file());
+    case google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE:
+      return FullNameToC(descriptor->message_type()->full_name(), descriptor->message_type()->file()) + " *";
+    case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
+      if (descriptor->type() == google::protobuf::FieldDescriptor::TYPE_BYTES ||
+          descriptor->options().GetExtension(pb_c_field).string_as_bytes())
+        return "ProtobufCBinaryData";
+      if (descriptor->file()->options().GetExtension(pb_c_file).const_strings())
+        return "const char *";
+      return "char *";
+  }
+  GOOGLE_LOG(FATAL) << "Unknown CPPTYPE";
+  return "";
+}
+
 ExtensionGenerator::ExtensionGenerator(const google::protobuf::FieldDescriptor* descriptor,
                                        const std::string& dllexport_decl)
   : descriptor_(descriptor),
+    field_generator_(FieldGeneratorMap::MakeGenerator(descriptor)),
     dllexport_decl_(dllexport_decl) {
+  const google::protobuf::Descriptor* extendee = descriptor->containing_type();
+  std::string ctype = ExtensionValueCType(descriptor);
+
+  vars_["lcname"] = FullNameToLower(descriptor->full_name(), descriptor->file());
+  vars_["fullname"] = std::string(descriptor->full_name());
+  vars_["shortname"] = std::string(descriptor->name());
+  vars_["packagename"] = std::string(descriptor->file()->package());
+  vars_["number"] = SimpleItoa(descriptor->number());
+  vars_["extendee"] = FullNameToC(extendee->full_name(), extendee->file());
+  vars_["lcextendee"] = FullNameToLower(extendee->full_name(), extendee->file());
+  vars_["ctype"] = ctype;
+  vars_["ctype_"] = ctype.back() == '*' ? ctype : ctype + " ";
+  if (dllexport_decl.empty()) {
+    vars_["dllexport"] = "";
+  } else {
+    vars_["dllexport"] = dllexport_decl + " ";
+  }
 }
 
 ExtensionGenerator::~ExtensionGenerator() {}
 
+void ExtensionGenerator::PrintGetterSignature(google::protobuf::io::Printer* printer) {
+  if (descriptor_->is_repeated()) {
+    printer->Print(vars_,
+		   "size_t $lcname$__get\n"
+		   "                     (const $extendee$ *message,\n"
+		   "                      $ctype_$**values)");
+  } else {
+    printer->Print(vars_,
+		   "protobuf_c_boolean $lcname$__get\n"
+		   "                     (const $extendee$ *message,\n"
+		   "                      $ctype_$*value)");
+  }
+}
+
+void ExtensionGenerator::PrintSetterSignature(google::protobuf::io::Printer* printer) {
+  if (descriptor_->is_repeated()) {
+    printer->Print(vars_,
+		   "protobuf_c_boolean $lcname$__set\n"
+		   "                     ($extendee$ *message,\n"
+		   "                      size_t n,\n"
+		   "                      $ctype_$*values,\n"
+		   "                      ProtobufCAllocator *allocator)");
+  } else {
+    printer->Print(vars_,
+		   "protobuf_c_boolean $lcname$__set\n"
+		   "                     ($extendee$ *message,\n"
+		   "                      $ctype_$value,\n"
+		   "                      ProtobufCAllocator *allocator)");
+  }
+}
+
 void ExtensionGenerator::GenerateDeclaration(google::protobuf::io::Printer* printer) {
+  printer->Print(vars_,
+		 "extern $dllexport$const ProtobufCExtensionDescriptor $lcname$__descriptor;\n");
+  PrintGetterSignature(printer);
+  printer->Print(";\n");
+  PrintSetterSignature(printer);
+  printer->Print(";\n");
 }
 
 void ExtensionGenerator::GenerateDefinition(google::protobuf::io::Printer* printer) {
+  bool optimize_code_size = descriptor_->file()->options().has_optimize_for() &&
+    descriptor_->file()->options().optimize_for() ==
+      google::protobuf::FileOptions_OptimizeMode_CODE_SIZE;
+
+  printer->Print(vars_,
+		 "static const ProtobufCFieldDescriptor $lcname$__field_descriptors[1] =\n"
+		 "{\n");
+  printer->Indent();
+  field_generator_->GenerateDescriptorInitializer(printer);
+  printer->Outdent();
+  printer->Print("};\n");
+  if (!optimize_code_size) {
+    printer->Print(vars_,
+		   "static const unsigned $lcname$__field_indices_by_name[] = {\n"
+		   "  0,   /* field[0] = $shortname$ */\n"
+		   "};\n");
+  }
+  printer->Print(vars_,
+		 "static const ProtobufCIntRange $lcname$__number_ranges[1 + 1] =\n"
+		 "{\n"
+		 "  { $number$, 0 },\n"
+		 "  { 0, 1 }\n"
+		 "};\n"
+		 "const ProtobufCExtensionDescriptor $lcname$__descriptor =\n"
+		 "{\n"
+		 "  &$lcextendee$__descriptor,\n"
+		 "  {\n"
+		 "    PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,\n");
+  if (optimize_code_size) {
+    printer->Print("    NULL,NULL,NULL,NULL, /* CODE_SIZE */\n");
+  } else {
+    printer->Print(vars_,
+		   "    \"$fullname$\",\n"
+		   "    \"$shortname$\",\n"
+		   "    \"ProtobufCExtensionValue\",\n"
+		   "    \"$packagename$\",\n");
+  }
+  printer->Print(vars_,
+		 "    sizeof(ProtobufCExtensionValue),\n"
+		 "    1,\n"
+		 "    $lcname$__field_descriptors,\n");
+  if (optimize_code_size) {
+    printer->Print("    NULL, /* CODE_SIZE */\n");
+  } else {
+    printer->Print(vars_, "    $lcname$__field_indices_by_name,\n");
+  }
+  printer->Print(vars_,
+		 "    1,"
+		 "  $lcname$__number_ranges,\n"
+		 "    NULL, /* initialised from the field descriptor */\n"
+		 "    NULL,NULL,NULL    /* extensions, reserved[23] */\n"
+		 "  }\n"
+		 "};\n");
+
+  // Typed accessors. Storage is not copied, as for any member of a message
+  // built by hand.
+  PrintGetterSignature(printer);
+  printer->Print(vars_,
+		 "\n"
+		 "{\n"
+		 "  const ProtobufCExtensionValue *ev =\n"
+		 "    protobuf_c_message_get_extension ((const ProtobufCMessage *) message, &$lcname$__descriptor);\n");
+  if (descriptor_->is_repeated()) {
+    printer->Print(vars_,
+		   "  if (ev == NULL) {\n"
+		   "    *values = NULL;\n"
+		   "    return 0;\n"
+		   "  }\n"
+		   "  *values = ($ctype_$*) ev->value.v_array;\n"
+		   "  return ev->n;\n"
+		   "}\n");
+  } else {
+    printer->Print(vars_,
+		   "  if (ev == NULL)\n"
+		   "    return 0;\n"
+		   "  *value = *($ctype_$const *) &ev->value;\n"
+		   "  return 1;\n"
+		   "}\n");
+  }
+  PrintSetterSignature(printer);
+  printer->Print(vars_,
+		 "\n"
+		 "{\n"
+		 "  ProtobufCExtensionValue *ev =\n"
+		 "    protobuf_c_message_set_extension ((ProtobufCMessage *) message, &$lcname$__descriptor, allocator);\n"
+		 "  if (ev == NULL)\n"
+		 "    return 0;\n");
+  if (descriptor_->is_repeated()) {
+    printer->Print(vars_,
+		   "  ev->n = n;\n"
+		   "  ev->value.v_array = values;\n");
+  } else {
+    printer->Print(vars_,
+		   "  ev->has = 1;\n"
+		   "  *($ctype_$*) &ev->value = value;\n");
+  }
+  printer->Print("  return 1;\n"
+		 "}\n");
 }
 
 }  // namespace protobuf_c
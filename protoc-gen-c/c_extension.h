@@ -64,12 +64,16 @@
 #ifndef PROTOBUF_C_PROTOC_GEN_C_C_EXTENSION_H__
 #define PROTOBUF_C_PROTOC_GEN_C_C_EXTENSION_H__
 
+#include <map>
+#include <memory>
 #include <string>
 
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/io/printer.h>
 #include <google/protobuf/stubs/common.h>
 
+#include "c_field.h"
+
 namespace protobuf_c {
 
 // Generates code for an extension, which may be within the scope of some
@@ -89,8 +93,12 @@ class ExtensionGenerator {
   void GenerateDefinition(google::protobuf::io::Printer* printer);
 
  private:
+  void PrintGetterSignature(google::protobuf::io::Printer* printer);
+  void PrintSetterSignature(google::protobuf::io::Printer* printer);
+
   const google::protobuf::FieldDescriptor* descriptor_;
-  std::string type_traits_;
+  std::unique_ptr<FieldGenerator> field_generator_;
+  std::map<std::string, std::string> vars_;
   std::string dllexport_decl_;
 };
 
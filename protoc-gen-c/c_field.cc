@@ -104,6 +104,50 @@ static bool is_packable_type(google::protobuf::FieldDescriptor::Type type)
     //TYPE_MESSAGE
 }
 
+// The field's key as the packers write it, first byte in the low-order bits,
+// or 0 if it takes more than three bytes.
+static uint32_t EncodedTag(const google::protobuf::FieldDescriptor* field,
+                           bool packed)
+{
+  uint32_t wire_type;
+  uint32_t key;
+  uint32_t rv = 0;
+  int shift = 0;
+
+  if (packed) {
+    wire_type = 2;
+  } else {
+    switch (field->type()) {
+      case google::protobuf::FieldDescriptor::TYPE_DOUBLE:
+      case google::protobuf::FieldDescriptor::TYPE_FIXED64:
+      case google::protobuf::FieldDescriptor::TYPE_SFIXED64:
+        wire_type = 1;
+        break;
+      case google::protobuf::FieldDescriptor::TYPE_FLOAT:
+      case google::protobuf::FieldDescriptor::TYPE_FIXED32:
+      case google::protobuf::FieldDescriptor::TYPE_SFIXED32:
+        wire_type = 5;
+        break;
+      case google::protobuf::FieldDescriptor::TYPE_STRING:
+      case google::protobuf::FieldDescriptor::TYPE_BYTES:
+      case google::protobuf::FieldDescriptor::TYPE_MESSAGE:
+        wire_type = 2;
+        break;
+      case google::protobuf::FieldDescriptor::TYPE_GROUP:
+        return 0;
+      default:
+        wire_type = 0;
+        break;
+    }
+  }
+  if (field->number() >= (1 << 18))
+    return 0;
+  key = (uint32_t(field->number()) << 3) | wire_type;
+  for (; key >= 0x80; key >>= 7, shift += 8)
+    rv |= ((key & 0x7f) | 0x80) << shift;
+  return rv | (key << shift);
+}
+
 void FieldGenerator::GenerateDescriptorInitializerGeneric(google::protobuf::io::Printer* printer,
 							  bool optional_uses_has,
 							  const std::string &type_macro,
@@ -113,7 +157,29 @@ void FieldGenerator::GenerateDescriptorInitializerGeneric(google::protobuf::io::
   const google::protobuf::OneofDescriptor *oneof = descriptor_->containing_oneof();
   const ProtobufCFileOptions opt = descriptor_->file()->options().GetExtension(pb_c_file);
   variables["TYPE"] = type_macro;
-  variables["classname"] = FullNameToC(FieldScope(descriptor_)->full_name(), FieldScope(descriptor_)->file());
+  if (descriptor_->is_extension()) {
+    // Extensions live in the single field of a ProtobufCExtensionValue.
+    variables["classname"] = "ProtobufCExtensionValue";
+    variables["has_member"] = "has";
+    variables["n_member"] = "n";
+    variables["member"] = "value";
+  } else {
+    variables["classname"] = FullNameToC(FieldScope(descriptor_)->full_name(), FieldScope(descriptor_)->file());
+    variables["has_member"] = "has_" + FieldName(descriptor_);
+    variables["n_member"] = "n_" + FieldName(descriptor_);
+    variables["member"] = FieldName(descriptor_);
+    if (descriptor_->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE &&
+        FieldRepeatedLayout(descriptor_) == REPEATED_LAYOUT_SOA) {
+      // the array of the lowest-numbered element field comes first
+      const google::protobuf::Descriptor* element = descriptor_->message_type();
+      const google::protobuf::FieldDescriptor* first = element->field(0);
+      for (int i = 1; i < element->field_count(); i++) {
+        if (element->field(i)->number() < first->number())
+          first = element->field(i);
+      }
+      variables["member"] += "_" + FieldName(first);
+    }
+  }
   variables["name"] = FieldName(descriptor_);
   if (opt.use_oneof_field_name())
     variables["proto_name"] = std::string(oneof->name());
@@ -132,7 +198,7 @@ void FieldGenerator::GenerateDescriptorInitializerGeneric(google::protobuf::io::
     variables["LABEL"] = CamelToUpper(GetLabelName(descriptor_->label()));
   }
 
-  if (descriptor_->has_default_value()) {
+  if (descriptor_->has_default_value() && !descriptor_->is_extension()) {
     variables["default_value"] = std::string("&")
                                + FullNameToLower(descriptor_->full_name(), descriptor_->file())
 			       + "__default_value";
@@ -145,16 +211,19 @@ void FieldGenerator::GenerateDescriptorInitializerGeneric(google::protobuf::io::
 
   variables["flags"] = "0";
 
+  bool packed = false;
   if (descriptor_->label() == google::protobuf::FieldDescriptor::LABEL_REPEATED
    && is_packable_type (descriptor_->type())
    && descriptor_->options().packed()) {
-    variables["flags"] += " | PROTOBUF_C_FIELD_FLAG_PACKED";
+    packed = true;
   } else if (descriptor_->label() == google::protobuf::FieldDescriptor::LABEL_REPEATED
    && is_packable_type (descriptor_->type())
    && FieldSyntax(descriptor_) == 3
    && !descriptor_->options().has_packed()) {
-    variables["flags"] += " | PROTOBUF_C_FIELD_FLAG_PACKED";
+    packed = true;
   }
+  if (packed)
+    variables["flags"] += " | PROTOBUF_C_FIELD_FLAG_PACKED";
 
   if (descriptor_->options().deprecated())
     variables["flags"] += " | PROTOBUF_C_FIELD_FLAG_DEPRECATED";
@@ -162,6 +231,29 @@ void FieldGenerator::GenerateDescriptorInitializerGeneric(google::protobuf::io::
   if (oneof != NULL)
     variables["flags"] += " | PROTOBUF_C_FIELD_FLAG_ONEOF";
 
+  if (FieldIsIndexedMap(descriptor_))
+    variables["flags"] += " | PROTOBUF_C_FIELD_FLAG_MAP";
+  else if (descriptor_->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE &&
+           FieldRepeatedLayout(descriptor_) == REPEATED_LAYOUT_CONTIGUOUS)
+    variables["flags"] += " | PROTOBUF_C_FIELD_FLAG_CONTIGUOUS";
+  else if (descriptor_->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE &&
+           FieldRepeatedLayout(descriptor_) == REPEATED_LAYOUT_SOA)
+    variables["flags"] += " | PROTOBUF_C_FIELD_FLAG_SOA";
+
+  if (descriptor_->is_map())
+    variables["flags"] += " | PROTOBUF_C_FIELD_FLAG_MAP_ENTRIES";
+
+  if (descriptor_->type() == google::protobuf::FieldDescriptor::TYPE_ENUM) {
+    const ProtobufCFieldOptions fopt = descriptor_->options().GetExtension(pb_c_field);
+    ProtobufCEnumCheck enum_check = opt.enum_check();
+    if (fopt.has_enum_check())
+      enum_check = fopt.enum_check();
+    if (enum_check == ENUM_CHECK_REJECT)
+      variables["flags"] += " | PROTOBUF_C_FIELD_FLAG_ENUM_REJECT";
+    else if (enum_check == ENUM_CHECK_UNKNOWN)
+      variables["flags"] += " | PROTOBUF_C_FIELD_FLAG_ENUM_UNKNOWN";
+  }
+
   // Eliminate codesmell "or with 0"
   if (variables["flags"].find("0 | ") == 0) {
    variables["flags"].erase(0, 4);
@@ -187,20 +279,23 @@ void FieldGenerator::GenerateDescriptorInitializerGeneric(google::protobuf::io::
       if (oneof != NULL) {
         printer->Print(variables, "  offsetof($classname$, $oneofname$_case),\n");
       } else if (optional_uses_has) {
-	printer->Print(variables, "  offsetof($classname$, has_$name$),\n");
+	printer->Print(variables, "  offsetof($classname$, $has_member$),\n");
       } else {
 	printer->Print(variables, "  0,   /* quantifier_offset */\n");
       }
       break;
     case google::protobuf::FieldDescriptor::LABEL_REPEATED:
-      printer->Print(variables, "  offsetof($classname$, n_$name$),\n");
+      printer->Print(variables, "  offsetof($classname$, $n_member$),\n");
       break;
   }
-  printer->Print(variables, "  offsetof($classname$, $name$),\n");
+  printer->Print(variables, "  offsetof($classname$, $member$),\n");
   printer->Print(variables, "  $descriptor_addr$,\n");
   printer->Print(variables, "  $default_value$,\n");
   printer->Print(variables, "  $flags$,             /* flags */\n");
-  printer->Print(variables, "  0,NULL,NULL    /* reserved1,reserved2, etc */\n");
+  char encoded_tag[16];
+  variables["encoded_tag"] = std::string("0x")
+    + FastHexToBuffer(EncodedTag(descriptor_, packed), encoded_tag);
+  printer->Print(variables, "  $encoded_tag$,NULL,NULL    /* encoded_tag,reserved2,reserved3 */\n");
   printer->Print("},\n");
 }
 
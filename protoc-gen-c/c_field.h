@@ -107,11 +107,12 @@ class FieldGeneratorMap {
 
   const FieldGenerator& get(const google::protobuf::FieldDescriptor* field) const;
 
+  // Construct the generator for a single field or extension.
+  static FieldGenerator* MakeGenerator(const google::protobuf::FieldDescriptor* field);
+
  private:
   const google::protobuf::Descriptor* descriptor_;
   std::unique_ptr<std::unique_ptr<FieldGenerator>[]> field_generators_;
-
-  static FieldGenerator* MakeGenerator(const google::protobuf::FieldDescriptor* field);
 };
 
 }  // namespace protobuf_c
@@ -126,12 +126,15 @@ void FileGenerator::GenerateHeader(google::protobuf::io::Printer* printer) {
     "#ifndef PROTOBUF_C_$filename_identifier$__INCLUDED\n"
     "#define PROTOBUF_C_$filename_identifier$__INCLUDED\n"
     "\n"
-    "#include <protobuf-c/protobuf-c.h>\n"
-    "\n"
-    "PROTOBUF_C__BEGIN_DECLS\n"
-    "\n",
+    "#include <protobuf-c/protobuf-c.h>\n",
     "filename", file_->name(),
     "filename_identifier", filename_identifier);
+  if (FileHasViews(file_))
+    printer->Print("#include <protobuf-c/protobuf-c-wire.h>\n");
+  printer->Print(
+    "\n"
+    "PROTOBUF_C__BEGIN_DECLS\n"
+    "\n");
 
   // Verify the protobuf-c library header version is compatible with the
   // protoc-gen-c version before going any further.
@@ -204,6 +207,10 @@ void FileGenerator::GenerateHeader(google::protobuf::io::Printer* printer) {
   }
 
   // Declare extension identifiers.
+  printer->Print("\n/* --- extensions --- */\n\n");
+  for (int i = 0; i < file_->message_type_count(); i++) {
+    message_generators_[i]->GenerateExtensionDeclarations(printer);
+  }
   for (int i = 0; i < file_->extension_count(); i++) {
     extension_generators_[i]->GenerateDeclaration(printer);
   }
@@ -240,6 +247,14 @@ void FileGenerator::GenerateSource(google::protobuf::io::Printer* printer) {
     "filename", file_->name(),
     "basename", StripProto(file_->name()));
 
+  // for strcmp() in the generated method name lookups
+  bool optimize_code_size = file_->options().has_optimize_for() &&
+    file_->options().optimize_for() ==
+    google::protobuf::FileOptions_OptimizeMode_CODE_SIZE;
+  if (file_->service_count() > 0 && !optimize_code_size) {
+    printer->Print("#include <string.h>\n");
+  }
+
   const ProtobufCFileOptions opt = file_->options().GetExtension(pb_c_file);
 
   for (int i = 0; i < file_->message_type_count(); i++) {
@@ -256,6 +271,12 @@ void FileGenerator::GenerateSource(google::protobuf::io::Printer* printer) {
   for (int i = 0; i < file_->enum_type_count(); i++) {
     enum_generators_[i]->GenerateEnumDescriptor(printer);
   }
+  for (int i = 0; i < file_->message_type_count(); i++) {
+    message_generators_[i]->GenerateExtensionDefinitions(printer);
+  }
+  for (int i = 0; i < file_->extension_count(); i++) {
+    extension_generators_[i]->GenerateDefinition(printer);
+  }
   for (int i = 0; i < file_->service_count(); i++) {
     service_generators_[i]->GenerateCFile(printer);
   }
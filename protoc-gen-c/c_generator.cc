@@ -97,6 +97,58 @@ void ParseOptions(const std::string& text, std::vector<std::pair<std::string, st
   }
 }
 
+// Checks the (pb_c_field).layout option of a field.
+static bool ValidateRepeatedLayout(const google::protobuf::FieldDescriptor* field,
+                                   std::string* error) {
+  ProtobufCRepeatedLayout layout = FieldRepeatedLayout(field);
+
+  if (layout == REPEATED_LAYOUT_POINTERS)
+    return true;
+  if (!field->is_repeated() || field->is_map() || field->is_extension() ||
+      field->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+    *error = field->full_name() +
+      ": (pb_c_field).layout is only allowed on repeated message fields";
+    return false;
+  }
+  if (layout != REPEATED_LAYOUT_SOA)
+    return true;
+  const google::protobuf::Descriptor* element = field->message_type();
+  if (element->field_count() == 0) {
+    *error = field->full_name() + ": REPEATED_LAYOUT_SOA requires " +
+      element->full_name() + " to have fields";
+    return false;
+  }
+  for (int i = 0; i < element->field_count(); i++) {
+    const google::protobuf::FieldDescriptor* member = element->field(i);
+    if (member->is_repeated() || member->containing_oneof() != NULL ||
+        member->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_STRING ||
+        member->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+      *error = field->full_name() + ": REPEATED_LAYOUT_SOA requires " +
+        element->full_name() + " to have only singular scalar fields, but " +
+        member->name() + " is not";
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool ValidateRepeatedLayouts(const google::protobuf::Descriptor* message,
+                                    std::string* error) {
+  for (int i = 0; i < message->field_count(); i++) {
+    if (!ValidateRepeatedLayout(message->field(i), error))
+      return false;
+  }
+  for (int i = 0; i < message->extension_count(); i++) {
+    if (!ValidateRepeatedLayout(message->extension(i), error))
+      return false;
+  }
+  for (int i = 0; i < message->nested_type_count(); i++) {
+    if (!ValidateRepeatedLayouts(message->nested_type(i), error))
+      return false;
+  }
+  return true;
+}
+
 CGenerator::CGenerator() {}
 CGenerator::~CGenerator() {}
 
@@ -143,6 +195,14 @@ bool CGenerator::Generate(const google::protobuf::FileDescriptor* file,
 
   // -----------------------------------------------------------------
 
+  for (int i = 0; i < file->message_type_count(); i++) {
+    if (!ValidateRepeatedLayouts(file->message_type(i), error))
+      return false;
+  }
+  for (int i = 0; i < file->extension_count(); i++) {
+    if (!ValidateRepeatedLayout(file->extension(i), error))
+      return false;
+  }
 
   std::string basename = StripProto(file->name());
   basename.append(".pb-c");
@@ -304,6 +304,38 @@ std::string FieldDeprecated(const google::protobuf::FieldDescriptor* field) {
   return "";
 }
 
+bool FieldIsIndexedMap(const google::protobuf::FieldDescriptor* field) {
+  return field->is_map() &&
+         field->options().GetExtension(pb_c_field).map_index();
+}
+
+ProtobufCRepeatedLayout FieldRepeatedLayout(const google::protobuf::FieldDescriptor* field) {
+  return field->options().GetExtension(pb_c_field).layout();
+}
+
+bool MessageHasView(const google::protobuf::Descriptor* descriptor) {
+  const ProtobufCMessageOptions opt = descriptor->options().GetExtension(pb_c_msg);
+  if (opt.has_gen_views())
+    return opt.gen_views();
+  return descriptor->file()->options().GetExtension(pb_c_file).gen_views();
+}
+
+static bool MessageTreeHasViews(const google::protobuf::Descriptor* descriptor) {
+  if (MessageHasView(descriptor))
+    return true;
+  for (int i = 0; i < descriptor->nested_type_count(); i++)
+    if (MessageTreeHasViews(descriptor->nested_type(i)))
+      return true;
+  return false;
+}
+
+bool FileHasViews(const google::protobuf::FileDescriptor* file) {
+  for (int i = 0; i < file->message_type_count(); i++)
+    if (MessageTreeHasViews(file->message_type(i)))
+      return true;
+  return false;
+}
+
 std::string StripProto(compat::StringView filename) {
   if (HasSuffixString(filename, ".protodevel")) {
     return StripSuffixString(filename, ".protodevel");
@@ -101,6 +101,19 @@ std::string FieldName(const google::protobuf::FieldDescriptor* field);
 // Get macro string for deprecated field
 std::string FieldDeprecated(const google::protobuf::FieldDescriptor* field);
 
+// Is this a map field with the (pb_c_field).map_index option set?
+bool FieldIsIndexedMap(const google::protobuf::FieldDescriptor* field);
+
+// The (pb_c_field).layout of a field; only meaningful on repeated messages.
+ProtobufCRepeatedLayout FieldRepeatedLayout(const google::protobuf::FieldDescriptor* field);
+
+// Is a view generated for this message, per (pb_c_msg).gen_views or else
+// (pb_c_file).gen_views?
+bool MessageHasView(const google::protobuf::Descriptor* descriptor);
+
+// Is a view generated for any message of this file?
+bool FileHasViews(const google::protobuf::FileDescriptor* file);
+
 // Returns the scope where the field was defined (for extensions, this is
 // different from the message type to which the field applies).
 inline const google::protobuf::Descriptor* FieldScope(const google::protobuf::FieldDescriptor* field) {
@@ -116,6 +116,10 @@ void MessageGenerator::
 GenerateStructTypedef(google::protobuf::io::Printer* printer) {
   printer->Print("typedef struct $classname$ $classname$;\n",
                  "classname", FullNameToC(descriptor_->full_name(), descriptor_->file()));
+  if (MessageHasView(descriptor_)) {
+    printer->Print("typedef struct $classname$View $classname$View;\n",
+                   "classname", FullNameToC(descriptor_->full_name(), descriptor_->file()));
+  }
 
   for (int i = 0; i < descriptor_->nested_type_count(); i++) {
     nested_generators_[i]->GenerateStructTypedef(printer);
@@ -239,6 +243,9 @@ GenerateStructDefinition(google::protobuf::io::Printer* printer) {
     printer->Outdent();
     printer->Print(vars, "};\n");
   }
+  if (descriptor_->extension_range_count() > 0) {
+    printer->Print("ProtobufCExtensionSet *_extensions;\n");
+  }
   printer->Outdent();
 
   printer->Print(vars, "};\n");
@@ -285,7 +292,99 @@ GenerateStructDefinition(google::protobuf::io::Printer* printer) {
     }
   }
 
+  if (descriptor_->extension_range_count() > 0) {
+    printer->Print(", NULL");
+  }
+
   printer->Print(" }\n\n\n");
+
+  if (MessageHasView(descriptor_)) {
+    vars["n_view_fields"] = SimpleItoa(std::max(descriptor_->field_count(), 1));
+    printer->Print(vars,
+      "struct $dllexport$ $classname$View\n"
+      "{\n"
+      "  ProtobufCWireView base;\n"
+      "  ProtobufCWireViewField fields[$n_view_fields$];\n"
+      "};\n\n\n");
+  }
+}
+
+// Index of a field in the generated descriptor, whose fields are sorted by
+// number.
+static int FieldIndex(const google::protobuf::Descriptor* descriptor,
+                      const google::protobuf::FieldDescriptor* field)
+{
+  int index = 0;
+  for (int j = 0; j < descriptor->field_count(); j++)
+    if (descriptor->field(j)->number() < field->number())
+      index++;
+  return index;
+}
+
+// C type of the value returned by the view accessors of a field.
+static std::string ViewValueCType(const google::protobuf::FieldDescriptor* field)
+{
+  switch (field->type()) {
+    case google::protobuf::FieldDescriptor::TYPE_INT32:
+    case google::protobuf::FieldDescriptor::TYPE_SINT32:
+    case google::protobuf::FieldDescriptor::TYPE_SFIXED32:
+      return "int32_t";
+    case google::protobuf::FieldDescriptor::TYPE_UINT32:
+    case google::protobuf::FieldDescriptor::TYPE_FIXED32:
+      return "uint32_t";
+    case google::protobuf::FieldDescriptor::TYPE_INT64:
+    case google::protobuf::FieldDescriptor::TYPE_SINT64:
+    case google::protobuf::FieldDescriptor::TYPE_SFIXED64:
+      return "int64_t";
+    case google::protobuf::FieldDescriptor::TYPE_UINT64:
+    case google::protobuf::FieldDescriptor::TYPE_FIXED64:
+      return "uint64_t";
+    case google::protobuf::FieldDescriptor::TYPE_FLOAT: return "float";
+    case google::protobuf::FieldDescriptor::TYPE_DOUBLE: return "double";
+    case google::protobuf::FieldDescriptor::TYPE_BOOL: return "protobuf_c_boolean";
+    case google::protobuf::FieldDescriptor::TYPE_ENUM:
+      return FullNameToC(field->enum_type()->full_name(), field->enum_type()->file());
+    case google::protobuf::FieldDescriptor::TYPE_MESSAGE:
+      if (MessageHasView(field->message_type()))
+        return FullNameToC(field->message_type()->full_name(), field->message_type()->file()) + "View";
+      return "ProtobufCBinaryData";
+    case google::protobuf::FieldDescriptor::TYPE_STRING:
+    case google::protobuf::FieldDescriptor::TYPE_BYTES:
+      return "ProtobufCBinaryData";
+    default: GOOGLE_LOG(FATAL) << "groups are not supported"; return "";
+  }
+}
+
+// C type of the key parameter of a generated map lookup function.
+static std::string MapKeyCType(const google::protobuf::FieldDescriptor* key)
+{
+  switch (key->cpp_type()) {
+    case google::protobuf::FieldDescriptor::CPPTYPE_INT32: return "int32_t";
+    case google::protobuf::FieldDescriptor::CPPTYPE_INT64: return "int64_t";
+    case google::protobuf::FieldDescriptor::CPPTYPE_UINT32: return "uint32_t";
+    case google::protobuf::FieldDescriptor::CPPTYPE_UINT64: return "uint64_t";
+    case google::protobuf::FieldDescriptor::CPPTYPE_BOOL: return "protobuf_c_boolean";
+    case google::protobuf::FieldDescriptor::CPPTYPE_STRING: return "const char *";
+    default: GOOGLE_LOG(FATAL) << "invalid map key type"; return "";
+  }
+}
+
+// Print the signature of the lookup function of an indexed map field.
+static void PrintMapLookupSignature(google::protobuf::io::Printer* printer,
+                                    const google::protobuf::FieldDescriptor* field,
+                                    std::map<std::string, std::string> &vars)
+{
+  vars["entryname"] = FullNameToC(field->message_type()->full_name(), field->message_type()->file());
+  vars["fieldname"] = FieldName(field);
+  std::string keytype = MapKeyCType(field->message_type()->map_key());
+  if (keytype.back() != '*')
+    keytype += " ";
+  vars["keytype"] = keytype;
+  printer->Print(vars,
+		 "const $entryname$ *\n"
+		 "       $lcclassname$__$fieldname$__get\n"
+		 "                     ($classname$ *message,\n"
+		 "                      $keytype$key)");
 }
 
 void MessageGenerator::
@@ -340,6 +439,15 @@ GenerateHelperFunctionDeclarations(google::protobuf::io::Printer* printer,
 		 "                      ProtobufCAllocator *allocator);\n"
 		);
   }
+  for (int i = 0; i < descriptor_->field_count(); i++) {
+    const google::protobuf::FieldDescriptor* field = descriptor_->field(i);
+    if (FieldIsIndexedMap(field)) {
+      PrintMapLookupSignature(printer, field, vars);
+      printer->Print(";\n");
+    }
+  }
+  if (MessageHasView(descriptor_))
+    GenerateViewFunctions(printer, false);
 }
 
 void MessageGenerator::
@@ -355,6 +463,27 @@ GenerateDescriptorDeclarations(google::protobuf::io::Printer* printer) {
     enum_generators_[i]->GenerateDescriptorDeclarations(printer);
   }
 }
+
+void MessageGenerator::
+GenerateExtensionDeclarations(google::protobuf::io::Printer* printer) {
+  for (int i = 0; i < descriptor_->nested_type_count(); i++) {
+    nested_generators_[i]->GenerateExtensionDeclarations(printer);
+  }
+  for (int i = 0; i < descriptor_->extension_count(); i++) {
+    extension_generators_[i]->GenerateDeclaration(printer);
+  }
+}
+
+void MessageGenerator::
+GenerateExtensionDefinitions(google::protobuf::io::Printer* printer) {
+  for (int i = 0; i < descriptor_->nested_type_count(); i++) {
+    nested_generators_[i]->GenerateExtensionDefinitions(printer);
+  }
+  for (int i = 0; i < descriptor_->extension_count(); i++) {
+    extension_generators_[i]->GenerateDefinition(printer);
+  }
+}
+
 void MessageGenerator::GenerateClosureTypedef(google::protobuf::io::Printer* printer)
 {
   for (int i = 0; i < descriptor_->nested_type_count(); i++) {
@@ -457,6 +586,122 @@ GenerateHelperFunctionDefinitions(google::protobuf::io::Printer* printer,
 		 "}\n"
 		);
   }
+  for (int i = 0; i < descriptor_->field_count(); i++) {
+    const google::protobuf::FieldDescriptor* field = descriptor_->field(i);
+    if (!FieldIsIndexedMap(field))
+      continue;
+
+    vars["index"] = SimpleItoa(FieldIndex(descriptor_, field));
+    PrintMapLookupSignature(printer, field, vars);
+    printer->Print(vars,
+		 "\n"
+		 "{\n"
+		 "  assert(message->$base$.descriptor == &$lcclassname$__descriptor);\n"
+		 "  return (const $entryname$ *)\n"
+		 "    protobuf_c_message_map_lookup ((ProtobufCMessage*)message,\n"
+		 "                                   &$lcclassname$__descriptor.fields[$index$],\n"
+		 "                                   &key);\n"
+		 "}\n"
+		);
+  }
+  if (MessageHasView(descriptor_))
+    GenerateViewFunctions(printer, true);
+}
+
+void MessageGenerator::
+GenerateViewFunctions(google::protobuf::io::Printer* printer, bool definitions)
+{
+  std::map<std::string, std::string> vars;
+  vars["classname"] = FullNameToC(descriptor_->full_name(), descriptor_->file());
+  vars["lcclassname"] = FullNameToLower(descriptor_->full_name(), descriptor_->file());
+  vars["end"] = definitions ? "\n" : ";\n";
+
+  if (!definitions)
+    printer->Print(vars, "/* $classname$View methods */\n");
+  printer->Print(vars,
+		 "void   $lcclassname$__view_init\n"
+		 "                     ($classname$View *view,\n"
+		 "                      size_t len,\n"
+		 "                      const uint8_t *data)$end$");
+  if (definitions) {
+    printer->Print(vars,
+		 "{\n"
+		 "  protobuf_c_wire_view_init (&view->base, &$lcclassname$__descriptor,\n"
+		 "                             view->fields, len, data);\n"
+		 "}\n");
+  }
+
+  for (int i = 0; i < descriptor_->field_count(); i++) {
+    const google::protobuf::FieldDescriptor* field = descriptor_->field(i);
+    bool is_view = field->type() == google::protobuf::FieldDescriptor::TYPE_MESSAGE &&
+                   MessageHasView(field->message_type());
+
+    vars["fieldname"] = FieldName(field);
+    vars["index"] = SimpleItoa(FieldIndex(descriptor_, field));
+    vars["valuetype"] = ViewValueCType(field);
+    if (is_view) {
+      vars["lcvalueclass"] = FullNameToLower(field->message_type()->full_name(),
+                                             field->message_type()->file());
+    }
+
+    if (!field->is_repeated()) {
+      printer->Print(vars,
+		 "protobuf_c_boolean\n"
+		 "       $lcclassname$__view_get_$fieldname$\n"
+		 "                     ($classname$View *view,\n"
+		 "                      $valuetype$ *value)$end$");
+      if (!definitions)
+        continue;
+      if (is_view) {
+        printer->Print(vars,
+		 "{\n"
+		 "  ProtobufCBinaryData data;\n"
+		 "  protobuf_c_boolean rv = protobuf_c_wire_view_get (&view->base, $index$, &data);\n"
+		 "  $lcvalueclass$__view_init (value, data.len, data.data);\n"
+		 "  return rv;\n"
+		 "}\n");
+      } else {
+        printer->Print(vars,
+		 "{\n"
+		 "  return protobuf_c_wire_view_get (&view->base, $index$, value);\n"
+		 "}\n");
+      }
+      continue;
+    }
+
+    printer->Print(vars,
+		 "void   $lcclassname$__view_iter_$fieldname$\n"
+		 "                     ($classname$View *view,\n"
+		 "                      ProtobufCWireViewIter *iter)$end$");
+    if (definitions) {
+      printer->Print(vars,
+		 "{\n"
+		 "  protobuf_c_wire_view_iter_init (&view->base, $index$, iter);\n"
+		 "}\n");
+    }
+    printer->Print(vars,
+		 "protobuf_c_boolean\n"
+		 "       $lcclassname$__view_next_$fieldname$\n"
+		 "                     (ProtobufCWireViewIter *iter,\n"
+		 "                      $valuetype$ *value)$end$");
+    if (!definitions)
+      continue;
+    if (is_view) {
+      printer->Print(vars,
+		 "{\n"
+		 "  ProtobufCBinaryData data;\n"
+		 "  if (!protobuf_c_wire_view_iter_next (iter, &data))\n"
+		 "    return 0;\n"
+		 "  $lcvalueclass$__view_init (value, data.len, data.data);\n"
+		 "  return 1;\n"
+		 "}\n");
+    } else {
+      printer->Print(vars,
+		 "{\n"
+		 "  return protobuf_c_wire_view_iter_next (iter, value);\n"
+		 "}\n");
+    }
+  }
 }
 
 void MessageGenerator::
@@ -618,6 +863,14 @@ GenerateMessageDescriptor(google::protobuf::io::Printer* printer, bool gen_init)
       "#define $lcclassname$__number_ranges NULL\n");
   }
 
+  if (descriptor_->extension_range_count() > 0) {
+    printer->Print(vars,
+      "static const ProtobufCMessageExtensions $lcclassname$__extensions =\n"
+      "{\n"
+      "  offsetof($classname$, _extensions)\n"
+      "};\n");
+  }
+
   printer->Print(vars,
     "const ProtobufCMessageDescriptor $lcclassname$__descriptor =\n"
     "{\n"
@@ -648,9 +901,16 @@ GenerateMessageDescriptor(google::protobuf::io::Printer* printer, bool gen_init)
   } else {
     printer->Print(vars, "  NULL, /* gen_init_helpers = false */\n");
   }
-  printer->Print(vars,
-    "  NULL,NULL,NULL    /* reserved[123] */\n"
-    "};\n");
+  if (descriptor_->extension_range_count() > 0) {
+    printer->Print(vars,
+      "  &$lcclassname$__extensions,\n"
+      "  NULL,NULL    /* reserved[23] */\n"
+      "};\n");
+  } else {
+    printer->Print(vars,
+      "  NULL,NULL,NULL    /* reserved[123] */\n"
+      "};\n");
+  }
 }
 
 int MessageGenerator::GetOneofUnionOrder(const google::protobuf::FieldDescriptor* fd)
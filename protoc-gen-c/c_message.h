@@ -104,6 +104,10 @@ class MessageGenerator {
   // Generate __INIT macro for populating this structure
   void GenerateStructStaticInitMacro(google::protobuf::io::Printer* printer);
 
+  // Declare the extensions defined in the scope of this message and its
+  // nested types.
+  void GenerateExtensionDeclarations(google::protobuf::io::Printer* printer);
+
   // Generate standard helper functions declarations for this message.
   void GenerateHelperFunctionDeclarations(google::protobuf::io::Printer* printer,
 					  bool is_pack_deep,
@@ -115,6 +119,10 @@ class MessageGenerator {
   // Generate code that initializes the global variable storing the message's
   // descriptor.
   void GenerateMessageDescriptor(google::protobuf::io::Printer* printer, bool gen_init);
+
+  // Generate the extensions defined in the scope of this message and its
+  // nested types.
+  void GenerateExtensionDefinitions(google::protobuf::io::Printer* printer);
   void GenerateHelperFunctionDefinitions(google::protobuf::io::Printer* printer,
 					 bool is_pack_deep,
 					 bool gen_pack,
@@ -124,6 +132,10 @@ class MessageGenerator {
 
   int GetOneofUnionOrder(const google::protobuf::FieldDescriptor *fd);
 
+  // Generate the view functions of this message, declarations or definitions.
+  void GenerateViewFunctions(google::protobuf::io::Printer* printer,
+                             bool definitions);
+
   const google::protobuf::Descriptor* descriptor_;
   std::string dllexport_decl_;
   FieldGeneratorMap field_generators_;
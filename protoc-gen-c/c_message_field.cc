@@ -61,6 +61,9 @@
 
 // Modified to implement C code by Dave Benson.
 
+#include <algorithm>
+#include <vector>
+
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/io/printer.h>
 #include <google/protobuf/wire_format.h>
@@ -70,6 +73,40 @@
 
 namespace protobuf_c {
 
+// C type of one member array of a structure-of-arrays field.
+static std::string SoaMemberCType(const google::protobuf::FieldDescriptor* field)
+{
+  switch (field->cpp_type()) {
+    case google::protobuf::FieldDescriptor::CPPTYPE_INT32  : return "int32_t";
+    case google::protobuf::FieldDescriptor::CPPTYPE_INT64  : return "int64_t";
+    case google::protobuf::FieldDescriptor::CPPTYPE_UINT32 : return "uint32_t";
+    case google::protobuf::FieldDescriptor::CPPTYPE_UINT64 : return "uint64_t";
+    case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT  : return "float";
+    case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE : return "double";
+    case google::protobuf::FieldDescriptor::CPPTYPE_BOOL   : return "protobuf_c_boolean";
+    case google::protobuf::FieldDescriptor::CPPTYPE_ENUM   :
+      return FullNameToC(field->enum_type()->full_name(), field->enum_type()->file());
+    default:
+      GOOGLE_LOG(FATAL) << "not a scalar type";
+  }
+  return "";
+}
+
+// Fields of a structure-of-arrays element, in the order of their arrays.
+static std::vector<const google::protobuf::FieldDescriptor*>
+SoaMemberFields(const google::protobuf::Descriptor* type)
+{
+  std::vector<const google::protobuf::FieldDescriptor*> fields;
+  for (int i = 0; i < type->field_count(); i++)
+    fields.push_back(type->field(i));
+  std::sort(fields.begin(), fields.end(),
+            [](const google::protobuf::FieldDescriptor* a,
+               const google::protobuf::FieldDescriptor* b) {
+              return a->number() < b->number();
+            });
+  return fields;
+}
+
 MessageFieldGenerator::
 MessageFieldGenerator(const google::protobuf::FieldDescriptor* descriptor)
   : FieldGenerator(descriptor) {
@@ -90,7 +127,22 @@ void MessageFieldGenerator::GenerateStructMembers(google::protobuf::io::Printer*
       break;
     case google::protobuf::FieldDescriptor::LABEL_REPEATED:
       printer->Print(vars, "size_t n_$name$$deprecated$;\n");
-      printer->Print(vars, "$type$ **$name$$deprecated$;\n");
+      if (FieldIsIndexedMap(descriptor_)) {
+        // the runtime expects the index right after the entry array
+        printer->Print(vars, "$type$ *$name$$deprecated$;\n");
+        printer->Print(vars, "ProtobufCMapIndex *$name$_index;\n");
+      } else if (FieldRepeatedLayout(descriptor_) == REPEATED_LAYOUT_CONTIGUOUS) {
+        printer->Print(vars, "$type$ *$name$$deprecated$;\n");
+      } else if (FieldRepeatedLayout(descriptor_) == REPEATED_LAYOUT_SOA) {
+        // the runtime expects one array per element field, in number order
+        for (auto field : SoaMemberFields(descriptor_->message_type())) {
+          vars["member_type"] = SoaMemberCType(field);
+          vars["member"] = FieldName(field);
+          printer->Print(vars, "$member_type$ *$name$_$member$$deprecated$;\n");
+        }
+      } else {
+        printer->Print(vars, "$type$ **$name$$deprecated$;\n");
+      }
       break;
   }
 }
@@ -109,7 +161,15 @@ void MessageFieldGenerator::GenerateStaticInit(google::protobuf::io::Printer* pr
       printer->Print("NULL");
       break;
     case google::protobuf::FieldDescriptor::LABEL_REPEATED:
-      printer->Print("0,NULL");
+      if (FieldIsIndexedMap(descriptor_)) {
+        printer->Print("0,NULL,NULL");
+      } else if (FieldRepeatedLayout(descriptor_) == REPEATED_LAYOUT_SOA) {
+        printer->Print("0");
+        for (int i = 0; i < descriptor_->message_type()->field_count(); i++)
+          printer->Print(",NULL");
+      } else {
+        printer->Print("0,NULL");
+      }
       break;
   }
 }
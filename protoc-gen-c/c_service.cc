@@ -78,6 +78,7 @@ ServiceGenerator::ServiceGenerator(const google::protobuf::ServiceDescriptor* de
   vars_["lcfullname"] = FullNameToLower(descriptor_->full_name(), descriptor_->file());
   vars_["ucfullname"] = FullNameToUpper(descriptor_->full_name(), descriptor_->file());
   vars_["lcfullpadd"] = ConvertToSpaces(vars_["lcfullname"]);
+  vars_["invokepad"] = ConvertToSpaces(vars_["lcfullname"] + "__invoke");
   vars_["package"] = std::string(descriptor_->file()->package());
   if (dllexport_decl.empty()) {
     vars_["dllexport"] = "";
@@ -94,6 +95,7 @@ void ServiceGenerator::GenerateMainHFile(google::protobuf::io::Printer* printer)
   GenerateVfuncs(printer);
   GenerateInitMacros(printer);
   GenerateCallersDeclarations(printer);
+  GenerateDispatchDeclarations(printer);
 }
 void ServiceGenerator::GenerateVfuncs(google::protobuf::io::Printer* printer)
 {
@@ -126,7 +128,7 @@ void ServiceGenerator::GenerateInitMacros(google::protobuf::io::Printer* printer
 {
   printer->Print(vars_,
 		 "#define $ucfullname$__BASE_INIT \\\n"
-		 "    { &$lcfullname$__descriptor, protobuf_c_service_invoke_internal, NULL }\n"
+		 "    { &$lcfullname$__descriptor, $lcfullname$__invoke, NULL }\n"
 		 "#define $ucfullname$__INIT(function_prefix__) \\\n"
 		 "    { $ucfullname$__BASE_INIT");
   for (int i = 0; i < descriptor_->method_count(); i++) {
@@ -159,6 +161,27 @@ void ServiceGenerator::GenerateCallersDeclarations(google::protobuf::io::Printer
   }
 }
 
+void ServiceGenerator::GenerateDispatchDeclarations(google::protobuf::io::Printer* printer)
+{
+  printer->Print(vars_,
+                 "void $lcfullname$__invoke(ProtobufCService *service,\n"
+                 "     $invokepad$ unsigned method_index,\n"
+                 "     $invokepad$ const ProtobufCMessage *input,\n"
+                 "     $invokepad$ ProtobufCClosure closure,\n"
+                 "     $invokepad$ void *closure_data);\n"
+                 "protobuf_c_boolean\n"
+                 "     $lcfullname$__invoke_packed(ProtobufCService *service,\n"
+                 "     $invokepad$        unsigned method_index,\n"
+                 "     $invokepad$        size_t len,\n"
+                 "     $invokepad$        const uint8_t *data,\n"
+                 "     $invokepad$        ProtobufCClosure closure,\n"
+                 "     $invokepad$        void *closure_data);\n");
+  if (!OptimizeCodeSize()) {
+    printer->Print(vars_,
+                   "int  $lcfullname$__method_index(const char *name);\n");
+  }
+}
+
 void ServiceGenerator::GenerateDescriptorDeclarations(google::protobuf::io::Printer* printer)
 {
   printer->Print(vars_, "extern const ProtobufCServiceDescriptor $lcfullname$__descriptor;\n");
@@ -169,9 +192,19 @@ void ServiceGenerator::GenerateDescriptorDeclarations(google::protobuf::io::Prin
 void ServiceGenerator::GenerateCFile(google::protobuf::io::Printer* printer)
 {
   GenerateServiceDescriptor(printer);
+  if (!OptimizeCodeSize())
+    GenerateMethodIndex(printer);
+  GenerateInvoke(printer);
+  GenerateInvokePacked(printer);
   GenerateCallersImplementations(printer);
   GenerateInit(printer);
 }
+bool ServiceGenerator::OptimizeCodeSize() const
+{
+  return descriptor_->file()->options().has_optimize_for() &&
+    descriptor_->file()->options().optimize_for() ==
+    google::protobuf::FileOptions_OptimizeMode_CODE_SIZE;
+}
 void ServiceGenerator::GenerateInit(google::protobuf::io::Printer* printer)
 {
   printer->Print(vars_,
@@ -181,6 +214,7 @@ void ServiceGenerator::GenerateInit(google::protobuf::io::Printer* printer)
 		 "  protobuf_c_service_generated_init (&service->base,\n"
 		 "                                     &$lcfullname$__descriptor,\n"
 		 "                                     (ProtobufCServiceDestroy) destroy);\n"
+		 "  service->base.invoke = $lcfullname$__invoke;\n"
 		 "}\n");
 }
 
@@ -198,9 +232,7 @@ void ServiceGenerator::GenerateServiceDescriptor(google::protobuf::io::Printer*
   int n_methods = descriptor_->method_count();
   std::vector<MethodIndexAndName> mi_array;
 
-  bool optimize_code_size = descriptor_->file()->options().has_optimize_for() &&
-    descriptor_->file()->options().optimize_for() ==
-    google::protobuf::FileOptions_OptimizeMode_CODE_SIZE;
+  bool optimize_code_size = OptimizeCodeSize();
 
   vars_["n_methods"] = SimpleItoa(n_methods);
   printer->Print(vars_, "static const ProtobufCMethodDescriptor $lcfullname$__method_descriptors[$n_methods$] =\n"
@@ -261,6 +293,150 @@ void ServiceGenerator::GenerateServiceDescriptor(google::protobuf::io::Printer*
   }
 }
 
+// FNV-1a, seeded; must match the loop emitted by GenerateMethodIndex().
+static uint32_t
+HashMethodName(uint32_t seed, compat::StringView name)
+{
+  uint32_t hash = seed;
+  for (char c : name)
+    hash = (hash ^ (uint8_t) c) * 16777619u;
+  return hash;
+}
+
+// Looks up a method name with a perfect hash: a seed is searched for under
+// which the names hash to distinct slots of a table at least twice as large
+// as the number of methods, growing the table if no seed is found.
+void ServiceGenerator::GenerateMethodIndex(google::protobuf::io::Printer* printer)
+{
+  int n_methods = descriptor_->method_count();
+  uint32_t table_size = 2;
+  uint32_t seed = 2166136261u;
+  std::vector<unsigned> slots;
+
+  while (table_size < 2 * (uint32_t) n_methods)
+    table_size *= 2;
+  for (;;) {
+    bool found = false;
+    for (unsigned attempt = 0; attempt < 4096 && !found; attempt++, seed++) {
+      found = true;
+      slots.assign(table_size, 0);
+      for (int i = 0; i < n_methods && found; i++) {
+        uint32_t slot = HashMethodName(seed, descriptor_->method(i)->name()) &
+                        (table_size - 1);
+        if (slots[slot] != 0)
+          found = false;
+        slots[slot] = i + 1;
+      }
+    }
+    if (found) {
+      seed--;
+      break;
+    }
+    table_size *= 2;
+  }
+
+  vars_["table_size"] = SimpleItoa(table_size);
+  vars_["mask"] = SimpleItoa(table_size - 1);
+  vars_["seed"] = SimpleItoa(seed);
+  printer->Print(vars_,
+                 "/* method index + 1 by name hash, 0 for an empty slot */\n"
+                 "static const unsigned $lcfullname$__method_slots[$table_size$] =\n"
+                 "{\n");
+  for (uint32_t i = 0; i < table_size; i++) {
+    vars_["slot"] = SimpleItoa(slots[i]);
+    vars_["sep"] = (i + 1 == table_size) ? "\n" : (i % 16 == 15) ? ",\n" : ", ";
+    printer->Print(vars_, (i % 16 == 0) ? "  $slot$$sep$" : "$slot$$sep$");
+  }
+  printer->Print(vars_,
+                 "};\n"
+                 "int  $lcfullname$__method_index(const char *name)\n"
+                 "{\n"
+                 "  uint32_t hash = $seed$u;\n"
+                 "  const char *p;\n"
+                 "  unsigned slot;\n"
+                 "\n"
+                 "  for (p = name; *p != '\\0'; p++)\n"
+                 "    hash = (hash ^ (uint8_t) *p) * 16777619u;\n"
+                 "  slot = $lcfullname$__method_slots[hash & $mask$u];\n"
+                 "  if (slot == 0 ||\n"
+                 "      strcmp (name, $lcfullname$__method_descriptors[slot - 1].name) != 0)\n"
+                 "    return -1;\n"
+                 "  return (int) slot - 1;\n"
+                 "}\n");
+}
+
+void ServiceGenerator::GenerateInvoke(google::protobuf::io::Printer* printer)
+{
+  printer->Print(vars_,
+                 "void $lcfullname$__invoke(ProtobufCService *service,\n"
+                 "     $invokepad$ unsigned method_index,\n"
+                 "     $invokepad$ const ProtobufCMessage *input,\n"
+                 "     $invokepad$ ProtobufCClosure closure,\n"
+                 "     $invokepad$ void *closure_data)\n"
+                 "{\n");
+  if (descriptor_->method_count() == 0) {
+    printer->Print(vars_,
+                   "  assert(service->descriptor == &$lcfullname$__descriptor);\n"
+                   "  (void) service;\n"
+                   "  (void) method_index;\n"
+                   "  (void) input;\n"
+                   "  closure(NULL, closure_data);\n"
+                   "}\n");
+    return;
+  }
+  printer->Print(vars_,
+                 "  $cname$_Service *impl = ($cname$_Service *) service;\n"
+                 "\n"
+                 "  assert(service->descriptor == &$lcfullname$__descriptor);\n"
+                 "  switch (method_index) {\n");
+  for (int i = 0; i < descriptor_->method_count(); i++) {
+    const google::protobuf::MethodDescriptor* method = descriptor_->method(i);
+    vars_["method"] = CamelToLower(method->name());
+    vars_["index"] = SimpleItoa(i);
+    vars_["input_typename"] = FullNameToC(method->input_type()->full_name(), method->input_type()->file());
+    vars_["output_typename"] = FullNameToC(method->output_type()->full_name(), method->output_type()->file());
+    printer->Print(vars_,
+                   "  case $index$:\n"
+                   "    if (impl->$method$ == NULL)\n"
+                   "      break;\n"
+                   "    impl->$method$(impl, (const $input_typename$ *) input, ($output_typename$_Closure) closure, closure_data);\n"
+                   "    return;\n");
+  }
+  printer->Print(vars_,
+                 "  }\n"
+                 "  /* out of range or not implemented */\n"
+                 "  closure(NULL, closure_data);\n"
+                 "}\n");
+}
+
+void ServiceGenerator::GenerateInvokePacked(google::protobuf::io::Printer* printer)
+{
+  printer->Print(vars_,
+                 "protobuf_c_boolean\n"
+                 "     $lcfullname$__invoke_packed(ProtobufCService *service,\n"
+                 "     $invokepad$        unsigned method_index,\n"
+                 "     $invokepad$        size_t len,\n"
+                 "     $invokepad$        const uint8_t *data,\n"
+                 "     $invokepad$        ProtobufCClosure closure,\n"
+                 "     $invokepad$        void *closure_data)\n"
+                 "{\n"
+                 "  uint64_t scratch[PROTOBUF_C_SERVICE_ARENA_SIZE / sizeof (uint64_t)];\n"
+                 "  ProtobufCArena arena;\n"
+                 "  ProtobufCMessage *input;\n"
+                 "\n"
+                 "  assert(service->descriptor == &$lcfullname$__descriptor);\n"
+                 "  if (method_index >= $lcfullname$__descriptor.n_methods)\n"
+                 "    return 0;\n"
+                 "  protobuf_c_arena_init (&arena, scratch, sizeof (scratch));\n"
+                 "  input = protobuf_c_message_unpack ($lcfullname$__method_descriptors[method_index].input,\n"
+                 "                                     &arena.base, len, data);\n"
+                 "  if (input != NULL)\n"
+                 "    service->invoke (service, method_index, input, closure, closure_data);\n"
+                 "  protobuf_c_arena_clear (&arena);\n"
+                 "  return input != NULL;\n"
+                 "}\n");
+}
+
 void ServiceGenerator::GenerateCallersImplementations(google::protobuf::io::Printer* printer)
 {
   for (int i = 0; i < descriptor_->method_count(); i++) {
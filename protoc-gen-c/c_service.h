@@ -85,12 +85,18 @@ class ServiceGenerator {
   void GenerateInitMacros(google::protobuf::io::Printer* printer);
   void GenerateDescriptorDeclarations(google::protobuf::io::Printer* printer);
   void GenerateCallersDeclarations(google::protobuf::io::Printer* printer);
+  void GenerateDispatchDeclarations(google::protobuf::io::Printer* printer);
 
   // Source file stuff.
   void GenerateCFile(google::protobuf::io::Printer* printer);
   void GenerateServiceDescriptor(google::protobuf::io::Printer* printer);
   void GenerateInit(google::protobuf::io::Printer* printer);
   void GenerateCallersImplementations(google::protobuf::io::Printer* printer);
+  void GenerateMethodIndex(google::protobuf::io::Printer* printer);
+  void GenerateInvoke(google::protobuf::io::Printer* printer);
+  void GenerateInvokePacked(google::protobuf::io::Printer* printer);
+
+  bool OptimizeCodeSize() const;
 
   const google::protobuf::ServiceDescriptor* descriptor_;
   std::map<std::string, std::string> vars_;
@@ -3,6 +3,7 @@
 
 #define __STDC_LIMIT_MACROS
 #include "t/test-full.pb.h"
+#include <google/protobuf/descriptor.pb.h>
 #include <limits.h>
 #  if defined(_MSC_VER)
      /* On windows, in ms visual studio, define the types ourselves */
@@ -1088,6 +1089,111 @@ static void dump_test_submess_merge (void)
   dump_message_bytes(&merged2, "test_submess_merged2");
 }
 
+/* one entry per map, since map iteration order is unspecified */
+static void
+dump_test_map_index (void)
+{
+  TestMapIndex mess;
+  (*mess.mutable_counts())["seven"] = 7;
+  (*mess.mutable_subs())[-42].set_test(3);
+  (*mess.mutable_names())[true] = "yes";
+  dump_message_bytes(&mess, "test_map_index_single");
+}
+
+static void
+dump_test_extensions (void)
+{
+  TestExtendable mess;
+  mess.set_plain(1);
+  mess.SetExtension(ext_int, 42);
+  mess.SetExtension(ext_str, "hello");
+  mess.AddExtension(ext_packed, -1);
+  mess.AddExtension(ext_packed, 5);
+  mess.AddExtension(ext_packed, 300);
+  mess.MutableExtension(ext_sub)->set_test(9);
+  mess.SetExtension(TestExtensionScope::ext_enum, OTHER_VALUE);
+  dump_message_bytes(&mess, "test_extensions_all");
+}
+
+static void
+dump_test_repeated_layout (void)
+{
+  TestRepeatedLayout mess;
+  TestPoint *point;
+  mess.add_contiguous()->set_test(1);
+  mess.add_contiguous()->set_test(2);
+  mess.mutable_contiguous(1)->set_val1(5);
+  point = mess.add_soa();
+  point->set_ts(100);
+  point->set_v(1.5);
+  point->set_kind(VALUE);
+  point->set_delta(-3);
+  point = mess.add_soa();
+  point->set_ts(-7);
+  point->set_v(0);
+  point->set_kind(OTHER_VALUE);
+  point->set_delta(0);
+  mess.add_pointers()->set_ts(5);
+  dump_message_bytes(&mess, "test_repeated_layout_all");
+}
+
+/* test-full.proto and everything it imports, dependencies first, as
+ * `protoc --include_imports --descriptor_set_out` would write it */
+static void
+add_file_to_set (const google::protobuf::FileDescriptor *file,
+                 google::protobuf::FileDescriptorSet *set)
+{
+  for (int i = 0; i < set->file_size (); i++)
+    if (set->file (i).name () == file->name ())
+      return;
+  for (int i = 0; i < file->dependency_count (); i++)
+    add_file_to_set (file->dependency (i), set);
+  file->CopyTo (set->add_file ());
+}
+
+static void dump_test_descriptor_set (void)
+{
+  google::protobuf::FileDescriptorSet set;
+  add_file_to_set (TestMess::descriptor ()->file (), &set);
+  dump_message_bytes (&set, "test_full_descriptor_set");
+}
+
+/* message A { optional B b = 1; optional group G = 2 { } }
+ * message B { optional int32 x = 1; } */
+static void dump_test_group_descriptor_set (void)
+{
+  google::protobuf::FileDescriptorSet set;
+  google::protobuf::FileDescriptorProto *file = set.add_file ();
+  google::protobuf::DescriptorProto *a, *b;
+  google::protobuf::FieldDescriptorProto *field;
+
+  file->set_name ("t.proto");
+  file->set_package ("t");
+  a = file->add_message_type ();
+  a->set_name ("A");
+  field = a->add_field ();
+  field->set_name ("b");
+  field->set_number (1);
+  field->set_label (google::protobuf::FieldDescriptorProto::LABEL_OPTIONAL);
+  field->set_type (google::protobuf::FieldDescriptorProto::TYPE_MESSAGE);
+  field->set_type_name (".t.B");
+  field = a->add_field ();
+  field->set_name ("g");
+  field->set_number (2);
+  field->set_label (google::protobuf::FieldDescriptorProto::LABEL_OPTIONAL);
+  field->set_type (google::protobuf::FieldDescriptorProto::TYPE_GROUP);
+  field->set_type_name (".t.A.G");
+  a->add_nested_type ()->set_name ("G");
+  b = file->add_message_type ();
+  b->set_name ("B");
+  field = b->add_field ();
+  field->set_name ("x");
+  field->set_number (1);
+  field->set_label (google::protobuf::FieldDescriptorProto::LABEL_OPTIONAL);
+  field->set_type (google::protobuf::FieldDescriptorProto::TYPE_INT32);
+  dump_message_bytes (&set, "test_group_descriptor_set");
+}
+
 int main()
 {
   dump_test_enum_small ();
@@ -1165,5 +1271,10 @@ int main()
   dump_test_packed_repeated_enum ();
   dump_test_unknown_fields ();
   dump_test_submess_merge ();
+  dump_test_map_index ();
+  dump_test_extensions ();
+  dump_test_repeated_layout ();
+  dump_test_descriptor_set ();
+  dump_test_group_descriptor_set ();
   return 0;
 }
@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include "protobuf-c/protobuf-c-dynamic.h"
+#include "protobuf-c/protobuf-c-wire.h"
 #include "t/test-full.pb-c.h"
 #include "t/test-optimized.pb-c.h"
 #include "t/generated-code2/test-full-cxx-output.inc"
@@ -182,10 +184,12 @@ static void test_field_numbers (void)
   size_t len;
   uint8_t *data;
 
-#define DO_ONE_TEST(num, exp_len) \
+#define DO_ONE_TEST(num, exp_len, exp_encoded_tag) \
   { \
     Foo__TestFieldNo##num t = FOO__TEST_FIELD_NO##num##__INIT; \
     Foo__TestFieldNo##num *t2; \
+    assert (foo__test_field_no##num##__descriptor.fields[0].encoded_tag \
+            == exp_encoded_tag); \
     t.test = "tst"; \
     t2 = test_compare_pack_methods ((ProtobufCMessage*)(&t), &len, &data); \
     assert (strcmp (t2->test, "tst") == 0); \
@@ -194,14 +198,14 @@ static void test_field_numbers (void)
     free (data); \
     foo__test_field_no##num##__free_unpacked (t2, NULL); \
   }
-  DO_ONE_TEST (15, 1 + 1 + 3);
-  DO_ONE_TEST (16, 2 + 1 + 3);
-  DO_ONE_TEST (2047, 2 + 1 + 3);
-  DO_ONE_TEST (2048, 3 + 1 + 3);
-  DO_ONE_TEST (262143, 3 + 1 + 3);
-  DO_ONE_TEST (262144, 4 + 1 + 3);
-  DO_ONE_TEST (33554431, 4 + 1 + 3);
-  DO_ONE_TEST (33554432, 5 + 1 + 3);
+  DO_ONE_TEST (15, 1 + 1 + 3, 0x7a);
+  DO_ONE_TEST (16, 2 + 1 + 3, 0x0182);
+  DO_ONE_TEST (2047, 2 + 1 + 3, 0x7ffa);
+  DO_ONE_TEST (2048, 3 + 1 + 3, 0x018082);
+  DO_ONE_TEST (262143, 3 + 1 + 3, 0x7ffffa);
+  DO_ONE_TEST (262144, 4 + 1 + 3, 0);
+  DO_ONE_TEST (33554431, 4 + 1 + 3, 0);
+  DO_ONE_TEST (33554432, 5 + 1 + 3, 0);
 #undef DO_ONE_TEST
 }
 
@@ -1556,6 +1560,55 @@ static void test_packed_repeated_TestEnum (void)
 }
 
 
+static void test_packed_repeated_large (void)
+{
+  /* several encoding blocks of mixed-width varints */
+  enum { N = 5000 };
+  Foo__TestMessPacked mess = FOO__TEST_MESS_PACKED__INIT;
+  Foo__TestMessPacked *mess2;
+  int32_t *int32s = malloc (N * sizeof (int32_t));
+  int64_t *sint64s = malloc (N * sizeof (int64_t));
+  uint64_t *uint64s = malloc (N * sizeof (uint64_t));
+  protobuf_c_boolean *booleans = malloc (N * sizeof (protobuf_c_boolean));
+  uint8_t *data;
+  size_t len;
+  unsigned i;
+
+  assert (int32s != NULL && sint64s != NULL);
+  assert (uint64s != NULL && booleans != NULL);
+  for (i = 0; i < N; i++)
+    {
+      int32s[i] = (i % 7 == 0) ? -(int32_t) i : (int32_t) (i * i);
+      sint64s[i] = (i & 1) ? -(int64_t) i * 1000003 : (int64_t) i;
+      uint64s[i] = UINT64_C (1) << (i % 64);
+      booleans[i] = i % 3 == 0;
+    }
+  mess.n_test_int32 = N;
+  mess.test_int32 = int32s;
+  mess.n_test_sint64 = N;
+  mess.test_sint64 = sint64s;
+  mess.n_test_uint64 = N;
+  mess.test_uint64 = uint64s;
+  mess.n_test_boolean = N;
+  mess.test_boolean = booleans;
+  mess2 = test_compare_pack_methods (&mess.base, &len, &data);
+  assert (mess2->n_test_int32 == N && mess2->n_test_sint64 == N);
+  assert (mess2->n_test_uint64 == N && mess2->n_test_boolean == N);
+  for (i = 0; i < N; i++)
+    {
+      assert (mess2->test_int32[i] == int32s[i]);
+      assert (mess2->test_sint64[i] == sint64s[i]);
+      assert (mess2->test_uint64[i] == uint64s[i]);
+      assert (mess2->test_boolean[i] == booleans[i]);
+    }
+  foo__test_mess_packed__free_unpacked (mess2, NULL);
+  free (data);
+  free (int32s);
+  free (sint64s);
+  free (uint64s);
+  free (booleans);
+}
+
 static void test_unknown_fields (void)
 {
   static Foo__EmptyMess mess = FOO__EMPTY_MESS__INIT;
@@ -1684,6 +1737,656 @@ test_enum_lookups (void)
 #undef TEST_ENUM_DUP_VALUES
 }
 
+static void
+test_enum_is_valid (void)
+{
+  assert (foo__test_enum_small__is_valid (FOO__TEST_ENUM_SMALL__NEG_VALUE));
+  assert (foo__test_enum_small__is_valid (FOO__TEST_ENUM_SMALL__OTHER_VALUE));
+  assert (!foo__test_enum_small__is_valid (-2));
+  assert (!foo__test_enum_small__is_valid (2));
+  assert (foo__test_enum__is_valid (FOO__TEST_ENUM__VALUENEG123456));
+  assert (foo__test_enum__is_valid (FOO__TEST_ENUM__VALUE268435456));
+  assert (!foo__test_enum__is_valid (2));
+  assert (!foo__test_enum__is_valid (INT32_MIN));
+  assert (foo__test_enum_dup_values__is_valid (FOO__TEST_ENUM_DUP_VALUES__VALUE_BB));
+  assert (!foo__test_enum_dup_values__is_valid (43));
+
+  assert (protobuf_c_enum_descriptor_get_value (&foo__test_enum_small__descriptor, 2) == NULL);
+  assert (protobuf_c_enum_descriptor_get_value (&foo__test_enum_small__descriptor, INT32_MIN) == NULL);
+  assert (protobuf_c_enum_descriptor_get_value (&foo__test_enum_small__descriptor, INT32_MAX) == NULL);
+}
+
+static void
+test_map_index (void)
+{
+  /* counts = [{key: "ab"}, {key: <varint 1>}] */
+  static const uint8_t bad_entry[] = { 0x0a, 0x04, 0x0a, 0x02, 'a', 'b',
+                                       0x0a, 0x02, 0x08, 0x01 };
+  Foo__TestMapIndex mess = FOO__TEST_MAP_INDEX__INIT;
+  Foo__TestMapIndex__CountsEntry counts[100];
+  Foo__TestMapIndex__CountsEntry extra = FOO__TEST_MAP_INDEX__COUNTS_ENTRY__INIT;
+  Foo__TestMapIndex__SubsEntry sub_entry = FOO__TEST_MAP_INDEX__SUBS_ENTRY__INIT;
+  Foo__TestMapIndex__NamesEntry name_entry = FOO__TEST_MAP_INDEX__NAMES_ENTRY__INIT;
+  Foo__TestMapIndex__NamesEntry *names[1] = { &name_entry };
+  Foo__SubMess sub = FOO__SUB_MESS__INIT;
+  Foo__TestMapIndex *mess2;
+  const Foo__TestMapIndex__CountsEntry *count;
+  const Foo__TestMapIndex__SubsEntry *found_sub;
+  char keys[100][8];
+  uint8_t *data;
+  size_t len;
+  size_t len2;
+  unsigned i;
+
+  /* wire compatible with the C++ implementation */
+  extra.key = "seven";
+  extra.has_value = 1;
+  extra.value = 7;
+  sub.test = 3;
+  sub_entry.has_key = 1;
+  sub_entry.key = -42;
+  sub_entry.value = &sub;
+  name_entry.has_key = 1;
+  name_entry.key = 1;
+  name_entry.value = "yes";
+  mess.n_counts = 1;
+  mess.counts = &extra;
+  mess.n_subs = 1;
+  mess.subs = &sub_entry;
+  mess.n_names = 1;
+  mess.names = names;
+  mess2 = test_compare_pack_methods (&mess.base, &len, &data);
+  TEST_VERSUS_STATIC_ARRAY (len, data, test_map_index_single);
+  assert (mess2->n_counts == 1);
+  assert (strcmp (mess2->counts[0].key, "seven") == 0);
+  assert (mess2->n_subs == 1 && mess2->subs[0].value->test == 3);
+  assert (mess2->n_names == 1 && strcmp (mess2->names[0]->value, "yes") == 0);
+  found_sub = foo__test_map_index__subs__get (mess2, -42);
+  assert (found_sub == &mess2->subs[0]);
+  assert (foo__test_map_index__subs__get (mess2, 42) == NULL);
+  assert (protobuf_c_message_check (&mess2->base));
+  foo__test_map_index__free_unpacked (mess2, NULL);
+  free (data);
+
+  /* large enough for the hash index; a later duplicate key wins */
+  for (i = 0; i < 100; i++)
+    {
+      foo__test_map_index__counts_entry__init (&counts[i]);
+      snprintf (keys[i], sizeof (keys[i]), "k%u", i);
+      counts[i].key = keys[i];
+      counts[i].has_value = 1;
+      counts[i].value = i;
+    }
+  mess.n_counts = 100;
+  mess.counts = counts;
+  mess.n_subs = 0;
+  mess.n_names = 0;
+  count = foo__test_map_index__counts__get (&mess, "k37");
+  assert (count == &counts[37]);
+  assert (mess.counts_index != NULL);
+  len = foo__test_map_index__get_packed_size (&mess);
+  extra.key = "k5";
+  extra.value = 500;
+  mess.n_counts = 1;
+  mess.counts = &extra;
+  assert (foo__test_map_index__counts__get (&mess, "k5") == &extra);
+  protobuf_c_message_map_invalidate (&mess.base,
+                                     &foo__test_map_index__descriptor.fields[0]);
+  assert (mess.counts_index == NULL);
+  len2 = foo__test_map_index__get_packed_size (&mess);
+  data = malloc (len + len2);
+  assert (data != NULL);
+  mess.n_counts = 100;
+  mess.counts = counts;
+  assert (foo__test_map_index__pack (&mess, data) == len);
+  mess.n_counts = 1;
+  mess.counts = &extra;
+  assert (foo__test_map_index__pack (&mess, data + len) == len2);
+
+  mess2 = foo__test_map_index__unpack (NULL, len + len2, data);
+  assert (mess2 != NULL);
+  assert (mess2->n_counts == 101);
+  for (i = 0; i < 100; i++)
+    {
+      count = foo__test_map_index__counts__get (mess2, keys[i]);
+      assert (count != NULL);
+      assert (count->value == (i == 5 ? 500 : (int32_t) i));
+    }
+  assert (foo__test_map_index__counts__get (mess2, "k100") == NULL);
+  assert (foo__test_map_index__counts__get (mess2, "") == NULL);
+  assert (mess2->counts_index != NULL);
+  foo__test_map_index__free_unpacked (mess2, NULL);
+
+  /* small maps are scanned */
+  mess2 = foo__test_map_index__unpack (NULL, len2, data + len);
+  assert (mess2 != NULL);
+  count = foo__test_map_index__counts__get (mess2, "k5");
+  assert (count != NULL && count->value == 500);
+  assert (mess2->counts_index == NULL);
+  foo__test_map_index__free_unpacked (mess2, NULL);
+
+  free (data);
+
+  /* an entry that fails to unpack after a good one */
+  mess2 = foo__test_map_index__unpack (NULL, sizeof (bad_entry), bad_entry);
+  assert (mess2 == NULL);
+}
+
+
+static void
+test_repeated_layout (void)
+{
+  /* soa = [{}, {5: 1}] */
+  static const uint8_t sparse[] = { 0x12, 0x00, 0x12, 0x02, 0x28, 0x01 };
+  Foo__TestRepeatedLayout mess = FOO__TEST_REPEATED_LAYOUT__INIT;
+  Foo__SubMess contiguous[2] = { FOO__SUB_MESS__INIT, FOO__SUB_MESS__INIT };
+  Foo__TestPoint point = FOO__TEST_POINT__INIT;
+  Foo__TestPoint *pointers[1] = { &point };
+  int64_t ts[2] = { 100, -7 };
+  double v[2] = { 1.5, 0 };
+  Foo__TestEnumSmall kind[2] = { FOO__TEST_ENUM_SMALL__VALUE,
+                                 FOO__TEST_ENUM_SMALL__OTHER_VALUE };
+  int32_t delta[2] = { -3, 0 };
+  Foo__TestRepeatedLayout *mess2;
+  uint8_t *data;
+  uint8_t *twice;
+  size_t len;
+  unsigned i;
+
+  contiguous[0].test = 1;
+  contiguous[1].test = 2;
+  contiguous[1].has_val1 = 1;
+  contiguous[1].val1 = 5;
+  point.has_ts = 1;
+  point.ts = 5;
+  mess.n_contiguous = 2;
+  mess.contiguous = contiguous;
+  mess.n_soa = 2;
+  mess.soa_ts = ts;
+  mess.soa_v = v;
+  mess.soa_kind = kind;
+  mess.soa_delta = delta;
+  mess.n_pointers = 1;
+  mess.pointers = pointers;
+  mess2 = test_compare_pack_methods (&mess.base, &len, &data);
+  TEST_VERSUS_STATIC_ARRAY (len, data, test_repeated_layout_all);
+  assert (mess2->n_contiguous == 2);
+  assert (mess2->contiguous[0].test == 1 && !mess2->contiguous[0].has_val1);
+  assert (mess2->contiguous[1].test == 2 && mess2->contiguous[1].val1 == 5);
+  assert (mess2->n_soa == 2);
+  for (i = 0; i < 2; i++)
+    {
+      assert (mess2->soa_ts[i] == ts[i]);
+      assert (mess2->soa_v[i] == v[i]);
+      assert (mess2->soa_kind[i] == kind[i]);
+      assert (mess2->soa_delta[i] == delta[i]);
+    }
+  assert (mess2->n_pointers == 1 && mess2->pointers[0]->ts == 5);
+  assert (protobuf_c_message_check (&mess2->base));
+  foo__test_repeated_layout__free_unpacked (mess2, NULL);
+
+  /* repeated fields of a merged message are concatenated */
+  twice = malloc (len * 2);
+  assert (twice != NULL);
+  memcpy (twice, data, len);
+  memcpy (twice + len, data, len);
+  mess2 = foo__test_repeated_layout__unpack (NULL, len * 2, twice);
+  assert (mess2 != NULL);
+  assert (mess2->n_contiguous == 4 && mess2->contiguous[3].val1 == 5);
+  assert (mess2->n_soa == 4);
+  for (i = 0; i < 4; i++)
+    {
+      assert (mess2->soa_ts[i] == ts[i % 2]);
+      assert (mess2->soa_delta[i] == delta[i % 2]);
+    }
+  foo__test_repeated_layout__free_unpacked (mess2, NULL);
+  free (twice);
+  free (data);
+
+  /* absent members take their defaults, unknown ones are dropped */
+  mess2 = foo__test_repeated_layout__unpack (NULL, sizeof (sparse), sparse);
+  assert (mess2 != NULL);
+  assert (mess2->n_soa == 2);
+  for (i = 0; i < 2; i++)
+    {
+      assert (mess2->soa_ts[i] == 0 && mess2->soa_v[i] == 0);
+      assert (mess2->soa_kind[i] == FOO__TEST_ENUM_SMALL__OTHER_VALUE);
+    }
+  foo__test_repeated_layout__free_unpacked (mess2, NULL);
+}
+
+static unsigned n_traced_unpacks;
+
+static void
+count_traced_unpacks (ProtobufCTraceEvent event,
+                      const ProtobufCMessageDescriptor *descriptor,
+                      size_t size,
+                      void *trace_data)
+{
+  (void) size;
+  if (event == PROTOBUF_C_TRACE_UNPACK && descriptor == trace_data)
+    n_traced_unpacks++;
+}
+
+static void
+test_stats (void)
+{
+  Foo__TestMess mess = FOO__TEST_MESS__INIT;
+  Foo__SubMess sub = FOO__SUB_MESS__INIT;
+  Foo__SubMess *subs[1] = { &sub };
+  int32_t values[20];
+  ProtobufCStats stats;
+  ProtobufCStatsMessage messages[PROTOBUF_C_STATS_MAX_MESSAGES];
+  ProtobufCMessage *mess2;
+  uint8_t *data;
+  size_t len;
+  size_t i;
+  unsigned found = 0;
+
+  protobuf_c_stats_reset ();
+  if (!protobuf_c_stats_snapshot (&stats, 0, NULL))
+    {
+      /* compiled out */
+      assert (stats.n_allocs == 0 && stats.n_messages == 0);
+      return;
+    }
+  protobuf_c_stats_set_trace (count_traced_unpacks,
+                              (void *) &foo__sub_mess__descriptor);
+
+  /* more fields than the first scan slab holds */
+  for (i = 0; i < 20; i++)
+    values[i] = i;
+  mess.n_test_int32 = 20;
+  mess.test_int32 = values;
+  sub.test = 7;
+  mess.n_test_message = 1;
+  mess.test_message = subs;
+  len = protobuf_c_message_get_packed_size (&mess.base);
+  data = malloc (len);
+  assert (data != NULL);
+  assert (protobuf_c_message_pack (&mess.base, data) == len);
+  mess2 = protobuf_c_message_unpack (&foo__test_mess__descriptor, NULL,
+                                     len, data);
+  assert (mess2 != NULL);
+  protobuf_c_message_free_unpacked (mess2, NULL);
+  mess2 = protobuf_c_message_unpack (&foo__empty_mess__descriptor, NULL,
+                                     len, data);
+  assert (mess2 != NULL);
+  protobuf_c_message_free_unpacked (mess2, NULL);
+  free (data);
+  protobuf_c_stats_set_trace (NULL, NULL);
+
+  assert (protobuf_c_stats_snapshot (&stats, PROTOBUF_C_STATS_MAX_MESSAGES,
+                                     messages));
+  assert (stats.n_allocs > 0);
+  assert (stats.n_frees == stats.n_allocs);
+  assert (stats.n_scanned_member_spills >= 2);
+  assert (stats.n_unknown_fields == 21);
+  assert (n_traced_unpacks == 1);
+  for (i = 0; i < stats.n_messages; i++)
+    {
+      if (messages[i].descriptor == &foo__test_mess__descriptor)
+        {
+          assert (messages[i].n_packed == 1);
+          assert (messages[i].packed_bytes == len);
+          assert (messages[i].n_unpacked == 1);
+          assert (messages[i].unpacked_bytes == len);
+          found++;
+        }
+      else if (messages[i].descriptor == &foo__sub_mess__descriptor)
+        {
+          assert (messages[i].n_packed == 1 && messages[i].n_unpacked == 1);
+          found++;
+        }
+    }
+  assert (found == 2);
+  protobuf_c_stats_reset ();
+}
+
+static void
+test_extensions (void)
+{
+  Foo__TestExtendable mess = FOO__TEST_EXTENDABLE__INIT;
+  Foo__SubMess sub = FOO__SUB_MESS__INIT;
+  int32_t packed[3] = { -1, 5, 300 };
+  ProtobufCUnpackOptions options = PROTOBUF_C_UNPACK_OPTIONS_INIT;
+  ProtobufCExtensionRegistry *registry;
+  ProtobufCExtensionRegistry *partial;
+  Foo__TestExtendable *mess2;
+  Foo__TestEnumSmall enum_value;
+  const char *str;
+  Foo__SubMess *sub2;
+  int32_t *values;
+  int32_t value;
+  uint8_t *data;
+  uint8_t *data2;
+  uint8_t *twice;
+  size_t len;
+  size_t len2;
+
+  /* typed setters on a message built by hand, wire compatible with C++ */
+  mess.has_plain = 1;
+  mess.plain = 1;
+  sub.test = 9;
+  assert (foo__ext_int__set (&mess, 42, NULL));
+  assert (foo__ext_str__set (&mess, "hello", NULL));
+  assert (foo__ext_packed__set (&mess, 3, packed, NULL));
+  assert (foo__ext_sub__set (&mess, &sub, NULL));
+  assert (foo__test_extension_scope__ext_enum__set (&mess,
+                                                    FOO__TEST_ENUM_SMALL__OTHER_VALUE,
+                                                    NULL));
+  assert (foo__ext_int__get (&mess, &value) && value == 42);
+  assert (protobuf_c_message_check (&mess.base));
+
+  /* without a registry, extensions remain unknown fields */
+  mess2 = test_compare_pack_methods (&mess.base, &len, &data);
+  TEST_VERSUS_STATIC_ARRAY (len, data, test_extensions_all);
+  assert (mess2->base.n_unknown_fields == 5);
+  assert (mess2->_extensions == NULL);
+  assert (!foo__ext_int__get (mess2, &value));
+  foo__test_extendable__free_unpacked (mess2, NULL);
+  protobuf_c_message_clear_extensions (&mess.base, NULL);
+  assert (mess._extensions == NULL);
+
+  /* registered extensions are decoded into the extension table */
+  registry = protobuf_c_extension_registry_new (NULL);
+  assert (registry != NULL);
+  assert (protobuf_c_extension_registry_add (registry, &foo__ext_int__descriptor));
+  assert (protobuf_c_extension_registry_add (registry, &foo__ext_str__descriptor));
+  assert (protobuf_c_extension_registry_add (registry, &foo__ext_packed__descriptor));
+  assert (protobuf_c_extension_registry_add (registry, &foo__ext_sub__descriptor));
+  assert (protobuf_c_extension_registry_add (registry,
+                                             &foo__test_extension_scope__ext_enum__descriptor));
+  assert (protobuf_c_extension_registry_find (registry,
+                                              &foo__test_extendable__descriptor,
+                                              102) == &foo__ext_packed__descriptor);
+  assert (protobuf_c_extension_registry_find (registry,
+                                              &foo__sub_mess__descriptor,
+                                              102) == NULL);
+  options.extensions = registry;
+  mess2 = (Foo__TestExtendable *)
+    protobuf_c_message_unpack_with_options (&foo__test_extendable__descriptor,
+                                            NULL, &options, len, data);
+  assert (mess2 != NULL);
+  assert (mess2->base.n_unknown_fields == 0);
+  assert (mess2->has_plain && mess2->plain == 1);
+  assert (foo__ext_int__get (mess2, &value) && value == 42);
+  assert (foo__ext_str__get (mess2, &str) && strcmp (str, "hello") == 0);
+  assert (foo__ext_packed__get (mess2, &values) == 3);
+  assert (values[0] == -1 && values[1] == 5 && values[2] == 300);
+  assert (foo__ext_sub__get (mess2, &sub2) && sub2->test == 9);
+  assert (foo__test_extension_scope__ext_enum__get (mess2, &enum_value));
+  assert (enum_value == FOO__TEST_ENUM_SMALL__OTHER_VALUE);
+  assert (protobuf_c_message_check (&mess2->base));
+  len2 = foo__test_extendable__get_packed_size (mess2);
+  assert (len2 == len);
+  data2 = malloc (len2);
+  assert (data2 != NULL);
+  foo__test_extendable__pack (mess2, data2);
+  assert (memcmp (data, data2, len) == 0);
+  free (data2);
+  foo__test_extendable__free_unpacked (mess2, NULL);
+
+  /* repeated occurrences: scalars are replaced, arrays concatenated and
+   * messages merged */
+  twice = malloc (2 * len);
+  assert (twice != NULL);
+  memcpy (twice, data, len);
+  memcpy (twice + len, data, len);
+  mess2 = (Foo__TestExtendable *)
+    protobuf_c_message_unpack_with_options (&foo__test_extendable__descriptor,
+                                            NULL, &options, 2 * len, twice);
+  assert (mess2 != NULL);
+  assert (foo__ext_int__get (mess2, &value) && value == 42);
+  assert (foo__ext_packed__get (mess2, &values) == 6);
+  assert (values[3] == -1 && values[5] == 300);
+  assert (foo__ext_sub__get (mess2, &sub2) && sub2->test == 9);
+  foo__test_extendable__free_unpacked (mess2, NULL);
+  free (twice);
+
+  /* only what is registered is decoded, the rest round-trips unchanged */
+  partial = protobuf_c_extension_registry_new (NULL);
+  assert (partial != NULL);
+  assert (protobuf_c_extension_registry_add (partial, &foo__ext_int__descriptor));
+  options.extensions = partial;
+  mess2 = (Foo__TestExtendable *)
+    protobuf_c_message_unpack_with_options (&foo__test_extendable__descriptor,
+                                            NULL, &options, len, data);
+  assert (mess2 != NULL);
+  assert (mess2->base.n_unknown_fields == 4);
+  assert (foo__ext_int__get (mess2, &value) && value == 42);
+  assert (!foo__ext_str__get (mess2, &str));
+  data2 = malloc (len);
+  assert (data2 != NULL);
+  assert (foo__test_extendable__pack (mess2, data2) == len);
+  assert (memcmp (data, data2, len) == 0);
+  free (data2);
+  foo__test_extendable__free_unpacked (mess2, NULL);
+
+  /* the registry is per call, plain unpacking still ignores extensions */
+  mess2 = foo__test_extendable__unpack (NULL, len, data);
+  assert (mess2 != NULL);
+  assert (mess2->base.n_unknown_fields == 5);
+  foo__test_extendable__free_unpacked (mess2, NULL);
+
+  /* callers built against a structure without `extensions` decode none */
+  options.size = offsetof (ProtobufCUnpackOptions, extensions);
+  mess2 = (Foo__TestExtendable *)
+    protobuf_c_message_unpack_with_options (&foo__test_extendable__descriptor,
+                                            NULL, &options, len, data);
+  assert (mess2 != NULL);
+  assert (mess2->base.n_unknown_fields == 5);
+  foo__test_extendable__free_unpacked (mess2, NULL);
+
+  protobuf_c_extension_registry_free (partial);
+  protobuf_c_extension_registry_free (registry);
+  free (data);
+}
+
+static void
+test_deterministic_pack (void)
+{
+  /* plain = 1, unknown 3 = 5, unknown 7 = 1, unknown 7 = 2, ext_int = 42 */
+  static const uint8_t expected_extendable[] = { 0x08, 0x01, 0x18, 0x05,
+                                                 0x38, 0x01, 0x38, 0x02,
+                                                 0xa0, 0x06, 0x2a };
+  uint8_t one = 1, two = 2, five = 5;
+  ProtobufCMessageUnknownField sub_unknown[2] = {
+    { 12, PROTOBUF_C_WIRE_TYPE_VARINT, 1, &one },
+    { 11, PROTOBUF_C_WIRE_TYPE_VARINT, 1, &two },
+  };
+  ProtobufCMessageUnknownField sorted_unknown[2] = {
+    { 11, PROTOBUF_C_WIRE_TYPE_VARINT, 1, &two },
+    { 12, PROTOBUF_C_WIRE_TYPE_VARINT, 1, &one },
+  };
+  ProtobufCMessageUnknownField ext_unknown[3] = {
+    { 7, PROTOBUF_C_WIRE_TYPE_VARINT, 1, &one },
+    { 3, PROTOBUF_C_WIRE_TYPE_VARINT, 1, &five },
+    { 7, PROTOBUF_C_WIRE_TYPE_VARINT, 1, &two },
+  };
+  const char *count_keys[3] = { "b", "a", "c" };
+  Foo__TestMapIndex shuffled = FOO__TEST_MAP_INDEX__INIT;
+  Foo__TestMapIndex sorted = FOO__TEST_MAP_INDEX__INIT;
+  Foo__TestMapIndex__CountsEntry counts[3], sorted_counts[3], dup_counts[3];
+  Foo__TestMapIndex__SubsEntry subs[2], sorted_subs[2];
+  Foo__TestMapIndex__NamesEntry names[2];
+  Foo__TestMapIndex__NamesEntry *name_ptrs[2] = { &names[0], &names[1] };
+  Foo__TestMapIndex__NamesEntry *sorted_name_ptrs[2] = { &names[1], &names[0] };
+  Foo__SubMess sub_a = FOO__SUB_MESS__INIT;
+  Foo__SubMess sub_b = FOO__SUB_MESS__INIT;
+  Foo__SubMess sorted_sub_b = FOO__SUB_MESS__INIT;
+  Foo__TestExtendable ext = FOO__TEST_EXTENDABLE__INIT;
+  uint8_t *data, *data2;
+  size_t len;
+  unsigned i;
+
+  for (i = 0; i < 3; i++)
+    {
+      foo__test_map_index__counts_entry__init (&counts[i]);
+      counts[i].key = (char *) count_keys[i];
+      counts[i].has_value = 1;
+      counts[i].value = count_keys[i][0];
+    }
+  sorted_counts[0] = counts[1];
+  sorted_counts[1] = counts[0];
+  sorted_counts[2] = counts[2];
+
+  sub_a.test = 1;
+  sub_b.test = 2;
+  sub_b.has_val1 = 1;
+  sub_b.val1 = 6;
+  sub_b.base.n_unknown_fields = 2;
+  sub_b.base.unknown_fields = sub_unknown;
+  sorted_sub_b = sub_b;
+  sorted_sub_b.base.unknown_fields = sorted_unknown;
+  for (i = 0; i < 2; i++)
+    {
+      foo__test_map_index__subs_entry__init (&subs[i]);
+      subs[i].has_key = 1;
+      foo__test_map_index__names_entry__init (&names[i]);
+      names[i].has_key = 1;
+    }
+  subs[0].key = 5;
+  subs[0].value = &sub_b;
+  subs[1].key = -1;
+  subs[1].value = &sub_a;
+  sorted_subs[0] = subs[1];
+  sorted_subs[1] = subs[0];
+  sorted_subs[1].value = &sorted_sub_b;
+  names[0].key = 1;
+  names[0].value = "yes";
+  names[1].key = 0;
+  names[1].value = "no";
+
+  shuffled.n_counts = 3;
+  shuffled.counts = counts;
+  shuffled.n_subs = 2;
+  shuffled.subs = subs;
+  shuffled.n_names = 2;
+  shuffled.names = name_ptrs;
+  sorted.n_counts = 3;
+  sorted.counts = sorted_counts;
+  sorted.n_subs = 2;
+  sorted.subs = sorted_subs;
+  sorted.n_names = 2;
+  sorted.names = sorted_name_ptrs;
+
+  /* entries in key order and embedded unknown fields by number: the plain
+   * packing of the sorted message */
+  len = foo__test_map_index__get_packed_size (&shuffled);
+  assert (foo__test_map_index__get_packed_size (&sorted) == len);
+  data = malloc (len);
+  data2 = malloc (len);
+  assert (data != NULL && data2 != NULL);
+  assert (protobuf_c_message_pack_deterministic (&shuffled.base, data) == len);
+  assert (foo__test_map_index__pack (&sorted, data2) == len);
+  assert (memcmp (data, data2, len) == 0);
+  assert (protobuf_c_message_pack_deterministic (&sorted.base, data2) == len);
+  assert (memcmp (data, data2, len) == 0);
+  free (data);
+  free (data2);
+
+  /* of entries with equal keys only the last, which wins on unpack, is
+   * written: { b, a = 1, a = 2 } packs as { a = 2, b } */
+  dup_counts[0] = counts[0];
+  dup_counts[1] = counts[1];
+  dup_counts[2] = counts[1];
+  dup_counts[2].value = 2;
+  sorted_counts[0] = dup_counts[2];
+  sorted_counts[1] = counts[0];
+  foo__test_map_index__init (&shuffled);
+  foo__test_map_index__init (&sorted);
+  shuffled.n_counts = 3;
+  shuffled.counts = dup_counts;
+  sorted.n_counts = 2;
+  sorted.counts = sorted_counts;
+  len = foo__test_map_index__get_packed_size (&sorted);
+  data = malloc (foo__test_map_index__get_packed_size (&shuffled));
+  data2 = malloc (len);
+  assert (data != NULL && data2 != NULL);
+  assert (protobuf_c_message_pack_deterministic (&shuffled.base, data) == len);
+  assert (foo__test_map_index__pack (&sorted, data2) == len);
+  assert (memcmp (data, data2, len) == 0);
+  free (data);
+  free (data2);
+
+  /* extensions and unknown fields among the declared fields */
+  ext.has_plain = 1;
+  ext.plain = 1;
+  ext.base.n_unknown_fields = 3;
+  ext.base.unknown_fields = ext_unknown;
+  assert (foo__ext_int__set (&ext, 42, NULL));
+  len = foo__test_extendable__get_packed_size (&ext);
+  assert (len == sizeof (expected_extendable));
+  data = malloc (len);
+  assert (data != NULL);
+  assert (protobuf_c_message_pack_deterministic (&ext.base, data) == len);
+  TEST_VERSUS_STATIC_ARRAY (len, data, expected_extendable);
+  free (data);
+  protobuf_c_message_clear_extensions (&ext.base, NULL);
+}
+
+static void
+test_enum_check (void)
+{
+  /* open = 5 */
+  static const uint8_t open_data[] = { 0x08, 0x05 };
+  /* rejected = 5 */
+  static const uint8_t rejected_data[] = { 0x10, 0x05 };
+  /* closed = 2, closed_packed = [0, 7, 1] */
+  static const uint8_t closed_data[] = { 0x18, 0x02, 0x22, 0x03, 0x00, 0x07, 0x01 };
+  /* closed = 1, closed_packed = [-1] */
+  static const uint8_t valid_data[] = { 0x18, 0x01, 0x22, 0x0a,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01 };
+  Foo__TestEnumCheck *mess;
+  size_t len;
+  uint8_t *data;
+
+  mess = foo__test_enum_check__unpack (NULL, sizeof (open_data), open_data);
+  assert (mess != NULL);
+  assert (mess->has_open && mess->open == 5);
+  foo__test_enum_check__free_unpacked (mess, NULL);
+
+  mess = foo__test_enum_check__unpack (NULL, sizeof (rejected_data), rejected_data);
+  assert (mess == NULL);
+
+  mess = foo__test_enum_check__unpack (NULL, sizeof (closed_data), closed_data);
+  assert (mess != NULL);
+  assert (!mess->has_closed);
+  assert (mess->n_closed_packed == 2);
+  assert (mess->closed_packed[0] == FOO__TEST_ENUM_SMALL__VALUE);
+  assert (mess->closed_packed[1] == FOO__TEST_ENUM_SMALL__OTHER_VALUE);
+  assert (mess->base.n_unknown_fields == 2);
+  assert (mess->base.unknown_fields[0].tag == 3);
+  assert (mess->base.unknown_fields[0].wire_type == PROTOBUF_C_WIRE_TYPE_VARINT);
+  assert (mess->base.unknown_fields[0].len == 1);
+  assert (mess->base.unknown_fields[0].data[0] == 2);
+  assert (mess->base.unknown_fields[1].tag == 4);
+  assert (mess->base.unknown_fields[1].wire_type == PROTOBUF_C_WIRE_TYPE_VARINT);
+  assert (mess->base.unknown_fields[1].len == 1);
+  assert (mess->base.unknown_fields[1].data[0] == 7);
+
+  /* undeclared values survive a round trip as unknown fields */
+  len = foo__test_enum_check__get_packed_size (mess);
+  data = malloc (len);
+  assert (foo__test_enum_check__pack (mess, data) == len);
+  foo__test_enum_check__free_unpacked (mess, NULL);
+  mess = foo__test_enum_check__unpack (NULL, len, data);
+  assert (mess != NULL);
+  assert (mess->n_closed_packed == 2);
+  assert (mess->base.n_unknown_fields == 2);
+  foo__test_enum_check__free_unpacked (mess, NULL);
+  free (data);
+
+  mess = foo__test_enum_check__unpack (NULL, sizeof (valid_data), valid_data);
+  assert (mess != NULL);
+  assert (mess->has_closed && mess->closed == FOO__TEST_ENUM__VALUE1);
+  assert (mess->n_closed_packed == 1);
+  assert (mess->closed_packed[0] == FOO__TEST_ENUM_SMALL__NEG_VALUE);
+  assert (mess->base.n_unknown_fields == 0);
+  foo__test_enum_check__free_unpacked (mess, NULL);
+}
+
 static void
 test_message_descriptor (const ProtobufCMessageDescriptor *desc)
 {
@@ -1918,6 +2621,203 @@ test_field_merge (void)
    foo__test_mess_optional__free_unpacked (merged, NULL);
 }
 
+static void
+test_field_merge_many (void)
+{
+  const unsigned n = 10000;
+  Foo__TestMessOptional msg = FOO__TEST_MESS_OPTIONAL__INIT;
+  Foo__SubMess sub = FOO__SUB_MESS__INIT;
+  Foo__SubMess__SubSubMess subsub = FOO__SUB_MESS__SUB_SUB_MESS__INIT;
+  Foo__TestMessOptional *merged;
+  int32_t value;
+  size_t msg_size, len = 0;
+  uint8_t *packed;
+  unsigned i;
+
+  /* every partial encoding carries one element of each repeated field */
+  msg.test_message = &sub;
+  sub.n_rep = 1;
+  sub.rep = &value;
+  sub.sub1 = &subsub;
+  subsub.n_rep = 1;
+  subsub.rep = &value;
+  value = -1;
+  msg_size = foo__test_mess_optional__get_packed_size (&msg);
+  packed = malloc (n * msg_size);
+  for (i = 0; i < n; i++)
+    {
+      value = i;
+      len += foo__test_mess_optional__pack (&msg, packed + len);
+    }
+  assert (len <= n * msg_size);
+
+  merged = foo__test_mess_optional__unpack (NULL, len, packed);
+  assert (merged != NULL);
+  assert (merged->test_message->n_rep == n);
+  assert (merged->test_message->sub1->n_rep == n);
+  for (i = 0; i < n; i++)
+    {
+      assert (merged->test_message->rep[i] == (int32_t) i);
+      assert (merged->test_message->sub1->rep[i] == (int32_t) i);
+    }
+  assert (merged->test_message->sub2 == NULL);
+
+  free (packed);
+  foo__test_mess_optional__free_unpacked (merged, NULL);
+}
+
+static void
+test_max_depth (void)
+{
+  const unsigned n = PROTOBUF_C_DEFAULT_MAX_DEPTH + 20;
+  Foo__TestNested *nodes = malloc (n * sizeof (Foo__TestNested));
+  ProtobufCUnpackOptions options = PROTOBUF_C_UNPACK_OPTIONS_INIT;
+  Foo__TestNested *mess;
+  size_t len;
+  uint8_t *packed;
+  unsigned i;
+
+  for (i = 0; i < n; i++)
+    {
+      foo__test_nested__init (&nodes[i]);
+      nodes[i].has_depth = 1;
+      nodes[i].depth = i;
+      nodes[i].child = i + 1 < n ? &nodes[i + 1] : NULL;
+    }
+  assert (!protobuf_c_message_check (&nodes[0].base));
+  assert (protobuf_c_message_check (&nodes[n - PROTOBUF_C_DEFAULT_MAX_DEPTH].base));
+  assert (!protobuf_c_message_check (&nodes[n - PROTOBUF_C_DEFAULT_MAX_DEPTH - 1].base));
+
+  len = protobuf_c_message_get_packed_size (&nodes[0].base);
+  packed = malloc (len);
+  assert (protobuf_c_message_pack (&nodes[0].base, packed) == len);
+
+  assert (foo__test_nested__unpack (NULL, len, packed) == NULL);
+  options.max_depth = n - 1;
+  assert (protobuf_c_message_unpack_with_options (&foo__test_nested__descriptor,
+                                                  NULL, &options, len, packed) == NULL);
+  options.max_depth = n;
+  mess = (Foo__TestNested *)
+    protobuf_c_message_unpack_with_options (&foo__test_nested__descriptor,
+                                            NULL, &options, len, packed);
+  assert (mess != NULL);
+  assert (mess->child->child->depth == 2);
+  foo__test_nested__free_unpacked (mess, NULL);
+
+  /* the innermost levels alone are within the default limit */
+  nodes[n - PROTOBUF_C_DEFAULT_MAX_DEPTH - 1].child = NULL;
+  len = protobuf_c_message_pack (&nodes[n - PROTOBUF_C_DEFAULT_MAX_DEPTH].base,
+                                 packed);
+  mess = foo__test_nested__unpack (NULL, len, packed);
+  assert (mess != NULL);
+  foo__test_nested__free_unpacked (mess, NULL);
+
+  free (packed);
+  free (nodes);
+}
+
+static void
+test_unpack_options (void)
+{
+  ProtobufCUnpackOptions options = PROTOBUF_C_UNPACK_OPTIONS_INIT;
+  Foo__TestMessPacked packed_mess = FOO__TEST_MESS_PACKED__INIT;
+  Foo__TestMess mess = FOO__TEST_MESS__INIT;
+  Foo__SubMess subs[10];
+  Foo__SubMess *sub_ptrs[10];
+  int32_t values[1000];
+  uint8_t unknown_data[1] = { 1 };
+  ProtobufCMessageUnknownField unknown[3];
+  ProtobufCMessage *rv;
+  uint8_t *packed;
+  size_t len;
+  unsigned i;
+
+  for (i = 0; i < 1000; i++)
+    values[i] = i;
+  for (i = 0; i < 10; i++)
+    {
+      foo__sub_mess__init (&subs[i]);
+      subs[i].test = i;
+      sub_ptrs[i] = &subs[i];
+    }
+  for (i = 0; i < 3; i++)
+    {
+      unknown[i].tag = 100 + i;
+      unknown[i].wire_type = PROTOBUF_C_WIRE_TYPE_VARINT;
+      unknown[i].len = 1;
+      unknown[i].data = unknown_data;
+    }
+
+  /* elements are counted before the arrays are allocated */
+  packed_mess.n_test_int32 = 1000;
+  packed_mess.test_int32 = values;
+  packed = malloc (foo__test_mess_packed__get_packed_size (&packed_mess));
+  len = foo__test_mess_packed__pack (&packed_mess, packed);
+  options.max_elements = 999;
+  assert (protobuf_c_message_unpack_with_options (&foo__test_mess_packed__descriptor,
+                                                  NULL, &options, len, packed) == NULL);
+  options.max_elements = 1000;
+  rv = protobuf_c_message_unpack_with_options (&foo__test_mess_packed__descriptor,
+                                               NULL, &options, len, packed);
+  assert (rv != NULL);
+  protobuf_c_message_free_unpacked (rv, NULL);
+
+  options.max_elements = 0;
+  options.max_allocated = 1000 * sizeof (int32_t);
+  assert (protobuf_c_message_unpack_with_options (&foo__test_mess_packed__descriptor,
+                                                  NULL, &options, len, packed) == NULL);
+  options.max_allocated = 1000 * sizeof (int32_t) + sizeof (Foo__TestMessPacked);
+  rv = protobuf_c_message_unpack_with_options (&foo__test_mess_packed__descriptor,
+                                               NULL, &options, len, packed);
+  assert (rv != NULL);
+  protobuf_c_message_free_unpacked (rv, NULL);
+
+  options.max_allocated = 0;
+  options.max_message_size = len - 1;
+  assert (protobuf_c_message_unpack_with_options (&foo__test_mess_packed__descriptor,
+                                                  NULL, &options, len, packed) == NULL);
+  options.max_message_size = 0;
+  free (packed);
+
+  /* submessages and unknown fields */
+  mess.n_test_message = 10;
+  mess.test_message = sub_ptrs;
+  mess.base.n_unknown_fields = 3;
+  mess.base.unknown_fields = unknown;
+  packed = malloc (foo__test_mess__get_packed_size (&mess));
+  len = foo__test_mess__pack (&mess, packed);
+  options.max_submessages = 9;
+  assert (protobuf_c_message_unpack_with_options (&foo__test_mess__descriptor,
+                                                  NULL, &options, len, packed) == NULL);
+  options.max_submessages = 10;
+  options.max_unknown_fields = 2;
+  assert (protobuf_c_message_unpack_with_options (&foo__test_mess__descriptor,
+                                                  NULL, &options, len, packed) == NULL);
+  options.max_unknown_fields = 3;
+  rv = protobuf_c_message_unpack_with_options (&foo__test_mess__descriptor,
+                                               NULL, &options, len, packed);
+  assert (rv != NULL);
+  assert (((Foo__TestMess *) rv)->n_test_message == 10);
+  assert (rv->n_unknown_fields == 3);
+  protobuf_c_message_free_unpacked (rv, NULL);
+
+  /* options from a caller built against an older, shorter structure only
+   * set the limits it has; a longer one than the library knows is refused */
+  options.size = offsetof (ProtobufCUnpackOptions, max_unknown_fields);
+  options.max_unknown_fields = 2;
+  rv = protobuf_c_message_unpack_with_options (&foo__test_mess__descriptor,
+                                               NULL, &options, len, packed);
+  assert (rv != NULL);
+  protobuf_c_message_free_unpacked (rv, NULL);
+  options.size = sizeof (options) + 1;
+  assert (protobuf_c_message_unpack_with_options (&foo__test_mess__descriptor,
+                                                  NULL, &options, len, packed) == NULL);
+  options.size = 0;
+  assert (protobuf_c_message_unpack_with_options (&foo__test_mess__descriptor,
+                                                  NULL, &options, len, packed) == NULL);
+  free (packed);
+}
+
 static void
 test_submessage_merge (void)
 {
@@ -2226,12 +3126,821 @@ test_message_check(void)
   assert(1 == protobuf_c_message_check(&m.base));
 }
 
+#define DYNAMIC_FIELD(type, message, desc, name)                   \
+  (*(type *) ((char *) (message) +                                \
+    protobuf_c_message_descriptor_get_field_by_name (desc, name)->offset))
+
+static void
+test_dynamic_descriptor_matches (ProtobufCDescriptorPool *pool,
+                                 const ProtobufCMessageDescriptor *generated)
+{
+  const ProtobufCMessageDescriptor *desc;
+  unsigned i;
+
+  desc = protobuf_c_descriptor_pool_find_message (pool, generated->name);
+  assert (desc != NULL);
+  assert (strcmp (desc->short_name, generated->short_name) == 0);
+  assert (strcmp (desc->package_name, generated->package_name) == 0);
+  assert (desc->n_fields == generated->n_fields);
+  assert (desc->n_field_ranges == generated->n_field_ranges);
+  for (i = 0; i < desc->n_fields; i++)
+    {
+      const ProtobufCFieldDescriptor *f = desc->fields + i;
+      const ProtobufCFieldDescriptor *g = generated->fields + i;
+      assert (strcmp (f->name, g->name) == 0);
+      assert (f->id == g->id);
+      assert (f->label == g->label);
+      assert (f->type == g->type);
+      assert (f->flags == g->flags);
+      assert (f->encoded_tag == g->encoded_tag);
+      /* proto2 enums get their first value, which INIT uses instead */
+      if (g->type != PROTOBUF_C_TYPE_ENUM || g->label != PROTOBUF_C_LABEL_OPTIONAL
+          || (g->flags & PROTOBUF_C_FIELD_FLAG_ONEOF) != 0)
+        assert ((f->default_value == NULL) == (g->default_value == NULL));
+      assert ((f->quantifier_offset == 0) == (g->quantifier_offset == 0));
+      if (g->type == PROTOBUF_C_TYPE_MESSAGE || g->type == PROTOBUF_C_TYPE_ENUM)
+        assert (strcmp (((const ProtobufCMessageDescriptor *) f->descriptor)->name,
+                        ((const ProtobufCMessageDescriptor *) g->descriptor)->name) == 0);
+      assert (desc->fields_sorted_by_name[i] == generated->fields_sorted_by_name[i]);
+    }
+  test_message_descriptor (desc);
+}
+
+static void
+test_dynamic_descriptors (void)
+{
+  Foo__TestMessOptional optional = FOO__TEST_MESS_OPTIONAL__INIT;
+  ProtobufCDescriptorPool *pool;
+  const ProtobufCMessageDescriptor *desc;
+  const ProtobufCEnumDescriptor *edesc;
+  ProtobufCMessage *mess;
+  ProtobufCBinaryData *bd;
+  uint8_t *packed;
+  size_t len;
+
+  pool = protobuf_c_descriptor_pool_new (NULL, sizeof (test_full_descriptor_set),
+                                         test_full_descriptor_set);
+  assert (pool != NULL);
+
+  assert (protobuf_c_descriptor_pool_find_message (pool, "foo.NoSuchMessage") == NULL);
+  assert (protobuf_c_descriptor_pool_find_message (pool, "foo.TestEnum") == NULL);
+  assert (protobuf_c_descriptor_pool_find_enum (pool, "foo.TestMess") == NULL);
+
+  test_dynamic_descriptor_matches (pool, &foo__test_mess__descriptor);
+  test_dynamic_descriptor_matches (pool, &foo__test_mess_packed__descriptor);
+  test_dynamic_descriptor_matches (pool, &foo__test_mess_optional__descriptor);
+  test_dynamic_descriptor_matches (pool, &foo__test_mess_oneof__descriptor);
+  test_dynamic_descriptor_matches (pool, &foo__test_mess_sub_mess__descriptor);
+  test_dynamic_descriptor_matches (pool, &foo__sub_mess__sub_sub_mess__descriptor);
+  test_dynamic_descriptor_matches (pool, &foo__test_field_flags__descriptor);
+  test_dynamic_descriptor_matches (pool, &foo__test_enum_check__descriptor);
+  test_dynamic_descriptor_matches (pool, &foo__test_map_index__descriptor);
+
+  edesc = protobuf_c_descriptor_pool_find_enum (pool, "foo.TestEnumDupValues");
+  assert (edesc != NULL);
+  test_enum_descriptor (edesc);
+  assert (edesc->n_values == foo__test_enum_dup_values__descriptor.n_values);
+  assert (protobuf_c_enum_descriptor_get_value_by_name (edesc, "VALUE_AA")->value == 1000);
+  edesc = protobuf_c_descriptor_pool_find_enum (pool, "foo.TestEnum");
+  assert (edesc != NULL);
+  test_enum_descriptor (edesc);
+  assert (edesc->n_value_ranges == foo__test_enum__descriptor.n_value_ranges);
+
+  /* default values */
+  desc = protobuf_c_descriptor_pool_find_message (pool, "foo.DefaultOptionalValues");
+  assert (desc != NULL);
+  mess = malloc (desc->sizeof_message);
+  protobuf_c_message_init (desc, mess);
+  assert (mess->descriptor == desc);
+  assert (DYNAMIC_FIELD (int32_t, mess, desc, "v_int32") == -42);
+  assert (DYNAMIC_FIELD (uint32_t, mess, desc, "v_uint32") == 666);
+  assert (DYNAMIC_FIELD (float, mess, desc, "v_float") == 2.5);
+  assert (DYNAMIC_FIELD (double, mess, desc, "v_double") == 4.5);
+  assert (strcmp (DYNAMIC_FIELD (const char *, mess, desc, "v_string"), "hi mom\n") == 0);
+  bd = &DYNAMIC_FIELD (ProtobufCBinaryData, mess, desc, "v_bytes");
+  assert (bd->len == 13);
+  assert (memcmp (bd->data, "a \0 character", 13) == 0);
+  assert (protobuf_c_message_get_packed_size (mess) == 0);
+  free (mess);
+
+  /* proto2 enums start at their first declared value, as with INIT */
+  desc = protobuf_c_descriptor_pool_find_message (pool, "foo.TestMessOptional");
+  assert (desc != NULL);
+  mess = malloc (desc->sizeof_message);
+  protobuf_c_message_init (desc, mess);
+  assert (DYNAMIC_FIELD (int, mess, desc, "test_enum_small") == optional.test_enum_small);
+  assert (DYNAMIC_FIELD (int, mess, desc, "test_enum_small") == FOO__TEST_ENUM_SMALL__NEG_VALUE);
+  assert (DYNAMIC_FIELD (int, mess, desc, "test_enum") == optional.test_enum);
+  assert (DYNAMIC_FIELD (int, mess, desc, "test_enum") == FOO__TEST_ENUM__VALUENEG123456);
+  assert (protobuf_c_message_get_packed_size (mess) == 0);
+  free (mess);
+
+  /* same wire behaviour as the generated descriptor, merging included */
+  desc = protobuf_c_descriptor_pool_find_message (pool, "foo.TestMessSubMess");
+  assert (desc != NULL);
+  mess = protobuf_c_message_unpack (desc, NULL, sizeof (test_submess_unmerged1),
+                                    test_submess_unmerged1);
+  assert (mess != NULL);
+  assert (protobuf_c_message_check (mess));
+  len = protobuf_c_message_get_packed_size (mess);
+  packed = malloc (len);
+  assert (protobuf_c_message_pack (mess, packed) == len);
+  TEST_VERSUS_STATIC_ARRAY (len, packed, test_submess_merged1);
+  free (packed);
+  protobuf_c_message_free_unpacked (mess, NULL);
+
+  desc = protobuf_c_descriptor_pool_find_message (pool, "foo.TestMessPacked");
+  mess = protobuf_c_message_unpack (desc, NULL, sizeof (test_packed_repeated_int32_arr_min_max),
+                                    test_packed_repeated_int32_arr_min_max);
+  assert (mess != NULL);
+  len = protobuf_c_message_get_packed_size (mess);
+  packed = malloc (len);
+  assert (protobuf_c_message_pack (mess, packed) == len);
+  TEST_VERSUS_STATIC_ARRAY (len, packed, test_packed_repeated_int32_arr_min_max);
+  free (packed);
+  protobuf_c_message_free_unpacked (mess, NULL);
+
+  protobuf_c_descriptor_pool_free (pool);
+
+  /* a type that cannot be built does not fail the types it pulled in */
+  pool = protobuf_c_descriptor_pool_new (NULL, sizeof (test_group_descriptor_set),
+                                         test_group_descriptor_set);
+  assert (pool != NULL);
+  assert (protobuf_c_descriptor_pool_find_message (pool, "t.A") == NULL);
+  assert (protobuf_c_descriptor_pool_find_message (pool, "t.A") == NULL);
+  desc = protobuf_c_descriptor_pool_find_message (pool, "t.B");
+  assert (desc != NULL);
+  assert (desc->n_fields == 1 && strcmp (desc->fields[0].name, "x") == 0);
+  protobuf_c_descriptor_pool_free (pool);
+
+  assert (protobuf_c_descriptor_pool_new (NULL, 3, (const uint8_t *) "\x0a\x05x") == NULL);
+}
+
+/* --- wire-level operations --- */
+
+static Foo__TestMess *
+wire_filter_test (ProtobufCWireFilterMode mode,
+                  size_t n_paths,
+                  const char *const *paths,
+                  size_t len,
+                  const uint8_t *data)
+{
+  ProtobufCWireFieldSet *set;
+  uint8_t scratch[16];
+  ProtobufCBufferSimple bs = PROTOBUF_C_BUFFER_SIMPLE_INIT (scratch);
+  Foo__TestMess *rv;
+
+  set = protobuf_c_wire_field_set_new (NULL, &foo__test_mess__descriptor,
+                                       mode, n_paths, paths);
+  assert (set != NULL);
+  assert (protobuf_c_wire_filter (&foo__test_mess__descriptor, set,
+                                  len, data, &bs.base));
+  rv = foo__test_mess__unpack (NULL, bs.len, bs.data);
+  assert (rv != NULL);
+  PROTOBUF_C_BUFFER_SIMPLE_CLEAR (&bs);
+  protobuf_c_wire_field_set_free (set);
+  return rv;
+}
+
+static void
+test_wire_filter (void)
+{
+  Foo__TestMess mess = FOO__TEST_MESS__INIT;
+  Foo__SubMess subs[2] = { FOO__SUB_MESS__INIT, FOO__SUB_MESS__INIT };
+  Foo__SubMess *sub_ptrs[2] = { &subs[0], &subs[1] };
+  Foo__SubMess__SubSubMess subsub = FOO__SUB_MESS__SUB_SUB_MESS__INIT;
+  int32_t int32s[2] = { 1, -2 };
+  uint32_t fixed32s[1] = { 0xdeadbeef };
+  const char *strings[1] = { "secret" };
+  static const char *const keep[] = {
+    "test_int32", "test_message.test", "test_message.val2"
+  };
+  static const char *const drop[] = { "test_string", "test_message.sub1" };
+  static const char *const blank[] = {
+    "test_fixed32", "test_string", "test_message.val1"
+  };
+  static const char *const bad_paths[][1] = {
+    { "nope" }, { "test_int32.val1" }, { "test_message.nope" }
+  };
+  ProtobufCWireFieldSet *set;
+  uint8_t scratch[16];
+  ProtobufCBufferSimple bs = PROTOBUF_C_BUFFER_SIMPLE_INIT (scratch);
+  Foo__TestMess *out;
+  uint8_t *packed;
+  size_t len;
+  unsigned i;
+
+  subsub.str1 = "nested";
+  for (i = 0; i < 2; i++)
+    {
+      subs[i].test = i;
+      subs[i].has_val1 = 1;
+      subs[i].val1 = 10 + i;
+      subs[i].has_val2 = 1;
+      subs[i].val2 = 20 + i;
+      subs[i].sub1 = &subsub;
+    }
+  mess.n_test_int32 = 2;
+  mess.test_int32 = int32s;
+  mess.n_test_fixed32 = 1;
+  mess.test_fixed32 = fixed32s;
+  mess.n_test_string = 1;
+  mess.test_string = strings;
+  mess.n_test_message = 2;
+  mess.test_message = sub_ptrs;
+  len = foo__test_mess__get_packed_size (&mess);
+  packed = malloc (len);
+  foo__test_mess__pack (&mess, packed);
+
+  out = wire_filter_test (PROTOBUF_C_WIRE_FILTER_KEEP, N_ELEMENTS (keep), keep,
+                          len, packed);
+  assert (out->n_test_int32 == 2 && out->test_int32[1] == -2);
+  assert (out->n_test_fixed32 == 0);
+  assert (out->n_test_string == 0);
+  assert (out->n_test_message == 2);
+  for (i = 0; i < 2; i++)
+    {
+      assert (out->test_message[i]->test == (int32_t) i);
+      assert (!out->test_message[i]->has_val1);
+      assert (out->test_message[i]->val2 == 20 + (int32_t) i);
+      assert (out->test_message[i]->sub1 == NULL);
+    }
+  foo__test_mess__free_unpacked (out, NULL);
+
+  out = wire_filter_test (PROTOBUF_C_WIRE_FILTER_DROP, N_ELEMENTS (drop), drop,
+                          len, packed);
+  assert (out->n_test_int32 == 2);
+  assert (out->n_test_fixed32 == 1 && out->test_fixed32[0] == 0xdeadbeef);
+  assert (out->n_test_string == 0);
+  assert (out->n_test_message == 2);
+  for (i = 0; i < 2; i++)
+    {
+      assert (out->test_message[i]->val1 == 10 + (int32_t) i);
+      assert (out->test_message[i]->sub1 == NULL);
+    }
+  foo__test_mess__free_unpacked (out, NULL);
+
+  out = wire_filter_test (PROTOBUF_C_WIRE_FILTER_BLANK, N_ELEMENTS (blank), blank,
+                          len, packed);
+  assert (out->n_test_fixed32 == 1 && out->test_fixed32[0] == 0);
+  assert (out->n_test_string == 1 && out->test_string[0][0] == '\0');
+  for (i = 0; i < 2; i++)
+    {
+      assert (out->test_message[i]->has_val1);
+      assert (out->test_message[i]->val1 == 0);
+      assert (out->test_message[i]->val2 == 20 + (int32_t) i);
+      assert (strcmp (out->test_message[i]->sub1->str1, "nested") == 0);
+    }
+  foo__test_mess__free_unpacked (out, NULL);
+
+  /* keeping nothing */
+  out = wire_filter_test (PROTOBUF_C_WIRE_FILTER_KEEP, 0, NULL, len, packed);
+  assert (out->n_test_int32 == 0 && out->n_test_message == 0);
+  foo__test_mess__free_unpacked (out, NULL);
+
+  /* malformed input */
+  set = protobuf_c_wire_field_set_new (NULL, &foo__test_mess__descriptor,
+                                       PROTOBUF_C_WIRE_FILTER_DROP,
+                                       N_ELEMENTS (drop), drop);
+  assert (!protobuf_c_wire_filter (&foo__test_mess__descriptor, set,
+                                   len - 1, packed, &bs.base));
+  PROTOBUF_C_BUFFER_SIMPLE_CLEAR (&bs);
+  protobuf_c_wire_field_set_free (set);
+
+  for (i = 0; i < N_ELEMENTS (bad_paths); i++)
+    assert (protobuf_c_wire_field_set_new (NULL, &foo__test_mess__descriptor,
+                                           PROTOBUF_C_WIRE_FILTER_KEEP,
+                                           1, bad_paths[i]) == NULL);
+  free (packed);
+}
+
+static void
+test_wire_view (void)
+{
+  Foo__SubMess sub = FOO__SUB_MESS__INIT;
+  Foo__SubMess__SubSubMess subsub = FOO__SUB_MESS__SUB_SUB_MESS__INIT;
+  Foo__TestMessPacked packed_mess = FOO__TEST_MESS_PACKED__INIT;
+  Foo__TestMessOneof oneof_mess = FOO__TEST_MESS_ONEOF__INIT;
+  Foo__TestMess mess = FOO__TEST_MESS__INIT;
+  Foo__SubMess *subs[2] = { &sub, &sub };
+  const char *strings[2] = { "one", "two" };
+  int32_t sub_rep[2] = { 3, -4 };
+  int64_t sint64s[3] = { -1, INT64_MAX, INT64_MIN };
+  double doubles[2] = { 0.5, -2.25 };
+  Foo__SubMessView view;
+  Foo__SubMess__SubSubMessView subview;
+  Foo__TestMessView mess_view;
+  Foo__TestMessPackedView packed_view;
+  Foo__TestMessOneofView oneof_view;
+  ProtobufCWireViewIter iter;
+  ProtobufCBinaryData bd;
+  int32_t i32;
+  int64_t i64;
+  double d;
+  uint8_t oneof_buf[16];
+  uint8_t *packed;
+  size_t len;
+  unsigned n;
+
+  subsub.str1 = "nested";
+  sub.test = 5;
+  sub.has_val2 = 1;
+  sub.val2 = 7;
+  sub.n_rep = 2;
+  sub.rep = sub_rep;
+  sub.sub1 = &subsub;
+  len = foo__sub_mess__get_packed_size (&sub);
+  packed = malloc (len);
+  foo__sub_mess__pack (&sub, packed);
+
+  foo__sub_mess__view_init (&view, len, packed);
+  assert (foo__sub_mess__view_get_test (&view, &i32) && i32 == 5);
+  assert (!foo__sub_mess__view_get_val1 (&view, &i32) && i32 == 0);
+  assert (foo__sub_mess__view_get_val2 (&view, &i32) && i32 == 7);
+  foo__sub_mess__view_iter_rep (&view, &iter);
+  assert (foo__sub_mess__view_next_rep (&iter, &i32) && i32 == 3);
+  assert (foo__sub_mess__view_next_rep (&iter, &i32) && i32 == -4);
+  assert (!foo__sub_mess__view_next_rep (&iter, &i32));
+
+  assert (foo__sub_mess__view_get_sub1 (&view, &subview));
+  assert (foo__sub_mess__sub_sub_mess__view_get_str1 (&subview, &bd));
+  assert (bd.len == 6 && memcmp (bd.data, "nested", 6) == 0);
+  assert (bd.data >= packed && bd.data < packed + len);
+  /* missing fields read as their defaults */
+  assert (!foo__sub_mess__sub_sub_mess__view_get_val1 (&subview, &i32));
+  assert (i32 == 100);
+  assert (!foo__sub_mess__sub_sub_mess__view_get_bytes1 (&subview, &bd));
+  assert (bd.len == 8 && memcmp (bd.data, "a \0 char", 8) == 0);
+  assert (!foo__sub_mess__view_get_sub2 (&view, &subview));
+  assert (!foo__sub_mess__sub_sub_mess__view_get_str1 (&subview, &bd));
+  assert (bd.len == 12 && memcmp (bd.data, "hello world\n", 12) == 0);
+
+  /* malformed data reads as missing fields */
+  foo__sub_mess__view_init (&view, len - 1, packed);
+  assert (!protobuf_c_wire_view_index (&view.base));
+  assert (!foo__sub_mess__view_get_test (&view, &i32) && i32 == 0);
+  free (packed);
+
+  mess.n_test_string = 2;
+  mess.test_string = strings;
+  mess.n_test_message = 2;
+  mess.test_message = subs;
+  len = foo__test_mess__get_packed_size (&mess);
+  packed = malloc (len);
+  foo__test_mess__pack (&mess, packed);
+  foo__test_mess__view_init (&mess_view, len, packed);
+  foo__test_mess__view_iter_test_string (&mess_view, &iter);
+  assert (foo__test_mess__view_next_test_string (&iter, &bd));
+  assert (bd.len == 3 && memcmp (bd.data, "one", 3) == 0);
+  assert (foo__test_mess__view_next_test_string (&iter, &bd));
+  assert (bd.len == 3 && memcmp (bd.data, "two", 3) == 0);
+  assert (!foo__test_mess__view_next_test_string (&iter, &bd));
+  foo__test_mess__view_iter_test_message (&mess_view, &iter);
+  for (n = 0; foo__test_mess__view_next_test_message (&iter, &view); n++)
+    assert (foo__sub_mess__view_get_val2 (&view, &i32) && i32 == 7);
+  assert (n == 2);
+  foo__test_mess__view_iter_test_int32 (&mess_view, &iter);
+  assert (!foo__test_mess__view_next_test_int32 (&iter, &i32));
+  free (packed);
+
+  packed_mess.n_test_sint64 = 3;
+  packed_mess.test_sint64 = sint64s;
+  packed_mess.n_test_double = 2;
+  packed_mess.test_double = doubles;
+  len = foo__test_mess_packed__get_packed_size (&packed_mess);
+  packed = malloc (len);
+  foo__test_mess_packed__pack (&packed_mess, packed);
+  foo__test_mess_packed__view_init (&packed_view, len, packed);
+  foo__test_mess_packed__view_iter_test_sint64 (&packed_view, &iter);
+  for (n = 0; foo__test_mess_packed__view_next_test_sint64 (&iter, &i64); n++)
+    assert (i64 == sint64s[n]);
+  assert (n == 3);
+  foo__test_mess_packed__view_iter_test_double (&packed_view, &iter);
+  for (n = 0; foo__test_mess_packed__view_next_test_double (&iter, &d); n++)
+    assert (d == doubles[n]);
+  assert (n == 2);
+  free (packed);
+
+  /* the last member of a oneof to occur wins */
+  oneof_mess.test_oneof_case = FOO__TEST_MESS_ONEOF__TEST_ONEOF_TEST_INT32;
+  oneof_mess.test_int32 = 3;
+  len = foo__test_mess_oneof__pack (&oneof_mess, oneof_buf);
+  oneof_mess.test_oneof_case = FOO__TEST_MESS_ONEOF__TEST_ONEOF_TEST_STRING;
+  oneof_mess.test_string = "s";
+  len += foo__test_mess_oneof__pack (&oneof_mess, oneof_buf + len);
+  foo__test_mess_oneof__view_init (&oneof_view, len, oneof_buf);
+  assert (!foo__test_mess_oneof__view_get_test_int32 (&oneof_view, &i32));
+  assert (foo__test_mess_oneof__view_get_test_string (&oneof_view, &bd));
+  assert (bd.len == 1 && bd.data[0] == 's');
+}
+
+static void
+test_wire_extract (void)
+{
+  Foo__SubMess sub = FOO__SUB_MESS__INIT;
+  Foo__SubMess__SubSubMess subsub = FOO__SUB_MESS__SUB_SUB_MESS__INIT;
+  static const char *const key_paths[] = { "sub1.str1", "test", "val1", "sub2.val1" };
+  static const char *const bad_paths[][2] = {
+    { "rep", NULL }, { "sub1", NULL }, { "test", "test" }, { "sub1.nope", NULL }
+  };
+  static const char *const through_repeated[] = { "test_message.test" };
+  ProtobufCWireKeyPath *path;
+  ProtobufCWireKey keys[3 * N_ELEMENTS (key_paths)];
+  const uint8_t *datas[3];
+  size_t lens[3];
+  uint8_t *packed;
+  size_t len;
+  unsigned i;
+
+  subsub.str1 = "shard";
+  sub.test = 42;
+  sub.sub1 = &subsub;
+  len = foo__sub_mess__get_packed_size (&sub);
+  packed = malloc (len);
+  foo__sub_mess__pack (&sub, packed);
+
+  path = protobuf_c_wire_key_path_new (NULL, &foo__sub_mess__descriptor,
+                                       N_ELEMENTS (key_paths), key_paths);
+  assert (path != NULL);
+  assert (protobuf_c_wire_extract (path, len, packed, keys));
+  assert (keys[0].present && keys[0].value.v_binary.len == 5);
+  assert (memcmp (keys[0].value.v_binary.data, "shard", 5) == 0);
+  assert (keys[0].field == protobuf_c_message_descriptor_get_field_by_name
+                             (&foo__sub_mess__sub_sub_mess__descriptor, "str1"));
+  assert (keys[1].present && keys[1].value.v_int32 == 42);
+  assert (!keys[2].present && keys[2].value.v_int32 == 0);
+  assert (!keys[3].present && keys[3].value.v_int32 == 100);
+
+  /* the middle record is truncated */
+  for (i = 0; i < 3; i++)
+    {
+      datas[i] = packed;
+      lens[i] = i == 1 ? len - 1 : len;
+    }
+  assert (protobuf_c_wire_extract_batch (path, 3, lens, datas, keys) == 2);
+  for (i = 0; i < 3; i++)
+    {
+      ProtobufCWireKey *k = keys + i * N_ELEMENTS (key_paths);
+      assert (k[1].present == (i != 1));
+      assert (k[1].value.v_int32 == (i != 1 ? 42 : 0));
+      assert (k[0].present == (i != 1));
+    }
+  protobuf_c_wire_key_path_free (path);
+  free (packed);
+
+  for (i = 0; i < N_ELEMENTS (bad_paths); i++)
+    assert (protobuf_c_wire_key_path_new (NULL, &foo__sub_mess__descriptor,
+                                          bad_paths[i][1] ? 2 : 1,
+                                          bad_paths[i]) == NULL);
+  assert (protobuf_c_wire_key_path_new (NULL, &foo__test_mess__descriptor, 1,
+                                        through_repeated) == NULL);
+}
+
+static Foo__TestMessOptional *
+unpack_optional (size_t len, const uint8_t *data)
+{
+  return (Foo__TestMessOptional *)
+    protobuf_c_message_unpack (&foo__test_mess_optional__descriptor,
+                               NULL, len, data);
+}
+
+static void
+test_wire_patch (void)
+{
+  Foo__TestMessOptional mess = FOO__TEST_MESS_OPTIONAL__INIT;
+  Foo__SubMess sub = FOO__SUB_MESS__INIT;
+  static const char *const key_paths[] = {
+    "test_double", "test_int32", "test_fixed32", "test_message.val1",
+    "test_string", "test_message.sub1.str1"
+  };
+  ProtobufCWireKeyPath *path;
+  ProtobufCWireKey value;
+  uint8_t scratch[16];
+  ProtobufCBufferSimple bs = PROTOBUF_C_BUFFER_SIMPLE_INIT (scratch);
+  Foo__TestMessOptional *out;
+  uint8_t long_str[140];
+  uint8_t *packed;
+  uint8_t *copy;
+  uint8_t *nested;
+  size_t nested_len;
+  size_t len;
+
+  mess.has_test_double = 1;
+  mess.test_double = 1.5;
+  mess.has_test_int32 = 1;
+  mess.test_int32 = 5;
+  mess.test_string = "short";
+  sub.test = 9;
+  sub.has_val1 = 1;
+  sub.val1 = 1;
+  mess.test_message = &sub;
+  len = protobuf_c_message_get_packed_size (&mess.base);
+  packed = malloc (len);
+  protobuf_c_message_pack (&mess.base, packed);
+  copy = malloc (len);
+  memcpy (copy, packed, len);
+
+  path = protobuf_c_wire_key_path_new (NULL,
+                                       &foo__test_mess_optional__descriptor,
+                                       N_ELEMENTS (key_paths), key_paths);
+  assert (path != NULL);
+
+  /* in place: fixed-width fields always fit, varints only at the same size */
+  value.value.v_double = 2.5;
+  assert (protobuf_c_wire_patch_in_place (path, 0, len, packed, &value.value));
+  value.value.v_int32 = 7;
+  assert (protobuf_c_wire_patch_in_place (path, 1, len, packed, &value.value));
+  value.value.v_int32 = 300;
+  assert (!protobuf_c_wire_patch_in_place (path, 1, len, packed, &value.value));
+  value.value.v_uint32 = 0xdeadbeef;
+  assert (!protobuf_c_wire_patch_in_place (path, 2, len, packed, &value.value));
+  out = unpack_optional (len, packed);
+  assert (out != NULL);
+  assert (out->test_double == 2.5);
+  assert (out->test_int32 == 7);
+  assert (!out->has_test_fixed32);
+  assert (strcmp (out->test_string, "short") == 0);
+  assert (out->test_message->test == 9 && out->test_message->val1 == 1);
+  protobuf_c_message_free_unpacked (&out->base, NULL);
+  memcpy (copy, packed, len);
+
+  /* growing a nested varint rewrites the enclosing length prefix */
+  value.value.v_int32 = 100000;
+  assert (protobuf_c_wire_patch (path, 3, len, packed, &value.value, &bs.base));
+  assert (memcmp (packed, copy, len) == 0);
+  out = unpack_optional (bs.len, bs.data);
+  assert (out != NULL);
+  assert (out->test_message->test == 9);
+  assert (out->test_message->val1 == 100000);
+  assert (out->test_double == 2.5 && out->test_int32 == 7);
+  assert (strcmp (out->test_string, "short") == 0);
+  protobuf_c_message_free_unpacked (&out->base, NULL);
+  bs.len = 0;
+
+  value.value.v_binary.data = (uint8_t *) "a much longer string";
+  value.value.v_binary.len = 20;
+  assert (protobuf_c_wire_patch (path, 4, len, packed, &value.value, &bs.base));
+  out = unpack_optional (bs.len, bs.data);
+  assert (out != NULL);
+  assert (strcmp (out->test_string, "a much longer string") == 0);
+  assert (out->test_message->val1 == 1);
+  protobuf_c_message_free_unpacked (&out->base, NULL);
+  bs.len = 0;
+
+  /* missing fields are appended, with the submessages on their path */
+  value.value.v_uint32 = 0xdeadbeef;
+  assert (protobuf_c_wire_patch (path, 2, len, packed, &value.value, &bs.base));
+  out = unpack_optional (bs.len, bs.data);
+  assert (out != NULL);
+  assert (out->has_test_fixed32 && out->test_fixed32 == 0xdeadbeef);
+  protobuf_c_message_free_unpacked (&out->base, NULL);
+  bs.len = 0;
+
+  value.value.v_binary.data = (uint8_t *) "nested";
+  value.value.v_binary.len = 6;
+  assert (protobuf_c_wire_patch (path, 5, len, packed, &value.value, &bs.base));
+  out = unpack_optional (bs.len, bs.data);
+  assert (out != NULL);
+  assert (out->test_message->test == 9 && out->test_message->val1 == 1);
+  assert (strcmp (out->test_message->sub1->str1, "nested") == 0);
+  protobuf_c_message_free_unpacked (&out->base, NULL);
+  bs.len = 0;
+
+  /* the length prefixes of both submessages grow from one byte to two */
+  memset (long_str, 'x', sizeof (long_str));
+  value.value.v_binary.data = long_str;
+  value.value.v_binary.len = 110;
+  assert (protobuf_c_wire_patch (path, 5, len, packed, &value.value, &bs.base));
+  nested_len = bs.len;
+  nested = malloc (nested_len);
+  memcpy (nested, bs.data, nested_len);
+  bs.len = 0;
+  value.value.v_binary.len = 140;
+  assert (protobuf_c_wire_patch (path, 5, nested_len, nested, &value.value,
+                                 &bs.base));
+  assert (bs.len == nested_len + 33);
+  out = unpack_optional (bs.len, bs.data);
+  assert (out != NULL);
+  assert (out->test_message->test == 9 && out->test_message->val1 == 1);
+  assert (strlen (out->test_message->sub1->str1) == 140);
+  assert (out->test_double == 2.5);
+  protobuf_c_message_free_unpacked (&out->base, NULL);
+  free (nested);
+  bs.len = 0;
+
+  /* malformed input is rejected and left alone */
+  assert (!protobuf_c_wire_patch_in_place (path, 0, len - 1, packed,
+                                           &value.value));
+  assert (!protobuf_c_wire_patch (path, 0, len - 1, packed, &value.value,
+                                  &bs.base));
+  assert (bs.len == 0);
+  assert (memcmp (packed, copy, len) == 0);
+
+  PROTOBUF_C_BUFFER_SIMPLE_CLEAR (&bs);
+  protobuf_c_wire_key_path_free (path);
+  free (copy);
+  free (packed);
+}
+
 static void
 test_message_free_null (void)
 {
   foo__sub_mess__free_unpacked (NULL, NULL);
 }
 
+/* --- service dispatch --- */
+
+typedef struct
+{
+  int called;
+  int failed;
+  int32_t value;
+} ServiceResult;
+
+static void
+sub_mess_closure (const Foo__SubMess *output, void *closure_data)
+{
+  ServiceResult *result = closure_data;
+  result->called++;
+  if (output == NULL)
+    result->failed = 1;
+  else
+    result->value = output->test;
+}
+
+static void
+test_service_echo (Foo__TestService_Service *service,
+                   const Foo__SubMess *input,
+                   Foo__SubMess_Closure closure,
+                   void *closure_data)
+{
+  Foo__SubMess output = FOO__SUB_MESS__INIT;
+  (void) service;
+  output.test = input->test + 1;
+  closure (&output, closure_data);
+}
+
+static void
+test_service_count_messages (Foo__TestService_Service *service,
+                             const Foo__TestMess *input,
+                             Foo__SubMess_Closure closure,
+                             void *closure_data)
+{
+  Foo__SubMess output = FOO__SUB_MESS__INIT;
+  size_t i;
+  (void) service;
+  for (i = 0; i < input->n_test_message; i++)
+    assert (input->test_message[i]->test == (int32_t) i);
+  output.test = (int32_t) input->n_test_message;
+  closure (&output, closure_data);
+}
+
+/* an invoke function of its own, as an RPC client has */
+static void
+test_service_forward (ProtobufCService *service,
+                      unsigned method_index,
+                      const ProtobufCMessage *input,
+                      ProtobufCClosure closure,
+                      void *closure_data)
+{
+  Foo__SubMess output = FOO__SUB_MESS__INIT;
+  (void) service;
+  assert (method_index == 0);
+  output.test = ((const Foo__SubMess *) input)->test * 2;
+  closure (&output.base, closure_data);
+}
+
+static void
+test_service_dispatch (void)
+{
+  const ProtobufCServiceDescriptor *desc = &foo__test_service__descriptor;
+  Foo__TestService_Service service;
+  ProtobufCService forward = {
+    &foo__test_service__descriptor, test_service_forward, NULL
+  };
+  Foo__SubMess sub = FOO__SUB_MESS__INIT;
+  Foo__SubMess *subs[300];
+  Foo__SubMess sub_array[300];
+  Foo__TestMess mess = FOO__TEST_MESS__INIT;
+  ServiceResult result;
+  uint8_t *packed;
+  size_t len;
+  unsigned i;
+
+  /* hashed name lookup agrees with the descriptor */
+  for (i = 0; i < desc->n_methods; i++)
+    {
+      assert (foo__test_service__method_index (desc->methods[i].name) == (int) i);
+      assert (protobuf_c_service_descriptor_get_method_by_name (desc, desc->methods[i].name)
+              == desc->methods + i);
+    }
+  assert (foo__test_service__method_index ("") == -1);
+  assert (foo__test_service__method_index ("Ech") == -1);
+  assert (foo__test_service__method_index ("EchoBytesX") == -1);
+
+  foo__test_service__init (&service, NULL);
+  service.echo = test_service_echo;
+  service.count_messages = test_service_count_messages;
+
+  /* generated callers go through the switch */
+  memset (&result, 0, sizeof (result));
+  sub.test = 41;
+  foo__test_service__echo (&service.base, &sub, sub_mess_closure, &result);
+  assert (result.called == 1 && !result.failed && result.value == 42);
+
+  /* a method left NULL fails the call, with either invoke function */
+  memset (&result, 0, sizeof (result));
+  foo__test_service__unimplemented (&service.base, &sub, sub_mess_closure, &result);
+  assert (result.called == 1 && result.failed);
+  service.base.invoke = protobuf_c_service_invoke_internal;
+  memset (&result, 0, sizeof (result));
+  foo__test_service__unimplemented (&service.base, &sub, sub_mess_closure, &result);
+  assert (result.called == 1 && result.failed);
+  memset (&result, 0, sizeof (result));
+  service.base.invoke (&service.base, desc->n_methods, &sub.base,
+                       (ProtobufCClosure) sub_mess_closure, &result);
+  assert (result.called == 1 && result.failed);
+  service.base.invoke = foo__test_service__invoke;
+
+  /* unpack-then-invoke, with a request small enough for the stack arena */
+  len = foo__sub_mess__get_packed_size (&sub);
+  packed = malloc (len);
+  foo__sub_mess__pack (&sub, packed);
+  memset (&result, 0, sizeof (result));
+  assert (foo__test_service__invoke_packed (&service.base, 0, len, packed,
+                                            (ProtobufCClosure) sub_mess_closure,
+                                            &result));
+  assert (result.called == 1 && result.value == 42);
+
+  /* a service with its own invoke function is dispatched through it */
+  memset (&result, 0, sizeof (result));
+  assert (foo__test_service__invoke_packed (&forward, 0, len, packed,
+                                            (ProtobufCClosure) sub_mess_closure,
+                                            &result));
+  assert (result.called == 1 && result.value == 82);
+  free (packed);
+
+  /* and one that is not */
+  for (i = 0; i < 300; i++)
+    {
+      foo__sub_mess__init (&sub_array[i]);
+      sub_array[i].test = (int32_t) i;
+      subs[i] = &sub_array[i];
+    }
+  mess.n_test_message = 300;
+  mess.test_message = subs;
+  len = foo__test_mess__get_packed_size (&mess);
+  packed = malloc (len);
+  foo__test_mess__pack (&mess, packed);
+  memset (&result, 0, sizeof (result));
+  assert (foo__test_service__invoke_packed (&service.base, 2, len, packed,
+                                            (ProtobufCClosure) sub_mess_closure,
+                                            &result));
+  assert (result.called == 1 && result.value == 300);
+
+  /* bad requests and method indices are not invoked */
+  memset (&result, 0, sizeof (result));
+  assert (!foo__test_service__invoke_packed (&service.base, 0, len - 1, packed,
+                                             (ProtobufCClosure) sub_mess_closure,
+                                             &result));
+  assert (!foo__test_service__invoke_packed (&service.base, desc->n_methods,
+                                             len, packed,
+                                             (ProtobufCClosure) sub_mess_closure,
+                                             &result));
+  assert (result.called == 0);
+  free (packed);
+}
+
+static void
+test_arena (void)
+{
+  uint64_t scratch[8];
+  ProtobufCArena arena;
+  void *a, *b, *c;
+
+  protobuf_c_arena_init (&arena, (uint8_t *) scratch + 1, sizeof (scratch) - 1);
+  a = arena.base.alloc (arena.base.allocator_data, 3);
+  b = arena.base.alloc (arena.base.allocator_data, 8);
+  assert (a != NULL && b != NULL);
+  assert ((uintptr_t) a % 8 == 0 && (uintptr_t) b % 8 == 0);
+  assert ((uint8_t *) a >= (uint8_t *) scratch + 1);
+  assert ((uint8_t *) b + 8 <= (uint8_t *) (scratch + 8));
+
+  /* the rest comes from malloc */
+  c = arena.base.alloc (arena.base.allocator_data, 1000);
+  assert (c != NULL && (uintptr_t) c % 8 == 0);
+  memset (c, 0xff, 1000);
+  arena.base.free (arena.base.allocator_data, c);
+  protobuf_c_arena_clear (&arena);
+  assert (arena.base.alloc (arena.base.allocator_data, 3) == a);
+  protobuf_c_arena_clear (&arena);
+
+  protobuf_c_arena_init (&arena, NULL, 0);
+  a = arena.base.alloc (arena.base.allocator_data, 16);
+  assert (a != NULL);
+  protobuf_c_arena_clear (&arena);
+}
+
 /* === simple testing framework === */
 
 typedef void (*TestFunc) (void);
@@ -2343,10 +4052,18 @@ static Test tests[] =
   { "test packed repeated boolean", test_packed_repeated_boolean },
   { "test packed repeated TestEnumSmall", test_packed_repeated_TestEnumSmall },
   { "test packed repeated TestEnum", test_packed_repeated_TestEnum },
+  { "test packed repeated large arrays", test_packed_repeated_large },
 
   { "test unknown fields", test_unknown_fields },
 
   { "test enum lookups", test_enum_lookups },
+  { "test enum is_valid", test_enum_is_valid },
+  { "test enum check on unpack", test_enum_check },
+  { "test map index", test_map_index },
+  { "test extensions", test_extensions },
+  { "test deterministic pack", test_deterministic_pack },
+  { "test repeated layouts", test_repeated_layout },
+  { "test runtime statistics", test_stats },
   { "test message lookups", test_message_lookups },
 
   { "test required default values", test_required_default_values },
@@ -2355,6 +4072,9 @@ static Test tests[] =
   { "test optional lowercase enum default value", test_optional_lowercase_enum_default_value },
 
   { "test field merge", test_field_merge },
+  { "test field merge of many occurrences", test_field_merge_many },
+  { "test max depth", test_max_depth },
+  { "test unpack options", test_unpack_options },
   { "test submessage merge", test_submessage_merge },
 
   { "test free unpacked", test_alloc_free_all },
@@ -2370,6 +4090,15 @@ static Test tests[] =
   { "test message_check()", test_message_check },
 
   { "test freeing NULL", test_message_free_null },
+
+  { "test dynamic descriptors", test_dynamic_descriptors },
+  { "test wire filter", test_wire_filter },
+  { "test wire views", test_wire_view },
+  { "test wire key extraction", test_wire_extract },
+  { "test wire patching", test_wire_patch },
+
+  { "test service dispatch", test_service_dispatch },
+  { "test arena allocator", test_arena },
 };
 #define n_tests (sizeof(tests)/sizeof(Test))
 
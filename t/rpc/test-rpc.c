@@ -0,0 +1,458 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "protobuf-c/protobuf-c-rpc.h"
+#include "t/test.pb-c.h"
+
+#define SOCKET_PATH "test-rpc.sock"
+#define N_CALLS     1000
+#define MAX_LATER   16
+#define MAX_UNREAD  (64 * 1024 * 1024)
+
+typedef struct
+{
+  void (*func) (void);
+  const char *name;
+} Test;
+
+/* --- server side --- */
+
+/* calls to "later" are completed by the test, in reverse order */
+static struct
+{
+  Foo__LookupResult_Closure closure;
+  void *closure_data;
+} later[MAX_LATER];
+static unsigned n_later;
+
+static void
+reply (const char *name, Foo__LookupResult_Closure closure, void *closure_data)
+{
+  Foo__LookupResult result = FOO__LOOKUP_RESULT__INIT;
+  Foo__Person person = FOO__PERSON__INIT;
+
+  person.name = (char *) name;
+  person.id = (int32_t) strlen (name);
+  result.person = &person;
+  closure (&result, closure_data);
+}
+
+static void
+by_name (Foo__DirLookup_Service *service,
+         const Foo__Name *input,
+         Foo__LookupResult_Closure closure,
+         void *closure_data)
+{
+  (void) service;
+  if (input->name == NULL)
+    closure (NULL, closure_data);
+  else if (strcmp (input->name, "later") == 0)
+    {
+      assert (n_later < MAX_LATER);
+      later[n_later].closure = closure;
+      later[n_later].closure_data = closure_data;
+      n_later++;
+    }
+  else
+    reply (input->name, closure, closure_data);
+}
+
+static void
+complete_later (void)
+{
+  while (n_later > 0)
+    {
+      n_later--;
+      reply ("later", later[n_later].closure, later[n_later].closure_data);
+    }
+}
+
+static Foo__DirLookup_Service the_service = FOO__DIR_LOOKUP__INIT ();
+
+/* --- client side --- */
+
+typedef struct
+{
+  int done;
+  int failed;
+  int32_t id;
+  char name[32];
+} Result;
+
+static void
+handle_result (const Foo__LookupResult *result, void *closure_data)
+{
+  Result *r = closure_data;
+
+  assert (!r->done);
+  r->done = 1;
+  if (result == NULL)
+    {
+      r->failed = 1;
+      return;
+    }
+  assert (result->person != NULL);
+  r->id = result->person->id;
+  snprintf (r->name, sizeof (r->name), "%s", result->person->name);
+}
+
+static void
+call (ProtobufCService *client, const char *name, Result *r)
+{
+  Foo__Name input = FOO__NAME__INIT;
+
+  memset (r, 0, sizeof (*r));
+  input.name = (char *) name;
+  foo__dir_lookup__by_name (client, &input, handle_result, r);
+}
+
+static void
+run_until_done (ProtobufCRpcDispatch *dispatch, ProtobufCService *client)
+{
+  while (protobuf_c_rpc_client_n_pending (client) > 0)
+    assert (protobuf_c_rpc_dispatch_run (dispatch, 1000) > 0);
+}
+
+static void
+check_pipelined_calls (ProtobufCRpcDispatch *dispatch,
+                       ProtobufCService *client)
+{
+  static Result results[N_CALLS];
+  char name[32];
+  unsigned i;
+
+  /* everything is queued before the first byte goes out */
+  for (i = 0; i < N_CALLS; i++)
+    {
+      snprintf (name, sizeof (name), "name-%u", i);
+      call (client, name, &results[i]);
+    }
+  assert (protobuf_c_rpc_client_n_pending (client) == N_CALLS);
+  run_until_done (dispatch, client);
+  for (i = 0; i < N_CALLS; i++)
+    {
+      snprintf (name, sizeof (name), "name-%u", i);
+      assert (results[i].done && !results[i].failed);
+      assert (strcmp (results[i].name, name) == 0);
+      assert (results[i].id == (int32_t) strlen (name));
+    }
+}
+
+static void
+test_local_pipelined (void)
+{
+  ProtobufCRpcDispatch *dispatch = protobuf_c_rpc_dispatch_new ();
+  ProtobufCRpcServer *server;
+  ProtobufCService *client;
+
+  assert (dispatch != NULL);
+  server = protobuf_c_rpc_server_new (PROTOBUF_C_RPC_ADDRESS_LOCAL,
+                                      SOCKET_PATH, &the_service.base,
+                                      dispatch);
+  assert (server != NULL);
+  client = protobuf_c_rpc_client_new (PROTOBUF_C_RPC_ADDRESS_LOCAL,
+                                      SOCKET_PATH, &foo__dir_lookup__descriptor,
+                                      dispatch);
+  assert (client != NULL);
+  check_pipelined_calls (dispatch, client);
+
+  protobuf_c_service_destroy (client);
+  protobuf_c_rpc_server_destroy (server);
+  protobuf_c_rpc_dispatch_free (dispatch);
+}
+
+static void
+test_tcp (void)
+{
+  ProtobufCRpcDispatch *dispatch = protobuf_c_rpc_dispatch_new ();
+  ProtobufCRpcServer *server = NULL;
+  ProtobufCService *client;
+  char address[32];
+  unsigned port;
+
+  assert (dispatch != NULL);
+  for (port = 41000; server == NULL && port < 41100; port++)
+    {
+      snprintf (address, sizeof (address), "127.0.0.1:%u", port);
+      server = protobuf_c_rpc_server_new (PROTOBUF_C_RPC_ADDRESS_TCP, address,
+                                          &the_service.base, dispatch);
+    }
+  assert (server != NULL);
+  client = protobuf_c_rpc_client_new (PROTOBUF_C_RPC_ADDRESS_TCP, address,
+                                      &foo__dir_lookup__descriptor, dispatch);
+  assert (client != NULL);
+  check_pipelined_calls (dispatch, client);
+
+  protobuf_c_service_destroy (client);
+  protobuf_c_rpc_server_destroy (server);
+  protobuf_c_rpc_dispatch_free (dispatch);
+}
+
+static void
+test_out_of_order_and_failures (void)
+{
+  ProtobufCRpcDispatch *dispatch = protobuf_c_rpc_dispatch_new ();
+  ProtobufCRpcServer *server;
+  ProtobufCService *client;
+  Result results[6];
+  unsigned i;
+
+  assert (dispatch != NULL);
+  server = protobuf_c_rpc_server_new (PROTOBUF_C_RPC_ADDRESS_LOCAL,
+                                      SOCKET_PATH, &the_service.base,
+                                      dispatch);
+  assert (server != NULL);
+  client = protobuf_c_rpc_client_new (PROTOBUF_C_RPC_ADDRESS_LOCAL,
+                                      SOCKET_PATH, &foo__dir_lookup__descriptor,
+                                      dispatch);
+  assert (client != NULL);
+
+  /* completed after the calls behind them, and a failing handler */
+  call (client, "later", &results[0]);
+  call (client, "later", &results[1]);
+  call (client, "now", &results[2]);
+  call (client, NULL, &results[3]);
+  while (!results[2].done || !results[3].done || n_later < 2)
+    assert (protobuf_c_rpc_dispatch_run (dispatch, 1000) > 0);
+  assert (!results[0].done && !results[1].done);
+  assert (strcmp (results[2].name, "now") == 0);
+  assert (results[3].failed);
+  complete_later ();
+  run_until_done (dispatch, client);
+  for (i = 0; i < 2; i++)
+    assert (results[i].done && !results[i].failed &&
+            strcmp (results[i].name, "later") == 0);
+
+  /* a server going away fails what is outstanding */
+  call (client, "later", &results[4]);
+  while (n_later < 1)
+    assert (protobuf_c_rpc_dispatch_run (dispatch, 1000) > 0);
+  protobuf_c_rpc_server_destroy (server);
+  run_until_done (dispatch, client);
+  assert (results[4].done && results[4].failed);
+  complete_later ();
+
+  /* and so does a dead connection */
+  call (client, "now", &results[5]);
+  assert (results[5].done && results[5].failed);
+
+  protobuf_c_service_destroy (client);
+  protobuf_c_rpc_dispatch_free (dispatch);
+}
+
+static void
+test_destroy_client_with_pending_calls (void)
+{
+  ProtobufCRpcDispatch *dispatch = protobuf_c_rpc_dispatch_new ();
+  ProtobufCRpcServer *server;
+  ProtobufCService *client;
+  Result results[2];
+
+  assert (dispatch != NULL);
+  server = protobuf_c_rpc_server_new (PROTOBUF_C_RPC_ADDRESS_LOCAL,
+                                      SOCKET_PATH, &the_service.base,
+                                      dispatch);
+  client = protobuf_c_rpc_client_new (PROTOBUF_C_RPC_ADDRESS_LOCAL,
+                                      SOCKET_PATH, &foo__dir_lookup__descriptor,
+                                      dispatch);
+  assert (server != NULL && client != NULL);
+  call (client, "later", &results[0]);
+  call (client, "now", &results[1]);
+  while (n_later < 1)
+    assert (protobuf_c_rpc_dispatch_run (dispatch, 1000) > 0);
+  protobuf_c_service_destroy (client);
+  assert (results[0].done && results[0].failed);
+  assert (results[1].done);
+
+  /* the server notices the disconnect; the late reply goes nowhere */
+  protobuf_c_rpc_dispatch_run (dispatch, 100);
+  complete_later ();
+  protobuf_c_rpc_server_destroy (server);
+  protobuf_c_rpc_dispatch_free (dispatch);
+}
+
+static void
+test_socket_path_checks (void)
+{
+  ProtobufCRpcDispatch *dispatch = protobuf_c_rpc_dispatch_new ();
+  ProtobufCRpcServer *server;
+  ProtobufCService *client;
+  struct sockaddr_un addr;
+  struct stat st;
+  FILE *fp;
+  int fd;
+
+  assert (dispatch != NULL);
+
+  /* a file that is not a socket is never removed */
+  fp = fopen (SOCKET_PATH, "w");
+  assert (fp != NULL);
+  fputs ("precious", fp);
+  fclose (fp);
+  assert (protobuf_c_rpc_server_new (PROTOBUF_C_RPC_ADDRESS_LOCAL,
+                                     SOCKET_PATH, &the_service.base,
+                                     dispatch) == NULL);
+  assert (stat (SOCKET_PATH, &st) == 0 && S_ISREG (st.st_mode));
+  assert (st.st_size == 8);
+  unlink (SOCKET_PATH);
+
+  /* a stale socket is */
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  assert (fd >= 0);
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, SOCKET_PATH);
+  assert (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) == 0);
+  close (fd);
+  server = protobuf_c_rpc_server_new (PROTOBUF_C_RPC_ADDRESS_LOCAL,
+                                      SOCKET_PATH, &the_service.base,
+                                      dispatch);
+  assert (server != NULL);
+  client = protobuf_c_rpc_client_new (PROTOBUF_C_RPC_ADDRESS_LOCAL,
+                                      SOCKET_PATH, &foo__dir_lookup__descriptor,
+                                      dispatch);
+  assert (client != NULL);
+  check_pipelined_calls (dispatch, client);
+  protobuf_c_service_destroy (client);
+  protobuf_c_rpc_server_destroy (server);
+
+  assert (protobuf_c_rpc_client_new (PROTOBUF_C_RPC_ADDRESS_LOCAL,
+                                     SOCKET_PATH, &foo__dir_lookup__descriptor,
+                                     dispatch) == NULL);
+  protobuf_c_rpc_dispatch_free (dispatch);
+}
+
+static void
+write_uint32_le (uint8_t *out, uint32_t value)
+{
+  out[0] = (uint8_t) value;
+  out[1] = (uint8_t) (value >> 8);
+  out[2] = (uint8_t) (value >> 16);
+  out[3] = (uint8_t) (value >> 24);
+}
+
+static void
+test_client_that_never_reads (void)
+{
+  ProtobufCRpcDispatch *dispatch = protobuf_c_rpc_dispatch_new ();
+  ProtobufCRpcServer *server;
+  Foo__Name input = FOO__NAME__INIT;
+  Foo__LookupResult result = FOO__LOOKUP_RESULT__INIT;
+  Foo__Person person = FOO__PERSON__INIT;
+  struct sockaddr_un addr;
+  static char name[4000];
+  uint8_t *frame, *reply;
+  size_t frame_len, reply_len;
+  size_t sent = 0, got = 0;
+  size_t n_requests, n_replies = 0;
+  unsigned n_stalls = 0;
+  ssize_t n;
+  int fd;
+
+  assert (dispatch != NULL);
+  server = protobuf_c_rpc_server_new (PROTOBUF_C_RPC_ADDRESS_LOCAL,
+                                      SOCKET_PATH, &the_service.base,
+                                      dispatch);
+  assert (server != NULL);
+
+  /* large requests for by_name, whose replies are as large */
+  memset (name, 'x', sizeof (name) - 1);
+  input.name = name;
+  frame_len = 12 + foo__name__get_packed_size (&input);
+  frame = malloc (frame_len);
+  assert (frame != NULL);
+  write_uint32_le (frame, 0);
+  write_uint32_le (frame + 4, 7);
+  write_uint32_le (frame + 8, (uint32_t) (frame_len - 12));
+  foo__name__pack (&input, frame + 12);
+  person.name = name;
+  person.id = (int32_t) strlen (name);
+  result.person = &person;
+  reply_len = 12 + foo__lookup_result__get_packed_size (&result);
+  reply = malloc (reply_len);
+  assert (reply != NULL);
+
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  assert (fd >= 0);
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, SOCKET_PATH);
+  assert (connect (fd, (struct sockaddr *) &addr, sizeof (addr)) == 0);
+
+  /* the server stops taking requests once its replies back up */
+  while (n_stalls < 10 && sent < MAX_UNREAD)
+    {
+      n = send (fd, frame + sent % frame_len, frame_len - sent % frame_len,
+                MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n > 0)
+        {
+          sent += n;
+          n_stalls = 0;
+          continue;
+        }
+      assert (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+      if (protobuf_c_rpc_dispatch_run (dispatch, 10) == 0)
+        n_stalls++;
+      else
+        n_stalls = 0;
+    }
+  assert (sent < MAX_UNREAD);
+
+  /* and answers every complete one once the client catches up */
+  n_requests = sent / frame_len;
+  while (n_replies < n_requests)
+    {
+      n = recv (fd, reply + got, reply_len - got, MSG_DONTWAIT);
+      if (n > 0)
+        {
+          got += n;
+          if (got == reply_len)
+            {
+              assert (reply[0] == PROTOBUF_C_RPC_STATUS_SUCCESS);
+              assert (reply[4] == 7);
+              n_replies++;
+              got = 0;
+            }
+          continue;
+        }
+      assert (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+      assert (protobuf_c_rpc_dispatch_run (dispatch, 1000) > 0);
+    }
+
+  close (fd);
+  protobuf_c_rpc_dispatch_run (dispatch, 100);
+  protobuf_c_rpc_server_destroy (server);
+  protobuf_c_rpc_dispatch_free (dispatch);
+  free (reply);
+  free (frame);
+}
+
+static Test tests[] = {
+  { test_local_pipelined, "test pipelined calls over a local socket" },
+  { test_tcp, "test pipelined calls over TCP" },
+  { test_out_of_order_and_failures, "test out-of-order replies and failures" },
+  { test_destroy_client_with_pending_calls, "test destroying a busy client" },
+  { test_socket_path_checks, "test socket path checks" },
+  { test_client_that_never_reads, "test a client that never reads" },
+};
+#define n_tests (sizeof(tests)/sizeof(Test))
+
+int main(void)
+{
+  unsigned i;
+
+  for (i = 0; i < n_tests; i++)
+    {
+      fprintf (stderr, "Test: %s... ", tests[i].name);
+      tests[i].func ();
+      fprintf (stderr, " done.\n");
+    }
+  return 0;
+}
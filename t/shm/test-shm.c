@@ -0,0 +1,208 @@
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "protobuf-c/protobuf-c-shm.h"
+#include "t/test-full.pb-c.h"
+
+#define N_MESSAGES   20000
+#define N_PRODUCERS  4
+#define MAX_REP      40
+
+typedef struct
+{
+  void (*func) (void);
+  const char *name;
+} Test;
+
+/* message "seq" from producer "producer", of a size that varies with seq */
+static protobuf_c_boolean
+send_message (ProtobufCShmRing *ring, int producer, int seq)
+{
+  Foo__SubMess sub = FOO__SUB_MESS__INIT;
+  int32_t rep[MAX_REP];
+  int i;
+
+  sub.test = producer;
+  sub.has_val1 = 1;
+  sub.val1 = seq;
+  sub.n_rep = seq % MAX_REP;
+  sub.rep = rep;
+  for (i = 0; i < (int) sub.n_rep; i++)
+    rep[i] = seq * i;
+  return protobuf_c_shm_ring_send (ring, &sub.base);
+}
+
+/* receives the next message and checks its contents */
+static Foo__SubMess *
+receive_message (ProtobufCShmRing *ring)
+{
+  const uint8_t *data;
+  Foo__SubMess *sub;
+  size_t len, i;
+
+  data = protobuf_c_shm_ring_peek (ring, &len);
+  if (data == NULL)
+    return NULL;
+  sub = foo__sub_mess__unpack (NULL, len, data);
+  protobuf_c_shm_ring_release (ring);
+  assert (sub != NULL);
+  assert (sub->has_val1);
+  assert (sub->n_rep == (size_t) (sub->val1 % MAX_REP));
+  for (i = 0; i < sub->n_rep; i++)
+    assert (sub->rep[i] == sub->val1 * (int) i);
+  return sub;
+}
+
+static void
+test_spsc (void)
+{
+  ProtobufCShmRing *ring = protobuf_c_shm_ring_new (PROTOBUF_C_SHM_RING_SPSC,
+                                                    4096);
+  int sent = 0, received = 0;
+  size_t len;
+
+  assert (ring != NULL);
+  assert (!protobuf_c_shm_ring_wait (ring, 0));
+
+  /* many laps, alternating between filling the ring and draining it */
+  while (received < N_MESSAGES)
+    {
+      Foo__SubMess *sub;
+
+      while (sent < N_MESSAGES && send_message (ring, 0, sent))
+        sent++;
+      assert (sent == N_MESSAGES || sent > received);
+      while ((sub = receive_message (ring)) != NULL)
+        {
+          assert (sub->test == 0);
+          assert (sub->val1 == received);
+          received++;
+          foo__sub_mess__free_unpacked (sub, NULL);
+          if (received % 3 == 0)
+            break;
+        }
+    }
+  assert (protobuf_c_shm_ring_peek (ring, &len) == NULL);
+  protobuf_c_shm_ring_free (ring);
+}
+
+static void
+test_too_large (void)
+{
+  ProtobufCShmRing *ring = protobuf_c_shm_ring_new (PROTOBUF_C_SHM_RING_SPSC,
+                                                    0);
+  Foo__TestMessRequiredBytes mess = FOO__TEST_MESS_REQUIRED_BYTES__INIT;
+  static uint8_t bytes[4096];
+
+  assert (ring != NULL);
+  mess.test.data = bytes;
+  mess.test.len = sizeof (bytes);
+  assert (!protobuf_c_shm_ring_send (ring, &mess.base));
+  mess.test.len = 2048 - 8 - 3;
+  assert (protobuf_c_shm_ring_send (ring, &mess.base));
+  protobuf_c_shm_ring_free (ring);
+}
+
+static void
+test_attach (void)
+{
+  ProtobufCShmRing *ring = protobuf_c_shm_ring_new (PROTOBUF_C_SHM_RING_MPSC,
+                                                    8192);
+  ProtobufCShmRing *peer;
+  Foo__SubMess *sub;
+
+  assert (ring != NULL);
+  peer = protobuf_c_shm_ring_attach (dup (protobuf_c_shm_ring_shm_fd (ring)),
+                                     dup (protobuf_c_shm_ring_event_fd (ring)));
+  assert (peer != NULL);
+  assert (send_message (peer, 7, 1234));
+  assert (protobuf_c_shm_ring_wait (ring, 0));
+  sub = receive_message (ring);
+  assert (sub != NULL && sub->test == 7 && sub->val1 == 1234);
+  foo__sub_mess__free_unpacked (sub, NULL);
+  protobuf_c_shm_ring_free (peer);
+  protobuf_c_shm_ring_free (ring);
+
+  /* not a ring */
+  assert (protobuf_c_shm_ring_attach (0, -1) == NULL);
+}
+
+static void
+test_mpsc_processes (void)
+{
+  ProtobufCShmRing *ring = protobuf_c_shm_ring_new (PROTOBUF_C_SHM_RING_MPSC,
+                                                    16384);
+  int next[N_PRODUCERS] = { 0 };
+  pid_t pids[N_PRODUCERS];
+  int i, received = 0;
+
+  assert (ring != NULL);
+  for (i = 0; i < N_PRODUCERS; i++)
+    {
+      pids[i] = fork ();
+      assert (pids[i] >= 0);
+      if (pids[i] == 0)
+        {
+          pid_t parent = getppid ();
+          int seq;
+          for (seq = 0; seq < N_MESSAGES; seq++)
+            while (!send_message (ring, i, seq))
+              {
+                /* don't spin forever if the consumer has failed */
+                if (getppid () != parent)
+                  _exit (1);
+                sched_yield ();
+              }
+          _exit (0);
+        }
+    }
+
+  /* messages from each producer arrive in order */
+  while (received < N_PRODUCERS * N_MESSAGES)
+    {
+      Foo__SubMess *sub;
+
+      assert (protobuf_c_shm_ring_wait (ring, 10000));
+      sub = receive_message (ring);
+      assert (sub != NULL);
+      assert (sub->test >= 0 && sub->test < N_PRODUCERS);
+      assert (sub->val1 == next[sub->test]);
+      next[sub->test]++;
+      received++;
+      foo__sub_mess__free_unpacked (sub, NULL);
+    }
+  for (i = 0; i < N_PRODUCERS; i++)
+    {
+      int status;
+      assert (waitpid (pids[i], &status, 0) == pids[i]);
+      assert (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+    }
+  assert (!protobuf_c_shm_ring_wait (ring, 0));
+  protobuf_c_shm_ring_free (ring);
+}
+
+static Test tests[] = {
+  { test_spsc, "test single-producer ring" },
+  { test_too_large, "test messages too large for the ring" },
+  { test_attach, "test attaching to a ring" },
+  { test_mpsc_processes, "test multi-producer ring across processes" },
+};
+#define n_tests (sizeof(tests)/sizeof(Test))
+
+int main(void)
+{
+  unsigned i;
+
+  for (i = 0; i < n_tests; i++)
+    {
+      fprintf (stderr, "Test: %s... ", tests[i].name);
+      tests[i].func ();
+      fprintf (stderr, " done.\n");
+    }
+  return 0;
+}
@@ -0,0 +1,383 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protobuf-c/protobuf-c-parallel.h"
+#include "protobuf-c/protobuf-c-pool.h"
+#include "t/test-full.pb-c.h"
+
+#define N_THREADS   4
+#define N_MESSAGES  1000
+#define N_BATCH     10000
+
+typedef struct
+{
+  void (*func) (void);
+  const char *name;
+} Test;
+
+/* a serialised Foo__TestMess with strings, bytes and submessages */
+static uint8_t *packed;
+static size_t packed_len;
+
+static void
+pack_test_message (void)
+{
+  Foo__TestMess mess = FOO__TEST_MESS__INIT;
+  Foo__SubMess subs[3] = { FOO__SUB_MESS__INIT, FOO__SUB_MESS__INIT,
+                           FOO__SUB_MESS__INIT };
+  Foo__SubMess *sub_ptrs[3] = { &subs[0], &subs[1], &subs[2] };
+  const char *strings[2] = { "short", "a somewhat longer string value" };
+  int32_t ints[5] = { 1, -2, 300, 40000, -5000000 };
+  ProtobufCBinaryData bytes[1];
+  static uint8_t blob[5000];
+
+  memset (blob, 'x', sizeof (blob));
+  bytes[0].len = sizeof (blob);
+  bytes[0].data = blob;
+  mess.n_test_int32 = 5;
+  mess.test_int32 = ints;
+  mess.n_test_string = 2;
+  mess.test_string = strings;
+  mess.n_test_bytes = 1;
+  mess.test_bytes = bytes;
+  subs[0].test = 1;
+  subs[1].test = 2;
+  subs[2].test = 3;
+  mess.n_test_message = 3;
+  mess.test_message = sub_ptrs;
+  packed_len = foo__test_mess__get_packed_size (&mess);
+  packed = malloc (packed_len);
+  assert (packed != NULL);
+  foo__test_mess__pack (&mess, packed);
+}
+
+static void
+check_test_message (const Foo__TestMess *mess)
+{
+  assert (mess != NULL);
+  assert (mess->n_test_int32 == 5 && mess->test_int32[4] == -5000000);
+  assert (mess->n_test_string == 2 && strcmp (mess->test_string[0], "short") == 0);
+  assert (mess->n_test_bytes == 1 && mess->test_bytes[0].len == 5000);
+  assert (mess->n_test_message == 3 && mess->test_message[2]->test == 3);
+}
+
+static void
+test_pool_basic (void)
+{
+  ProtobufCAllocator *pool = protobuf_c_pool_allocator_new ();
+  Foo__TestMess *mess;
+  void *blocks[64];
+  void *p;
+  size_t i;
+
+  assert (pool != NULL);
+  for (i = 0; i < 64; i++)
+    {
+      size_t size = i * 97;
+      blocks[i] = pool->alloc (pool->allocator_data, size);
+      assert (blocks[i] != NULL);
+      assert (((uintptr_t) blocks[i] & 15) == 0);
+      memset (blocks[i], (int) i, size);
+    }
+  for (i = 0; i < 64; i++)
+    pool->free (pool->allocator_data, blocks[i]);
+
+  /* a freed block is reused for the next request of its size class */
+  p = pool->alloc (pool->allocator_data, 100);
+  pool->free (pool->allocator_data, p);
+  assert (pool->alloc (pool->allocator_data, 120) == p);
+  pool->free (pool->allocator_data, p);
+
+  mess = foo__test_mess__unpack (pool, packed_len, packed);
+  check_test_message (mess);
+  foo__test_mess__free_unpacked (mess, pool);
+  protobuf_c_pool_allocator_destroy (pool);
+  protobuf_c_pool_allocator_destroy (NULL);
+}
+
+typedef struct
+{
+  ProtobufCAllocator *pool;
+  Foo__TestMess *messages[N_MESSAGES];
+  Foo__TestMess **to_free;
+} Worker;
+
+static void *
+unpack_messages (void *arg)
+{
+  Worker *w = arg;
+  unsigned i;
+
+  for (i = 0; i < N_MESSAGES; i++)
+    {
+      w->messages[i] = foo__test_mess__unpack (w->pool, packed_len, packed);
+      check_test_message (w->messages[i]);
+    }
+  return NULL;
+}
+
+/* free another thread's messages while allocating new ones */
+static void *
+free_and_unpack_messages (void *arg)
+{
+  Worker *w = arg;
+  unsigned i;
+
+  for (i = 0; i < N_MESSAGES; i++)
+    {
+      foo__test_mess__free_unpacked (w->to_free[i], w->pool);
+      w->to_free[i] = NULL;
+      w->messages[i] = foo__test_mess__unpack (w->pool, packed_len, packed);
+      check_test_message (w->messages[i]);
+    }
+  return NULL;
+}
+
+static void
+test_pool_cross_thread_free (void)
+{
+  ProtobufCAllocator *pool = protobuf_c_pool_allocator_new ();
+  static Worker workers[N_THREADS];
+  static Foo__TestMess *previous[N_THREADS][N_MESSAGES];
+  pthread_t threads[N_THREADS];
+  unsigned i, j;
+  int rv;
+
+  assert (pool != NULL);
+  for (i = 0; i < N_THREADS; i++)
+    {
+      workers[i].pool = pool;
+      rv = pthread_create (&threads[i], NULL, unpack_messages, &workers[i]);
+      assert (rv == 0);
+    }
+  for (i = 0; i < N_THREADS; i++)
+    {
+      rv = pthread_join (threads[i], NULL);
+      assert (rv == 0);
+    }
+
+  /* the second round of threads adopts the caches of the first */
+  for (i = 0; i < N_THREADS; i++)
+    memcpy (previous[i], workers[i].messages, sizeof (previous[i]));
+  for (i = 0; i < N_THREADS; i++)
+    {
+      workers[i].to_free = previous[(i + 1) % N_THREADS];
+      rv = pthread_create (&threads[i], NULL, free_and_unpack_messages,
+                           &workers[i]);
+      assert (rv == 0);
+    }
+  for (i = 0; i < N_THREADS; i++)
+    {
+      rv = pthread_join (threads[i], NULL);
+      assert (rv == 0);
+    }
+  (void) rv;
+
+  /* and the main thread frees everything that is left */
+  for (i = 0; i < N_THREADS; i++)
+    for (j = 0; j < N_MESSAGES; j++)
+      foo__test_mess__free_unpacked (workers[i].messages[j], pool);
+  protobuf_c_pool_allocator_destroy (pool);
+}
+
+static ProtobufCAllocator *
+get_shared_pool (void *factory_data, unsigned worker)
+{
+  (void) worker;
+  return factory_data;
+}
+
+static void
+test_unpack_batch (void)
+{
+  ProtobufCAllocator *pool = protobuf_c_pool_allocator_new ();
+  ProtobufCAllocatorFactory factory = { get_shared_pool, pool, 4 };
+  static uint8_t buffers[N_BATCH][16];
+  static size_t lens[N_BATCH];
+  static const uint8_t *datas[N_BATCH];
+  static ProtobufCMessage *out[N_BATCH];
+  static const uint8_t truncated[] = { 0x08 };
+  Foo__SubMess sub = FOO__SUB_MESS__INIT;
+  unsigned i;
+
+  assert (pool != NULL);
+  for (i = 0; i < N_BATCH; i++)
+    {
+      sub.test = (int32_t) i;
+      lens[i] = foo__sub_mess__pack (&sub, buffers[i]);
+      datas[i] = buffers[i];
+    }
+  datas[1234] = truncated;
+  lens[1234] = sizeof (truncated);
+
+  /* results come back in input order, with failures left NULL */
+  assert (protobuf_c_message_unpack_batch (&foo__sub_mess__descriptor,
+                                           &factory, N_BATCH, lens, datas,
+                                           out) == N_BATCH - 1);
+  for (i = 0; i < N_BATCH; i++)
+    {
+      if (i == 1234)
+        {
+          assert (out[i] == NULL);
+          continue;
+        }
+      assert (out[i] != NULL);
+      assert (((Foo__SubMess *) out[i])->test == (int32_t) i);
+      protobuf_c_message_free_unpacked (out[i], pool);
+    }
+
+  /* the system allocator, one worker per CPU */
+  assert (protobuf_c_message_unpack_batch (&foo__sub_mess__descriptor,
+                                           NULL, 100, lens, datas,
+                                           out) == 100);
+  for (i = 0; i < 100; i++)
+    {
+      assert (((Foo__SubMess *) out[i])->test == (int32_t) i);
+      protobuf_c_message_free_unpacked (out[i], NULL);
+    }
+  assert (protobuf_c_message_unpack_batch (&foo__sub_mess__descriptor,
+                                           NULL, 0, lens, datas, out) == 0);
+  protobuf_c_pool_allocator_destroy (pool);
+}
+
+static void
+test_unpack_parallel (void)
+{
+  ProtobufCAllocator *pool = protobuf_c_pool_allocator_new ();
+  ProtobufCAllocatorFactory factory = { get_shared_pool, pool, 4 };
+  Foo__TestMess mess = FOO__TEST_MESS__INIT;
+  Foo__SubMess *subs = calloc (N_BATCH, sizeof (Foo__SubMess));
+  Foo__SubMess **sub_ptrs = calloc (N_BATCH, sizeof (Foo__SubMess *));
+  int32_t ints[3] = { 7, 8, 9 };
+  Foo__TestMess *out;
+  uint8_t *data, *repacked;
+  size_t len;
+  unsigned i;
+
+  assert (pool != NULL && subs != NULL && sub_ptrs != NULL);
+  for (i = 0; i < N_BATCH; i++)
+    {
+      foo__sub_mess__init (&subs[i]);
+      subs[i].test = (int32_t) i;
+      subs[i].has_val1 = i % 3 == 0;
+      subs[i].val1 = (int32_t) i * 2;
+      sub_ptrs[i] = &subs[i];
+    }
+  mess.n_test_int32 = 3;
+  mess.test_int32 = ints;
+  mess.n_test_message = N_BATCH;
+  mess.test_message = sub_ptrs;
+  len = foo__test_mess__get_packed_size (&mess);
+  data = malloc (len);
+  repacked = malloc (len);
+  assert (data != NULL && repacked != NULL);
+  foo__test_mess__pack (&mess, data);
+
+  out = (Foo__TestMess *)
+    protobuf_c_message_unpack_parallel (&foo__test_mess__descriptor,
+                                        &factory, 100, len, data);
+  assert (out != NULL);
+  assert (out->n_test_int32 == 3 && out->test_int32[2] == 9);
+  assert (out->n_test_message == N_BATCH);
+  for (i = 0; i < N_BATCH; i++)
+    assert (out->test_message[i]->test == (int32_t) i);
+  assert (foo__test_mess__pack (out, repacked) == len);
+  assert (memcmp (data, repacked, len) == 0);
+  foo__test_mess__free_unpacked (out, pool);
+
+  /* below the threshold everything stays on this thread */
+  out = (Foo__TestMess *)
+    protobuf_c_message_unpack_parallel (&foo__test_mess__descriptor,
+                                        NULL, N_BATCH + 1, len, data);
+  assert (out != NULL && out->n_test_message == N_BATCH);
+  foo__test_mess__free_unpacked (out, NULL);
+
+  /* a corrupt element fails the whole message */
+  data[len - 1] |= 0x80;
+  assert (protobuf_c_message_unpack_parallel (&foo__test_mess__descriptor,
+                                              &factory, 100, len,
+                                              data) == NULL);
+
+  free (data);
+  free (repacked);
+  free (sub_ptrs);
+  free (subs);
+  protobuf_c_pool_allocator_destroy (pool);
+}
+
+static void
+test_pack_parallel (void)
+{
+  Foo__TestMess mess = FOO__TEST_MESS__INIT;
+  Foo__SubMess *subs = calloc (N_BATCH, sizeof (Foo__SubMess));
+  Foo__SubMess **sub_ptrs = calloc (N_BATCH, sizeof (Foo__SubMess *));
+  const char *strings[2] = { "before", "after" };
+  uint8_t *expected, *out;
+  size_t len;
+  unsigned i;
+
+  assert (subs != NULL && sub_ptrs != NULL);
+  for (i = 0; i < N_BATCH; i++)
+    {
+      foo__sub_mess__init (&subs[i]);
+      subs[i].test = (int32_t) (i * 7919);
+      subs[i].has_val2 = i % 5 == 0;
+      subs[i].val2 = -(int32_t) i;
+      sub_ptrs[i] = &subs[i];
+    }
+  mess.n_test_string = 2;
+  mess.test_string = strings;
+  mess.n_test_message = N_BATCH;
+  mess.test_message = sub_ptrs;
+  len = foo__test_mess__get_packed_size (&mess);
+  expected = malloc (len);
+  out = malloc (len);
+  assert (expected != NULL && out != NULL);
+  assert (foo__test_mess__pack (&mess, expected) == len);
+
+  memset (out, 0, len);
+  assert (protobuf_c_message_pack_parallel (&mess.base, 4, 100, out) == len);
+  assert (memcmp (expected, out, len) == 0);
+
+  memset (out, 0, len);
+  assert (protobuf_c_message_pack_parallel (&mess.base, 0, 0, out) == len);
+  assert (memcmp (expected, out, len) == 0);
+
+  /* below the threshold it is a plain pack */
+  memset (out, 0, len);
+  assert (protobuf_c_message_pack_parallel (&mess.base, 4, N_BATCH + 1,
+                                            out) == len);
+  assert (memcmp (expected, out, len) == 0);
+
+  free (expected);
+  free (out);
+  free (sub_ptrs);
+  free (subs);
+}
+
+static Test tests[] = {
+  { test_pool_basic, "test pool allocator" },
+  { test_pool_cross_thread_free, "test pool allocator cross-thread free" },
+  { test_unpack_batch, "test batch unpack" },
+  { test_unpack_parallel, "test parallel unpack of repeated fields" },
+  { test_pack_parallel, "test parallel pack of repeated fields" },
+};
+#define n_tests (sizeof(tests)/sizeof(Test))
+
+int main(void)
+{
+  unsigned i;
+
+  pack_test_message ();
+  for (i = 0; i < n_tests; i++)
+    {
+      fprintf (stderr, "Test: %s... ", tests[i].name);
+      tests[i].func ();
+      fprintf (stderr, " done.\n");
+    }
+  free (packed);
+  return 0;
+}